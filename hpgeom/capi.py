@@ -0,0 +1,109 @@
+"""Access to the hpgeom C API from compiled code.
+
+The extension module exports a versioned table of C functions (declared in
+``hpgeom_capi.h``) that can be called with no python overhead, for use in
+tight loops in C, Cython, or Numba code.  None of them need the GIL.
+Invalid inputs give -1 for pixel-valued functions, and 0 instead of 1 for the
+others; no exceptions are raised.
+
+From C or Cython, compile with ``include_dirs=[hpgeom.capi.get_include()]``
+and get the table with ``hpgeom_capi_import()``; Cython code can
+``from hpgeom.hpgeom_capi cimport hpgeom_capi, hpgeom_capi_import``.
+
+From Numba, the functions in this module are ctypes function pointers into
+the table, which can be called directly from ``@njit`` and ``@cfunc``
+functions.  Pointer arguments take an array's ``ctypes`` attribute, e.g.
+``ang2pix_batch(nside, 1, theta.ctypes, phi.ctypes, pix.ctypes, n)`` for
+contiguous arrays of the correct types (float64 and int64).  The ``nest``
+argument is 1 for NEST and 0 for RING pixels.
+"""
+import ctypes
+import os
+
+from ._hpgeom import _C_API
+
+__all__ = [
+    'CAPI_VERSION',
+    'get_include',
+    'ang2pix',
+    'pix2ang',
+    'lonlat2pix',
+    'pix2lonlat',
+    'vec2pix',
+    'pix2vec',
+    'nest2ring',
+    'ring2nest',
+    'neighbors',
+    'ang2pix_batch',
+    'pix2ang_batch',
+    'nest2ring_batch',
+    'ring2nest_batch',
+    'query_disc',
+]
+
+_CAPSULE_NAME = b"hpgeom._hpgeom._C_API"
+
+_i64 = ctypes.c_int64
+_int = ctypes.c_int
+_dbl = ctypes.c_double
+_ptr = ctypes.c_void_p
+
+
+class _hpgeom_capi(ctypes.Structure):
+    # This must match the hpgeom_capi struct in hpgeom_capi.h.
+    _fields_ = [
+        ('version', _int),
+        ('ang2pix', ctypes.CFUNCTYPE(_i64, _i64, _int, _dbl, _dbl)),
+        ('pix2ang', ctypes.CFUNCTYPE(_int, _i64, _int, _i64, _ptr, _ptr)),
+        ('lonlat2pix', ctypes.CFUNCTYPE(_i64, _i64, _int, _dbl, _dbl, _int)),
+        ('pix2lonlat', ctypes.CFUNCTYPE(_int, _i64, _int, _i64, _ptr, _ptr, _int)),
+        ('vec2pix', ctypes.CFUNCTYPE(_i64, _i64, _int, _dbl, _dbl, _dbl)),
+        ('pix2vec', ctypes.CFUNCTYPE(_int, _i64, _int, _i64, _ptr, _ptr, _ptr)),
+        ('nest2ring', ctypes.CFUNCTYPE(_i64, _i64, _i64)),
+        ('ring2nest', ctypes.CFUNCTYPE(_i64, _i64, _i64)),
+        ('neighbors', ctypes.CFUNCTYPE(_int, _i64, _int, _i64, _ptr)),
+        ('ang2pix_batch', ctypes.CFUNCTYPE(_int, _i64, _int, _ptr, _ptr, _ptr, _i64)),
+        ('pix2ang_batch', ctypes.CFUNCTYPE(_int, _i64, _int, _ptr, _ptr, _ptr, _i64)),
+        ('nest2ring_batch', ctypes.CFUNCTYPE(_int, _i64, _ptr, _ptr, _i64)),
+        ('ring2nest_batch', ctypes.CFUNCTYPE(_int, _i64, _ptr, _ptr, _i64)),
+        ('query_disc', ctypes.CFUNCTYPE(_i64, _i64, _int, _dbl, _dbl, _dbl, _int, _ptr, _i64)),
+    ]
+
+
+def _load_table():
+    get_pointer = ctypes.pythonapi.PyCapsule_GetPointer
+    get_pointer.restype = ctypes.c_void_p
+    get_pointer.argtypes = [ctypes.py_object, ctypes.c_char_p]
+
+    return _hpgeom_capi.from_address(get_pointer(_C_API, _CAPSULE_NAME))
+
+
+_table = _load_table()
+
+CAPI_VERSION = _table.version
+
+ang2pix = _table.ang2pix
+pix2ang = _table.pix2ang
+lonlat2pix = _table.lonlat2pix
+pix2lonlat = _table.pix2lonlat
+vec2pix = _table.vec2pix
+pix2vec = _table.pix2vec
+nest2ring = _table.nest2ring
+ring2nest = _table.ring2nest
+neighbors = _table.neighbors
+ang2pix_batch = _table.ang2pix_batch
+pix2ang_batch = _table.pix2ang_batch
+nest2ring_batch = _table.nest2ring_batch
+ring2nest_batch = _table.ring2nest_batch
+query_disc = _table.query_disc
+
+
+def get_include():
+    """Return the directory containing ``hpgeom_capi.h`` and
+    ``hpgeom_capi.pxd``.
+
+    Returns
+    -------
+    include_dir : `str`
+    """
+    return os.path.dirname(os.path.abspath(__file__))
@@ -29,9 +29,18 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "healpix_geom.h"
+#include "healpix_geom_simd.h"
+
+// The table and BMI2 bit routines below replace the portable ones.
+#define HPG_CORE_INFO healpix_info
+#define HPG_CORE_SPREAD_BITS64 spread_bits64
+#define HPG_CORE_COMPRESS_BITS64 compress_bits64
+#include "healpix_geom_core.h"
 #include "hpgeom_stack.h"
+#include "hpgeom_threads.h"
 #include "hpgeom_utils.h"
 
 static const uint16_t utab[] = {
@@ -54,10 +63,7 @@ static const uint16_t ctab[] = {
 #undef Z
 };
 
-static const int jrll[] = {2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4};
-static const int jpll[] = {1, 3, 5, 7, 0, 2, 4, 6, 1, 3, 5, 7};
-
-int64_t isqrt(int64_t i) { return sqrt(((double)(i)) + 0.5); }
+int64_t isqrt(int64_t i) { return hpg_core_isqrt(i); }
 
 int ilog2(int64_t arg) {
     int res = 0;
@@ -99,22 +105,7 @@ static inline double dblmax(double v1, double v2) {
 */
 static inline double dblmin(double v1, double v2) { return v1 < v2 ? v1 : v2; }
 
-static inline int64_t special_div(int64_t a, int64_t b) {
-    int64_t t = (a >= (b << 1));
-    a -= t * (b << 1);
-    return (t << 1) + (a >= b);
-}
-
-static inline double safe_atan2(double y, double x) {
-    return ((x == 0.) && (y == 0.)) ? 0.0 : atan2(y, x);
-}
-
-double fmodulo(double v1, double v2) {
-    // modulus function that returns values in range [0, v2)
-    if (v1 >= 0) return (v1 < v2) ? v1 : fmod(v1, v2);
-    double tmp = fmod(v1, v2) + v2;
-    return (tmp == v2) ? 0. : tmp;
-}
+double fmodulo(double v1, double v2) { return hpg_core_fmodulo(v1, v2); }
 
 healpix_info healpix_info_from_order(int order, enum Scheme scheme) {
     healpix_info hpx;
@@ -150,51 +141,187 @@ healpix_info healpix_info_from_nside(int64_t nside, enum Scheme scheme) {
     return hpx;
 }
 
+// Static initializer for the healpix_info of a power-of-two nside, matching
+// healpix_info_from_order().
+#define HPX_NSIDE(o) ((int64_t)(1) << (o))
+#define HPX_NPFACE(o) (HPX_NSIDE(o) << (o))
+#define HPX_FACT2(o) (4. / (12 * HPX_NPFACE(o)))
+#define HPX_INFO_ENTRY(o, s)                                                                 \
+    {(o),                                                                                    \
+     HPX_NSIDE(o),                                                                           \
+     HPX_NPFACE(o),                                                                          \
+     (HPX_NPFACE(o) - HPX_NSIDE(o)) << 1,                                                    \
+     12 * HPX_NPFACE(o),                                                                     \
+     HPX_FACT2(o),                                                                           \
+     (HPX_NSIDE(o) << 1) * HPX_FACT2(o),                                                     \
+     (s)}
+
+static const healpix_info hpx_order_table[2][MAX_ORDER + 1] = {
+    {
+        HPX_INFO_ENTRY(0, RING),
+        HPX_INFO_ENTRY(1, RING),
+        HPX_INFO_ENTRY(2, RING),
+        HPX_INFO_ENTRY(3, RING),
+        HPX_INFO_ENTRY(4, RING),
+        HPX_INFO_ENTRY(5, RING),
+        HPX_INFO_ENTRY(6, RING),
+        HPX_INFO_ENTRY(7, RING),
+        HPX_INFO_ENTRY(8, RING),
+        HPX_INFO_ENTRY(9, RING),
+        HPX_INFO_ENTRY(10, RING),
+        HPX_INFO_ENTRY(11, RING),
+        HPX_INFO_ENTRY(12, RING),
+        HPX_INFO_ENTRY(13, RING),
+        HPX_INFO_ENTRY(14, RING),
+        HPX_INFO_ENTRY(15, RING),
+        HPX_INFO_ENTRY(16, RING),
+        HPX_INFO_ENTRY(17, RING),
+        HPX_INFO_ENTRY(18, RING),
+        HPX_INFO_ENTRY(19, RING),
+        HPX_INFO_ENTRY(20, RING),
+        HPX_INFO_ENTRY(21, RING),
+        HPX_INFO_ENTRY(22, RING),
+        HPX_INFO_ENTRY(23, RING),
+        HPX_INFO_ENTRY(24, RING),
+        HPX_INFO_ENTRY(25, RING),
+        HPX_INFO_ENTRY(26, RING),
+        HPX_INFO_ENTRY(27, RING),
+        HPX_INFO_ENTRY(28, RING),
+        HPX_INFO_ENTRY(29, RING)
+    },
+    {
+        HPX_INFO_ENTRY(0, NEST),
+        HPX_INFO_ENTRY(1, NEST),
+        HPX_INFO_ENTRY(2, NEST),
+        HPX_INFO_ENTRY(3, NEST),
+        HPX_INFO_ENTRY(4, NEST),
+        HPX_INFO_ENTRY(5, NEST),
+        HPX_INFO_ENTRY(6, NEST),
+        HPX_INFO_ENTRY(7, NEST),
+        HPX_INFO_ENTRY(8, NEST),
+        HPX_INFO_ENTRY(9, NEST),
+        HPX_INFO_ENTRY(10, NEST),
+        HPX_INFO_ENTRY(11, NEST),
+        HPX_INFO_ENTRY(12, NEST),
+        HPX_INFO_ENTRY(13, NEST),
+        HPX_INFO_ENTRY(14, NEST),
+        HPX_INFO_ENTRY(15, NEST),
+        HPX_INFO_ENTRY(16, NEST),
+        HPX_INFO_ENTRY(17, NEST),
+        HPX_INFO_ENTRY(18, NEST),
+        HPX_INFO_ENTRY(19, NEST),
+        HPX_INFO_ENTRY(20, NEST),
+        HPX_INFO_ENTRY(21, NEST),
+        HPX_INFO_ENTRY(22, NEST),
+        HPX_INFO_ENTRY(23, NEST),
+        HPX_INFO_ENTRY(24, NEST),
+        HPX_INFO_ENTRY(25, NEST),
+        HPX_INFO_ENTRY(26, NEST),
+        HPX_INFO_ENTRY(27, NEST),
+        HPX_INFO_ENTRY(28, NEST),
+        HPX_INFO_ENTRY(29, NEST)
+    }};
+
+#undef HPX_INFO_ENTRY
+#undef HPX_FACT2
+#undef HPX_NPFACE
+#undef HPX_NSIDE
+
+static inline int order_from_pow2_nside(int64_t nside) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll((unsigned long long)nside);
+#else
+    return ilog2(nside);
+#endif
+}
+
+void hpx_cache_init(hpx_cache *cache) {
+    cache->n = 0;
+    cache->next = 0;
+}
+
+healpix_info healpix_info_cached(hpx_cache *cache, int64_t nside, enum Scheme scheme) {
+    // Power-of-two nsides (all NEST and most RING usage) come from the
+    // precomputed table.
+    if ((nside & (nside - 1)) == 0) {
+        return hpx_order_table[scheme][order_from_pow2_nside(nside)];
+    }
+
+    for (int i = 0; i < cache->n; i++) {
+        if (cache->info[i].nside == nside && cache->info[i].scheme == scheme) {
+            return cache->info[i];
+        }
+    }
+
+    healpix_info hpx = healpix_info_from_nside(nside, scheme);
+    cache->info[cache->next] = hpx;
+    cache->next = (cache->next + 1) % HPX_CACHE_SIZE;
+    if (cache->n < HPX_CACHE_SIZE) cache->n++;
+
+    return hpx;
+}
+
 int64_t ang2pix(healpix_info *hpx, double theta, double phi) {
-    if ((theta < 0.01) || (theta > 3.14159 - 0.01)) {
-        return loc2pix(hpx, cos(theta), phi, 0.0, false);
-    } else {
-        return loc2pix(hpx, cos(theta), phi, sin(theta), true);
+    return hpg_core_ang2pix(hpx, hpx->scheme == NEST, theta, phi);
+}
+
+typedef void (*ang2pix_batch_func)(healpix_info *hpx, const double *theta, const double *phi,
+                                   int64_t *pix, size_t n);
+
+// SIMD implementation of ang2pix_batch for power-of-two nsides, chosen at
+// module import by healpix_geom_init_dispatch().  NULL if unavailable.
+static ang2pix_batch_func ang2pix_batch_simd = NULL;
+
+// Use BMI2 pdep/pext for bit spreading/compression.
+static bool use_bmi2 = false;
+
+void healpix_geom_init_dispatch(void) {
+#if HPG_X86_SIMD
+    if (hpgeom_cpu_has_avx512()) {
+        ang2pix_batch_simd = ang2pix_batch_avx512;
+    } else if (hpgeom_cpu_has_avx2()) {
+        ang2pix_batch_simd = ang2pix_batch_avx2;
     }
+    use_bmi2 = hpgeom_cpu_has_fast_bmi2();
+#endif
 }
 
-int64_t vec2pix(healpix_info *hpx, vec3 *vec) {
-    double xl = 1. / vec3_length(vec);
-    double phi = safe_atan2(vec->y, vec->x);
-    double nz = vec->z * xl;
-    if (fabs(nz) > 0.99) {
-        return loc2pix(hpx, nz, phi, sqrt(vec->x * vec->x + vec->y * vec->y) * xl, true);
+void ang2pix_batch(healpix_info *hpx, const double *theta, const double *phi, int64_t *pix,
+                   size_t n) {
+    if (hpx->order >= 0 && ang2pix_batch_simd != NULL) {
+        ang2pix_batch_simd(hpx, theta, phi, pix, n);
+        return;
+    }
+    // The scheme is resolved once per batch rather than per element.
+    if (hpx->scheme == RING) {
+        for (size_t i = 0; i < n; i++) pix[i] = hpg_core_ang2pix(hpx, false, theta[i], phi[i]);
     } else {
-        return loc2pix(hpx, nz, phi, 0, false);
+        for (size_t i = 0; i < n; i++) pix[i] = hpg_core_ang2pix(hpx, true, theta[i], phi[i]);
     }
 }
 
+int64_t vec2pix(healpix_info *hpx, vec3 *vec) {
+    return hpg_core_vec2pix(hpx, hpx->scheme == NEST, vec->x, vec->y, vec->z);
+}
+
 void pix2ang(healpix_info *hpx, int64_t pix, double *theta, double *phi) {
-    double z, sth;
-    bool have_sth;
-    pix2loc(hpx, pix, &z, phi, &sth, &have_sth);
-    if (have_sth) {
-        *theta = atan2(sth, z);
+    hpg_core_pix2ang(hpx, hpx->scheme == NEST, pix, theta, phi);
+}
+
+void pix2ang_batch(healpix_info *hpx, const int64_t *pix, double *theta, double *phi,
+                   size_t n) {
+    if (hpx->scheme == RING) {
+        for (size_t i = 0; i < n; i++) {
+            hpg_core_pix2ang(hpx, false, pix[i], &theta[i], &phi[i]);
+        }
     } else {
-        *theta = acos(z);
+        for (size_t i = 0; i < n; i++) hpg_core_pix2ang(hpx, true, pix[i], &theta[i], &phi[i]);
     }
 }
 
 vec3 pix2vec(healpix_info *hpx, int64_t pix) {
-    double z, phi, sth;
-    bool have_sth;
     vec3 res;
-    pix2loc(hpx, pix, &z, &phi, &sth, &have_sth);
-    if (have_sth) {
-        res.x = sth * cos(phi);
-        res.y = sth * sin(phi);
-        res.z = z;
-    } else {
-        sth = sqrt((1 - z) * (1 + z));
-        res.x = sth * cos(phi);
-        res.y = sth * sin(phi);
-        res.z = z;
-    }
+    hpg_core_pix2vec(hpx, hpx->scheme == NEST, pix, &res.x, &res.y, &res.z);
     return res;
 }
 
@@ -226,231 +353,49 @@ int64_t ring2nest(healpix_info *hpx, int64_t pix) {
     return xyf2nest(hpx, ix, iy, face_num);
 }
 
-int64_t loc2pix(healpix_info *hpx, double z, double phi, double sth, bool have_sth) {
-    double za = fabs(z);
-    double tt = fmodulo(phi * HPG_INV_HALFPI, 4.0);  // in [0,4)
+void nest2ring_batch(healpix_info *hpx, const int64_t *nest, int64_t *ring, size_t n) {
+#if HPG_X86_SIMD
+    if (use_bmi2) {
+        nest2ring_batch_bmi2(hpx, nest, ring, n);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < n; i++) ring[i] = nest2ring(hpx, nest[i]);
+}
 
-    if (hpx->scheme == RING) {
-        if (za <= HPG_TWOTHIRD)  // Equatorial region
-        {
-            int64_t nl4 = 4 * hpx->nside;
-            double temp1 = hpx->nside * (0.5 + tt);
-            double temp2 = hpx->nside * z * 0.75;
-            int64_t jp = (int64_t)(temp1 - temp2);  // index of  ascending edge line
-            int64_t jm = (int64_t)(temp1 + temp2);  // index of descending edge line
-
-            // ring number counted from z=2/3
-            int64_t ir = hpx->nside + 1 + jp - jm;  // in {1,2n+1}
-            int64_t kshift = 1 - (ir & 1);          // kshift=1 if ir even, 0 otherwise
-
-            int64_t t1 = jp + jm - hpx->nside + kshift + 1 + nl4 + nl4;
-            int64_t ip =
-                (hpx->order > 0) ? (t1 >> 1) & (nl4 - 1) : ((t1 >> 1) % nl4);  // in {0,4n-1}
-
-            return hpx->ncap + (ir - 1) * nl4 + ip;
-        } else  // North & South polar caps
-        {
-            double tp = tt - (int64_t)(tt);
-            double tmp = ((za < 0.99) || (!have_sth))
-                             ? hpx->nside * sqrt(3 * (1 - za))
-                             : hpx->nside * sth / sqrt((1. + za) / 3.);
-
-            int64_t jp = (int64_t)(tp * tmp);          // increasing edge line index
-            int64_t jm = (int64_t)((1.0 - tp) * tmp);  // decreasing edge line index
-
-            int64_t ir = jp + jm + 1;         // ring number counted from the closest pole
-            int64_t ip = (int64_t)(tt * ir);  // in {0,4*ir-1}
-
-            if (z > 0.) {
-                return 2 * ir * (ir - 1) + ip;
-            } else {
-                return hpx->npix - 2 * ir * (ir + 1) + ip;
-            }
-        }
-    } else  // is_nest
-    {
-        if (za <= HPG_TWOTHIRD)  // Equatorial region
-        {
-            double temp1 = hpx->nside * (0.5 + tt);
-            double temp2 = hpx->nside * (z * 0.75);
-            int64_t jp = (int64_t)(temp1 - temp2);  // index of  ascending edge line
-            int64_t jm = (int64_t)(temp1 + temp2);  // index of descending edge line
-            int64_t ifp = jp >> hpx->order;         // in {0,4}
-            int64_t ifm = jm >> hpx->order;
-
-            int face_num = (ifp == ifm) ? (ifp | 4) : ((ifp < ifm) ? ifp : (ifm + 8));
-
-            int ix = jm & (hpx->nside - 1), iy = hpx->nside - (jp & (hpx->nside - 1)) - 1;
-            return xyf2nest(hpx, ix, iy, face_num);
-        } else  // polar region, za > 2/3
-        {
-            int ntt = (int)tt;
-            if (ntt >= 4) ntt = 3;
-            double tp = tt - ntt;
-            double tmp = ((za < 0.99) || (!have_sth))
-                             ? hpx->nside * sqrt(3 * (1 - za))
-                             : hpx->nside * sth / sqrt((1. + za) / 3.);
-
-            int64_t jp = (int64_t)(tp * tmp);           // increasing edge line index
-            int64_t jm = (int64_t)((1.0 - tp) * tmp);   // decreasing edge line index
-            if (jp >= hpx->nside) jp = hpx->nside - 1;  // for points too close to the boundary
-            if (jm >= hpx->nside) jm = hpx->nside - 1;
-            return (z >= 0) ? xyf2nest(hpx, hpx->nside - jm - 1, hpx->nside - jp - 1, ntt)
-                            : xyf2nest(hpx, jp, jm, ntt + 8);
-        }
+void ring2nest_batch(healpix_info *hpx, const int64_t *ring, int64_t *nest, size_t n) {
+#if HPG_X86_SIMD
+    if (use_bmi2) {
+        ring2nest_batch_bmi2(hpx, ring, nest, n);
+        return;
     }
+#endif
+    for (size_t i = 0; i < n; i++) nest[i] = ring2nest(hpx, ring[i]);
+}
+
+int64_t loc2pix(healpix_info *hpx, double z, double phi, double sth, bool have_sth) {
+    return hpg_core_loc2pix(hpx, hpx->scheme == NEST, z, phi, sth, have_sth);
 }
 
 void pix2loc(healpix_info *hpx, int64_t pix, double *z, double *phi, double *sth,
              bool *have_sth) {
-    *have_sth = false;
-    if (hpx->scheme == RING) {
-        if (pix < hpx->ncap)  // North Polar cap
-        {
-            int64_t iring =
-                (1 + (int64_t)(isqrt(1 + 2 * pix))) >> 1;  // counted from North pole
-            int64_t iphi = (pix + 1) - 2 * iring * (iring - 1);
-
-            double tmp = (iring * iring) * hpx->fact2;
-            *z = 1.0 - tmp;
-            if (*z > 0.99) {
-                *sth = sqrt(tmp * (2. - tmp));
-                *have_sth = true;
-            }
-            *phi = (iphi - 0.5) * HPG_HALFPI / iring;
-        } else if (pix < (hpx->npix - hpx->ncap))  // Equatorial region
-        {
-            int64_t nl4 = 4 * hpx->nside;
-            int64_t ip = pix - hpx->ncap;
-            int64_t tmp = (hpx->order >= 0) ? ip >> (hpx->order + 2) : ip / nl4;
-            int64_t iring = tmp + hpx->nside, iphi = ip - nl4 * tmp + 1;
-            // 1 if iring+nside is odd, 1/2 otherwise
-            double fodd = ((iring + hpx->nside) & 1) ? 1 : 0.5;
-
-            *z = (2 * hpx->nside - iring) * hpx->fact1;
-            *phi = (iphi - fodd) * HPG_PI * 0.75 * hpx->fact1;
-        } else  // South Polar cap
-        {
-            int64_t ip = hpx->npix - pix;
-            int64_t iring =
-                (1 + (int64_t)(isqrt(2 * ip - 1))) >> 1;  // counted from South pole
-            int64_t iphi = 4 * iring + 1 - (ip - 2 * iring * (iring - 1));
-
-            double tmp = (iring * iring) * hpx->fact2;
-            *z = tmp - 1.0;
-            if (*z < -0.99) {
-                *sth = sqrt(tmp * (2. - tmp));
-                *have_sth = true;
-            }
-            *phi = (iphi - 0.5) * HPG_HALFPI / iring;
-        }
-    } else {
-        int face_num, ix, iy;
-        nest2xyf(hpx, pix, &ix, &iy, &face_num);
-
-        int64_t jr = ((int64_t)(jrll[face_num]) << hpx->order) - ix - iy - 1;
-
-        int64_t nr;
-        if (jr < hpx->nside) {
-            nr = jr;
-            double tmp = (nr * nr) * hpx->fact2;
-            *z = 1 - tmp;
-            if (*z > 0.99) {
-                *sth = sqrt(tmp * (2. - tmp));
-                *have_sth = true;
-            }
-        } else if (jr > 3 * hpx->nside) {
-            nr = hpx->nside * 4 - jr;
-            double tmp = (nr * nr) * hpx->fact2;
-            *z = tmp - 1;
-            if (*z < -0.99) {
-                *sth = sqrt(tmp * (2. - tmp));
-                *have_sth = true;
-            }
-        } else {
-            nr = hpx->nside;
-            *z = (2 * hpx->nside - jr) * hpx->fact1;
-        }
-
-        int64_t tmp = (int64_t)(jpll[face_num]) * nr + ix - iy;
-        if (tmp < 0) tmp += 8 * nr;
-        *phi = (nr == hpx->nside) ? 0.75 * HPG_HALFPI * tmp * hpx->fact1
-                                  : (0.5 * HPG_HALFPI * tmp) / nr;
-    }
+    hpg_core_pix2loc(hpx, hpx->scheme == NEST, pix, z, phi, sth, have_sth);
 }
 
 int64_t xyf2nest(healpix_info *hpx, int ix, int iy, int face_num) {
-    return ((int64_t)face_num << (2 * hpx->order)) + spread_bits64(ix) +
-           (spread_bits64(iy) << 1);
+    return hpg_core_xyf2nest(hpx, ix, iy, face_num);
 }
 
 void nest2xyf(healpix_info *hpx, int64_t pix, int *ix, int *iy, int *face_num) {
-    *face_num = pix >> (2 * hpx->order);
-    pix &= (hpx->npface - 1);
-    *ix = compress_bits64(pix);
-    *iy = compress_bits64(pix >> 1);
+    hpg_core_nest2xyf(hpx, pix, ix, iy, face_num);
 }
 
 int64_t xyf2ring(healpix_info *hpx, int ix, int iy, int face_num) {
-    int64_t nl4 = 4 * hpx->nside;
-    int64_t jr = (jrll[face_num] * hpx->nside) - ix - iy - 1;
-
-    int64_t nr, kshift, n_before;
-
-    bool shifted;
-    get_ring_info_small(hpx, jr, &n_before, &nr, &shifted);
-    nr >>= 2;
-    kshift = 1 - shifted;
-    int64_t jp = (jpll[face_num] * nr + ix - iy + 1 + kshift) / 2;
-    if (jp < 1) jp += nl4;
-
-    return n_before + jp - 1;
+    return hpg_core_xyf2ring(hpx, ix, iy, face_num);
 }
 
 void ring2xyf(healpix_info *hpx, int64_t pix, int *ix, int *iy, int *face_num) {
-    int64_t iring, iphi, kshift, nr;
-    int64_t nl2 = 2 * hpx->nside;
-
-    if (pix < hpx->ncap) {                      // North Polar cap
-        iring = (1 + isqrt(1 + 2 * pix)) >> 1;  // counted from North pole
-        iphi = (pix + 1) - 2 * iring * (iring - 1);
-        kshift = 0;
-        nr = iring;
-        *face_num = special_div(iphi - 1, nr);
-    } else if (pix < (hpx->npix - hpx->ncap)) {  // Equatorial region
-        int64_t ip = pix - hpx->ncap;
-        int64_t tmp = (hpx->order >= 0) ? ip >> (hpx->order + 2) : ip / (4 * hpx->nside);
-        iring = tmp + hpx->nside;
-        iphi = ip - tmp * 4 * hpx->nside + 1;
-        kshift = (iring + hpx->nside) & 1;
-        nr = hpx->nside;
-        int64_t ire = tmp + 1, irm = nl2 + 1 - tmp;
-        int64_t ifm = iphi - (ire >> 1) + hpx->nside - 1,
-                ifp = iphi - (irm >> 1) + hpx->nside - 1;
-        if (hpx->order >= 0) {
-            ifm >>= hpx->order;
-            ifp >>= hpx->order;
-        } else {
-            ifm /= hpx->nside;
-            ifp /= hpx->nside;
-        }
-        *face_num = (ifp == ifm) ? (ifp | 4) : ((ifp < ifm) ? ifp : (ifm + 8));
-    } else {  // South Polar cap
-        int64_t ip = hpx->npix - pix;
-        iring = (1 + isqrt(2 * ip - 1)) >> 1;  // counted from South pole
-        iphi = 4 * iring + 1 - (ip - 2 * iring * (iring - 1));
-        kshift = 0;
-        nr = iring;
-        iring = 2 * nl2 - iring;
-        *face_num = special_div(iphi - 1, nr) + 8;
-    }
-
-    int64_t irt = iring - ((2 + (*face_num >> 2)) * hpx->nside) + 1;
-    int64_t ipt = 2 * iphi - jpll[*face_num] * nr - kshift - 1;
-    if (ipt >= nl2) ipt -= 8 * hpx->nside;
-
-    *ix = (ipt - irt) >> 1;
-    *iy = (-ipt - irt) >> 1;
+    hpg_core_ring2xyf(hpx, pix, ix, iy, face_num);
 }
 
 double ring2z(healpix_info *hpx, int64_t ring) {
@@ -465,12 +410,18 @@ double ring2z(healpix_info *hpx, int64_t ring) {
 }
 
 int64_t spread_bits64(int v) {
+#if HPG_X86_SIMD
+    if (use_bmi2) return spread_bits64_bmi2(v);
+#endif
     return (int64_t)(utab[v & 0xff]) | ((int64_t)(utab[(v >> 8) & 0xff]) << 16) |
            ((int64_t)(utab[(v >> 16) & 0xff]) << 32) |
            ((int64_t)(utab[(v >> 24) & 0xff]) << 48);
 }
 
 int compress_bits64(int64_t v) {
+#if HPG_X86_SIMD
+    if (use_bmi2) return compress_bits64_bmi2(v);
+#endif
     int64_t raw = v & 0x5555555555555555ull;
     raw |= raw >> 15;
     return ctab[raw & 0xff] | (ctab[(raw >> 8) & 0xff] << 4) |
@@ -511,20 +462,7 @@ int64_t ring_above(healpix_info *hpx, double z) {
 
 void get_ring_info_small(healpix_info *hpx, int64_t ring, int64_t *startpix, int64_t *ringpix,
                          bool *shifted) {
-    if (ring < hpx->nside) {
-        *shifted = true;
-        *ringpix = 4 * ring;
-        *startpix = 2 * ring * (ring - 1);
-    } else if (ring < 3 * hpx->nside) {
-        *shifted = ((ring - hpx->nside) & 1) == 0;
-        *ringpix = 4 * hpx->nside;
-        *startpix = hpx->ncap + (ring - hpx->nside) * (*ringpix);
-    } else {
-        *shifted = true;
-        int64_t nr = 4 * hpx->nside - ring;
-        *ringpix = 4 * nr;
-        *startpix = hpx->npix - 2 * nr * (nr + 1);
-    }
+    hpg_core_ring_info_small(hpx, ring, startpix, ringpix, shifted);
 }
 
 inline double cosdist_zphi(double z1, double phi1, double z2, double phi2) {
@@ -629,9 +567,376 @@ bool check_pixel_ring(healpix_info *hpx1, healpix_info *hpx2, int64_t pix, int64
     return true;
 }
 
+// Zone (as above) of the nest pixel pix at order o for a shape.
+typedef int (*nest_zone_func)(const void *shape, query_plan *plan, int o, int64_t pix);
+
+typedef struct {
+    double z;
+    double phi;
+    double cosrad;
+    double crpdr[MAX_ORDER + 1];
+    double crmdr[MAX_ORDER + 1];
+} disc_zones;
+
+static int disc_nest_zone(const void *shape, query_plan *plan, int o, int64_t pix) {
+    const disc_zones *disc = (const disc_zones *)shape;
+    double pix_z, pix_phi;
+    pix2zphi(&plan->base[o], pix, &pix_z, &pix_phi);
+    // cosine of angular distance between pixel center and disk center
+    double cangdist = cosdist_zphi(disc->z, disc->phi, pix_z, pix_phi);
+
+    if (cangdist <= disc->crpdr[o]) return 0;
+    return (cangdist < disc->cosrad) ? 1 : ((cangdist <= disc->crmdr[o]) ? 2 : 3);
+}
+
+typedef struct {
+    ellipse_shape ellipse;
+    double dmdr[MAX_ORDER + 1];
+    double dpdr[MAX_ORDER + 1];
+} ellipse_zones;
+
+static int ellipse_nest_zone(const void *shape, query_plan *plan, int o, int64_t pix) {
+    const ellipse_zones *zones = (const ellipse_zones *)shape;
+    const ellipse_shape *ellipse = &zones->ellipse;
+    double pix_z, pix_phi;
+    pix2zphi(&plan->base[o], pix, &pix_z, &pix_phi);
+    double d = acos(cosdist_zphi(ellipse->z1, ellipse->phi1, pix_z, pix_phi)) +
+               acos(cosdist_zphi(ellipse->z2, ellipse->phi2, pix_z, pix_phi));
+
+    if (d > zones->dpdr[o]) return 0;
+    return (d >= ellipse->major_axis) ? 1 : ((d > zones->dmdr[o]) ? 2 : 3);
+}
+
+static int box_nest_zone(const void *shape, query_plan *plan, int o, int64_t pix) {
+    const box_shape *box = (const box_shape *)shape;
+    double dr = plan->base_pixrad[o];  // safety distance
+    double pix_theta, pix_phi;
+    pix2ang(&plan->base[o], pix, &pix_theta, &pix_phi);
+
+    int zone_theta = 0, zone_phi = 0;
+
+    /* Check in the colatitude (theta) direction */
+    /* Note that the Box shape is inclusive of boundaries. */
+    double tmdr = pix_theta - dr, tpdr = pix_theta + dr;
+    if (tpdr >= (box->theta0 - HPG_EPSILON) && tmdr <= (box->theta1 + HPG_EPSILON)) {
+        // Check if completely inside
+        if (tmdr >= (box->theta0 - HPG_EPSILON) && tpdr <= (box->theta1 + HPG_EPSILON)) {
+            zone_theta = 3;
+        } else if (pix_theta >= (box->theta0 - HPG_EPSILON) &&
+                   pix_theta <= (box->theta1 + HPG_EPSILON)) {
+            zone_theta = 2;
+        } else {
+            zone_theta = 1;
+        }
+    }
+
+    /* Check in the longitude (phi) direction */
+    if (box->full_lon) {  // This has the full longitude range, always zone 3.
+        zone_phi = 3;
+    } else if (zone_theta > 0) {
+        // We need to rotate the pixel to match the rotation of the phi box.
+        // After that, we can trust that the pixel +/- dr will have the
+        // correct "winding" because the pixel itself will never have a
+        // radius larger than ~pi/4.
+        double pix_phi_rot = fmodulo(pix_phi + box->phi_rot_angle, HPG_TWO_PI);
+
+        double stheta = sin(pix_theta);
+        double pmdr_rot = pix_phi_rot - dr / stheta;
+        double ppdr_rot = pix_phi_rot + dr / stheta;
+
+        /* Note that the Box shape is inclusive of boundaries. */
+        if (ppdr_rot >= (box->phi0_rot - HPG_EPSILON) &&
+            pmdr_rot <= (box->phi1_rot + HPG_EPSILON)) {
+            // Check if completely inside
+            if (pmdr_rot >= (box->phi0_rot - HPG_EPSILON) &&
+                ppdr_rot <= (box->phi1_rot + HPG_EPSILON)) {
+                zone_phi = 3;
+            } else if (pix_phi_rot >= (box->phi0_rot - HPG_EPSILON) &&
+                       pix_phi_rot <= (box->phi1_rot + HPG_EPSILON)) {
+                zone_phi = 2;
+            } else {
+                zone_phi = 1;
+            }
+        }
+    }
+
+    return intmin(zone_theta, zone_phi);
+}
+
+// Depth-first search of the pixels below the nroot pixels at order o_root,
+// in order, appending the pixels at the order of plan->hpx to pixset.  This
+// is inlined into a search function for each shape, so that the zone tests
+// are not called through a pointer.
+static inline void nest_traverse(query_plan *plan, nest_zone_func zone_func,
+                                 const void *shape, bool inclusive, const int64_t *roots,
+                                 size_t nroot, int o_root, i64stack *stk, i64rangeset *pixset,
+                                 int *status, char *err) {
+    *status = 1;
+    // this does not alter the storage
+    stk->size = 0;
+    for (size_t i = nroot; i-- > 0;) {
+        i64stack_push(stk, roots[i], status, err);
+        if (!*status) return;
+        i64stack_push(stk, o_root, status, err);
+        if (!*status) return;
+    }
+
+    int stacktop = 0;  // a place to save a stack position
+    while (stk->size > 0) {
+        // pop current pixel number and order from the stack
+        int64_t pix, temp;
+        i64stack_pop_pair(stk, &pix, &temp, status, err);
+        if (!*status) return;
+        int o = (int)temp;
+
+        int zone = zone_func(shape, plan, o, pix);
+        if (zone > 0) {
+            check_pixel_nest(o, plan->hpx.order, plan->omax, zone, pixset, pix, stk, inclusive,
+                             &stacktop, status, err);
+            if (!*status) return;
+        }
+    }
+}
+
+typedef void (*nest_traverse_func)(query_plan *plan, const void *shape, bool inclusive,
+                                   const int64_t *roots, size_t nroot, int o_root,
+                                   i64stack *stk, i64rangeset *pixset, int *status, char *err);
+
+#define NEST_TRAVERSE_FUNC(name, zone_func)                                                 \
+    static void name(query_plan *plan, const void *shape, bool inclusive,                   \
+                     const int64_t *roots, size_t nroot, int o_root, i64stack *stk,         \
+                     i64rangeset *pixset, int *status, char *err) {                         \
+        nest_traverse(plan, zone_func, shape, inclusive, roots, nroot, o_root, stk, pixset, \
+                      status, err);                                                         \
+    }
+
+NEST_TRAVERSE_FUNC(disc_nest_traverse, disc_nest_zone)
+NEST_TRAVERSE_FUNC(ellipse_nest_traverse, ellipse_nest_zone)
+NEST_TRAVERSE_FUNC(box_nest_traverse, box_nest_zone)
+
+// A subtree of a threaded nest search, or a range of pixels found while
+// splitting the search, which has o = -1.  The pixels of a subtree are
+// stored in [start, stop) of the output of the thread that searched it.
+typedef struct {
+    int64_t pix;
+    int64_t end;
+    int o;
+    size_t start;
+    size_t stop;
+} nest_subtree;
+
+typedef struct {
+    i64stack *stk;
+    i64rangeset *pixset;
+    i64stack *out;
+    int status;
+    char err[ERR_SIZE];
+} nest_thread_state;
+
+typedef struct {
+    query_plan *plan;
+    nest_traverse_func traverse_func;
+    const void *shape;
+    bool inclusive;
+    nest_subtree *subtrees;
+    size_t nsubtree;
+    int n_threads;
+    nest_thread_state *threads;
+} nest_traverse_job;
+
+static void nest_traverse_thread(void *arg, int thread_id) {
+    nest_traverse_job *job = (nest_traverse_job *)arg;
+    nest_thread_state *state = &job->threads[thread_id];
+    i64stack *out = state->out;
+
+    state->status = 1;
+    for (size_t i = thread_id; i < job->nsubtree; i += job->n_threads) {
+        nest_subtree *subtree = &job->subtrees[i];
+        if (subtree->o < 0) continue;
+
+        state->pixset->stack->size = 0;
+        job->traverse_func(job->plan, job->shape, job->inclusive, &subtree->pix, 1, subtree->o,
+                           state->stk, state->pixset, &state->status, state->err);
+        if (!state->status) return;
+
+        size_t n = state->pixset->stack->size;
+        subtree->start = out->size;
+        i64stack_resize(out, out->size + n, &state->status, state->err);
+        if (!state->status) return;
+        memcpy(&out->data[subtree->start], state->pixset->stack->data, n * sizeof(int64_t));
+        subtree->stop = out->size;
+    }
+}
+
+// Replace each subtree in *subtrees with its children, as check_pixel_nest
+// does above the order of plan->hpx.
+static void nest_split_subtrees(query_plan *plan, nest_zone_func zone_func, const void *shape,
+                                nest_subtree **subtrees, size_t *nsubtree, int *status,
+                                char *err) {
+    int order_ = plan->hpx.order;
+    nest_subtree *in = *subtrees;
+    nest_subtree *out = malloc(4 * (*nsubtree) * sizeof(nest_subtree));
+    size_t nout = 0;
+
+    if (out == NULL) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "Could not allocate query subtrees.");
+        return;
+    }
+
+    for (size_t i = 0; i < *nsubtree; i++) {
+        if (in[i].o < 0) {
+            out[nout++] = in[i];
+            continue;
+        }
+        int o = in[i].o;
+        int64_t pix = in[i].pix;
+        int zone = zone_func(shape, plan, o, pix);
+        if (zone >= 3) {
+            int sdist = 2 * (order_ - o);
+            out[nout].pix = pix << sdist;
+            out[nout].end = (pix + 1) << sdist;
+            out[nout++].o = -1;
+        } else if (zone > 0) {
+            for (int j = 0; j < 4; j++) {
+                out[nout].pix = 4 * pix + j;
+                out[nout++].o = o + 1;
+            }
+        }
+    }
+
+    free(in);
+    *subtrees = out;
+    *nsubtree = nout;
+}
+
+/*
+ * Search the nest pixels of a shape, in order, appending the pixels at the
+ * order of plan->hpx to pixset.
+ *
+ * With n_threads > 1 (or n_threads = 0 and a default of more than one
+ * thread), the top of the search is expanded breadth first until there are
+ * enough subtrees to share between the threads.  The subtrees are then
+ * searched in parallel, each thread with its own stack and output, and the
+ * outputs are merged in order.  The expansion is stopped early, and the
+ * rest of the search run on the calling thread, if the estimated number of
+ * pixels to test is too small to be worth splitting.  The pixels found do
+ * not depend on the number of threads.
+ */
+static void nest_search(query_plan *plan, nest_zone_func zone_func,
+                        nest_traverse_func traverse_func, const void *shape, bool inclusive,
+                        int n_threads, i64rangeset *pixset, query_workspace *ws, int *status,
+                        char *err) {
+    static const int64_t base_pixels[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+    int order_ = plan->hpx.order;
+    nest_subtree *subtrees = NULL;
+    nest_thread_state *threads = NULL;
+    size_t nsubtree = 12;
+    int level = 0;
+
+    *status = 1;
+    // The number of pixels tested grows with the boundary of the shape, so
+    // roughly doubles with each order.
+    n_threads = hpgeom_resolve_threads(n_threads, (int64_t)12 << plan->omax,
+                                       HPGEOM_MIN_TRAVERSAL_CHUNK);
+    if (n_threads <= 1) {
+        traverse_func(plan, shape, inclusive, base_pixels, 12, 0, ws->stk, pixset, status,
+                      err);
+        return;
+    }
+
+    subtrees = malloc(nsubtree * sizeof(nest_subtree));
+    if (subtrees == NULL) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "Could not allocate query subtrees.");
+        return;
+    }
+    for (size_t i = 0; i < nsubtree; i++) {
+        subtrees[i].pix = (int64_t)i;
+        subtrees[i].o = 0;
+    }
+
+    int n_split = 1;
+    while (level < order_) {
+        size_t nopen = 0;
+        for (size_t i = 0; i < nsubtree; i++) nopen += (subtrees[i].o >= 0);
+        n_split = hpgeom_resolve_threads(n_threads, (int64_t)nopen << (plan->omax - level),
+                                         HPGEOM_MIN_TRAVERSAL_CHUNK);
+        if ((n_split <= 1) || (nopen >= (size_t)n_split * HPGEOM_SUBTREES_PER_THREAD)) break;
+
+        nest_split_subtrees(plan, zone_func, shape, &subtrees, &nsubtree, status, err);
+        if (!*status) goto cleanup;
+        level++;
+    }
+
+    threads = calloc(n_split, sizeof(nest_thread_state));
+    if (threads == NULL) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "Could not allocate query threads.");
+        goto cleanup;
+    }
+    for (int t = 0; t < n_split; t++) {
+        threads[t].stk = i64stack_new(0, status, err);
+        if (!*status) goto cleanup;
+        threads[t].pixset = i64rangeset_new(status, err);
+        if (!*status) goto cleanup;
+        threads[t].out = i64stack_new(0, status, err);
+        if (!*status) goto cleanup;
+    }
+
+    nest_traverse_job job = {plan,     traverse_func, shape,  inclusive, subtrees,
+                             nsubtree, n_split,       threads};
+    hpgeom_parallel_for(n_split, nest_traverse_thread, &job);
+    for (int t = 0; t < n_split; t++) {
+        if (!threads[t].status) {
+            *status = 0;
+            snprintf(err, ERR_SIZE, "%s", threads[t].err);
+            goto cleanup;
+        }
+    }
+
+    for (size_t i = 0; i < nsubtree; i++) {
+        nest_subtree *subtree = &subtrees[i];
+        if (subtree->o < 0) {
+            i64rangeset_append(pixset, subtree->pix, subtree->end, status, err);
+            if (!*status) goto cleanup;
+            continue;
+        }
+        int64_t *data = threads[i % n_split].out->data;
+        for (size_t j = subtree->start; j < subtree->stop; j += 2) {
+            i64rangeset_append(pixset, data[j], data[j + 1], status, err);
+            if (!*status) goto cleanup;
+        }
+    }
+
+cleanup:
+    if (threads != NULL) {
+        for (int t = 0; t < n_split; t++) {
+            if (threads[t].stk != NULL) i64stack_delete(threads[t].stk);
+            i64rangeset_delete(threads[t].pixset);
+            if (threads[t].out != NULL) i64stack_delete(threads[t].out);
+        }
+        free(threads);
+    }
+    free(subtrees);
+}
+
 void query_disc(healpix_info *hpx, double ptg_theta, double ptg_phi, double radius, int fact,
-                i64rangeset *pixset, int *status, char *err) {
+                int n_threads, i64rangeset *pixset, int *status, char *err) {
+    query_workspace *ws = query_workspace_new(status, err);
+    if (!*status) return;
+
+    query_disc_ws(hpx, ptg_theta, ptg_phi, radius, fact, n_threads, pixset, ws, status, err);
+
+    query_workspace_delete(ws);
+}
+
+void query_disc_ws(healpix_info *hpx, double ptg_theta, double ptg_phi, double radius,
+                   int fact, int n_threads, i64rangeset *pixset, query_workspace *ws,
+                   int *status, char *err) {
+    *status = 1;
     bool inclusive = (fact != 0);
+    query_plan *plan = query_workspace_plan(ws, hpx, fact);
     // this does not alter the storage
     pixset->stack->size = 0;
 
@@ -640,19 +945,18 @@ void query_disc(healpix_info *hpx, double ptg_theta, double ptg_phi, double radi
         if (inclusive) {
             fct = fact;
         }
-        healpix_info hpx2;
+        healpix_info *hpx2 = &plan->hpx2;
         double rsmall, rbig;
         if (fct > 1) {
-            hpx2 = healpix_info_from_nside(fct * hpx->nside, RING);
-            rsmall = radius + max_pixrad(&hpx2);
-            rbig = radius + max_pixrad(hpx);
+            rsmall = radius + plan->pixrad2;
+            rbig = radius + plan->pixrad;
         } else {
-            rsmall = rbig = inclusive ? radius + max_pixrad(hpx) : radius;
+            rsmall = rbig = inclusive ? radius + plan->pixrad : radius;
         }
 
         if (rsmall >= HPG_PI) {
             i64rangeset_append(pixset, 0, hpx->npix, status, err);
-            goto cleanup_ring;
+            return;
         }
 
         if (rbig > HPG_PI) {
@@ -676,7 +980,7 @@ void query_disc(healpix_info *hpx, double ptg_theta, double ptg_phi, double radi
             bool dummy;
             get_ring_info_small(hpx, irmin - 1, &sp, &rp, &dummy);
             i64rangeset_append(pixset, 0, sp + rp, status, err);
-            if (!*status) goto cleanup_ring;
+            if (!*status) return;
         }
         if ((fct > 1) && (rlat1 > 0)) irmin = i64max((int64_t)1, irmin - 1);
 
@@ -710,11 +1014,11 @@ void query_disc(healpix_info *hpx, double ptg_theta, double ptg_phi, double radi
 
                 if (fct > 1) {
                     while ((ip_lo <= ip_hi) &&
-                           check_pixel_ring(hpx, &hpx2, ip_lo, nr, ipix1, fct, z0, ptg_phi,
+                           check_pixel_ring(hpx, hpx2, ip_lo, nr, ipix1, fct, z0, ptg_phi,
                                             cosrsmall, cpix))
                         ++ip_lo;
                     while ((ip_hi > ip_lo) &&
-                           check_pixel_ring(hpx, &hpx2, ip_hi, nr, ipix1, fct, z0, ptg_phi,
+                           check_pixel_ring(hpx, hpx2, ip_hi, nr, ipix1, fct, z0, ptg_phi,
                                             cosrsmall, cpix))
                         --ip_hi;
                 }
@@ -726,13 +1030,13 @@ void query_disc(healpix_info *hpx, double ptg_theta, double ptg_phi, double radi
                     }
                     if (ip_lo < 0) {
                         i64rangeset_append(pixset, ipix1, ipix1 + ip_hi + 1, status, err);
-                        if (!*status) goto cleanup_ring;
+                        if (!*status) return;
                         i64rangeset_append(pixset, ipix1 + ip_lo + nr, ipix2 + 1, status, err);
-                        if (!*status) goto cleanup_ring;
+                        if (!*status) return;
                     } else {
                         i64rangeset_append(pixset, ipix1 + ip_lo, ipix1 + ip_hi + 1, status,
                                            err);
-                        if (!*status) goto cleanup_ring;
+                        if (!*status) return;
                     }
                 }
             }
@@ -742,72 +1046,33 @@ void query_disc(healpix_info *hpx, double ptg_theta, double ptg_phi, double radi
             bool dummy;
             get_ring_info_small(hpx, irmax + 1, &sp, &rp, &dummy);
             i64rangeset_append(pixset, sp, hpx->npix, status, err);
-            if (!*status) goto cleanup_ring;
+            if (!*status) return;
         }
-    cleanup_ring:;
     } else {  // schema == NEST
-        i64stack *stk = NULL;
         if (radius >= HPG_PI) {  // disk covers the whole sphere
             i64rangeset_append(pixset, 0, hpx->npix, status, err);
             return;
         }
 
-        int oplus = 0;
-        if (inclusive) {
-            oplus = ilog2(fact);
-        }
-        int omax = hpx->order + oplus;  // the order up to which we test
-
-        // Statically define the array of bases because it's not large.
-        double ptg_z = cos(ptg_theta);
-        struct healpix_info base[MAX_ORDER + 1];
-        double crpdr[MAX_ORDER + 1], crmdr[MAX_ORDER + 1];
-        double cosrad = cos(radius);
-        for (int o = 0; o <= omax; o++) {
-            base[o] = healpix_info_from_order(o, NEST);
-            double dr = max_pixrad(&base[o]);  // safety distance
-            crpdr[o] = ((radius + dr) > HPG_PI) ? -1. : cos(radius + dr);
-            crmdr[o] = ((radius - dr) < 0.) ? 1. : cos(radius - dr);
+        disc_zones disc;
+        disc.z = cos(ptg_theta);
+        disc.phi = ptg_phi;
+        disc.cosrad = cos(radius);
+        for (int o = 0; o <= plan->omax; o++) {
+            double dr = plan->base_pixrad[o];  // safety distance
+            disc.crpdr[o] = ((radius + dr) > HPG_PI) ? -1. : cos(radius + dr);
+            disc.crmdr[o] = ((radius - dr) < 0.) ? 1. : cos(radius - dr);
         }
 
-        stk = i64stack_new(2 * (12 + 3 * omax), status, err);
-        if (!*status) goto cleanup_nest;
-        for (int i = 0; i < 12; i++) {
-            i64stack_push(stk, (int64_t)(11 - i), status, err);
-            if (!*status) goto cleanup_nest;
-            i64stack_push(stk, 0, status, err);
-            if (!*status) goto cleanup_nest;
-        }
-
-        int stacktop = 0;  // a place to save a stack position
-        while (stk->size > 0) {
-            // pop current pixel number and order from the stack
-            int64_t pix, temp;
-            i64stack_pop_pair(stk, &pix, &temp, status, err);
-            if (!*status) goto cleanup_nest;
-            int o = (int)temp;
-
-            double pix_z, pix_phi;
-            pix2zphi(&base[o], pix, &pix_z, &pix_phi);
-            // cosine of angular distance between pixel center and disk center
-            double cangdist = cosdist_zphi(ptg_z, ptg_phi, pix_z, pix_phi);
-
-            if (cangdist > crpdr[o]) {
-                int zone = (cangdist < cosrad) ? 1 : ((cangdist <= crmdr[o]) ? 2 : 3);
-                check_pixel_nest(o, hpx->order, omax, zone, pixset, pix, stk, inclusive,
-                                 &stacktop, status, err);
-                if (!*status) goto cleanup_nest;
-            }
-        }
-    cleanup_nest:
-        if (stk != NULL) i64stack_delete(stk);
+        nest_search(plan, disc_nest_zone, disc_nest_traverse, &disc, inclusive, n_threads,
+                    pixset, ws, status, err);
     }
 }
 
 void xyf2loc(double x, double y, int face, double *z, double *phi, double *sth,
              bool *have_sth) {
     *have_sth = false;
-    double jr = jrll[face] - x - y;
+    double jr = hpg_core_jrll[face] - x - y;
     double nr;
     if (jr < 1) {
         nr = jr;
@@ -830,7 +1095,7 @@ void xyf2loc(double x, double y, int face, double *z, double *phi, double *sth,
         *z = (2 - jr) * 2. / 3.;
     }
 
-    double tmp = jpll[face] * nr + x - y;
+    double tmp = hpg_core_jpll[face] * nr + x - y;
     if (tmp < 0) tmp += 8;
     if (tmp >= 8) tmp -= 8;
     *phi = (nr < 1e-15) ? 0 : (0.5 * HPG_HALFPI * tmp) / nr;
@@ -1025,49 +1290,156 @@ static void find_enclosing_circle(vec3arr *point, vec3 *center, double *cosrad)
     }
 }
 
+query_workspace *query_workspace_new(int *status, char *err) {
+    *status = 1;
+    query_workspace *ws = calloc(1, sizeof(query_workspace));
+    if (ws == NULL) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "Could not allocate query workspace.");
+        return NULL;
+    }
+
+    ws->stk = i64stack_new(0, status, err);
+    if (!*status) goto fail;
+    ws->tr = i64rangeset_new(status, err);
+    if (!*status) goto fail;
+
+    return ws;
+
+fail:
+    query_workspace_delete(ws);
+    return NULL;
+}
+
+query_workspace *query_workspace_delete(query_workspace *ws) {
+    if (ws != NULL) {
+        free(ws->vv);
+        free(ws->normal);
+        free(ws->rad);
+        free(ws->z0);
+        free(ws->xa);
+        free(ws->cosrsmall);
+        free(ws->cosrbig);
+        free(ws->ptg);
+        free(ws->cpix);
+        free(ws->crlimit);
+        if (ws->stk != NULL) i64stack_delete(ws->stk);
+        i64rangeset_delete(ws->tr);
+        free(ws);
+    }
+    return NULL;
+}
+
+void query_plan_init(query_plan *plan, healpix_info *hpx, int fact) {
+    plan->hpx = *hpx;
+    plan->fact = fact;
+    plan->pixrad = max_pixrad(hpx);
+    plan->omax = hpx->order;
+    if (hpx->scheme == NEST) {
+        if (fact != 0) plan->omax += ilog2(fact);
+        for (int o = 0; o <= plan->omax; o++) {
+            plan->base[o] = healpix_info_from_order(o, NEST);
+            plan->base_pixrad[o] = max_pixrad(&plan->base[o]);
+        }
+    } else if (fact > 1) {
+        plan->hpx2 = healpix_info_from_nside(fact * hpx->nside, RING);
+        plan->pixrad2 = max_pixrad(&plan->hpx2);
+    }
+}
+
+query_plan *query_workspace_plan(query_workspace *ws, healpix_info *hpx, int fact) {
+    query_plan *plan = &ws->plan;
+    if (!ws->have_plan || plan->hpx.nside != hpx->nside || plan->hpx.scheme != hpx->scheme ||
+        plan->fact != fact) {
+        query_plan_init(plan, hpx, fact);
+        ws->have_plan = true;
+    }
+    return plan;
+}
+
+// Grow *buf to hold at least n elements of elsize bytes.  The old contents
+// are not preserved.
+static void workspace_grow(void **buf, size_t n, size_t elsize, int *status, char *err) {
+    free(*buf);
+    *buf = malloc(n * elsize);
+    if (*buf == NULL) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "Could not allocate query workspace.");
+    }
+}
+
+static void query_workspace_reserve_discs(query_workspace *ws, size_t ndisc, int *status,
+                                          char *err) {
+    *status = 1;
+    if (ndisc <= ws->ndisc_alloc) return;
+
+    workspace_grow((void **)&ws->z0, ndisc, sizeof(double), status, err);
+    if (*status) workspace_grow((void **)&ws->xa, ndisc, sizeof(double), status, err);
+    if (*status) workspace_grow((void **)&ws->cosrsmall, ndisc, sizeof(double), status, err);
+    if (*status) workspace_grow((void **)&ws->cosrbig, ndisc, sizeof(double), status, err);
+    if (*status) workspace_grow((void **)&ws->ptg, ndisc, sizeof(pointing), status, err);
+    if (*status) workspace_grow((void **)&ws->cpix, ndisc, sizeof(int64_t), status, err);
+    if (*status)
+        workspace_grow((void **)&ws->crlimit, 3 * (MAX_ORDER + 1) * ndisc, sizeof(double),
+                       status, err);
+
+    ws->ndisc_alloc = (*status) ? ndisc : 0;
+}
+
+static void query_workspace_reserve_vertices(query_workspace *ws, size_t nvert, int *status,
+                                             char *err) {
+    *status = 1;
+    if (nvert <= ws->nvert_alloc) return;
+
+    // The normals and radii have one extra element for the enclosing circle.
+    workspace_grow((void **)&ws->vv, nvert, sizeof(vec3), status, err);
+    if (*status) workspace_grow((void **)&ws->normal, nvert + 1, sizeof(vec3), status, err);
+    if (*status) workspace_grow((void **)&ws->rad, nvert + 1, sizeof(double), status, err);
+
+    ws->nvert_alloc = (*status) ? nvert : 0;
+}
+
 void query_multidisc(healpix_info *hpx, vec3arr *norm, double *rad, int fact,
                      i64rangeset *pixset, int *status, char *err) {
+    query_workspace *ws = query_workspace_new(status, err);
+    if (!*status) return;
+
+    query_multidisc_ws(hpx, norm, rad, fact, pixset, ws, status, err);
+
+    query_workspace_delete(ws);
+}
+
+void query_multidisc_ws(healpix_info *hpx, vec3arr *norm, double *rad, int fact,
+                        i64rangeset *pixset, query_workspace *ws, int *status, char *err) {
     *status = 1;
     bool inclusive = (fact != 0);
     size_t nv = norm->size;
     // this does not alter the storage
     pixset->stack->size = 0;
 
+    query_workspace_reserve_discs(ws, nv, status, err);
+    if (!*status) return;
+    query_plan *plan = query_workspace_plan(ws, hpx, fact);
+
     if (hpx->scheme == RING) {
-        dblarr *z0 = NULL, *xa = NULL, *cosrsmall = NULL, *cosrbig = NULL;
-        pointingarr *ptg = NULL;
-        i64stack *cpix = NULL;
-        i64rangeset *tr = NULL;
+        double *z0 = ws->z0, *xa = ws->xa, *cosrsmall = ws->cosrsmall, *cosrbig = ws->cosrbig;
+        pointing *ptg = ws->ptg;
+        int64_t *cpix = ws->cpix;
+        i64rangeset *tr = ws->tr;
         int64_t fct = 1;
         if (inclusive) {
             fct = fact;
         }
-        healpix_info hpx2;
+        healpix_info *hpx2 = &plan->hpx2;
         double rpsmall, rpbig;
         if (fct > 1) {
-            hpx2 = healpix_info_from_nside(fct * hpx->nside, RING);
-            rpsmall = max_pixrad(&hpx2);
-            rpbig = max_pixrad(hpx);
+            rpsmall = plan->pixrad2;
+            rpbig = plan->pixrad;
         } else {
-            rpsmall = rpbig = inclusive ? max_pixrad(hpx) : 0;
+            rpsmall = rpbig = inclusive ? plan->pixrad : 0;
         }
 
-        tr = i64rangeset_new(status, err);
-        if (!*status) goto cleanup_ring;
-
         int64_t irmin = 1, irmax = 4 * hpx->nside - 1;
-        z0 = dblarr_new(nv, status, err);
-        if (!*status) goto cleanup_ring;
-        xa = dblarr_new(nv, status, err);
-        if (!*status) goto cleanup_ring;
-        cosrsmall = dblarr_new(nv, status, err);
-        if (!*status) goto cleanup_ring;
-        cosrbig = dblarr_new(nv, status, err);
-        if (!*status) goto cleanup_ring;
-        ptg = pointingarr_new(nv, status, err);
-        if (!*status) goto cleanup_ring;
-        cpix = i64stack_new(nv, status, err);
-        if (!*status) goto cleanup_ring;
 
         size_t counter = 0;
         for (size_t i = 0; i < nv; i++) {
@@ -1076,17 +1448,16 @@ void query_multidisc(healpix_info *hpx, vec3arr *norm, double *rad, int fact,
                 double rbig = dblmin(HPG_PI, rad[i] + rpbig);
                 pointing pnt;
                 pointing_from_vec3(&norm->data[i], &pnt);
-                cosrsmall->data[counter] = cos(rsmall);
-                cosrbig->data[counter] = cos(rbig);
+                cosrsmall[counter] = cos(rsmall);
+                cosrbig[counter] = cos(rbig);
                 double cth = cos(pnt.theta);
-                z0->data[counter] = cth;
+                z0[counter] = cth;
                 if (fct > 1) {
-                    cpix->data[counter] = loc2pix(hpx, cth, pnt.phi, 0, false);
-                    if (!*status) goto cleanup_ring;
+                    cpix[counter] = loc2pix(hpx, cth, pnt.phi, 0, false);
                 }
-                xa->data[counter] = 1. / sqrt((1 - cth) * (1 + cth));
-                ptg->data[counter].theta = pnt.theta;
-                ptg->data[counter].phi = pnt.phi;
+                xa[counter] = 1. / sqrt((1 - cth) * (1 + cth));
+                ptg[counter].theta = pnt.theta;
+                ptg[counter].phi = pnt.phi;
                 counter++;
 
                 double rlat1 = pnt.theta - rsmall;
@@ -1116,28 +1487,24 @@ void query_multidisc(healpix_info *hpx, vec3arr *norm, double *rad, int fact,
             double shift = shifted ? 0.5 : 0.;
             tr->stack->size = 0;
             i64rangeset_append(tr, ipix1, ipix1 + nr, status, err);
-            if (!*status) goto cleanup_ring;
+            if (!*status) return;
             for (size_t j = 0; j < counter; j++) {
-                double x = (cosrbig->data[j] - z * z0->data[j]) * xa->data[j];
+                double x = (cosrbig[j] - z * z0[j]) * xa[j];
                 double ysq = 1. - z * z - x * x;
                 if (ysq > 0) {
                     double dphi = atan2(sqrt(ysq), x);
                     int64_t ip_lo =
-                        (int64_t)floor((nr * HPG_INV_TWOPI) * (ptg->data[j].phi - dphi) -
-                                       shift) +
-                        1;
-                    int64_t ip_hi = (int64_t)floor(
-                        (nr * HPG_INV_TWOPI) * (ptg->data[j].phi + dphi) - shift);
+                        (int64_t)floor((nr * HPG_INV_TWOPI) * (ptg[j].phi - dphi) - shift) + 1;
+                    int64_t ip_hi =
+                        (int64_t)floor((nr * HPG_INV_TWOPI) * (ptg[j].phi + dphi) - shift);
                     if (fct > 1) {
                         while ((ip_lo <= ip_hi) &&
-                               check_pixel_ring(hpx, &hpx2, ip_lo, nr, ipix1, fct, z0->data[j],
-                                                ptg->data[j].phi, cosrsmall->data[j],
-                                                cpix->data[j]))
+                               check_pixel_ring(hpx, hpx2, ip_lo, nr, ipix1, fct, z0[j],
+                                                ptg[j].phi, cosrsmall[j], cpix[j]))
                             ++ip_lo;
                         while ((ip_hi > ip_lo) &&
-                               check_pixel_ring(hpx, &hpx2, ip_hi, nr, ipix1, fct, z0->data[j],
-                                                ptg->data[j].phi, cosrsmall->data[j],
-                                                cpix->data[j]))
+                               check_pixel_ring(hpx, hpx2, ip_hi, nr, ipix1, fct, z0[j],
+                                                ptg[j].phi, cosrsmall[j], cpix[j]))
                             --ip_hi;
                     }
                     if (ip_hi >= nr) {
@@ -1152,67 +1519,42 @@ void query_multidisc(healpix_info *hpx, vec3arr *norm, double *rad, int fact,
                                               err);
                     }
                 }
-                if (!*status) goto cleanup_ring;
+                if (!*status) return;
             }
             i64rangeset_append_i64rangeset(pixset, tr, status, err);
-            if (!*status) goto cleanup_ring;
+            if (!*status) return;
         }
-
-    cleanup_ring:
-        if (z0 != NULL) dblarr_delete(z0);
-        if (xa != NULL) dblarr_delete(xa);
-        if (cosrsmall != NULL) dblarr_delete(cosrsmall);
-        if (cosrbig != NULL) dblarr_delete(cosrbig);
-        if (ptg != NULL) pointingarr_delete(ptg);
-        if (tr != NULL) i64rangeset_delete(tr);
-        if (cpix != NULL) i64stack_delete(cpix);
-
     } else {  // scheme == NEST
-        dblarr *crlimit0[MAX_ORDER + 1];
-        dblarr *crlimit1[MAX_ORDER + 1];
-        dblarr *crlimit2[MAX_ORDER + 1];
-        i64stack *stk = NULL;
-
-        for (int o = 0; o <= MAX_ORDER; o++) {
-            crlimit0[o] = NULL;
-            crlimit1[o] = NULL;
-            crlimit2[o] = NULL;
-        }
-
-        int oplus = 0;
-        if (inclusive) {
-            oplus = ilog2(fact);
-        }
-        int omax = hpx->order + oplus;  // the order up to which we test
+        i64stack *stk = ws->stk;
+        int omax = plan->omax;  // the order up to which we test
+        healpix_info *base = plan->base;
 
         // TODO: ignore all disks with radius>=pi
 
-        struct healpix_info base[MAX_ORDER + 1];
-        for (int o = 0; o <= MAX_ORDER; o++) {  // prepare data at the required orders
-            base[o] = healpix_info_from_order(o, NEST);
-            crlimit0[o] = dblarr_new(nv, status, err);
-            if (!*status) goto cleanup_nest;
-            crlimit1[o] = dblarr_new(nv, status, err);
-            if (!*status) goto cleanup_nest;
-            crlimit2[o] = dblarr_new(nv, status, err);
-            if (!*status) goto cleanup_nest;
+        // Limits for each order o and disc i are stored at crlimit[(3 * o + zone) * nv + i].
+        // Pixels are never tested beyond omax.
+        double *crlimit = ws->crlimit;
+        for (int o = 0; o <= omax; o++) {  // prepare data at the required orders
+            double *crlimit0 = &crlimit[(3 * o) * nv];
+            double *crlimit1 = &crlimit[(3 * o + 1) * nv];
+            double *crlimit2 = &crlimit[(3 * o + 2) * nv];
 
-            double dr = max_pixrad(&base[o]);  // safety distance
+            double dr = plan->base_pixrad[o];  // safety distance
 
             for (size_t i = 0; i < nv; i++) {
-                crlimit0[o]->data[i] = (rad[i] + dr > HPG_PI) ? -1. : cos(rad[i] + dr);
-                crlimit1[o]->data[i] = (o == 0) ? cos(rad[i]) : crlimit1[0]->data[i];
-                crlimit2[o]->data[i] = (rad[i] - dr < 0.) ? 1. : cos(rad[i] - dr);
+                crlimit0[i] = (rad[i] + dr > HPG_PI) ? -1. : cos(rad[i] + dr);
+                crlimit1[i] = (o == 0) ? cos(rad[i]) : crlimit[nv + i];
+                crlimit2[i] = (rad[i] - dr < 0.) ? 1. : cos(rad[i] - dr);
             }
         }
 
-        stk = i64stack_new(2 * (12 + 3 * omax), status, err);
-        if (!*status) goto cleanup_nest;
+        // this does not alter the storage
+        stk->size = 0;
         for (int i = 0; i < 12; i++) {
             i64stack_push(stk, (int64_t)(11 - i), status, err);
-            if (!*status) goto cleanup_nest;
+            if (!*status) return;
             i64stack_push(stk, 0, status, err);
-            if (!*status) goto cleanup_nest;
+            if (!*status) return;
         }
 
         int stacktop = 0;  // a place to save a stack position
@@ -1220,110 +1562,118 @@ void query_multidisc(healpix_info *hpx, vec3arr *norm, double *rad, int fact,
             // pop current pixel number and order from the stack
             int64_t pix, temp;
             i64stack_pop_pair(stk, &pix, &temp, status, err);
-            if (!*status) goto cleanup_nest;
+            if (!*status) return;
             int o = (int)temp;
             vec3 pv = pix2vec(&base[o], pix);
 
             size_t zone = 3;
             for (size_t i = 0; i < nv; i++) {
                 double crad = vec3_dotprod(&pv, &norm->data[i]);
-                double crlim;
                 for (size_t iz = 0; iz < zone; iz++) {
-                    if (iz == 0) {
-                        crlim = crlimit0[o]->data[i];
-                    } else if (iz == 1) {
-                        crlim = crlimit1[o]->data[i];
-                    } else {
-                        crlim = crlimit2[o]->data[i];
-                    }
-                    if (crad < crlim)
+                    if (crad < crlimit[(3 * o + iz) * nv + i])
                         if ((zone = iz) == 0) goto bailout;
                 }
             }
             check_pixel_nest(o, hpx->order, omax, zone, pixset, pix, stk, inclusive, &stacktop,
                              status, err);
-            if (!*status) goto cleanup_nest;
+            if (!*status) return;
         bailout:;
         }
-    cleanup_nest:
-        for (int o = 0; o <= MAX_ORDER; o++) {
-            if (crlimit0[o] != NULL) dblarr_delete(crlimit0[o]);
-            if (crlimit1[o] != NULL) dblarr_delete(crlimit1[o]);
-            if (crlimit2[o] != NULL) dblarr_delete(crlimit2[o]);
-        }
-        if (stk != NULL) i64stack_delete(stk);
     }
 }
 
-void query_polygon(healpix_info *hpx, pointingarr *vertex, int fact, i64rangeset *pixset,
-                   int *status, char *err) {
-    *status = 1;
-
-    bool inclusive = (fact != 0);
+static void polygon_normals(pointingarr *vertex, vec3 *vv, vec3 *normal, int *status,
+                            char *err) {
+    // Compute the inward normals of the edges of a convex polygon.  vv is
+    // scratch space for the vertex vectors.
     size_t nv = vertex->size;
-    size_t ncirc = inclusive ? nv + 1 : nv;
-    vec3arr *vv = NULL, *normal = NULL;
-    double *rad = NULL;
-
-    if (nv < 3) {
-        snprintf(err, ERR_SIZE, "Polygon does not have enough vertices.");
-        *status = 0;
-        return;
-    }
-
-    vv = vec3arr_new(nv, status, err);
-    if (!*status) goto cleanup;
 
     for (size_t i = 0; i < nv; i++) {
-        vec3_from_pointing(&vertex->data[i], &vv->data[i]);
+        vec3_from_pointing(&vertex->data[i], &vv[i]);
     }
 
-    normal = vec3arr_new(ncirc, status, err);
-    if (!*status) goto cleanup;
     int flip = 0;
     for (size_t i = 0; i < nv; i++) {
-        vec3_crossprod(&vv->data[i], &vv->data[(i + 1) % nv], &normal->data[i]);
-        vec3_normalize(&normal->data[i]);
-        double hnd = vec3_dotprod(&normal->data[i], &vv->data[(i + 2) % nv]);
+        vec3_crossprod(&vv[i], &vv[(i + 1) % nv], &normal[i]);
+        vec3_normalize(&normal[i]);
+        double hnd = vec3_dotprod(&normal[i], &vv[(i + 2) % nv]);
         if (fabs(hnd) < 1e-10) {
             snprintf(err, ERR_SIZE, "Polygon has degenerate corner.");
             *status = 0;
-            goto cleanup;
+            return;
         }
         if (i == 0)
             flip = (hnd < 0.) ? -1 : 1;
         else if (flip * hnd < 0) {
             snprintf(err, ERR_SIZE, "Polygon is not convex.");
             *status = 0;
-            goto cleanup;
+            return;
         }
-        normal->data[i].x *= flip;
-        normal->data[i].y *= flip;
-        normal->data[i].z *= flip;
+        normal[i].x *= flip;
+        normal[i].y *= flip;
+        normal[i].z *= flip;
     }
-    rad = (double *)calloc(ncirc, sizeof(double));
-    if (rad == NULL) {
-        snprintf(err, ERR_SIZE, "Could not allocate array memory.");
+}
+
+void query_polygon(healpix_info *hpx, pointingarr *vertex, int fact, i64rangeset *pixset,
+                   int *status, char *err) {
+    query_workspace *ws = query_workspace_new(status, err);
+    if (!*status) return;
+
+    query_polygon_ws(hpx, vertex, fact, pixset, ws, status, err);
+
+    query_workspace_delete(ws);
+}
+
+void query_polygon_ws(healpix_info *hpx, pointingarr *vertex, int fact, i64rangeset *pixset,
+                      query_workspace *ws, int *status, char *err) {
+    *status = 1;
+
+    bool inclusive = (fact != 0);
+    size_t nv = vertex->size;
+    size_t ncirc = inclusive ? nv + 1 : nv;
+
+    if (nv < 3) {
+        snprintf(err, ERR_SIZE, "Polygon does not have enough vertices.");
         *status = 0;
-        goto cleanup;
+        return;
     }
+
+    query_workspace_reserve_vertices(ws, nv, status, err);
+    if (!*status) return;
+    vec3 *vv = ws->vv;
+    vec3arr normal = {ncirc, ws->normal};
+    double *rad = ws->rad;
+
+    polygon_normals(vertex, vv, normal.data, status, err);
+    if (!*status) return;
     for (size_t i = 0; i < ncirc; i++) rad[i] = HPG_HALFPI;
     if (inclusive) {
         double cosrad;
-        find_enclosing_circle(vv, &normal->data[nv], &cosrad);
+        vec3arr vvarr = {nv, vv};
+        find_enclosing_circle(&vvarr, &normal.data[nv], &cosrad);
         rad[nv] = acos(cosrad);
     }
-    query_multidisc(hpx, normal, rad, fact, pixset, status, err);
-
-cleanup:
-    if (vv != NULL) vec3arr_delete(vv);
-    if (normal != NULL) vec3arr_delete(normal);
-    if (rad != NULL) free(rad);
+    query_multidisc_ws(hpx, &normal, rad, fact, pixset, ws, status, err);
 }
 
 void query_ellipse(healpix_info *hpx, double ptg_theta, double ptg_phi, double semi_major,
-                   double semi_minor, double alpha, int fact, struct i64rangeset *pixset,
-                   int *status, char *err) {
+                   double semi_minor, double alpha, int fact, int n_threads,
+                   struct i64rangeset *pixset, int *status, char *err) {
+    query_workspace *ws = query_workspace_new(status, err);
+    if (!*status) return;
+
+    query_ellipse_ws(hpx, ptg_theta, ptg_phi, semi_major, semi_minor, alpha, fact, n_threads,
+                     pixset, ws, status, err);
+
+    query_workspace_delete(ws);
+}
+
+void query_ellipse_ws(healpix_info *hpx, double ptg_theta, double ptg_phi, double semi_major,
+                      double semi_minor, double alpha, int fact, int n_threads,
+                      struct i64rangeset *pixset, query_workspace *ws, int *status,
+                      char *err) {
+    *status = 1;
     if (hpx->scheme == RING) {
         snprintf(err, ERR_SIZE, "query_ellipse only supports nest ordering.");
         *status = 0;
@@ -1338,12 +1688,143 @@ void query_ellipse(healpix_info *hpx, double ptg_theta, double ptg_phi, double s
         return;
     }
 
-    i64stack *stk = NULL;
+    bool inclusive = (fact != 0);
+    // this does not alter the storage
+    pixset->stack->size = 0;
+
+    ellipse_zones zones;
+    ellipse_shape_init(&zones.ellipse, ptg_theta, ptg_phi, semi_major, semi_minor, alpha);
+
+    if (zones.ellipse.full) {  // disk covers the whole sphere
+        i64rangeset_append(pixset, 0, hpx->npix, status, err);
+        return;
+    }
+
+    query_plan *plan = query_workspace_plan(ws, hpx, fact);
+    for (int o = 0; o <= plan->omax; o++) {
+        double dr = plan->base_pixrad[o];  // safety distance
+        zones.dmdr[o] = 2 * semi_major - 2 * dr;
+        zones.dpdr[o] = 2 * semi_major + 2 * dr;
+    }
+
+    nest_search(plan, ellipse_nest_zone, ellipse_nest_traverse, &zones, inclusive, n_threads,
+                pixset, ws, status, err);
+}
+
+void query_box(healpix_info *hpx, double ptg_theta0, double ptg_theta1, double ptg_phi0,
+               double ptg_phi1, bool full_lon, int fact, int n_threads,
+               struct i64rangeset *pixset, int *status, char *err) {
+    query_workspace *ws = query_workspace_new(status, err);
+    if (!*status) return;
+
+    query_box_ws(hpx, ptg_theta0, ptg_theta1, ptg_phi0, ptg_phi1, full_lon, fact, n_threads,
+                 pixset, ws, status, err);
+
+    query_workspace_delete(ws);
+}
+
+void query_box_ws(healpix_info *hpx, double ptg_theta0, double ptg_theta1, double ptg_phi0,
+                  double ptg_phi1, bool full_lon, int fact, int n_threads,
+                  struct i64rangeset *pixset, query_workspace *ws, int *status, char *err) {
+    *status = 1;
+    if (hpx->scheme == RING) {
+        snprintf(err, ERR_SIZE, "query_box only supports nest ordering.");
+        *status = 0;
+        return;
+    }
 
     bool inclusive = (fact != 0);
     // this does not alter the storage
     pixset->stack->size = 0;
 
+    box_shape box;
+    box_shape_init(&box, ptg_theta0, ptg_theta1, ptg_phi0, ptg_phi1, full_lon);
+    if (box.empty) return;
+
+    query_plan *plan = query_workspace_plan(ws, hpx, fact);
+    nest_search(plan, box_nest_zone, box_nest_traverse, &box, inclusive, n_threads, pixset, ws,
+                status, err);
+}
+
+static inline void push_range(i64stack *out, int64_t lo, int64_t hi, int *status, char *err) {
+    i64stack_push(out, lo, status, err);
+    if (*status) i64stack_push(out, hi, status, err);
+}
+
+// Push the ring ranges covering the aligned nest block of 4**k pixels
+// starting at pix.  The block is a square of 2**k x 2**k pixels in a face,
+// and each of its diagonals (constant ix + iy) lies along a single ring,
+// where the ring pixel number increases by one with each step in ix.  A
+// diagonal is thus a single range of ring pixels, unless it wraps through
+// the start of its ring (which can only happen in face 4).
+static void nest_block_to_ring(healpix_info *hpx, int64_t pix, int k, i64stack *out,
+                               int *status, char *err) {
+    int ix, iy, face_num;
+    int64_t size = (int64_t)1 << k;
+
+    nest2xyf(hpx, pix, &ix, &iy, &face_num);
+
+    for (int64_t d = 0; d < 2 * size - 1; d++) {
+        int64_t sum = ix + iy + d;
+        int xmin = ix + (int)((d < size) ? 0 : d - (size - 1));
+        int xmax = ix + (int)((d < size) ? d : size - 1);
+        int64_t pa = xyf2ring(hpx, xmin, (int)(sum - xmin), face_num);
+        int64_t pb = xyf2ring(hpx, xmax, (int)(sum - xmax), face_num);
+
+        if (pb >= pa) {
+            push_range(out, pa, pb + 1, status, err);
+        } else {
+            int64_t startpix, ringpix;
+            bool shifted;
+            get_ring_info_small(hpx, hpg_core_jrll[face_num] * hpx->nside - sum - 1, &startpix,
+                                &ringpix, &shifted);
+            push_range(out, pa, startpix + ringpix, status, err);
+            if (*status) push_range(out, startpix, pb + 1, status, err);
+        }
+        if (!*status) return;
+    }
+}
+
+void nest_ranges_to_ring(healpix_info *hpx, i64rangeset *pixset, int *status, char *err) {
+    i64stack *nest = pixset->stack;
+    i64stack *ring = NULL;
+
+    *status = 1;
+    ring = i64stack_new(nest->size, status, err);
+    if (!*status) return;
+
+    // Each range is split into the largest aligned nest blocks that it
+    // contains, which are converted a diagonal at a time.
+    for (size_t j = 0; j < nest->size; j += 2) {
+        int64_t pix = nest->data[j], end = nest->data[j + 1];
+        while (pix < end) {
+            int k = 0;
+            while ((k < hpx->order) && ((pix & ((INT64_C(4) << (2 * k)) - 1)) == 0) &&
+                   (pix + (INT64_C(4) << (2 * k)) <= end))
+                k++;
+            nest_block_to_ring(hpx, pix, k, ring, status, err);
+            if (!*status) {
+                i64stack_delete(ring);
+                return;
+            }
+            pix += INT64_C(1) << (2 * k);
+        }
+    }
+    ring->size = i64ranges_sort_merge(ring->data, ring->size);
+
+    pixset->stack = ring;
+    i64stack_delete(nest);
+}
+
+void disc_shape_init(disc_shape *disc, double ptg_theta, double ptg_phi, double radius) {
+    disc->z0 = cos(ptg_theta);
+    disc->phi0 = ptg_phi;
+    disc->cosrad = cos(radius);
+    disc->full = (radius >= HPG_PI);
+}
+
+void ellipse_shape_init(ellipse_shape *ellipse, double ptg_theta, double ptg_phi,
+                        double semi_major, double semi_minor, double alpha) {
     /*
       The following math is adapted from
       https://math.stackexchange.com/questions/3747965/points-within-an-ellipse-on-the-globe
@@ -1396,190 +1877,139 @@ void query_ellipse(healpix_info *hpx, double ptg_theta, double ptg_phi, double s
     pointing_from_vec3(&f1vec, &f1ptg);
     pointing_from_vec3(&f2vec, &f2ptg);
 
-    if (semi_minor >= HPG_PI) {  // disk covers the whole sphere
-        i64rangeset_append(pixset, 0, hpx->npix, status, err);
-        goto cleanup;
-    }
-
-    int oplus = 0;
-    if (inclusive) {
-        oplus = ilog2(fact);
-    }
-    int omax = hpx->order + oplus;  // the order up to which we test
+    ellipse->z1 = f1vec.z;
+    ellipse->phi1 = f1ptg.phi;
+    ellipse->z2 = f2vec.z;
+    ellipse->phi2 = f2ptg.phi;
+    ellipse->major_axis = 2 * semi_major;
+    ellipse->full = (semi_minor >= HPG_PI);
+}
 
-    // Statically define the array of bases because it's not large.
-    struct healpix_info base[MAX_ORDER + 1];
+void box_shape_init(box_shape *box, double ptg_theta0, double ptg_theta1, double ptg_phi0,
+                    double ptg_phi1, bool full_lon) {
+    box->theta0 = ptg_theta0;
+    box->theta1 = ptg_theta1;
+    box->full_lon = full_lon;
 
-    double dr[MAX_ORDER + 1];
-    double dmdr[MAX_ORDER + 1];
-    double dpdr[MAX_ORDER + 1];
-    for (int o = 0; o <= omax; o++) {
-        base[o] = healpix_info_from_order(o, NEST);
-        dr[o] = max_pixrad(&base[o]);  // safety distance
-        dmdr[o] = 2 * semi_major - 2 * dr[o];
-        dpdr[o] = 2 * semi_major + 2 * dr[o];
-    }
+    // Check if we have an empty box
+    box->empty = (ptg_theta0 == ptg_theta1) || ((ptg_phi0 == ptg_phi1) && !full_lon);
 
-    stk = i64stack_new(2 * (12 + 3 * omax), status, err);
-    if (!*status) goto cleanup;
-    for (int i = 0; i < 12; i++) {
-        i64stack_push(stk, (int64_t)(11 - i), status, err);
-        if (!*status) goto cleanup;
-        i64stack_push(stk, 0, status, err);
-        if (!*status) goto cleanup;
+    // This is the rotation angle to center the phi range and pi radians,
+    // thus normalizing the box. There are two different computations,
+    // depending on whether the box needs an additional pi rotation to
+    // avoid the zero angle.
+    if (ptg_phi0 < ptg_phi1) {
+        box->phi_rot_angle = fmodulo(HPG_PI - (ptg_phi0 + ptg_phi1) / 2., HPG_TWO_PI);
+    } else {
+        box->phi_rot_angle = fmodulo(-(ptg_phi0 + ptg_phi1) / 2., HPG_TWO_PI);
     }
 
-    int stacktop = 0;  // a place to save a stack position
-    while (stk->size > 0) {
-        // pop current pixel number and order from the stack
-        int64_t pix, temp;
-        i64stack_pop_pair(stk, &pix, &temp, status, err);
-        if (!*status) goto cleanup;
-        int o = (int)temp;
-
-        double pix_z, pix_phi;
-        pix2zphi(&base[o], pix, &pix_z, &pix_phi);
-        double d = acos(cosdist_zphi(f1vec.z, f1ptg.phi, pix_z, pix_phi)) +
-                   acos(cosdist_zphi(f2vec.z, f2ptg.phi, pix_z, pix_phi));
-        if (d <= dpdr[o]) {
-            int zone = (d >= 2 * semi_major) ? 1 : ((d > dmdr[o]) ? 2 : 3);
-            check_pixel_nest(o, hpx->order, omax, zone, pixset, pix, stk, inclusive, &stacktop,
-                             status, err);
-            if (!*status) goto cleanup;
-        }
-    }
-cleanup:
-    if (stk != NULL) i64stack_delete(stk);
+    box->phi0_rot = fmodulo(ptg_phi0 + box->phi_rot_angle, HPG_TWO_PI);
+    box->phi1_rot = fmodulo(ptg_phi1 + box->phi_rot_angle, HPG_TWO_PI);
 }
 
-void query_box(healpix_info *hpx, double ptg_theta0, double ptg_theta1, double ptg_phi0,
-               double ptg_phi1, bool full_lon, int fact, struct i64rangeset *pixset,
-               int *status, char *err) {
-    if (hpx->scheme == RING) {
-        snprintf(err, ERR_SIZE, "query_box only supports nest ordering.");
+polygon_shape *polygon_shape_new(pointingarr *vertex, int *status, char *err) {
+    *status = 1;
+    polygon_shape *polygon = NULL;
+    vec3 *vv = NULL;
+    size_t nv = vertex->size;
+
+    if (nv < 3) {
+        snprintf(err, ERR_SIZE, "Polygon does not have enough vertices.");
         *status = 0;
-        return;
+        return NULL;
     }
 
-    i64stack *stk = NULL;
+    polygon = calloc(1, sizeof(polygon_shape));
+    if (polygon == NULL) goto fail_alloc;
+    polygon->normal = malloc(nv * sizeof(vec3));
+    if (polygon->normal == NULL) goto fail_alloc;
+    vv = malloc(nv * sizeof(vec3));
+    if (vv == NULL) goto fail_alloc;
 
-    bool inclusive = (fact != 0);
-    // this does not alter the storage
-    pixset->stack->size = 0;
+    polygon->nv = nv;
+    // The polygon query uses discs with radius pi/2 around each normal.
+    polygon->cosrad = cos(HPG_HALFPI);
 
-    // First check if we have an empty box
-    if (ptg_theta0 == ptg_theta1) goto cleanup;
-    if (ptg_phi0 == ptg_phi1 && !full_lon) goto cleanup;
+    polygon_normals(vertex, vv, polygon->normal, status, err);
+    free(vv);
+    if (!*status) return polygon_shape_delete(polygon);
 
-    // This is the rotation angle to center the phi range and pi radians,
-    // thus normalizing the box. There are two different computations,
-    // depending on whether the box needs an additional pi rotation to
-    // avoid the zero angle.
-    double ptg_phi_rot_angle = 0.0;
-    if (ptg_phi0 < ptg_phi1) {
-        ptg_phi_rot_angle = fmodulo(HPG_PI - (ptg_phi0 + ptg_phi1) / 2., HPG_TWO_PI);
-    } else {
-        ptg_phi_rot_angle = fmodulo(-(ptg_phi0 + ptg_phi1) / 2., HPG_TWO_PI);
-    }
+    return polygon;
 
-    double ptg_phi0_rot = fmodulo(ptg_phi0 + ptg_phi_rot_angle, HPG_TWO_PI);
-    double ptg_phi1_rot = fmodulo(ptg_phi1 + ptg_phi_rot_angle, HPG_TWO_PI);
-    int oplus = 0;
-    if (inclusive) {
-        oplus = ilog2(fact);
-    }
-    int omax = hpx->order + oplus;  // the order up to which we test
+fail_alloc:
+    snprintf(err, ERR_SIZE, "Failed to allocate memory for polygon_shape");
+    *status = 0;
+    free(vv);
+    return polygon_shape_delete(polygon);
+}
 
-    // Statically define the array of bases because it's not large.
-    struct healpix_info base[MAX_ORDER + 1];
-    double dr[MAX_ORDER + 1];
-    for (int o = 0; o <= omax; o++) {
-        base[o] = healpix_info_from_order(o, NEST);
-        dr[o] = max_pixrad(&base[o]);  // safety distance
+polygon_shape *polygon_shape_delete(polygon_shape *polygon) {
+    if (polygon != NULL) {
+        free(polygon->normal);
+        free(polygon);
     }
+    return NULL;
+}
 
-    stk = i64stack_new(2 * (12 + 3 * omax), status, err);
-    if (!*status) goto cleanup;
-    for (int i = 0; i < 12; i++) {
-        i64stack_push(stk, (int64_t)(11 - i), status, err);
-        if (!*status) goto cleanup;
-        i64stack_push(stk, 0, status, err);
-        if (!*status) goto cleanup;
+void points_in_disc(const disc_shape *disc, const double *theta, const double *phi,
+                    uint8_t *inside, size_t n) {
+    // Same criterion as the pixel centers in query_disc.
+    for (size_t i = 0; i < n; i++) {
+        double cangdist = cosdist_zphi(disc->z0, disc->phi0, cos(theta[i]), phi[i]);
+        inside[i] = (uint8_t)(disc->full | (cangdist >= disc->cosrad));
     }
+}
 
-    int stacktop = 0;  // a place to save a stack position
-    while (stk->size > 0) {
-        // pop current pixel number and order from the stack
-        int64_t pix, temp;
-        i64stack_pop_pair(stk, &pix, &temp, status, err);
-        if (!*status) goto cleanup;
-        int o = (int)temp;
-
-        /* Short note on the "zone":
-           zone = 0: pixel lies completely outside the queried shape
-           1: pixel may overlap with the shape, pixel center is outside
-           2: pixel center is inside the shape, but maybe not the complete pixel
-           3: pixel lies completely inside the shape */
+void points_in_ellipse(const ellipse_shape *ellipse, const double *theta, const double *phi,
+                       uint8_t *inside, size_t n) {
+    // Same criterion as the pixel centers in query_ellipse.
+    for (size_t i = 0; i < n; i++) {
+        double z = cos(theta[i]);
+        double d = acos(cosdist_zphi(ellipse->z1, ellipse->phi1, z, phi[i])) +
+                   acos(cosdist_zphi(ellipse->z2, ellipse->phi2, z, phi[i]));
+        inside[i] = (uint8_t)(ellipse->full | (d < ellipse->major_axis));
+    }
+}
 
-        double pix_theta, pix_phi;
-        pix2ang(&base[o], pix, &pix_theta, &pix_phi);
+void points_in_box(const box_shape *box, const double *theta, const double *phi,
+                   uint8_t *inside, size_t n) {
+    // Same criterion as the pixel centers in query_box, inclusive of boundaries.
+    double theta0 = box->theta0 - HPG_EPSILON, theta1 = box->theta1 + HPG_EPSILON;
+    double phi0_rot = box->phi0_rot - HPG_EPSILON, phi1_rot = box->phi1_rot + HPG_EPSILON;
 
-        int zone_theta = 0, zone_phi = 0;
+    if (box->empty) {
+        memset(inside, 0, n);
+        return;
+    }
 
-        /* Check in the colatitude (theta) direction */
-        /* Note that the Box shape is inclusive of boundaries. */
-        double tmdr = pix_theta - dr[o], tpdr = pix_theta + dr[o];
-        if (tpdr >= (ptg_theta0 - HPG_EPSILON) && tmdr <= (ptg_theta1 + HPG_EPSILON)) {
-            // Check if completely inside
-            if (tmdr >= (ptg_theta0 - HPG_EPSILON) && tpdr <= (ptg_theta1 + HPG_EPSILON)) {
-                zone_theta = 3;
-            } else if (pix_theta >= (ptg_theta0 - HPG_EPSILON) &&
-                       pix_theta <= (ptg_theta1 + HPG_EPSILON)) {
-                zone_theta = 2;
-            } else {
-                zone_theta = 1;
-            }
-        }
+    for (size_t i = 0; i < n; i++) {
+        bool in_theta = (theta[i] >= theta0) & (theta[i] <= theta1);
+        inside[i] = (uint8_t)in_theta;
+    }
+    if (box->full_lon) return;
 
-        /* Check in the longitude (phi) direction */
-        if (full_lon) {  // This has the full longitude range, always zone 3.
-            zone_phi = 3;
-        } else if (zone_theta > 0) {
-            // We need to rotate the pixel to match the rotation of the phi box.
-            // After that, we can trust that the pixel +/- dr will have the
-            // correct "winding" because the pixel itself will never have a
-            // radius larger than ~pi/4.
-            double pix_phi_rot = fmodulo(pix_phi + ptg_phi_rot_angle, HPG_TWO_PI);
-
-            double stheta = sin(pix_theta);
-            double pmdr_rot = pix_phi_rot - dr[o] / stheta;
-            double ppdr_rot = pix_phi_rot + dr[o] / stheta;
-
-            /* Note that the Box shape is inclusive of boundaries. */
-            if (ppdr_rot >= (ptg_phi0_rot - HPG_EPSILON) &&
-                pmdr_rot <= (ptg_phi1_rot + HPG_EPSILON)) {
-                // Check if completely inside
-                if (pmdr_rot >= (ptg_phi0_rot - HPG_EPSILON) &&
-                    ppdr_rot <= (ptg_phi1_rot + HPG_EPSILON)) {
-                    zone_phi = 3;
-                } else if (pix_phi_rot >= (ptg_phi0_rot - HPG_EPSILON) &&
-                           pix_phi_rot <= (ptg_phi1_rot + HPG_EPSILON)) {
-                    zone_phi = 2;
-                } else {
-                    zone_phi = 1;
-                }
-            }
-        }
+    for (size_t i = 0; i < n; i++) {
+        double phi_rot = fmodulo(phi[i] + box->phi_rot_angle, HPG_TWO_PI);
+        bool in_phi = (phi_rot >= phi0_rot) & (phi_rot <= phi1_rot);
+        inside[i] &= (uint8_t)in_phi;
+    }
+}
 
-        int zone = intmin(zone_theta, zone_phi);
-        if (zone > 0) {
-            check_pixel_nest(o, hpx->order, omax, zone, pixset, pix, stk, inclusive, &stacktop,
-                             status, err);
-            if (!*status) goto cleanup;
+void points_in_polygon(const polygon_shape *polygon, const double *theta, const double *phi,
+                       uint8_t *inside, size_t n) {
+    // Same criterion as the pixel centers in query_polygon: a point is inside
+    // if it is within pi/2 of all the edge normals.
+    for (size_t i = 0; i < n; i++) {
+        double sth = sin(theta[i]);
+        double x = sth * cos(phi[i]), y = sth * sin(phi[i]), z = cos(theta[i]);
+        bool in = true;
+        for (size_t j = 0; j < polygon->nv; j++) {
+            const vec3 *normal = &polygon->normal[j];
+            in &= ((x * normal->x + y * normal->y + z * normal->z) >= polygon->cosrad);
         }
+        inside[i] = (uint8_t)in;
     }
-cleanup:
-    if (stk != NULL) i64stack_delete(stk);
 }
 
 void get_ring_info2(healpix_info *hpx, int64_t ring, int64_t *startpix, int64_t *ringpix,
@@ -26,6 +26,7 @@
 #include "hpgeom_stack.h"
 #include <math.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define HPG_PI 3.141592653589793238462643383279502884197           /* pi */
@@ -48,6 +49,14 @@
 #define MAX_ORDER 29
 #define MAX_NSIDE (int64_t)(1) << MAX_ORDER
 
+// Generic kernel bodies are specialized by calling them with compile-time
+// constant arguments, so they must be inlined into each caller.
+#if defined(__GNUC__) || defined(__clang__)
+#define HPG_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define HPG_ALWAYS_INLINE inline
+#endif
+
 typedef enum Scheme { RING, NEST } Scheme;
 
 typedef struct healpix_info {
@@ -61,8 +70,97 @@ typedef struct healpix_info {
     Scheme scheme;
 } healpix_info;
 
+#define HPX_CACHE_SIZE 8
+
+// Small round-robin cache of healpix_info for non-power-of-two (RING) nsides.
+// Each thread of execution must use its own cache.
+typedef struct hpx_cache {
+    healpix_info info[HPX_CACHE_SIZE];
+    int n;
+    int next;
+} hpx_cache;
+
+// Tables that depend only on the resolution and inclusive factor of a query,
+// set up by query_plan_init.  The per-order tables up to omax, the deepest
+// order tested, are only filled for nest queries, and hpx2 and pixrad2 only
+// for ring queries with fact > 1.
+typedef struct query_plan {
+    healpix_info hpx;
+    int fact;
+    int omax;
+    // max_pixrad of hpx.
+    double pixrad;
+    // The nest healpix_info and max_pixrad for orders 0 to omax.
+    healpix_info base[MAX_ORDER + 1];
+    double base_pixrad[MAX_ORDER + 1];
+    // The ring healpix_info at nside * fact, and its max_pixrad.
+    healpix_info hpx2;
+    double pixrad2;
+} query_plan;
+
+// Scratch buffers and tables for the *_ws queries, which grow as needed and
+// are reused over many queries.  The query_plan is kept for the last nside,
+// scheme and fact used.  Each thread of execution must use its own workspace.
+typedef struct query_workspace {
+    size_t ndisc_alloc;
+    size_t nvert_alloc;
+    // Per-vertex buffers for query_polygon_ws.
+    vec3 *vv;
+    vec3 *normal;
+    double *rad;
+    // Per-disc buffers for query_multidisc_ws.
+    double *z0;
+    double *xa;
+    double *cosrsmall;
+    double *cosrbig;
+    pointing *ptg;
+    int64_t *cpix;
+    double *crlimit;
+    i64stack *stk;
+    i64rangeset *tr;
+    bool have_plan;
+    query_plan plan;
+} query_workspace;
+
+// Shapes for testing points directly, with the same criteria that the
+// queries use for pixel centers.
+typedef struct disc_shape {
+    double z0;
+    double phi0;
+    double cosrad;
+    bool full;
+} disc_shape;
+
+typedef struct ellipse_shape {
+    double z1;
+    double phi1;
+    double z2;
+    double phi2;
+    double major_axis;
+    bool full;
+} ellipse_shape;
+
+typedef struct box_shape {
+    double theta0;
+    double theta1;
+    double phi0_rot;
+    double phi1_rot;
+    double phi_rot_angle;
+    bool full_lon;
+    bool empty;
+} box_shape;
+
+typedef struct polygon_shape {
+    size_t nv;
+    vec3 *normal;
+    double cosrad;
+} polygon_shape;
+
 healpix_info healpix_info_from_order(int order, enum Scheme scheme);
 healpix_info healpix_info_from_nside(int64_t nside, enum Scheme scheme);
+void hpx_cache_init(hpx_cache *cache);
+healpix_info healpix_info_cached(hpx_cache *cache, int64_t nside, enum Scheme scheme);
+void healpix_geom_init_dispatch(void);
 
 int64_t isqrt(int64_t i);
 int ilog2(int64_t arg);
@@ -86,6 +184,18 @@ void nest2xyf(healpix_info *hpx, int64_t pix, int *ix, int *iy, int *face_num);
 void ring2xyf(healpix_info *hpx, int64_t pix, int *ix, int *iy, int *face_num);
 int64_t nest2ring(healpix_info *hpx, int64_t pix);
 int64_t ring2nest(healpix_info *hpx, int64_t pix);
+
+// Batch kernels over n contiguous elements with a single nside and scheme.
+// The inputs must be in range, and are not checked.  The conversions are
+// done element by element, so for nest2ring_batch and ring2nest_batch the
+// output may be the same array as the input.
+void ang2pix_batch(healpix_info *hpx, const double *theta, const double *phi, int64_t *pix,
+                   size_t n);
+void pix2ang_batch(healpix_info *hpx, const int64_t *pix, double *theta, double *phi,
+                   size_t n);
+void nest2ring_batch(healpix_info *hpx, const int64_t *nest, int64_t *ring, size_t n);
+void ring2nest_batch(healpix_info *hpx, const int64_t *ring, int64_t *nest, size_t n);
+
 vec3 pix2vec(healpix_info *hpx, int64_t pix);
 int64_t vec2pix(healpix_info *hpx, vec3 *vec);
 
@@ -104,14 +214,30 @@ void check_pixel_nest(int o, int order_, int omax, int zone, struct i64rangeset
                       int64_t pix, struct i64stack *stk, bool inclusive, int *stacktop,
                       int *status, char *err);
 
+// The nest searches of query_disc, query_ellipse and query_box are split over
+// n_threads threads (0 for the default of hpgeom_threads.h) when large enough.
 void query_disc(healpix_info *hpx, double ptg_theta, double ptg_phi, double radius, int fact,
-                struct i64rangeset *pixset, int *status, char *err);
+                int n_threads, struct i64rangeset *pixset, int *status, char *err);
 void query_ellipse(healpix_info *hpx, double ptg_theta, double ptg_phi, double semi_major,
-                   double semi_minor, double alpha, int fact, struct i64rangeset *pixset,
-                   int *status, char *err);
+                   double semi_minor, double alpha, int fact, int n_threads,
+                   struct i64rangeset *pixset, int *status, char *err);
 void query_box(healpix_info *hpx, double ptg_theta0, double ptg_theta1, double ptg_phi0,
-               double ptg_phi1, bool full_lon, int fact, struct i64rangeset *pixset,
-               int *status, char *err);
+               double ptg_phi1, bool full_lon, int fact, int n_threads,
+               struct i64rangeset *pixset, int *status, char *err);
+void query_disc_ws(healpix_info *hpx, double ptg_theta, double ptg_phi, double radius,
+                   int fact, int n_threads, struct i64rangeset *pixset, query_workspace *ws,
+                   int *status, char *err);
+void query_ellipse_ws(healpix_info *hpx, double ptg_theta, double ptg_phi, double semi_major,
+                      double semi_minor, double alpha, int fact, int n_threads,
+                      struct i64rangeset *pixset, query_workspace *ws, int *status,
+                      char *err);
+void query_box_ws(healpix_info *hpx, double ptg_theta0, double ptg_theta1, double ptg_phi0,
+                  double ptg_phi1, bool full_lon, int fact, int n_threads,
+                  struct i64rangeset *pixset, query_workspace *ws, int *status, char *err);
+// Convert a set of nest pixel ranges (for the nest hpx) in place to the
+// sorted ranges of the same pixels in ring ordering.
+void nest_ranges_to_ring(healpix_info *hpx, struct i64rangeset *pixset, int *status,
+                         char *err);
 
 void xyf2loc(double x, double y, int face, double *z, double *phi, double *sth,
              bool *have_sth);
@@ -122,6 +248,30 @@ void query_multidisc(healpix_info *hpx, vec3arr *norm, double *rad, int fact,
                      i64rangeset *pixset, int *status, char *err);
 void query_polygon(healpix_info *hpx, pointingarr *vertex, int fact, i64rangeset *pixset,
                    int *status, char *err);
+query_workspace *query_workspace_new(int *status, char *err);
+query_workspace *query_workspace_delete(query_workspace *ws);
+void query_plan_init(query_plan *plan, healpix_info *hpx, int fact);
+query_plan *query_workspace_plan(query_workspace *ws, healpix_info *hpx, int fact);
+void query_multidisc_ws(healpix_info *hpx, vec3arr *norm, double *rad, int fact,
+                        i64rangeset *pixset, query_workspace *ws, int *status, char *err);
+void query_polygon_ws(healpix_info *hpx, pointingarr *vertex, int fact, i64rangeset *pixset,
+                      query_workspace *ws, int *status, char *err);
+
+void disc_shape_init(disc_shape *disc, double ptg_theta, double ptg_phi, double radius);
+void ellipse_shape_init(ellipse_shape *ellipse, double ptg_theta, double ptg_phi,
+                        double semi_major, double semi_minor, double alpha);
+void box_shape_init(box_shape *box, double ptg_theta0, double ptg_theta1, double ptg_phi0,
+                    double ptg_phi1, bool full_lon);
+polygon_shape *polygon_shape_new(pointingarr *vertex, int *status, char *err);
+polygon_shape *polygon_shape_delete(polygon_shape *polygon);
+void points_in_disc(const disc_shape *disc, const double *theta, const double *phi,
+                    uint8_t *inside, size_t n);
+void points_in_ellipse(const ellipse_shape *ellipse, const double *theta, const double *phi,
+                       uint8_t *inside, size_t n);
+void points_in_box(const box_shape *box, const double *theta, const double *phi,
+                   uint8_t *inside, size_t n);
+void points_in_polygon(const polygon_shape *polygon, const double *theta, const double *phi,
+                       uint8_t *inside, size_t n);
 
 void get_ring_info2(healpix_info *hpx, int64_t ring, int64_t *startpix, int64_t *ringpix,
                     double *theta, bool *shifted);
@@ -0,0 +1,420 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+
+/*
+ *  Original healpix_cxx code:
+ *  Copyright (C) 2003-2016 Max-Planck-Society
+ *  Author: Martin Reinecke
+ */
+
+// The pixelization arithmetic shared by healpix_geom.c and the C++ front end
+// hpgeom.hpp: ang2pix, pix2ang, vec2pix, pix2vec and the nest/ring
+// conversions for a single nside.  Everything is static inline, so callers
+// with a compile-time healpix_info get the nside/order arithmetic folded into
+// constants.  The inputs are not range checked.
+//
+// The includer defines HPG_CORE_INFO to its healpix_info struct type, which
+// must have the members order, nside, npface, ncap, npix, fact2 and fact1.
+// It may also define HPG_CORE_SPREAD_BITS64 and HPG_CORE_COMPRESS_BITS64 to
+// faster versions of hpg_core_spread_bits64 and hpg_core_compress_bits64,
+// which must give identical results.
+
+#ifndef _HEALPIX_GEOM_CORE_H
+#define _HEALPIX_GEOM_CORE_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef HPG_CORE_INFO
+#error "HPG_CORE_INFO must be defined before including healpix_geom_core.h"
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HPG_CORE_INLINE static inline __attribute__((always_inline))
+#else
+#define HPG_CORE_INLINE static inline
+#endif
+
+// The bit manipulation routines are constexpr for the C++ front end.
+#ifdef __cplusplus
+#define HPG_CORE_CONSTEXPR constexpr
+#else
+#define HPG_CORE_CONSTEXPR
+#endif
+
+#ifndef HPG_CORE_SPREAD_BITS64
+#define HPG_CORE_SPREAD_BITS64 hpg_core_spread_bits64
+#endif
+#ifndef HPG_CORE_COMPRESS_BITS64
+#define HPG_CORE_COMPRESS_BITS64 hpg_core_compress_bits64
+#endif
+
+#define HPG_CORE_PI 3.141592653589793238462643383279502884197
+#define HPG_CORE_HALFPI 1.570796326794896619231321691639751442099
+#define HPG_CORE_INV_HALFPI 0.6366197723675813430755350534900574
+#define HPG_CORE_TWOTHIRD (2.0 / 3.0)
+
+static const int hpg_core_jrll[] = {2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4};
+static const int hpg_core_jpll[] = {1, 3, 5, 7, 0, 2, 4, 6, 1, 3, 5, 7};
+
+HPG_CORE_INLINE int64_t hpg_core_isqrt(int64_t i) {
+    return (int64_t)sqrt(((double)(i)) + 0.5);
+}
+
+// Modulus function that returns values in range [0, v2).
+HPG_CORE_INLINE double hpg_core_fmodulo(double v1, double v2) {
+    if (v1 >= 0) return (v1 < v2) ? v1 : fmod(v1, v2);
+    double tmp = fmod(v1, v2) + v2;
+    return (tmp == v2) ? 0. : tmp;
+}
+
+HPG_CORE_INLINE double hpg_core_safe_atan2(double y, double x) {
+    return ((x == 0.) && (y == 0.)) ? 0.0 : atan2(y, x);
+}
+
+HPG_CORE_INLINE HPG_CORE_CONSTEXPR int64_t hpg_core_special_div(int64_t a, int64_t b) {
+    int64_t t = (a >= (b << 1));
+    a -= t * (b << 1);
+    return (t << 1) + (a >= b);
+}
+
+// Interleave the bits of v with zeros, and the inverse.
+HPG_CORE_INLINE HPG_CORE_CONSTEXPR int64_t hpg_core_spread_bits64(int v) {
+    uint64_t x = (uint32_t)v;
+    x = (x | (x << 16)) & 0x0000ffff0000ffffull;
+    x = (x | (x << 8)) & 0x00ff00ff00ff00ffull;
+    x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return (int64_t)x;
+}
+
+HPG_CORE_INLINE HPG_CORE_CONSTEXPR int hpg_core_compress_bits64(int64_t v) {
+    uint64_t x = (uint64_t)v & 0x5555555555555555ull;
+    x = (x | (x >> 1)) & 0x3333333333333333ull;
+    x = (x | (x >> 2)) & 0x0f0f0f0f0f0f0f0full;
+    x = (x | (x >> 4)) & 0x00ff00ff00ff00ffull;
+    x = (x | (x >> 8)) & 0x0000ffff0000ffffull;
+    x = (x | (x >> 16)) & 0x00000000ffffffffull;
+    return (int)x;
+}
+
+HPG_CORE_INLINE HPG_CORE_CONSTEXPR int64_t hpg_core_xyf2nest(const HPG_CORE_INFO *hpx, int ix,
+                                                              int iy, int face_num) {
+    return ((int64_t)face_num << (2 * hpx->order)) + HPG_CORE_SPREAD_BITS64(ix) +
+           (HPG_CORE_SPREAD_BITS64(iy) << 1);
+}
+
+HPG_CORE_INLINE HPG_CORE_CONSTEXPR void hpg_core_nest2xyf(const HPG_CORE_INFO *hpx,
+                                                           int64_t pix, int *ix, int *iy,
+                                                           int *face_num) {
+    *face_num = (int)(pix >> (2 * hpx->order));
+    pix &= (hpx->npface - 1);
+    *ix = HPG_CORE_COMPRESS_BITS64(pix);
+    *iy = HPG_CORE_COMPRESS_BITS64(pix >> 1);
+}
+
+HPG_CORE_INLINE void hpg_core_ring_info_small(const HPG_CORE_INFO *hpx, int64_t ring,
+                                              int64_t *startpix, int64_t *ringpix,
+                                              bool *shifted) {
+    if (ring < hpx->nside) {
+        *shifted = true;
+        *ringpix = 4 * ring;
+        *startpix = 2 * ring * (ring - 1);
+    } else if (ring < 3 * hpx->nside) {
+        *shifted = ((ring - hpx->nside) & 1) == 0;
+        *ringpix = 4 * hpx->nside;
+        *startpix = hpx->ncap + (ring - hpx->nside) * (*ringpix);
+    } else {
+        *shifted = true;
+        int64_t nr = 4 * hpx->nside - ring;
+        *ringpix = 4 * nr;
+        *startpix = hpx->npix - 2 * nr * (nr + 1);
+    }
+}
+
+HPG_CORE_INLINE int64_t hpg_core_xyf2ring(const HPG_CORE_INFO *hpx, int ix, int iy,
+                                          int face_num) {
+    int64_t nl4 = 4 * hpx->nside;
+    int64_t jr = (hpg_core_jrll[face_num] * hpx->nside) - ix - iy - 1;
+
+    int64_t nr, kshift, n_before;
+
+    bool shifted;
+    hpg_core_ring_info_small(hpx, jr, &n_before, &nr, &shifted);
+    nr >>= 2;
+    kshift = 1 - shifted;
+    int64_t jp = (hpg_core_jpll[face_num] * nr + ix - iy + 1 + kshift) / 2;
+    if (jp < 1) jp += nl4;
+
+    return n_before + jp - 1;
+}
+
+HPG_CORE_INLINE void hpg_core_ring2xyf(const HPG_CORE_INFO *hpx, int64_t pix, int *ix,
+                                       int *iy, int *face_num) {
+    int64_t iring, iphi, kshift, nr;
+    int64_t nl2 = 2 * hpx->nside;
+
+    if (pix < hpx->ncap) {                               // North Polar cap
+        iring = (1 + hpg_core_isqrt(1 + 2 * pix)) >> 1;  // counted from North pole
+        iphi = (pix + 1) - 2 * iring * (iring - 1);
+        kshift = 0;
+        nr = iring;
+        *face_num = (int)hpg_core_special_div(iphi - 1, nr);
+    } else if (pix < (hpx->npix - hpx->ncap)) {  // Equatorial region
+        int64_t ip = pix - hpx->ncap;
+        int64_t tmp = (hpx->order >= 0) ? ip >> (hpx->order + 2) : ip / (4 * hpx->nside);
+        iring = tmp + hpx->nside;
+        iphi = ip - tmp * 4 * hpx->nside + 1;
+        kshift = (iring + hpx->nside) & 1;
+        nr = hpx->nside;
+        int64_t ire = tmp + 1, irm = nl2 + 1 - tmp;
+        int64_t ifm = iphi - (ire >> 1) + hpx->nside - 1,
+                ifp = iphi - (irm >> 1) + hpx->nside - 1;
+        if (hpx->order >= 0) {
+            ifm >>= hpx->order;
+            ifp >>= hpx->order;
+        } else {
+            ifm /= hpx->nside;
+            ifp /= hpx->nside;
+        }
+        *face_num = (int)((ifp == ifm) ? (ifp | 4) : ((ifp < ifm) ? ifp : (ifm + 8)));
+    } else {  // South Polar cap
+        int64_t ip = hpx->npix - pix;
+        iring = (1 + hpg_core_isqrt(2 * ip - 1)) >> 1;  // counted from South pole
+        iphi = 4 * iring + 1 - (ip - 2 * iring * (iring - 1));
+        kshift = 0;
+        nr = iring;
+        iring = 2 * nl2 - iring;
+        *face_num = (int)hpg_core_special_div(iphi - 1, nr) + 8;
+    }
+
+    int64_t irt = iring - ((2 + (*face_num >> 2)) * hpx->nside) + 1;
+    int64_t ipt = 2 * iphi - hpg_core_jpll[*face_num] * nr - kshift - 1;
+    if (ipt >= nl2) ipt -= 8 * hpx->nside;
+
+    *ix = (int)((ipt - irt) >> 1);
+    *iy = (int)((-ipt - irt) >> 1);
+}
+
+HPG_CORE_INLINE int64_t hpg_core_loc2pix(const HPG_CORE_INFO *hpx, bool nest, double z,
+                                         double phi, double sth, bool have_sth) {
+    double za = fabs(z);
+    double tt = hpg_core_fmodulo(phi * HPG_CORE_INV_HALFPI, 4.0);  // in [0,4)
+
+    if (!nest) {
+        if (za <= HPG_CORE_TWOTHIRD)  // Equatorial region
+        {
+            int64_t nl4 = 4 * hpx->nside;
+            double temp1 = hpx->nside * (0.5 + tt);
+            double temp2 = hpx->nside * z * 0.75;
+            int64_t jp = (int64_t)(temp1 - temp2);  // index of  ascending edge line
+            int64_t jm = (int64_t)(temp1 + temp2);  // index of descending edge line
+
+            // ring number counted from z=2/3
+            int64_t ir = hpx->nside + 1 + jp - jm;  // in {1,2n+1}
+            int64_t kshift = 1 - (ir & 1);          // kshift=1 if ir even, 0 otherwise
+
+            int64_t t1 = jp + jm - hpx->nside + kshift + 1 + nl4 + nl4;
+            int64_t ip =
+                (hpx->order > 0) ? (t1 >> 1) & (nl4 - 1) : ((t1 >> 1) % nl4);  // in {0,4n-1}
+
+            return hpx->ncap + (ir - 1) * nl4 + ip;
+        } else  // North & South polar caps
+        {
+            double tp = tt - (int64_t)(tt);
+            double tmp = ((za < 0.99) || (!have_sth))
+                             ? hpx->nside * sqrt(3 * (1 - za))
+                             : hpx->nside * sth / sqrt((1. + za) / 3.);
+
+            int64_t jp = (int64_t)(tp * tmp);          // increasing edge line index
+            int64_t jm = (int64_t)((1.0 - tp) * tmp);  // decreasing edge line index
+
+            int64_t ir = jp + jm + 1;         // ring number counted from the closest pole
+            int64_t ip = (int64_t)(tt * ir);  // in {0,4*ir-1}
+
+            if (z > 0.) {
+                return 2 * ir * (ir - 1) + ip;
+            } else {
+                return hpx->npix - 2 * ir * (ir + 1) + ip;
+            }
+        }
+    } else  // is_nest
+    {
+        if (za <= HPG_CORE_TWOTHIRD)  // Equatorial region
+        {
+            double temp1 = hpx->nside * (0.5 + tt);
+            double temp2 = hpx->nside * (z * 0.75);
+            int64_t jp = (int64_t)(temp1 - temp2);  // index of  ascending edge line
+            int64_t jm = (int64_t)(temp1 + temp2);  // index of descending edge line
+            int64_t ifp = jp >> hpx->order;         // in {0,4}
+            int64_t ifm = jm >> hpx->order;
+
+            int face_num = (int)((ifp == ifm) ? (ifp | 4) : ((ifp < ifm) ? ifp : (ifm + 8)));
+
+            int ix = (int)(jm & (hpx->nside - 1));
+            int iy = (int)(hpx->nside - (jp & (hpx->nside - 1)) - 1);
+            return hpg_core_xyf2nest(hpx, ix, iy, face_num);
+        } else  // polar region, za > 2/3
+        {
+            int ntt = (int)tt;
+            if (ntt >= 4) ntt = 3;
+            double tp = tt - ntt;
+            double tmp = ((za < 0.99) || (!have_sth))
+                             ? hpx->nside * sqrt(3 * (1 - za))
+                             : hpx->nside * sth / sqrt((1. + za) / 3.);
+
+            int64_t jp = (int64_t)(tp * tmp);           // increasing edge line index
+            int64_t jm = (int64_t)((1.0 - tp) * tmp);   // decreasing edge line index
+            if (jp >= hpx->nside) jp = hpx->nside - 1;  // for points too close to the boundary
+            if (jm >= hpx->nside) jm = hpx->nside - 1;
+            return (z >= 0) ? hpg_core_xyf2nest(hpx, (int)(hpx->nside - jm - 1),
+                                                (int)(hpx->nside - jp - 1), ntt)
+                            : hpg_core_xyf2nest(hpx, (int)jp, (int)jm, ntt + 8);
+        }
+    }
+}
+
+HPG_CORE_INLINE void hpg_core_pix2loc(const HPG_CORE_INFO *hpx, bool nest, int64_t pix,
+                                      double *z, double *phi, double *sth, bool *have_sth) {
+    *have_sth = false;
+    if (!nest) {
+        if (pix < hpx->ncap)  // North Polar cap
+        {
+            int64_t iring = (1 + hpg_core_isqrt(1 + 2 * pix)) >> 1;  // counted from North pole
+            int64_t iphi = (pix + 1) - 2 * iring * (iring - 1);
+
+            double tmp = (iring * iring) * hpx->fact2;
+            *z = 1.0 - tmp;
+            if (*z > 0.99) {
+                *sth = sqrt(tmp * (2. - tmp));
+                *have_sth = true;
+            }
+            *phi = (iphi - 0.5) * HPG_CORE_HALFPI / iring;
+        } else if (pix < (hpx->npix - hpx->ncap))  // Equatorial region
+        {
+            int64_t nl4 = 4 * hpx->nside;
+            int64_t ip = pix - hpx->ncap;
+            int64_t tmp = (hpx->order >= 0) ? ip >> (hpx->order + 2) : ip / nl4;
+            int64_t iring = tmp + hpx->nside, iphi = ip - nl4 * tmp + 1;
+            // 1 if iring+nside is odd, 1/2 otherwise
+            double fodd = ((iring + hpx->nside) & 1) ? 1 : 0.5;
+
+            *z = (2 * hpx->nside - iring) * hpx->fact1;
+            *phi = (iphi - fodd) * HPG_CORE_PI * 0.75 * hpx->fact1;
+        } else  // South Polar cap
+        {
+            int64_t ip = hpx->npix - pix;
+            int64_t iring = (1 + hpg_core_isqrt(2 * ip - 1)) >> 1;  // counted from South pole
+            int64_t iphi = 4 * iring + 1 - (ip - 2 * iring * (iring - 1));
+
+            double tmp = (iring * iring) * hpx->fact2;
+            *z = tmp - 1.0;
+            if (*z < -0.99) {
+                *sth = sqrt(tmp * (2. - tmp));
+                *have_sth = true;
+            }
+            *phi = (iphi - 0.5) * HPG_CORE_HALFPI / iring;
+        }
+    } else {
+        int face_num, ix, iy;
+        hpg_core_nest2xyf(hpx, pix, &ix, &iy, &face_num);
+
+        int64_t jr = ((int64_t)(hpg_core_jrll[face_num]) << hpx->order) - ix - iy - 1;
+
+        int64_t nr;
+        if (jr < hpx->nside) {
+            nr = jr;
+            double tmp = (nr * nr) * hpx->fact2;
+            *z = 1 - tmp;
+            if (*z > 0.99) {
+                *sth = sqrt(tmp * (2. - tmp));
+                *have_sth = true;
+            }
+        } else if (jr > 3 * hpx->nside) {
+            nr = hpx->nside * 4 - jr;
+            double tmp = (nr * nr) * hpx->fact2;
+            *z = tmp - 1;
+            if (*z < -0.99) {
+                *sth = sqrt(tmp * (2. - tmp));
+                *have_sth = true;
+            }
+        } else {
+            nr = hpx->nside;
+            *z = (2 * hpx->nside - jr) * hpx->fact1;
+        }
+
+        int64_t tmp = (int64_t)(hpg_core_jpll[face_num]) * nr + ix - iy;
+        if (tmp < 0) tmp += 8 * nr;
+        *phi = (nr == hpx->nside) ? 0.75 * HPG_CORE_HALFPI * tmp * hpx->fact1
+                                  : (0.5 * HPG_CORE_HALFPI * tmp) / nr;
+    }
+}
+
+// theta in [0, pi], phi in [0, 2*pi].
+HPG_CORE_INLINE int64_t hpg_core_ang2pix(const HPG_CORE_INFO *hpx, bool nest, double theta,
+                                         double phi) {
+    if ((theta < 0.01) || (theta > 3.14159 - 0.01)) {
+        return hpg_core_loc2pix(hpx, nest, cos(theta), phi, 0.0, false);
+    } else {
+        return hpg_core_loc2pix(hpx, nest, cos(theta), phi, sin(theta), true);
+    }
+}
+
+HPG_CORE_INLINE void hpg_core_pix2ang(const HPG_CORE_INFO *hpx, bool nest, int64_t pix,
+                                      double *theta, double *phi) {
+    double z, sth = 0.0;
+    bool have_sth;
+    hpg_core_pix2loc(hpx, nest, pix, &z, phi, &sth, &have_sth);
+    if (have_sth) {
+        *theta = atan2(sth, z);
+    } else {
+        *theta = acos(z);
+    }
+}
+
+// The vector need not be normalized, but must be finite and non-zero.
+HPG_CORE_INLINE int64_t hpg_core_vec2pix(const HPG_CORE_INFO *hpx, bool nest, double x,
+                                         double y, double z) {
+    double xl = 1. / sqrt(x * x + y * y + z * z);
+    double phi = hpg_core_safe_atan2(y, x);
+    double nz = z * xl;
+    if (fabs(nz) > 0.99) {
+        return hpg_core_loc2pix(hpx, nest, nz, phi, sqrt(x * x + y * y) * xl, true);
+    } else {
+        return hpg_core_loc2pix(hpx, nest, nz, phi, 0, false);
+    }
+}
+
+HPG_CORE_INLINE void hpg_core_pix2vec(const HPG_CORE_INFO *hpx, bool nest, int64_t pix,
+                                      double *x, double *y, double *z) {
+    double phi, sth = 0.0;
+    bool have_sth;
+    hpg_core_pix2loc(hpx, nest, pix, z, &phi, &sth, &have_sth);
+    if (!have_sth) sth = sqrt((1 - *z) * (1 + *z));
+    *x = sth * cos(phi);
+    *y = sth * sin(phi);
+}
+
+#endif
@@ -0,0 +1,468 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/*
+ * Vectorized versions of ang2pix() for power-of-two nsides.
+ *
+ * These follow loc2pix() operation for operation: both the equatorial and
+ * polar branches are evaluated for every lane and blended, and double to
+ * integer conversions truncate toward zero exactly as the C casts do.  The
+ * trig functions are still evaluated with the scalar libm calls, and no
+ * fused multiply-adds are used, so the results are bit-identical to the
+ * scalar code.  Blocks with phi outside [0, 2*pi) (which need the full
+ * fmodulo()) or with NaN coordinates fall back to the scalar code.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "healpix_geom.h"
+#include "healpix_geom_simd.h"
+
+#if HPG_X86_SIMD
+
+#include <immintrin.h>
+
+// AVX-512 implies FMA; contracting multiply-adds would change rounding.
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#else
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+int hpgeom_cpu_has_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+int hpgeom_cpu_has_avx512(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f");
+}
+
+int hpgeom_cpu_has_fast_bmi2(void) {
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("bmi2")) return 0;
+    // pdep/pext are microcoded (and much slower than the lookup tables) on
+    // AMD processors before Zen 3.
+    if (__builtin_cpu_is("amdfam15h") || __builtin_cpu_is("amdfam17h")) return 0;
+    return 1;
+}
+
+// 2**52; adding this to a non-negative integral double < 2**52 puts the
+// integer in the low mantissa bits.
+#define HPG_MAGIC_2_52 4503599627370496.0
+
+/*
+ * Scalar preparation for one lane, as in ang2pix().  sin(theta) is only
+ * needed for points very close to the poles, so it is only computed there.
+ */
+static inline void ang2pix_prep(double theta, double *z, double *sth, int64_t *use_sth) {
+    *z = cos(theta);
+    if ((theta < 0.01) || (theta > 3.14159 - 0.01) || (fabs(*z) < 0.99)) {
+        *sth = 0.0;
+        *use_sth = 0;
+    } else {
+        *sth = sin(theta);
+        *use_sth = -1;
+    }
+}
+
+/* AVX2 */
+
+#define HPG_AVX2 __attribute__((target("avx2")))
+
+// Truncate non-negative doubles < 2**52 to int64.
+static inline HPG_AVX2 __m256i trunc_epi64_avx2(__m256d x) {
+    const __m256d magic = _mm256_set1_pd(HPG_MAGIC_2_52);
+    x = _mm256_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    x = _mm256_add_pd(x, magic);
+    return _mm256_sub_epi64(_mm256_castpd_si256(x), _mm256_castpd_si256(magic));
+}
+
+// Convert non-negative int64 < 2**52 to double.
+static inline HPG_AVX2 __m256d epi64_to_pd_avx2(__m256i v) {
+    const __m256d magic = _mm256_set1_pd(HPG_MAGIC_2_52);
+    v = _mm256_add_epi64(v, _mm256_castpd_si256(magic));
+    return _mm256_sub_pd(_mm256_castsi256_pd(v), magic);
+}
+
+static inline HPG_AVX2 __m256i blend_epi64_avx2(__m256i a, __m256i b, __m256d mask) {
+    return _mm256_castpd_si256(
+        _mm256_blendv_pd(_mm256_castsi256_pd(a), _mm256_castsi256_pd(b), mask));
+}
+
+static inline HPG_AVX2 __m256i min_epi64_avx2(__m256i a, __m256i b) {
+    return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b));
+}
+
+static inline HPG_AVX2 __m256i spread_bits_avx2(__m256i x) {
+    x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 16)),
+                         _mm256_set1_epi64x(0x0000FFFF0000FFFFLL));
+    x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 8)),
+                         _mm256_set1_epi64x(0x00FF00FF00FF00FFLL));
+    x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 4)),
+                         _mm256_set1_epi64x(0x0F0F0F0F0F0F0F0FLL));
+    x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 2)),
+                         _mm256_set1_epi64x(0x3333333333333333LL));
+    x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 1)),
+                         _mm256_set1_epi64x(0x5555555555555555LL));
+    return x;
+}
+
+HPG_AVX2 void ang2pix_batch_avx2(healpix_info *hpx, const double *theta, const double *phi,
+                                 int64_t *pix, size_t n) {
+    const int64_t nside = hpx->nside;
+    const __m256d vnside = _mm256_set1_pd((double)nside);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d three = _mm256_set1_pd(3.0);
+    const __m256d four = _mm256_set1_pd(4.0);
+    const __m128i order_cnt = _mm_cvtsi32_si128(hpx->order);
+    double z[4], sth[4];
+    int64_t use_sth[4];
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        for (int k = 0; k < 4; k++) ang2pix_prep(theta[i + k], &z[k], &sth[k], &use_sth[k]);
+
+        __m256d vz = _mm256_loadu_pd(z);
+        __m256d za = _mm256_andnot_pd(_mm256_set1_pd(-0.0), vz);
+        __m256d tt = _mm256_mul_pd(_mm256_loadu_pd(phi + i), _mm256_set1_pd(HPG_INV_HALFPI));
+
+        __m256d ok = _mm256_and_pd(_mm256_cmp_pd(tt, zero, _CMP_GE_OQ),
+                                   _mm256_cmp_pd(tt, four, _CMP_LT_OQ));
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(za, one, _CMP_LE_OQ));
+        if (_mm256_movemask_pd(ok) != 0xf) {
+            for (int k = 0; k < 4; k++) pix[i + k] = ang2pix(hpx, theta[i + k], phi[i + k]);
+            continue;
+        }
+
+        __m256d equatorial = _mm256_cmp_pd(za, _mm256_set1_pd(HPG_TWOTHIRD), _CMP_LE_OQ);
+
+        // Polar cap edge distance.
+        __m256d sq_a = _mm256_sqrt_pd(_mm256_mul_pd(three, _mm256_sub_pd(one, za)));
+        __m256d tmp_a = _mm256_mul_pd(vnside, sq_a);
+        __m256d tmp_b = _mm256_div_pd(_mm256_mul_pd(vnside, _mm256_loadu_pd(sth)),
+                                      _mm256_sqrt_pd(_mm256_div_pd(_mm256_add_pd(one, za),
+                                                                   three)));
+        __m256d sth_mask = _mm256_castsi256_pd(_mm256_loadu_si256((__m256i *)use_sth));
+        __m256d tmp = _mm256_blendv_pd(tmp_a, tmp_b, sth_mask);
+        __m256d ttrunc = _mm256_round_pd(tt, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        __m256d tp = _mm256_sub_pd(tt, ttrunc);
+        __m256i pjp = trunc_epi64_avx2(_mm256_mul_pd(tp, tmp));
+        __m256i pjm = trunc_epi64_avx2(_mm256_mul_pd(_mm256_sub_pd(one, tp), tmp));
+
+        __m256d temp1 = _mm256_mul_pd(vnside, _mm256_add_pd(_mm256_set1_pd(0.5), tt));
+        __m256i result;
+
+        if (hpx->scheme == RING) {
+            const int64_t nl4 = 4 * nside;
+
+            // Equatorial region
+            __m256d temp2 = _mm256_mul_pd(_mm256_mul_pd(vnside, vz), _mm256_set1_pd(0.75));
+            __m256i jp = trunc_epi64_avx2(_mm256_sub_pd(temp1, temp2));
+            __m256i jm = trunc_epi64_avx2(_mm256_add_pd(temp1, temp2));
+            __m256i ir =
+                _mm256_add_epi64(_mm256_set1_epi64x(nside + 1), _mm256_sub_epi64(jp, jm));
+            __m256i kshift = _mm256_xor_si256(_mm256_and_si256(ir, _mm256_set1_epi64x(1)),
+                                              _mm256_set1_epi64x(1));
+            __m256i t1 = _mm256_add_epi64(_mm256_add_epi64(jp, jm), kshift);
+            t1 = _mm256_add_epi64(t1, _mm256_set1_epi64x(1 - nside + nl4 + nl4));
+            __m256i ip = _mm256_and_si256(_mm256_srli_epi64(t1, 1),
+                                          _mm256_set1_epi64x(nl4 - 1));
+            __m256i eq_pix = _mm256_sll_epi64(_mm256_sub_epi64(ir, _mm256_set1_epi64x(1)),
+                                              _mm_cvtsi32_si128(hpx->order + 2));
+            eq_pix = _mm256_add_epi64(_mm256_add_epi64(eq_pix, ip),
+                                      _mm256_set1_epi64x(hpx->ncap));
+
+            // Polar caps
+            __m256i pir = _mm256_add_epi64(_mm256_add_epi64(pjp, pjm), _mm256_set1_epi64x(1));
+            __m256i pip = trunc_epi64_avx2(_mm256_mul_pd(tt, epi64_to_pd_avx2(pir)));
+            __m256i north = _mm256_slli_epi64(
+                _mm256_mul_epu32(pir, _mm256_sub_epi64(pir, _mm256_set1_epi64x(1))), 1);
+            north = _mm256_add_epi64(north, pip);
+            __m256i south = _mm256_slli_epi64(
+                _mm256_mul_epu32(pir, _mm256_add_epi64(pir, _mm256_set1_epi64x(1))), 1);
+            south = _mm256_add_epi64(_mm256_sub_epi64(_mm256_set1_epi64x(hpx->npix), south),
+                                     pip);
+            __m256i polar_pix =
+                blend_epi64_avx2(south, north, _mm256_cmp_pd(vz, zero, _CMP_GT_OQ));
+
+            result = blend_epi64_avx2(polar_pix, eq_pix, equatorial);
+        } else {
+            const __m256i nsidem1 = _mm256_set1_epi64x(nside - 1);
+
+            // Equatorial region
+            __m256d temp2 = _mm256_mul_pd(vnside, _mm256_mul_pd(vz, _mm256_set1_pd(0.75)));
+            __m256i jp = trunc_epi64_avx2(_mm256_sub_pd(temp1, temp2));
+            __m256i jm = trunc_epi64_avx2(_mm256_add_pd(temp1, temp2));
+            __m256i ifp = _mm256_srl_epi64(jp, order_cnt);
+            __m256i ifm = _mm256_srl_epi64(jm, order_cnt);
+            __m256i eq_face = _mm256_blendv_epi8(_mm256_add_epi64(ifm, _mm256_set1_epi64x(8)),
+                                                 ifp, _mm256_cmpgt_epi64(ifm, ifp));
+            eq_face = _mm256_blendv_epi8(eq_face, _mm256_or_si256(ifp, _mm256_set1_epi64x(4)),
+                                         _mm256_cmpeq_epi64(ifp, ifm));
+            __m256i eq_ix = _mm256_and_si256(jm, nsidem1);
+            __m256i eq_iy = _mm256_sub_epi64(nsidem1, _mm256_and_si256(jp, nsidem1));
+
+            // Polar caps
+            __m256i ntt = trunc_epi64_avx2(tt);
+            pjp = min_epi64_avx2(pjp, nsidem1);
+            pjm = min_epi64_avx2(pjm, nsidem1);
+            __m256d north = _mm256_cmp_pd(vz, zero, _CMP_GE_OQ);
+            __m256i p_ix = blend_epi64_avx2(pjp, _mm256_sub_epi64(nsidem1, pjm), north);
+            __m256i p_iy = blend_epi64_avx2(pjm, _mm256_sub_epi64(nsidem1, pjp), north);
+            __m256i p_face = blend_epi64_avx2(_mm256_add_epi64(ntt, _mm256_set1_epi64x(8)),
+                                              ntt, north);
+
+            __m256i ix = blend_epi64_avx2(p_ix, eq_ix, equatorial);
+            __m256i iy = blend_epi64_avx2(p_iy, eq_iy, equatorial);
+            __m256i face = blend_epi64_avx2(p_face, eq_face, equatorial);
+
+            result = _mm256_sll_epi64(face, _mm_cvtsi32_si128(2 * hpx->order));
+            result = _mm256_add_epi64(result, spread_bits_avx2(ix));
+            result = _mm256_add_epi64(result, _mm256_slli_epi64(spread_bits_avx2(iy), 1));
+        }
+
+        _mm256_storeu_si256((__m256i *)(pix + i), result);
+    }
+
+    for (; i < n; i++) pix[i] = ang2pix(hpx, theta[i], phi[i]);
+}
+
+#undef HPG_AVX2
+
+/* AVX-512 */
+
+#define HPG_AVX512 __attribute__((target("avx512f")))
+
+static inline HPG_AVX512 __m512i trunc_epi64_avx512(__m512d x) {
+    const __m512d magic = _mm512_set1_pd(HPG_MAGIC_2_52);
+    x = _mm512_roundscale_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    x = _mm512_add_pd(x, magic);
+    return _mm512_sub_epi64(_mm512_castpd_si512(x), _mm512_castpd_si512(magic));
+}
+
+static inline HPG_AVX512 __m512d epi64_to_pd_avx512(__m512i v) {
+    const __m512d magic = _mm512_set1_pd(HPG_MAGIC_2_52);
+    v = _mm512_add_epi64(v, _mm512_castpd_si512(magic));
+    return _mm512_sub_pd(_mm512_castsi512_pd(v), magic);
+}
+
+static inline HPG_AVX512 __m512i spread_bits_avx512(__m512i x) {
+    x = _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 16)),
+                         _mm512_set1_epi64(0x0000FFFF0000FFFFLL));
+    x = _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 8)),
+                         _mm512_set1_epi64(0x00FF00FF00FF00FFLL));
+    x = _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 4)),
+                         _mm512_set1_epi64(0x0F0F0F0F0F0F0F0FLL));
+    x = _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 2)),
+                         _mm512_set1_epi64(0x3333333333333333LL));
+    x = _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 1)),
+                         _mm512_set1_epi64(0x5555555555555555LL));
+    return x;
+}
+
+HPG_AVX512 void ang2pix_batch_avx512(healpix_info *hpx, const double *theta, const double *phi,
+                                     int64_t *pix, size_t n) {
+    const int64_t nside = hpx->nside;
+    const __m512d vnside = _mm512_set1_pd((double)nside);
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d three = _mm512_set1_pd(3.0);
+    const __m512d four = _mm512_set1_pd(4.0);
+    const __m512i one_i = _mm512_set1_epi64(1);
+    const __m128i order_cnt = _mm_cvtsi32_si128(hpx->order);
+    double z[8], sth[8];
+    int64_t use_sth[8];
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __mmask8 use_sth_mask = 0;
+        for (int k = 0; k < 8; k++) {
+            ang2pix_prep(theta[i + k], &z[k], &sth[k], &use_sth[k]);
+            if (use_sth[k]) use_sth_mask |= (__mmask8)(1 << k);
+        }
+
+        __m512d vz = _mm512_loadu_pd(z);
+        __m512d za = _mm512_abs_pd(vz);
+        __m512d tt = _mm512_mul_pd(_mm512_loadu_pd(phi + i), _mm512_set1_pd(HPG_INV_HALFPI));
+
+        __mmask8 ok = _mm512_cmp_pd_mask(tt, zero, _CMP_GE_OQ) &
+                      _mm512_cmp_pd_mask(tt, four, _CMP_LT_OQ) &
+                      _mm512_cmp_pd_mask(za, one, _CMP_LE_OQ);
+        if (ok != 0xff) {
+            for (int k = 0; k < 8; k++) pix[i + k] = ang2pix(hpx, theta[i + k], phi[i + k]);
+            continue;
+        }
+
+        __mmask8 equatorial = _mm512_cmp_pd_mask(za, _mm512_set1_pd(HPG_TWOTHIRD), _CMP_LE_OQ);
+
+        // Polar cap edge distance.
+        __m512d sq_a = _mm512_sqrt_pd(_mm512_mul_pd(three, _mm512_sub_pd(one, za)));
+        __m512d tmp_a = _mm512_mul_pd(vnside, sq_a);
+        __m512d tmp_b = _mm512_div_pd(_mm512_mul_pd(vnside, _mm512_loadu_pd(sth)),
+                                      _mm512_sqrt_pd(_mm512_div_pd(_mm512_add_pd(one, za),
+                                                                   three)));
+        __m512d tmp = _mm512_mask_blend_pd(use_sth_mask, tmp_a, tmp_b);
+        __m512d ttrunc = _mm512_roundscale_pd(tt, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        __m512d tp = _mm512_sub_pd(tt, ttrunc);
+        __m512i pjp = trunc_epi64_avx512(_mm512_mul_pd(tp, tmp));
+        __m512i pjm = trunc_epi64_avx512(_mm512_mul_pd(_mm512_sub_pd(one, tp), tmp));
+
+        __m512d temp1 = _mm512_mul_pd(vnside, _mm512_add_pd(_mm512_set1_pd(0.5), tt));
+        __m512i result;
+
+        if (hpx->scheme == RING) {
+            const int64_t nl4 = 4 * nside;
+
+            // Equatorial region
+            __m512d temp2 = _mm512_mul_pd(_mm512_mul_pd(vnside, vz), _mm512_set1_pd(0.75));
+            __m512i jp = trunc_epi64_avx512(_mm512_sub_pd(temp1, temp2));
+            __m512i jm = trunc_epi64_avx512(_mm512_add_pd(temp1, temp2));
+            __m512i ir =
+                _mm512_add_epi64(_mm512_set1_epi64(nside + 1), _mm512_sub_epi64(jp, jm));
+            __m512i kshift = _mm512_xor_si512(_mm512_and_si512(ir, one_i), one_i);
+            __m512i t1 = _mm512_add_epi64(_mm512_add_epi64(jp, jm), kshift);
+            t1 = _mm512_add_epi64(t1, _mm512_set1_epi64(1 - nside + nl4 + nl4));
+            __m512i ip = _mm512_and_si512(_mm512_srli_epi64(t1, 1),
+                                          _mm512_set1_epi64(nl4 - 1));
+            __m512i eq_pix = _mm512_sll_epi64(_mm512_sub_epi64(ir, one_i),
+                                              _mm_cvtsi32_si128(hpx->order + 2));
+            eq_pix = _mm512_add_epi64(_mm512_add_epi64(eq_pix, ip),
+                                      _mm512_set1_epi64(hpx->ncap));
+
+            // Polar caps
+            __m512i pir = _mm512_add_epi64(_mm512_add_epi64(pjp, pjm), one_i);
+            __m512i pip = trunc_epi64_avx512(_mm512_mul_pd(tt, epi64_to_pd_avx512(pir)));
+            __m512i north =
+                _mm512_slli_epi64(_mm512_mul_epu32(pir, _mm512_sub_epi64(pir, one_i)), 1);
+            north = _mm512_add_epi64(north, pip);
+            __m512i south =
+                _mm512_slli_epi64(_mm512_mul_epu32(pir, _mm512_add_epi64(pir, one_i)), 1);
+            south = _mm512_add_epi64(_mm512_sub_epi64(_mm512_set1_epi64(hpx->npix), south),
+                                     pip);
+            __m512i polar_pix =
+                _mm512_mask_blend_epi64(_mm512_cmp_pd_mask(vz, zero, _CMP_GT_OQ), south,
+                                        north);
+
+            result = _mm512_mask_blend_epi64(equatorial, polar_pix, eq_pix);
+        } else {
+            const __m512i nsidem1 = _mm512_set1_epi64(nside - 1);
+
+            // Equatorial region
+            __m512d temp2 = _mm512_mul_pd(vnside, _mm512_mul_pd(vz, _mm512_set1_pd(0.75)));
+            __m512i jp = trunc_epi64_avx512(_mm512_sub_pd(temp1, temp2));
+            __m512i jm = trunc_epi64_avx512(_mm512_add_pd(temp1, temp2));
+            __m512i ifp = _mm512_srl_epi64(jp, order_cnt);
+            __m512i ifm = _mm512_srl_epi64(jm, order_cnt);
+            __m512i eq_face = _mm512_mask_blend_epi64(_mm512_cmpgt_epi64_mask(ifm, ifp),
+                                                      _mm512_add_epi64(ifm,
+                                                                       _mm512_set1_epi64(8)),
+                                                      ifp);
+            eq_face = _mm512_mask_blend_epi64(_mm512_cmpeq_epi64_mask(ifp, ifm), eq_face,
+                                              _mm512_or_si512(ifp, _mm512_set1_epi64(4)));
+            __m512i eq_ix = _mm512_and_si512(jm, nsidem1);
+            __m512i eq_iy = _mm512_sub_epi64(nsidem1, _mm512_and_si512(jp, nsidem1));
+
+            // Polar caps
+            __m512i ntt = trunc_epi64_avx512(tt);
+            pjp = _mm512_min_epi64(pjp, nsidem1);
+            pjm = _mm512_min_epi64(pjm, nsidem1);
+            __mmask8 north = _mm512_cmp_pd_mask(vz, zero, _CMP_GE_OQ);
+            __m512i p_ix = _mm512_mask_blend_epi64(north, pjp, _mm512_sub_epi64(nsidem1, pjm));
+            __m512i p_iy = _mm512_mask_blend_epi64(north, pjm, _mm512_sub_epi64(nsidem1, pjp));
+            __m512i p_face =
+                _mm512_mask_blend_epi64(north, _mm512_add_epi64(ntt, _mm512_set1_epi64(8)),
+                                        ntt);
+
+            __m512i ix = _mm512_mask_blend_epi64(equatorial, p_ix, eq_ix);
+            __m512i iy = _mm512_mask_blend_epi64(equatorial, p_iy, eq_iy);
+            __m512i face = _mm512_mask_blend_epi64(equatorial, p_face, eq_face);
+
+            result = _mm512_sll_epi64(face, _mm_cvtsi32_si128(2 * hpx->order));
+            result = _mm512_add_epi64(result, spread_bits_avx512(ix));
+            result = _mm512_add_epi64(result, _mm512_slli_epi64(spread_bits_avx512(iy), 1));
+        }
+
+        _mm512_storeu_si512((void *)(pix + i), result);
+    }
+
+    for (; i < n; i++) pix[i] = ang2pix(hpx, theta[i], phi[i]);
+}
+
+#undef HPG_AVX512
+
+/* BMI2 */
+
+#define HPG_BMI2 __attribute__((target("bmi2")))
+
+static inline HPG_BMI2 int64_t spread_bits64_pdep(int v) {
+    return (int64_t)_pdep_u64((uint32_t)v, 0x5555555555555555ULL);
+}
+
+static inline HPG_BMI2 int compress_bits64_pext(int64_t v) {
+    return (int)_pext_u64((uint64_t)v, 0x5555555555555555ULL);
+}
+
+HPG_BMI2 int64_t spread_bits64_bmi2(int v) { return spread_bits64_pdep(v); }
+
+HPG_BMI2 int compress_bits64_bmi2(int64_t v) { return compress_bits64_pext(v); }
+
+HPG_BMI2 void nest2ring_batch_bmi2(healpix_info *hpx, const int64_t *nest, int64_t *ring,
+                                   size_t n) {
+    const int shift = 2 * hpx->order;
+    const int64_t mask = hpx->npface - 1;
+
+    for (size_t i = 0; i < n; i++) {
+        int64_t pix = nest[i];
+        int face_num = (int)(pix >> shift);
+        pix &= mask;
+        ring[i] = xyf2ring(hpx, compress_bits64_pext(pix), compress_bits64_pext(pix >> 1),
+                           face_num);
+    }
+}
+
+HPG_BMI2 void ring2nest_batch_bmi2(healpix_info *hpx, const int64_t *ring, int64_t *nest,
+                                   size_t n) {
+    const int shift = 2 * hpx->order;
+    int ix, iy, face_num;
+
+    for (size_t i = 0; i < n; i++) {
+        ring2xyf(hpx, ring[i], &ix, &iy, &face_num);
+        nest[i] = ((int64_t)face_num << shift) + spread_bits64_pdep(ix) +
+                  (spread_bits64_pdep(iy) << 1);
+    }
+}
+
+#undef HPG_BMI2
+
+#else
+
+int hpgeom_cpu_has_avx2(void) { return 0; }
+
+int hpgeom_cpu_has_avx512(void) { return 0; }
+
+int hpgeom_cpu_has_fast_bmi2(void) { return 0; }
+
+#endif
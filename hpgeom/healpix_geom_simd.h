@@ -0,0 +1,55 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+#ifndef _HEALPIX_GEOM_SIMD_H
+#define _HEALPIX_GEOM_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "healpix_geom.h"
+
+// The SIMD kernels use per-function target attributes, so they are only
+// built with gcc/clang on x86-64.  Everywhere else the scalar code is used.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HPG_X86_SIMD 1
+#else
+#define HPG_X86_SIMD 0
+#endif
+
+int hpgeom_cpu_has_avx2(void);
+int hpgeom_cpu_has_avx512(void);
+int hpgeom_cpu_has_fast_bmi2(void);
+
+#if HPG_X86_SIMD
+void ang2pix_batch_avx2(healpix_info *hpx, const double *theta, const double *phi,
+                        int64_t *pix, size_t n);
+void ang2pix_batch_avx512(healpix_info *hpx, const double *theta, const double *phi,
+                          int64_t *pix, size_t n);
+
+int64_t spread_bits64_bmi2(int v);
+int compress_bits64_bmi2(int64_t v);
+void nest2ring_batch_bmi2(healpix_info *hpx, const int64_t *nest, int64_t *ring, size_t n);
+void ring2nest_batch_bmi2(healpix_info *hpx, const int64_t *ring, int64_t *nest, size_t n);
+#endif
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "healpix_geom.h"
+#include "healpix_moc.h"
+#include "hpgeom_stack.h"
+#include "hpgeom_utils.h"
+
+moc *moc_new(int max_order, int *status, char *err) {
+    *status = 1;
+    if ((max_order < 0) || (max_order > MAX_ORDER)) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "MOC max_order %d must be between 0 and %d.", max_order,
+                 MAX_ORDER);
+        return NULL;
+    }
+
+    moc *m = malloc(sizeof(moc));
+    if (m == NULL) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "Could not allocate moc");
+        return NULL;
+    }
+    m->max_order = max_order;
+    m->rangeset = i64rangeset_new(status, err);
+    if (!*status) {
+        free(m);
+        return NULL;
+    }
+
+    return m;
+}
+
+moc *moc_delete(moc *m) {
+    if (m != NULL) {
+        m->rangeset = i64rangeset_delete(m->rangeset);
+        free(m);
+    }
+    return NULL;
+}
+
+int nuniq_order(int64_t uniq) { return ilog2(uniq) / 2 - 1; }
+
+static inline int64_t nuniq_from_cell(int order, int64_t pix) {
+    return (INT64_C(4) << (2 * order)) + pix;
+}
+
+// Depth (max_order - order) of the largest cell which starts at pixel lo of
+// a range [lo, hi) at max_order, and which lies within the range.
+static inline int cell_depth(int64_t lo, int64_t hi, int max_order) {
+    int depth = ilog2(hi - lo) / 2;
+
+    if (depth > max_order) depth = max_order;
+    while ((lo & ((INT64_C(1) << (2 * depth)) - 1)) != 0) depth--;
+
+    return depth;
+}
+
+size_t moc_ncell(moc *m, size_t *counts) {
+    const int64_t *data = m->rangeset->stack->data;
+    size_t size = m->rangeset->stack->size;
+    size_t ncell = 0;
+
+    if (counts != NULL) memset(counts, 0, (m->max_order + 1) * sizeof(size_t));
+
+    for (size_t j = 0; j < size; j += 2) {
+        int64_t lo = data[j];
+        while (lo < data[j + 1]) {
+            int depth = cell_depth(lo, data[j + 1], m->max_order);
+            if (counts != NULL) counts[m->max_order - depth]++;
+            ncell++;
+            lo += INT64_C(1) << (2 * depth);
+        }
+    }
+
+    return ncell;
+}
+
+void moc_fill_nuniq(moc *m, int64_t *nuniq) {
+    // The cells of each range are found in increasing order, as are the
+    // ranges, so each order is filled in sorted order from its own offset.
+    const int64_t *data = m->rangeset->stack->data;
+    size_t size = m->rangeset->stack->size;
+    size_t offsets[MAX_ORDER + 1];
+    size_t ncell = 0;
+
+    moc_ncell(m, offsets);
+    for (int order = 0; order <= m->max_order; order++) {
+        size_t count = offsets[order];
+        offsets[order] = ncell;
+        ncell += count;
+    }
+
+    for (size_t j = 0; j < size; j += 2) {
+        int64_t lo = data[j];
+        while (lo < data[j + 1]) {
+            int depth = cell_depth(lo, data[j + 1], m->max_order);
+            int order = m->max_order - depth;
+            nuniq[offsets[order]++] = nuniq_from_cell(order, lo >> (2 * depth));
+            lo += INT64_C(1) << (2 * depth);
+        }
+    }
+}
+
+void moc_set_nuniq(moc *m, const int64_t *nuniq, size_t n, int *status, char *err) {
+    i64stack *stack = m->rangeset->stack;
+
+    *status = 1;
+    for (size_t i = 0; i < n; i++) {
+        if (nuniq[i] < 4) {
+            *status = 0;
+            snprintf(err, ERR_SIZE, "NUNIQ value %lld is not valid.", (long long)nuniq[i]);
+            return;
+        }
+        int order = nuniq_order(nuniq[i]);
+        if (order > m->max_order) {
+            *status = 0;
+            snprintf(err, ERR_SIZE, "NUNIQ cell of order %d is finer than max_order %d.",
+                     order, m->max_order);
+            return;
+        }
+    }
+
+    i64stack_resize(stack, 2 * n, status, err);
+    if (!*status) return;
+
+    for (size_t i = 0; i < n; i++) {
+        int order = nuniq_order(nuniq[i]);
+        int shift = 2 * (m->max_order - order);
+        int64_t pix = nuniq[i] - nuniq_from_cell(order, 0);
+        stack->data[2 * i] = pix << shift;
+        stack->data[2 * i + 1] = (pix + 1) << shift;
+    }
+    stack->size = i64ranges_sort_merge(stack->data, 2 * n);
+}
+
+// The ranges of m at order >= m->max_order.  These are the ranges of m
+// itself if the orders match, and are otherwise shifted into tmp.
+static i64rangeset *moc_ranges_at_order(moc *m, int order, i64rangeset *tmp, int *status,
+                                        char *err) {
+    int shift = 2 * (order - m->max_order);
+    i64stack *stack = m->rangeset->stack;
+
+    *status = 1;
+    if (shift == 0) return m->rangeset;
+
+    i64stack_resize(tmp->stack, stack->size, status, err);
+    if (!*status) return NULL;
+    for (size_t j = 0; j < stack->size; j++) {
+        tmp->stack->data[j] = stack->data[j] << shift;
+    }
+
+    return tmp;
+}
+
+typedef void (*moc_rangeset_op)(i64rangeset *a, i64rangeset *b, i64rangeset *out, int *status,
+                                char *err);
+
+static void moc_combine(moc *a, moc *b, moc_rangeset_op op, moc *out, int *status,
+                        char *err) {
+    // Only the MOC with the lower max_order needs to be shifted, so both may
+    // share the scratch rangeset.
+    int order = (a->max_order > b->max_order) ? a->max_order : b->max_order;
+    i64rangeset *ra, *rb;
+    i64rangeset *tmp = i64rangeset_new(status, err);
+    if (!*status) return;
+
+    ra = moc_ranges_at_order(a, order, tmp, status, err);
+    if (!*status) goto cleanup;
+    rb = moc_ranges_at_order(b, order, tmp, status, err);
+    if (!*status) goto cleanup;
+
+    op(ra, rb, out->rangeset, status, err);
+    out->max_order = order;
+
+cleanup:
+    i64rangeset_delete(tmp);
+}
+
+void moc_union(moc *a, moc *b, moc *out, int *status, char *err) {
+    moc_combine(a, b, i64rangeset_union, out, status, err);
+}
+
+void moc_intersection(moc *a, moc *b, moc *out, int *status, char *err) {
+    moc_combine(a, b, i64rangeset_intersection, out, status, err);
+}
+
+void moc_degrade(moc *m, int order, moc *out, int *status, char *err) {
+    const int64_t *data = m->rangeset->stack->data;
+    size_t size = m->rangeset->stack->size;
+
+    *status = 1;
+    if ((order < 0) || (order > m->max_order)) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "Degraded order %d must be between 0 and max_order %d.", order,
+                 m->max_order);
+        return;
+    }
+
+    int shift = 2 * (m->max_order - order);
+    int64_t mask = (INT64_C(1) << shift) - 1;
+
+    i64rangeset_clear(out->rangeset, status, err);
+    out->max_order = order;
+    for (size_t j = 0; j < size; j += 2) {
+        // Round outwards; neighbouring ranges which now touch are merged.
+        i64rangeset_append(out->rangeset, data[j] >> shift, (data[j + 1] + mask) >> shift,
+                           status, err);
+        if (!*status) return;
+    }
+}
+
+bool moc_equal(moc *a, moc *b) {
+    // The ranges are merged, so equal coverage has equal ranges at any
+    // common order.
+    i64stack *sa = a->rangeset->stack;
+    i64stack *sb = b->rangeset->stack;
+    int order = (a->max_order > b->max_order) ? a->max_order : b->max_order;
+    int shift_a = 2 * (order - a->max_order);
+    int shift_b = 2 * (order - b->max_order);
+
+    if (sa->size != sb->size) return false;
+    for (size_t j = 0; j < sa->size; j++) {
+        if ((sa->data[j] << shift_a) != (sb->data[j] << shift_b)) return false;
+    }
+
+    return true;
+}
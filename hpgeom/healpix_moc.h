@@ -0,0 +1,68 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+
+#ifndef _HEALPIX_MOC_H
+#define _HEALPIX_MOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hpgeom_stack.h"
+
+// A multi-order coverage map (MOC) of nest pixels.  The coverage is stored as
+// sorted, merged [lo, high) ranges of pixels at max_order, which are
+// equivalent to the minimal set of cells of all orders <= max_order covering
+// the same area.  Cells are encoded with the NUNIQ scheme,
+// uniq = 4*4**order + pixel, so sorting by uniq sorts by order and then pixel.
+typedef struct moc {
+    int max_order;
+    i64rangeset *rangeset;
+} moc;
+
+moc *moc_new(int max_order, int *status, char *err);
+moc *moc_delete(moc *m);
+
+// Order of a NUNIQ cell, which must be >= 4.
+int nuniq_order(int64_t uniq);
+
+// Number of cells in the MOC.  If counts is not NULL, the number of cells of
+// each order is also stored in counts[0..max_order].
+size_t moc_ncell(moc *m, size_t *counts);
+// Fill nuniq with the moc_ncell() cells, in increasing order.
+void moc_fill_nuniq(moc *m, int64_t *nuniq);
+// Replace the coverage with n NUNIQ cells, which may be in any order and may
+// overlap.  Cells finer than max_order are an error.
+void moc_set_nuniq(moc *m, const int64_t *nuniq, size_t n, int *status, char *err);
+
+// The output must not be a or b, and is set at the larger max_order of a
+// and b, at which the result is exact.
+void moc_union(moc *a, moc *b, moc *out, int *status, char *err);
+void moc_intersection(moc *a, moc *b, moc *out, int *status, char *err);
+// Coarsen m to order <= m->max_order, such that every cell covers its
+// parent cell.  The output must not be m.
+void moc_degrade(moc *m, int order, moc *out, int *status, char *err);
+// Do a and b cover the same pixels?
+bool moc_equal(moc *a, moc *b);
+
+#endif
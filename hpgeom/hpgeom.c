@@ -20,12 +20,21 @@
 #include <Python.h>
 
 #define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#define PY_ARRAY_UNIQUE_SYMBOL HPGEOM_ARRAY_API
 
 #include <numpy/arrayobject.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "healpix_geom.h"
+#include "hpgeom_capsule.h"
+#include "hpgeom_moc.h"
+#include "hpgeom_pixelset.h"
+#include "hpgeom_query_context.h"
+#include "hpgeom_rangeset.h"
 #include "hpgeom_stack.h"
+#include "hpgeom_threads.h"
+#include "hpgeom_ufunc.h"
 #include "hpgeom_utils.h"
 
 #define NSIDE_DOC_PAR                      \
@@ -37,6 +46,8 @@
     "    and in radians if degrees=False. Theta/phi are always in radians.\n"
 
 #define AB_DOC_PAR "a, b : `float` or `np.ndarray` (N,)\n" AB_DOC_DESCR
+#define FLOAT32_DOC_DESCR \
+    "    float32 arrays are read directly, without conversion to float64.\n"
 #define NEST_DOC_PAR            \
     "nest : `bool`, optional\n" \
     "    Use nest ordering scheme?\n"
@@ -55,20 +66,323 @@
     "    a resolution fact*nside. For nest ordering, fact must be a power\n" \
     "    of 2, and nside*fact must always be <= 2**29.  For ring ordering\n" \
     "    fact may be any positive integer.\n"
-#define RETURN_PIXEL_RANGES_PAR                                                  \
-    "return_pixel_ranges : `bool`, optional\n"                                   \
-    "    Return an array of pixel ranges instead of a list of pixels.\n"         \
-    "    The ranges will be sorted, and each range is of the form [lo, high).\n" \
-    "    This option is only compatible with nest ordering.\n"
+#define PIX_DTYPE_DOC_PAR                                                     \
+    "dtype : `np.dtype`, optional\n"                                          \
+    "    Output dtype for the pixels, int64 (default) or int32.  int32 may\n" \
+    "    only be used when the number of pixels fits, for nside <= 8192.\n"
+#define RETURN_PIXEL_RANGES_PAR                                          \
+    "return_pixel_ranges : `bool`, optional\n"                           \
+    "    Return an array of pixel ranges instead of a list of pixels.\n" \
+    "    The ranges will be sorted, and each range is of the form [lo, high).\n"
+#define RETURN_MOC_PAR                                                          \
+    "return_moc : `bool`, optional\n"                                           \
+    "    Return a `MOC` of the nest pixels, which is serialized as the minimal\n" \
+    "    list of multi-order NUNIQ cells with MOC.to_nuniq().  Requires\n"       \
+    "    nest=True, and dtype is not used.\n"
+#define RETURN_UNION_PAR                                                       \
+    "return_union : `bool`, optional\n"                                       \
+    "    Return the union of all the queries as a single sorted array of\n"   \
+    "    pixels (or pixel ranges), instead of the offsets and results of\n"   \
+    "    each query.\n"
+
+#define N_THREADS_DOC_PAR                                                      \
+    "n_threads : `int`, optional\n"                                            \
+    "    Number of threads to split the computation over.  If 0, use the\n"    \
+    "    module default set with set_num_threads().  Small arrays are always\n" \
+    "    run on a single thread.\n"
+
+#define QUERY_N_THREADS_DOC_PAR                                                \
+    "n_threads : `int`, optional\n"                                            \
+    "    Number of threads to split a large nest search over.  If 0, use the\n" \
+    "    module default set with set_num_threads().  Small queries are always\n" \
+    "    run on a single thread, and the pixels do not depend on n_threads.\n"
+
+#define CHECK_DOC_PAR                                                        \
+    "check : `bool`, optional\n"                                              \
+    "    Check that the inputs are in range.  Set to False to skip the\n"     \
+    "    range checks for trusted inputs, for which out-of-range values\n"    \
+    "    give undefined results.  nside is always checked.\n"
+#define COORD_DTYPE_DOC_PAR                                                      \
+    "dtype : `np.dtype`, optional\n"                                             \
+    "    Output dtype for the coordinates, float64 (default) or float32.\n"      \
+    "    Computation is always done in double precision.\n"
+#define OUT_DOC_PAR(descr)                                                    \
+    "out : " descr ", optional\n"                                             \
+    "    Array(s) to store the output in, instead of allocating new arrays.\n" \
+    "    These must have exactly the output dtype and shape.\n"
+
+// Iterator flags for an output operand, which is allocated by the iterator
+// unless the caller provided an out array.
+#define HPG_OUT_OP_FLAGS(out) \
+    (NPY_ITER_WRITEONLY | (((out) == NULL) ? NPY_ITER_ALLOCATE : NPY_ITER_NO_BROADCAST))
+
+// Number of elements converted and pixelized at a time by the batch kernels.
+#define HPG_BLOCK_SIZE 512
+
+// State for running the inner loop of a vectorized function over the
+// [istart, iend) slice of an iterator.  Each thread has its own copy of
+// the iterator, and its own error status and message.  innersizeptr and
+// strides are only set for iterators with an external loop.
+typedef struct {
+    NpyIter *iter;
+    NpyIter_IterNextFunc *iternext;
+    char **dataptrarray;
+    npy_intp *innersizeptr;
+    npy_intp *strides;
+    npy_intp istart;
+    npy_intp iend;
+    const void *params;
+    int status;
+    char err[ERR_SIZE];
+} hpgeom_iter_chunk;
+
+typedef void (*hpgeom_chunk_kernel)(hpgeom_iter_chunk *chunk);
+
+typedef struct {
+    hpgeom_iter_chunk *chunks;
+    hpgeom_chunk_kernel kernel;
+} hpgeom_chunk_job;
+
+static void hpgeom_run_chunk(void *arg, int thread_id) {
+    hpgeom_chunk_job *job = (hpgeom_chunk_job *)arg;
+    hpgeom_iter_chunk *chunk = &job->chunks[thread_id];
+    char *errmsg = NULL;
+
+    // With a non-NULL errmsg this does not touch the GIL.
+    if (NpyIter_ResetToIterIndexRange(chunk->iter, chunk->istart, chunk->iend, &errmsg) !=
+        NPY_SUCCEED) {
+        snprintf(chunk->err, ERR_SIZE, "%s", errmsg);
+        chunk->status = 0;
+        return;
+    }
+    job->kernel(chunk);
+}
+
+/*
+ * Run kernel over all the elements of iter, split into contiguous chunks
+ * over n_threads threads (0 for the module default).  The iterator must
+ * have been created with NPY_ITER_RANGED.  This must be called with the
+ * GIL held, and the GIL is released while the kernel runs.
+ *
+ * Returns 1 on success, 0 if the kernel reported an error (the message of
+ * the first failing chunk is copied into err), or -1 if a python exception
+ * has been set.
+ */
+static int hpgeom_iter_run(NpyIter *iter, int n_threads, hpgeom_chunk_kernel kernel,
+                           const void *params, char *err) {
+    hpgeom_iter_chunk *chunks = NULL;
+    hpgeom_chunk_job job;
+    npy_intp size = NpyIter_GetIterSize(iter);
+    int status = 1;
+    int i;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (size == 0) return 1;
+
+    if (NpyIter_IterationNeedsAPI(iter)) {
+        n_threads = 1;
+    } else {
+        n_threads = hpgeom_resolve_threads(n_threads, (int64_t)size, HPGEOM_MIN_THREAD_CHUNK);
+    }
+
+    chunks = (hpgeom_iter_chunk *)PyMem_Calloc(n_threads, sizeof(hpgeom_iter_chunk));
+    if (chunks == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    for (i = 0; i < n_threads; i++) {
+        chunks[i].iter = (i == 0) ? iter : NpyIter_Copy(iter);
+        if (chunks[i].iter == NULL) {
+            status = -1;
+            goto cleanup;
+        }
+        chunks[i].iternext = NpyIter_GetIterNext(chunks[i].iter, NULL);
+        if (chunks[i].iternext == NULL) {
+            status = -1;
+            goto cleanup;
+        }
+        chunks[i].dataptrarray = NpyIter_GetDataPtrArray(chunks[i].iter);
+        if (NpyIter_HasExternalLoop(chunks[i].iter)) {
+            chunks[i].innersizeptr = NpyIter_GetInnerLoopSizePtr(chunks[i].iter);
+            chunks[i].strides = NpyIter_GetInnerStrideArray(chunks[i].iter);
+        }
+        chunks[i].istart = (size * i) / n_threads;
+        chunks[i].iend = (size * (i + 1)) / n_threads;
+        chunks[i].params = params;
+        chunks[i].status = 1;
+    }
+
+    if (!NpyIter_IterationNeedsAPI(iter)) NPY_BEGIN_THREADS;
+    if (n_threads == 1) {
+        kernel(&chunks[0]);
+    } else {
+        job.chunks = chunks;
+        job.kernel = kernel;
+        hpgeom_parallel_for(n_threads, hpgeom_run_chunk, &job);
+    }
+    NPY_END_THREADS;
+
+    for (i = 0; i < n_threads; i++) {
+        if (!chunks[i].status) {
+            memcpy(err, chunks[i].err, ERR_SIZE);
+            status = 0;
+            break;
+        }
+    }
+
+cleanup:
+    for (i = 1; i < n_threads; i++) {
+        if (chunks[i].iter != NULL) NpyIter_Deallocate(chunks[i].iter);
+    }
+    PyMem_Free(chunks);
+
+    return status;
+}
+
+// Parse the optional out argument of a function with nout outputs of the
+// given types.  A single output is given as an array and multiple outputs as
+// a tuple of arrays.  On success outs holds borrowed references to the arrays,
+// or NULLs if out is None.  Each array must be aligned, writeable, in native
+// byte order, and have exactly the output type, so that the kernels can write
+// to it directly.  Returns 0 with an exception set on failure.
+static int hpgeom_parse_out(PyObject *out, int nout, const int *typenums, PyObject **outs) {
+    int i;
+
+    for (i = 0; i < nout; i++) outs[i] = NULL;
+    if ((out == NULL) || (out == Py_None)) return 1;
+
+    if ((nout == 1) && !PyTuple_Check(out)) {
+        outs[0] = out;
+    } else {
+        if (!PyTuple_Check(out) || (PyTuple_GET_SIZE(out) != nout)) {
+            PyErr_Format(PyExc_TypeError, "out must be a tuple of %d arrays.", nout);
+            return 0;
+        }
+        for (i = 0; i < nout; i++) outs[i] = PyTuple_GET_ITEM(out, i);
+    }
+
+    for (i = 0; i < nout; i++) {
+        if (!PyArray_Check(outs[i])) {
+            PyErr_SetString(PyExc_TypeError, "out must be a numpy array.");
+            return 0;
+        }
+        if (PyArray_TYPE((PyArrayObject *)outs[i]) != typenums[i]) {
+            PyArray_Descr *descr = PyArray_DescrFromType(typenums[i]);
+            PyErr_Format(PyExc_TypeError, "out array must have dtype %s.",
+                         descr->typeobj->tp_name);
+            Py_DECREF(descr);
+            return 0;
+        }
+        if (!PyArray_ISBEHAVED((PyArrayObject *)outs[i])) {
+            PyErr_SetString(PyExc_ValueError,
+                            "out array must be aligned, writeable, and in native byte order.");
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Return a new reference to an output array of the given shape and type for
+// a function that fills its output by pointer.  This is the caller's out
+// array (parsed with hpgeom_parse_out), which must be C-contiguous with
+// exactly this shape, or a newly allocated array if out is NULL.
+static PyObject *hpgeom_out_or_new(PyObject *out, int nd, npy_intp *dims, int typenum) {
+    PyArrayObject *arr = (PyArrayObject *)out;
+    char shape[ERR_SIZE];
+    int len;
+
+    if (out == NULL) return PyArray_SimpleNew(nd, dims, typenum);
+
+    if (!PyArray_IS_C_CONTIGUOUS(arr) || (PyArray_NDIM(arr) != nd) ||
+        !PyArray_CompareLists(PyArray_DIMS(arr), dims, nd)) {
+        len = snprintf(shape, ERR_SIZE, "(");
+        for (int i = 0; i < nd; i++) {
+            len += snprintf(shape + len, ERR_SIZE - len, (i == 0) ? "%lld" : ", %lld",
+                            (long long)dims[i]);
+        }
+        snprintf(shape + len, ERR_SIZE - len, (nd == 1) ? ",)" : ")");
+        PyErr_Format(PyExc_ValueError, "out array must be C-contiguous with shape %s.",
+                     shape);
+        return NULL;
+    }
+
+    Py_INCREF(out);
+    return out;
+}
+
+// Return the floating point type used to read n coordinate inputs: float32
+// if all of them are float32 arrays, which the kernels then read directly
+// without an upcast copy, and double otherwise.
+static int hpgeom_coord_type(PyObject *const *objs, int n) {
+    for (int i = 0; i < n; i++) {
+        if (!PyArray_Check(objs[i]) || (PyArray_TYPE((PyArrayObject *)objs[i]) != NPY_FLOAT32))
+            return NPY_DOUBLE;
+    }
+    return NPY_FLOAT32;
+}
+
+// Parse an optional dtype argument for float outputs into a type number,
+// which is double by default.  Returns 0 with an exception set on failure.
+static int hpgeom_float_dtype(PyArray_Descr *dtype, int *typenum) {
+    *typenum = (dtype == NULL) ? NPY_DOUBLE : dtype->type_num;
+    if ((*typenum != NPY_DOUBLE) && (*typenum != NPY_FLOAT32)) {
+        PyErr_SetString(PyExc_ValueError, "dtype must be float32 or float64.");
+        return 0;
+    }
+    return 1;
+}
+
+// Parse an optional dtype argument for pixel outputs into a type number,
+// which is int64 by default.  Returns 0 with an exception set on failure.
+static int hpgeom_pixel_dtype(PyArray_Descr *dtype, int *typenum) {
+    *typenum = NPY_INT64;
+    if ((dtype == NULL) || PyArray_EquivTypenums(dtype->type_num, NPY_INT64)) return 1;
+    if (PyArray_EquivTypenums(dtype->type_num, NPY_INT32)) {
+        *typenum = NPY_INT32;
+        return 1;
+    }
+    PyErr_SetString(PyExc_ValueError, "dtype must be int32 or int64.");
+    return 0;
+}
+
+// Index of the angle convention for the specialized conversion kernels:
+// 0 for theta/phi, 1 for lon/lat in radians, 2 for lon/lat in degrees.
+static inline int hpgeom_angle_mode(int lonlat, int degrees) {
+    if (!lonlat) return 0;
+    return degrees ? 2 : 1;
+}
+
+static inline double hpgeom_read_coord(const char *p, bool float32) {
+    return float32 ? (double)*(const float *)p : *(const double *)p;
+}
+
+static inline void hpgeom_write_coord(char *p, double value, bool float32) {
+    if (float32) {
+        *(float *)p = (float)value;
+    } else {
+        *(double *)p = value;
+    }
+}
+
+// Return an output array (a new reference), converting 0-d arrays that were
+// allocated here to scalars.  The caller's out array is returned unchanged.
+static PyObject *hpgeom_return_out(PyObject *arr, PyObject *out) {
+    if (out != NULL) return arr;
+    return PyArray_Return((PyArrayObject *)arr);
+}
 
 PyDoc_STRVAR(angle_to_pixel_doc,
-             "angle_to_pixel(nside, a, b, nest=True, lonlat=True, degrees=True)\n"
+             "angle_to_pixel(nside, a, b, nest=True, lonlat=True, degrees=True, n_threads=0,\n"
+             "               dtype=None, check=True, out=None)\n"
              "--\n\n"
              "Convert angles to pixels.\n"
              "\n"
              "Parameters\n"
-             "----------\n" NSIDE_DOC_PAR AB_DOC_PAR NEST_DOC_PAR LONLAT_DOC_PAR
-                 DEGREES_DOC_PAR
+             "----------\n" NSIDE_DOC_PAR AB_DOC_PAR FLOAT32_DOC_DESCR NEST_DOC_PAR
+                 LONLAT_DOC_PAR DEGREES_DOC_PAR N_THREADS_DOC_PAR PIX_DTYPE_DOC_PAR
+                     CHECK_DOC_PAR OUT_DOC_PAR("`np.ndarray` (N,)")
              "\n"
              "Returns\n"
              "-------\n" PIX_DOC_PAR
@@ -79,41 +393,193 @@ PyDoc_STRVAR(angle_to_pixel_doc,
              "    If angles are out of range, or arrays cannot be broadcast"
              "    together.\n");
 
+typedef struct {
+    enum Scheme scheme;
+    int lonlat;
+    int degrees;
+    bool float32;
+    bool int32;
+    bool check;
+} angle_params;
+
+// Generic angle_to_pixel kernel.  The input dtype and angle convention are
+// compile-time constants in each of the instantiations below, so that no
+// per-element branching on them remains.
+static HPG_ALWAYS_INLINE void angle_to_pixel_kernel_impl(hpgeom_iter_chunk *chunk,
+                                                         bool float32, bool lonlat,
+                                                         bool degrees) {
+    const angle_params *params = (const angle_params *)chunk->params;
+    char **dataptrarray = chunk->dataptrarray;
+    npy_intp *strides = chunk->strides;
+    int64_t nside;
+    int64_t last_nside = -1;
+    hpx_cache cache;
+    bool started = false;
+    double abuf[HPG_BLOCK_SIZE], bbuf[HPG_BLOCK_SIZE];
+    double thetabuf[HPG_BLOCK_SIZE], phibuf[HPG_BLOCK_SIZE];
+    int64_t pixbuf[HPG_BLOCK_SIZE];
+    healpix_info hpx;
+
+    hpx_cache_init(&cache);
+    do {
+        char *nside_p = dataptrarray[0];
+        char *a_p = dataptrarray[1];
+        char *b_p = dataptrarray[2];
+        char *pix_p = dataptrarray[3];
+        npy_intp count = *chunk->innersizeptr;
+        bool contiguous_out = !params->int32 && (strides[3] == sizeof(int64_t));
+        // Contiguous double inputs are used in place rather than being
+        // copied into the block buffers.
+        bool contiguous_in = !float32 && (strides[1] == sizeof(double)) &&
+                             (strides[2] == sizeof(double));
+
+        // Angles are checked and converted a block at a time, and each run
+        // of constant nside within the block is pixelized with ang2pix_batch.
+        while (count > 0) {
+            npy_intp nblock = (count < HPG_BLOCK_SIZE) ? count : HPG_BLOCK_SIZE;
+            int64_t *outpix = contiguous_out ? (int64_t *)pix_p : pixbuf;
+            const double *a = contiguous_in ? (const double *)a_p : abuf;
+            const double *b = contiguous_in ? (const double *)b_p : bbuf;
+            const double *theta, *phi;
+            npy_intp run_start = 0;
+
+            if (!contiguous_in) {
+                for (npy_intp i = 0; i < nblock; i++) {
+                    abuf[i] = hpgeom_read_coord(a_p + i * strides[1], float32);
+                    bbuf[i] = hpgeom_read_coord(b_p + i * strides[2], float32);
+                }
+            }
+
+            // The whole block is validated before it is converted.
+            if (lonlat) {
+                if (params->check &&
+                    !hpgeom_check_lonlat_array(a, b, nblock, degrees, chunk->err)) {
+                    chunk->status = 0;
+                    return;
+                }
+                hpgeom_lonlat_to_thetaphi_array(a, b, thetabuf, phibuf, nblock, degrees);
+                theta = thetabuf;
+                phi = phibuf;
+            } else {
+                if (params->check && !hpgeom_check_theta_phi_array(a, b, nblock, chunk->err)) {
+                    chunk->status = 0;
+                    return;
+                }
+                theta = a;
+                phi = b;
+            }
+
+            for (npy_intp i = 0; i < nblock; i++) {
+                nside = *(int64_t *)(nside_p + i * strides[0]);
+
+                if ((!started) || (nside != last_nside)) {
+                    if (i > run_start) {
+                        ang2pix_batch(&hpx, &theta[run_start], &phi[run_start],
+                                      &outpix[run_start], i - run_start);
+                    }
+                    run_start = i;
+                    if (!hpgeom_check_nside(nside, params->scheme, chunk->err) ||
+                        (params->int32 && !hpgeom_check_nside_int32(nside, chunk->err))) {
+                        chunk->status = 0;
+                        return;
+                    }
+                    hpx = healpix_info_cached(&cache, nside, params->scheme);
+                    last_nside = nside;
+                    started = true;
+                }
+                // A constant nside only needs to be looked at once.
+                if (strides[0] == 0) break;
+            }
+            ang2pix_batch(&hpx, &theta[run_start], &phi[run_start], &outpix[run_start],
+                          nblock - run_start);
+
+            if (params->int32) {
+                for (npy_intp i = 0; i < nblock; i++) {
+                    *(int32_t *)(pix_p + i * strides[3]) = (int32_t)pixbuf[i];
+                }
+            } else if (!contiguous_out) {
+                for (npy_intp i = 0; i < nblock; i++) {
+                    *(int64_t *)(pix_p + i * strides[3]) = pixbuf[i];
+                }
+            }
+
+            nside_p += nblock * strides[0];
+            a_p += nblock * strides[1];
+            b_p += nblock * strides[2];
+            pix_p += nblock * strides[3];
+            count -= nblock;
+        }
+    } while (chunk->iternext(chunk->iter));
+}
+
+#define ANGLE_TO_PIXEL_KERNEL(name, float32, lonlat, degrees)        \
+    static void name(hpgeom_iter_chunk *chunk) {                     \
+        angle_to_pixel_kernel_impl(chunk, float32, lonlat, degrees); \
+    }
+
+ANGLE_TO_PIXEL_KERNEL(angle_to_pixel_kernel_f64_thetaphi, false, false, false)
+ANGLE_TO_PIXEL_KERNEL(angle_to_pixel_kernel_f64_lonlat_rad, false, true, false)
+ANGLE_TO_PIXEL_KERNEL(angle_to_pixel_kernel_f64_lonlat_deg, false, true, true)
+ANGLE_TO_PIXEL_KERNEL(angle_to_pixel_kernel_f32_thetaphi, true, false, false)
+ANGLE_TO_PIXEL_KERNEL(angle_to_pixel_kernel_f32_lonlat_rad, true, true, false)
+ANGLE_TO_PIXEL_KERNEL(angle_to_pixel_kernel_f32_lonlat_deg, true, true, true)
+
+#undef ANGLE_TO_PIXEL_KERNEL
+
+// Indexed by [float32][angle convention], see hpgeom_angle_mode().
+static const hpgeom_chunk_kernel angle_to_pixel_kernels[2][3] = {
+    {angle_to_pixel_kernel_f64_thetaphi, angle_to_pixel_kernel_f64_lonlat_rad,
+     angle_to_pixel_kernel_f64_lonlat_deg},
+    {angle_to_pixel_kernel_f32_thetaphi, angle_to_pixel_kernel_f32_lonlat_rad,
+     angle_to_pixel_kernel_f32_lonlat_deg}};
+
 static PyObject *angle_to_pixel(PyObject *dummy, PyObject *args, PyObject *kwargs) {
     PyObject *nside_obj = NULL, *a_obj = NULL, *b_obj = NULL;
     PyObject *nside_arr = NULL, *a_arr = NULL, *b_arr = NULL;
     PyObject *pix_arr = NULL;
+    PyObject *out_obj = NULL, *out = NULL;
 
     NpyIter *iter = NULL;
 
     int lonlat = 1;
     int nest = 1;
     int degrees = 1;
-    static char *kwlist[] = {"nside", "a", "b", "lonlat", "nest", "degrees", NULL};
-
-    double theta, phi;
-    healpix_info hpx;
+    int n_threads = 0;
+    int check = 1;
+    PyArray_Descr *dtype = NULL;
+    static char *kwlist[] = {"nside",     "a",     "b",     "lonlat", "nest", "degrees",
+                             "n_threads", "dtype", "check", "out",    NULL};
+    int out_types[1];
+
+    angle_params params;
+    hpgeom_chunk_kernel kernel;
+    int coord_type;
+    int status;
     char err[ERR_SIZE];
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|ppp", kwlist, &nside_obj, &a_obj,
-                                     &b_obj, &lonlat, &nest, &degrees))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|pppiO&pO", kwlist, &nside_obj,
+                                     &a_obj, &b_obj, &lonlat, &nest, &degrees, &n_threads,
+                                     PyArray_DescrConverter2, &dtype, &check, &out_obj))
         goto fail;
+    if (!hpgeom_pixel_dtype(dtype, &out_types[0])) goto fail;
+    if (!hpgeom_parse_out(out_obj, 1, out_types, &out)) goto fail;
+
+    PyObject *coord_objs[2] = {a_obj, b_obj};
+    coord_type = hpgeom_coord_type(coord_objs, 2);
 
     nside_arr =
         PyArray_FROM_OTF(nside_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
     if (nside_arr == NULL) goto fail;
-    a_arr = PyArray_FROM_OTF(a_obj, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    a_arr = PyArray_FROM_OTF(a_obj, coord_type, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
     if (a_arr == NULL) goto fail;
-    b_arr = PyArray_FROM_OTF(b_obj, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    b_arr = PyArray_FROM_OTF(b_obj, coord_type, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
     if (b_arr == NULL) goto fail;
 
-    // The input arrays are nside_arr (int64_t), a_arr (double), b_arr (double).
-    // The output array is pix_arr (int64_t).
+    // The input arrays are nside_arr (int64_t), a_arr, b_arr (double or float).
+    // The output array is pix_arr (int64_t or int32_t).
     PyArrayObject *op[4];
     npy_uint32 op_flags[4];
     PyArray_Descr *op_dtypes[4];
-    NpyIter_IterNextFunc *iternext;
-    char **dataptrarray;
 
     op[0] = (PyArrayObject *)nside_arr;
     op_flags[0] = NPY_ITER_READONLY;
@@ -124,64 +590,37 @@ static PyObject *angle_to_pixel(PyObject *dummy, PyObject *args, PyObject *kwarg
     op[2] = (PyArrayObject *)b_arr;
     op_flags[2] = NPY_ITER_READONLY;
     op_dtypes[2] = NULL;
-    op[3] = NULL;
-    op_flags[3] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
-    op_dtypes[3] = PyArray_DescrFromType(NPY_INT64);
-
-    iter = NpyIter_MultiNew(4, op, NPY_ITER_ZEROSIZE_OK, NPY_KEEPORDER, NPY_NO_CASTING,
-                            op_flags, op_dtypes);
+    op[3] = (PyArrayObject *)out;
+    op_flags[3] = HPG_OUT_OP_FLAGS(out);
+    op_dtypes[3] = PyArray_DescrFromType(out_types[0]);
+
+    // The external loop feeds blocks of angles to the ang2pix_batch kernel.
+    iter = NpyIter_MultiNew(4, op,
+                            NPY_ITER_ZEROSIZE_OK | NPY_ITER_RANGED | NPY_ITER_EXTERNAL_LOOP |
+                                NPY_ITER_BUFFERED | NPY_ITER_GROWINNER,
+                            NPY_KEEPORDER, NPY_NO_CASTING, op_flags, op_dtypes);
     if (iter == NULL) {
-        PyErr_SetString(PyExc_ValueError,
-                        "nside, a, b arrays could not be broadcast together.");
+        // A mismatched out array keeps numpy's more specific message.
+        if (out == NULL) {
+            PyErr_SetString(PyExc_ValueError,
+                            "nside, a, b arrays could not be broadcast together.");
+        }
         goto fail;
     }
 
-    iternext = NpyIter_GetIterNext(iter, NULL);
-    dataptrarray = NpyIter_GetDataPtrArray(iter);
-
-    enum Scheme scheme;
-    if (nest) {
-        scheme = NEST;
-    } else {
-        scheme = RING;
-    }
-
-    // Check for zero-size before entering loop.
-    if (NpyIter_GetIterSize(iter) > 0) {
-        int64_t *nside;
-        double *a, *b;
-        int64_t *outpix;
-        int64_t last_nside = -1;
-        bool started = false;
-        do {
-            nside = (int64_t *)dataptrarray[0];
-            a = (double *)dataptrarray[1];
-            b = (double *)dataptrarray[2];
-            outpix = (int64_t *)dataptrarray[3];
-
-            if ((!started) || (*nside != last_nside)) {
-                if (!hpgeom_check_nside(*nside, scheme, err)) {
-                    PyErr_SetString(PyExc_ValueError, err);
-                    goto fail;
-                }
-                hpx = healpix_info_from_nside(*nside, scheme);
-                started = true;
-            }
-            if (lonlat) {
-                if (!hpgeom_lonlat_to_thetaphi(*a, *b, &theta, &phi, (bool)degrees, err)) {
-                    PyErr_SetString(PyExc_ValueError, err);
-                    goto fail;
-                }
-            } else {
-                if (!hpgeom_check_theta_phi(*a, *b, err)) {
-                    PyErr_SetString(PyExc_ValueError, err);
-                    goto fail;
-                }
-                theta = *a;
-                phi = *b;
-            }
-            *outpix = ang2pix(&hpx, theta, phi);
-        } while (iternext(iter));
+    params.scheme = nest ? NEST : RING;
+    params.lonlat = lonlat;
+    params.degrees = degrees;
+    params.float32 = (coord_type == NPY_FLOAT32);
+    params.int32 = (out_types[0] == NPY_INT32);
+    params.check = check;
+
+    kernel = angle_to_pixel_kernels[params.float32][hpgeom_angle_mode(lonlat, degrees)];
+    status = hpgeom_iter_run(iter, n_threads, kernel, &params, err);
+    if (status < 0) goto fail;
+    if (status == 0) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
     }
 
     // The reference to the automatically generated output array is owned
@@ -194,18 +633,20 @@ static PyObject *angle_to_pixel(PyObject *dummy, PyObject *args, PyObject *kwarg
     Py_DECREF(nside_arr);
     Py_DECREF(a_arr);
     Py_DECREF(b_arr);
+    Py_XDECREF(dtype);
     if (NpyIter_Deallocate(iter) != NPY_SUCCEED) {
         iter = NULL;
         goto fail;
     }
 
-    return PyArray_Return((PyArrayObject *)pix_arr);
+    return hpgeom_return_out(pix_arr, out);
 
 fail:
     Py_XDECREF(nside_arr);
     Py_XDECREF(a_arr);
     Py_XDECREF(b_arr);
     Py_XDECREF(pix_arr);
+    Py_XDECREF(dtype);
     if (iter != NULL) {
         NpyIter_Deallocate(iter);
     }
@@ -214,13 +655,15 @@ fail:
 }
 
 PyDoc_STRVAR(pixel_to_angle_doc,
-             "pixel_to_angle(nside, pix, nest=True, lonlat=True, degrees=True)\n"
+             "pixel_to_angle(nside, pix, nest=True, lonlat=True, degrees=True, n_threads=0,\n"
+             "               dtype=None, check=True, out=None)\n"
              "--\n\n"
              "Convert pixels to angles.\n"
              "\n"
              "Parameters\n"
              "----------\n" NSIDE_DOC_PAR PIX_DOC_PAR NEST_DOC_PAR LONLAT_DOC_PAR
-                 DEGREES_DOC_PAR
+                 DEGREES_DOC_PAR N_THREADS_DOC_PAR COORD_DTYPE_DOC_PAR CHECK_DOC_PAR
+                     OUT_DOC_PAR("`tuple` [`np.ndarray`] (2,)")
              "\n"
              "Returns\n"
              "-------\n" AB_DOC_PAR
@@ -231,25 +674,168 @@ PyDoc_STRVAR(pixel_to_angle_doc,
              "    If pixel values are out of range, or arrays cannot be broadcast"
              "    together.\n");
 
+// Check (if requested) and convert a run of n pixels with a single nside.
+static inline int pixel_to_angle_run(const angle_params *params, healpix_info *hpx,
+                                     const int64_t *pix, double *theta, double *phi,
+                                     npy_intp n, char *err) {
+    if (n == 0) return 1;
+    if (params->check && !hpgeom_check_pixel_array(hpx, pix, n, err)) return 0;
+    pix2ang_batch(hpx, pix, theta, phi, n);
+    return 1;
+}
+
+// Generic pixel_to_angle kernel, instantiated below for each output dtype
+// and angle convention as for angle_to_pixel.
+static HPG_ALWAYS_INLINE void pixel_to_angle_kernel_impl(hpgeom_iter_chunk *chunk,
+                                                         bool float32, bool lonlat,
+                                                         bool degrees) {
+    const angle_params *params = (const angle_params *)chunk->params;
+    char **dataptrarray = chunk->dataptrarray;
+    npy_intp *strides = chunk->strides;
+    int64_t nside;
+    double a, b;
+    int64_t last_nside = -1;
+    hpx_cache cache;
+    bool started = false;
+    int64_t pixbuf[HPG_BLOCK_SIZE];
+    double thetabuf[HPG_BLOCK_SIZE], phibuf[HPG_BLOCK_SIZE];
+    healpix_info hpx;
+
+    hpx_cache_init(&cache);
+    do {
+        char *nside_p = dataptrarray[0];
+        char *pix_p = dataptrarray[1];
+        char *a_p = dataptrarray[2];
+        char *b_p = dataptrarray[3];
+        npy_intp count = *chunk->innersizeptr;
+        // Contiguous pixels are passed straight to pix2ang_batch, and
+        // contiguous theta/phi outputs are filled directly.
+        bool contiguous_in = (strides[1] == sizeof(int64_t));
+        bool contiguous_out = !lonlat && !float32 &&
+                              (strides[2] == sizeof(double)) && (strides[3] == sizeof(double));
+
+        // Pixels are converted a block at a time, and each run of constant
+        // nside within the block is checked and converted at once.
+        while (count > 0) {
+            npy_intp nblock = (count < HPG_BLOCK_SIZE) ? count : HPG_BLOCK_SIZE;
+            const int64_t *pix = contiguous_in ? (const int64_t *)pix_p : pixbuf;
+            double *theta = contiguous_out ? (double *)a_p : thetabuf;
+            double *phi = contiguous_out ? (double *)b_p : phibuf;
+            npy_intp run_start = 0;
+
+            if (!contiguous_in) {
+                for (npy_intp i = 0; i < nblock; i++) {
+                    pixbuf[i] = *(int64_t *)(pix_p + i * strides[1]);
+                }
+            }
+
+            for (npy_intp i = 0; i < nblock; i++) {
+                nside = *(int64_t *)(nside_p + i * strides[0]);
+
+                if ((!started) || (nside != last_nside)) {
+                    if (started && !pixel_to_angle_run(params, &hpx, &pix[run_start],
+                                                       &theta[run_start], &phi[run_start],
+                                                       i - run_start, chunk->err)) {
+                        chunk->status = 0;
+                        return;
+                    }
+                    run_start = i;
+                    if (!hpgeom_check_nside(nside, params->scheme, chunk->err)) {
+                        chunk->status = 0;
+                        return;
+                    }
+                    hpx = healpix_info_cached(&cache, nside, params->scheme);
+                    last_nside = nside;
+                    started = true;
+                }
+                // A constant nside only needs to be looked at once.
+                if (strides[0] == 0) break;
+            }
+            if (!pixel_to_angle_run(params, &hpx, &pix[run_start], &theta[run_start],
+                                    &phi[run_start], nblock - run_start, chunk->err)) {
+                chunk->status = 0;
+                return;
+            }
+
+            if (!contiguous_out) {
+                for (npy_intp i = 0; i < nblock; i++) {
+                    if (lonlat) {
+                        // As hpgeom_thetaphi_to_lonlat, without range checks since
+                        // theta/phi will always be within range on output.
+                        a = phi[i];
+                        b = -(theta[i] - HPG_HALFPI);
+                        if (degrees) {
+                            a *= HPG_R2D;
+                            b *= HPG_R2D;
+                        }
+                    } else {
+                        a = theta[i];
+                        b = phi[i];
+                    }
+                    hpgeom_write_coord(a_p + i * strides[2], a, float32);
+                    hpgeom_write_coord(b_p + i * strides[3], b, float32);
+                }
+            }
+
+            nside_p += nblock * strides[0];
+            pix_p += nblock * strides[1];
+            a_p += nblock * strides[2];
+            b_p += nblock * strides[3];
+            count -= nblock;
+        }
+    } while (chunk->iternext(chunk->iter));
+}
+
+#define PIXEL_TO_ANGLE_KERNEL(name, float32, lonlat, degrees)        \
+    static void name(hpgeom_iter_chunk *chunk) {                     \
+        pixel_to_angle_kernel_impl(chunk, float32, lonlat, degrees); \
+    }
+
+PIXEL_TO_ANGLE_KERNEL(pixel_to_angle_kernel_f64_thetaphi, false, false, false)
+PIXEL_TO_ANGLE_KERNEL(pixel_to_angle_kernel_f64_lonlat_rad, false, true, false)
+PIXEL_TO_ANGLE_KERNEL(pixel_to_angle_kernel_f64_lonlat_deg, false, true, true)
+PIXEL_TO_ANGLE_KERNEL(pixel_to_angle_kernel_f32_thetaphi, true, false, false)
+PIXEL_TO_ANGLE_KERNEL(pixel_to_angle_kernel_f32_lonlat_rad, true, true, false)
+PIXEL_TO_ANGLE_KERNEL(pixel_to_angle_kernel_f32_lonlat_deg, true, true, true)
+
+#undef PIXEL_TO_ANGLE_KERNEL
+
+static const hpgeom_chunk_kernel pixel_to_angle_kernels[2][3] = {
+    {pixel_to_angle_kernel_f64_thetaphi, pixel_to_angle_kernel_f64_lonlat_rad,
+     pixel_to_angle_kernel_f64_lonlat_deg},
+    {pixel_to_angle_kernel_f32_thetaphi, pixel_to_angle_kernel_f32_lonlat_rad,
+     pixel_to_angle_kernel_f32_lonlat_deg}};
+
 static PyObject *pixel_to_angle(PyObject *dummy, PyObject *args, PyObject *kwargs) {
     PyObject *nside_obj = NULL, *pix_obj = NULL;
     PyObject *nside_arr = NULL, *pix_arr = NULL;
     PyObject *a_arr = NULL, *b_arr = NULL;
+    PyObject *out_obj = NULL, *out[2];
 
     NpyIter *iter = NULL;
 
     int lonlat = 1;
     int nest = 1;
     int degrees = 1;
-    static char *kwlist[] = {"nside", "pix", "lonlat", "nest", "degrees", NULL};
-
-    double theta, phi;
-    healpix_info hpx;
+    int n_threads = 0;
+    int check = 1;
+    PyArray_Descr *dtype = NULL;
+    static char *kwlist[] = {"nside",     "pix",   "lonlat", "nest", "degrees",
+                             "n_threads", "dtype", "check",  "out",  NULL};
+    int out_types[2];
+
+    angle_params params;
+    hpgeom_chunk_kernel kernel;
+    int status;
     char err[ERR_SIZE];
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|ppp", kwlist, &nside_obj, &pix_obj,
-                                     &lonlat, &nest, &degrees))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|pppiO&pO", kwlist, &nside_obj,
+                                     &pix_obj, &lonlat, &nest, &degrees, &n_threads,
+                                     PyArray_DescrConverter2, &dtype, &check, &out_obj))
         goto fail;
+    if (!hpgeom_float_dtype(dtype, &out_types[0])) goto fail;
+    out_types[1] = out_types[0];
+    if (!hpgeom_parse_out(out_obj, 2, out_types, out)) goto fail;
 
     nside_arr =
         PyArray_FROM_OTF(nside_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
@@ -258,12 +844,10 @@ static PyObject *pixel_to_angle(PyObject *dummy, PyObject *args, PyObject *kwarg
     if (pix_arr == NULL) goto fail;
 
     // The input arrays are nside_arr (int64_t), pix_arr (int64_t).
-    // The output arrays are a_arr (double), b_arr (double).
+    // The output arrays are a_arr, b_arr (double or float).
     PyArrayObject *op[4];
     npy_uint32 op_flags[4];
     PyArray_Descr *op_dtypes[4];
-    NpyIter_IterNextFunc *iternext;
-    char **dataptrarray;
 
     op[0] = (PyArrayObject *)nside_arr;
     op_flags[0] = NPY_ITER_READONLY;
@@ -271,66 +855,38 @@ static PyObject *pixel_to_angle(PyObject *dummy, PyObject *args, PyObject *kwarg
     op[1] = (PyArrayObject *)pix_arr;
     op_flags[1] = NPY_ITER_READONLY;
     op_dtypes[1] = NULL;
-    op[2] = NULL;
-    op_flags[2] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
-    op_dtypes[2] = PyArray_DescrFromType(NPY_DOUBLE);
-    op[3] = NULL;
-    op_flags[3] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
-    op_dtypes[3] = PyArray_DescrFromType(NPY_DOUBLE);
-
-    iter = NpyIter_MultiNew(4, op, NPY_ITER_ZEROSIZE_OK, NPY_KEEPORDER, NPY_NO_CASTING,
-                            op_flags, op_dtypes);
+    op[2] = (PyArrayObject *)out[0];
+    op_flags[2] = HPG_OUT_OP_FLAGS(out[0]);
+    op_dtypes[2] = PyArray_DescrFromType(out_types[0]);
+    op[3] = (PyArrayObject *)out[1];
+    op_flags[3] = HPG_OUT_OP_FLAGS(out[1]);
+    op_dtypes[3] = PyArray_DescrFromType(out_types[1]);
+
+    // The external loop feeds blocks of pixels to the pix2ang_batch kernel.
+    iter = NpyIter_MultiNew(4, op,
+                            NPY_ITER_ZEROSIZE_OK | NPY_ITER_RANGED | NPY_ITER_EXTERNAL_LOOP |
+                                NPY_ITER_BUFFERED | NPY_ITER_GROWINNER,
+                            NPY_KEEPORDER, NPY_NO_CASTING, op_flags, op_dtypes);
     if (iter == NULL) {
-        PyErr_SetString(PyExc_ValueError,
-                        "nside, pix arrays could not be broadcast together.");
+        if (out[0] == NULL) {
+            PyErr_SetString(PyExc_ValueError,
+                            "nside, pix arrays could not be broadcast together.");
+        }
         goto fail;
     }
 
-    iternext = NpyIter_GetIterNext(iter, NULL);
-    dataptrarray = NpyIter_GetDataPtrArray(iter);
-
-    enum Scheme scheme;
-    if (nest) {
-        scheme = NEST;
-    } else {
-        scheme = RING;
-    }
-
-    // Check for zero-size before entering loop.
-    if (NpyIter_GetIterSize(iter) > 0) {
-        int64_t *nside;
-        int64_t *pix;
-        double *outa, *outb;
-        int64_t last_nside = -1;
-        bool started = false;
-        do {
-            nside = (int64_t *)dataptrarray[0];
-            pix = (int64_t *)dataptrarray[1];
-            outa = (double *)dataptrarray[2];
-            outb = (double *)dataptrarray[3];
+    params.scheme = nest ? NEST : RING;
+    params.lonlat = lonlat;
+    params.degrees = degrees;
+    params.float32 = (out_types[0] == NPY_FLOAT32);
+    params.check = check;
 
-            if ((!started) || (*nside != last_nside)) {
-                if (!hpgeom_check_nside(*nside, scheme, err)) {
-                    PyErr_SetString(PyExc_ValueError, err);
-                    goto fail;
-                }
-                hpx = healpix_info_from_nside(*nside, scheme);
-                started = true;
-            }
-            if (!hpgeom_check_pixel(&hpx, *pix, err)) {
-                PyErr_SetString(PyExc_ValueError, err);
-                goto fail;
-            }
-            pix2ang(&hpx, *pix, &theta, &phi);
-            if (lonlat) {
-                // We can skip error checking since theta/phi will always be
-                // within range on output.
-                hpgeom_thetaphi_to_lonlat(theta, phi, outa, outb, (bool)degrees, false, err);
-            } else {
-                *outa = theta;
-                *outb = phi;
-            }
-        } while (iternext(iter));
+    kernel = pixel_to_angle_kernels[params.float32][hpgeom_angle_mode(lonlat, degrees)];
+    status = hpgeom_iter_run(iter, n_threads, kernel, &params, err);
+    if (status < 0) goto fail;
+    if (status == 0) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
     }
 
     a_arr = (PyObject *)NpyIter_GetOperandArray(iter)[2];
@@ -340,20 +896,22 @@ static PyObject *pixel_to_angle(PyObject *dummy, PyObject *args, PyObject *kwarg
 
     Py_DECREF(nside_arr);
     Py_DECREF(pix_arr);
+    Py_XDECREF(dtype);
     if (NpyIter_Deallocate(iter) != NPY_SUCCEED) {
         iter = NULL;
         goto fail;
     }
 
     PyObject *retval = PyTuple_New(2);
-    PyTuple_SET_ITEM(retval, 0, PyArray_Return((PyArrayObject *)a_arr));
-    PyTuple_SET_ITEM(retval, 1, PyArray_Return((PyArrayObject *)b_arr));
+    PyTuple_SET_ITEM(retval, 0, hpgeom_return_out(a_arr, out[0]));
+    PyTuple_SET_ITEM(retval, 1, hpgeom_return_out(b_arr, out[1]));
 
     return retval;
 
 fail:
     Py_XDECREF(nside_arr);
     Py_XDECREF(pix_arr);
+    Py_XDECREF(dtype);
     Py_XDECREF(a_arr);
     Py_XDECREF(b_arr);
     if (iter != NULL) {
@@ -363,40 +921,47 @@ fail:
     return NULL;
 }
 
-static PyObject *create_query_return_arr(struct i64rangeset *pixset, int return_pixel_ranges,
-                                         int convert, healpix_info *hpx) {
-    // Convenience routine to share code between query returns.
+PyObject *create_query_return_arr(i64rangeset *pixset, int return_pixel_ranges, int typenum) {
+    // Convenience routine to share code between query returns.  The pixels
+    // or ranges are returned as typenum, which is NPY_INT64 or NPY_INT32.
 
-    PyObject *return_arr;
+    PyObject *return_arr = NULL;
+    NPY_BEGIN_THREADS_DEF;
 
     if (return_pixel_ranges) {
         npy_intp dims[2];
         dims[0] = pixset->stack->size / 2;
         dims[1] = 2;
 
-        return_arr = PyArray_SimpleNew(2, dims, NPY_INT64);
+        return_arr = PyArray_SimpleNew(2, dims, typenum);
         if (return_arr == NULL) goto fail;
-        int64_t *range_data = (int64_t *)PyArray_DATA((PyArrayObject *)return_arr);
 
-        memcpy(range_data, pixset->stack->data, pixset->stack->size * sizeof(int64_t));
+        if (typenum == NPY_INT32) {
+            int32_t *range_data = (int32_t *)PyArray_DATA((PyArrayObject *)return_arr);
+            for (size_t i = 0; i < pixset->stack->size; i++) {
+                range_data[i] = (int32_t)pixset->stack->data[i];
+            }
+        } else {
+            int64_t *range_data = (int64_t *)PyArray_DATA((PyArrayObject *)return_arr);
+            memcpy(range_data, pixset->stack->data, pixset->stack->size * sizeof(int64_t));
+        }
     } else {
         size_t npix = i64rangeset_npix(pixset);
         npy_intp dims[1];
         dims[0] = (npy_intp)npix;
 
-        return_arr = PyArray_SimpleNew(1, dims, NPY_INT64);
+        return_arr = PyArray_SimpleNew(1, dims, typenum);
         if (return_arr == NULL) goto fail;
-        int64_t *pix_data = (int64_t *)PyArray_DATA((PyArrayObject *)return_arr);
-
-        i64rangeset_fill_buffer(pixset, npix, pix_data);
-
-        if (convert) {
-            // Convert from nest to ring
-            for (size_t i = 0; i < npix; i++) pix_data[i] = nest2ring(hpx, pix_data[i]);
 
-            // And sort the pixels, as is expected.
-            PyArray_Sort((PyArrayObject *)return_arr, 0, NPY_QUICKSORT);
+        NPY_BEGIN_THREADS;
+        if (typenum == NPY_INT32) {
+            int32_t *pix_data = (int32_t *)PyArray_DATA((PyArrayObject *)return_arr);
+            i64rangeset_fill_buffer_int32(pixset, npix, pix_data);
+        } else {
+            int64_t *pix_data = (int64_t *)PyArray_DATA((PyArrayObject *)return_arr);
+            i64rangeset_fill_buffer(pixset, npix, pix_data);
         }
+        NPY_END_THREADS;
     }
 
     return return_arr;
@@ -407,9 +972,37 @@ fail:
     return NULL;
 }
 
+// The result of a query as a MOC if return_moc is set, which takes ownership
+// of *pixset, and otherwise as the array from create_query_return_arr().
+static PyObject *create_query_return(i64rangeset **pixset, const healpix_info *hpx,
+                                     int return_pixel_ranges, int return_moc, int typenum) {
+    if (return_moc) {
+        i64rangeset *rangeset = *pixset;
+        *pixset = NULL;
+        return MOC_from_i64rangeset(rangeset, hpx->order);
+    }
+
+    PyObject *return_arr = create_query_return_arr(*pixset, return_pixel_ranges, typenum);
+    if (return_arr == NULL) return NULL;
+
+    return PyArray_Return((PyArrayObject *)return_arr);
+}
+
+// Check the return_moc option of a query, setting a ValueError if it is not
+// allowed.
+static int hpgeom_check_return_moc(int return_moc, int nest, int return_pixel_ranges) {
+    if (return_moc && (!nest || return_pixel_ranges)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "return_moc requires nest=True and return_pixel_ranges=False.");
+        return 0;
+    }
+    return 1;
+}
+
 PyDoc_STRVAR(query_circle_doc,
              "query_circle(nside, a, b, radius, inclusive=False, fact=4, nest=True, "
-             "lonlat=True, degrees=True)\n"
+             "lonlat=True, degrees=True, return_pixel_ranges=False, dtype=None, "
+             "n_threads=0, return_moc=False)\n"
              "--\n\n"
              "Returns pixels whose centers lie within the circle defined by a, b\n"
              "([lon, lat] if lonlat=True otherwise [theta, phi]) and radius (in \n"
@@ -426,15 +1019,19 @@ PyDoc_STRVAR(query_circle_doc,
              "    within the circle. If True, return all pixels that overlap with\n"
              "    the circle. This is an approximation and may return a few extra\n"
              "    pixels.\n" FACT_DOC_PAR NEST_DOC_PAR LONLAT_DOC_PAR DEGREES_DOC_PAR
-                 RETURN_PIXEL_RANGES_PAR
+                 RETURN_PIXEL_RANGES_PAR PIX_DTYPE_DOC_PAR QUERY_N_THREADS_DOC_PAR
+                     RETURN_MOC_PAR
              "\n"
              "Returns\n"
              "-------\n"
              "pixels : `np.ndarray` (N,)\n"
-             "    Array of pixels (`np.int64`) which cover the circle.\n"
+             "    Array of pixels (`np.int64` or `np.int32`) which cover the circle.\n"
              "    (if return_pixel_ranges is False) or\n"
              "pixel_ranges : `np.ndarray` (M, 2)\n"
              "    Array of pixel ranges, [lo, high), which cover the circle.\n"
+             "    (if return_pixel_ranges is True) or\n"
+             "moc : `MOC`\n"
+             "    Multi-order coverage of the pixels (if return_moc is True).\n"
              "\n"
              "Raises\n"
              "------\n"
@@ -445,7 +1042,8 @@ PyDoc_STRVAR(query_circle_doc,
              "\n"
              "Notes\n"
              "-----\n"
-             "This method is more efficient with ring ordering.\n"
+             "This method is more efficient with ring ordering, for which n_threads\n"
+             "is not used.\n"
              "For inclusive=True, the algorithm may return some pixels which do not overlap\n"
              "with the circle. Higher fact values result in fewer false positives at the\n"
              "expense of increased run time.\n");
@@ -459,24 +1057,26 @@ static PyObject *query_circle(PyObject *dummy, PyObject *args, PyObject *kwargs)
     int lonlat = 1;
     int degrees = 1;
     int return_pixel_ranges = 0;
+    PyArray_Descr *dtype = NULL;
+    int typenum;
+    int n_threads = 0;
+    int return_moc = 0;
     static char *kwlist[] = {"nside", "a",    "b",      "radius",  "inclusive",
                              "fact",  "nest", "lonlat", "degrees", "return_pixel_ranges",
-                             NULL};
+                             "dtype", "n_threads", "return_moc", NULL};
 
     char err[ERR_SIZE];
     int status = 1;
     i64rangeset *pixset = NULL;
+    NPY_BEGIN_THREADS_DEF;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Lddd|plpppp", kwlist, &nside, &a, &b,
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Lddd|plppppO&ip", kwlist, &nside, &a, &b,
                                      &radius, &inclusive, &fact, &nest, &lonlat, &degrees,
-                                     &return_pixel_ranges))
+                                     &return_pixel_ranges, PyArray_DescrConverter2, &dtype,
+                                     &n_threads, &return_moc))
         goto fail;
-
-    if (return_pixel_ranges & ~nest) {
-        PyErr_SetString(PyExc_RuntimeError,
-                        "Can only use return_pixel_ranges with nest ordering.");
-        goto fail;
-    }
+    if (!hpgeom_pixel_dtype(dtype, &typenum)) goto fail;
+    if (!hpgeom_check_return_moc(return_moc, nest, return_pixel_ranges)) goto fail;
 
     double theta, phi;
     if (lonlat) {
@@ -507,7 +1107,8 @@ static PyObject *query_circle(PyObject *dummy, PyObject *args, PyObject *kwargs)
     } else {
         scheme = RING;
     }
-    if (!hpgeom_check_nside(nside, scheme, err)) {
+    if (!hpgeom_check_nside(nside, scheme, err) ||
+        ((typenum == NPY_INT32) && !hpgeom_check_nside_int32(nside, err))) {
         PyErr_SetString(PyExc_ValueError, err);
         goto fail;
     }
@@ -527,33 +1128,523 @@ static PyObject *query_circle(PyObject *dummy, PyObject *args, PyObject *kwargs)
             goto fail;
         }
     }
-    query_disc(&hpx, theta, phi, radius, fact, pixset, &status, err);
+    NPY_BEGIN_THREADS;
+    query_disc(&hpx, theta, phi, radius, fact, n_threads, pixset, &status, err);
+    NPY_END_THREADS;
 
     if (!status) {
         PyErr_SetString(PyExc_RuntimeError, err);
         goto fail;
     }
 
-    PyObject *return_arr = create_query_return_arr(pixset, return_pixel_ranges, 0, &hpx);
+    PyObject *retval =
+        create_query_return(&pixset, &hpx, return_pixel_ranges, return_moc, typenum);
+    if (retval == NULL) goto fail;
 
     i64rangeset_delete(pixset);
+    Py_XDECREF(dtype);
 
-    return PyArray_Return((PyArrayObject *)return_arr);
+    return retval;
 
 fail:
     i64rangeset_delete(pixset);
+    Py_XDECREF(dtype);
 
     return NULL;
 }
 
-PyDoc_STRVAR(query_polygon_doc,
-             "query_polygon(nside, a, b, inclusive=False, fact=4, nest=True, lonlat=True, "
-             "degrees=True)\n"
-             "--\n\n"
-             "Returns pixels whose centers lie within the convex polygon defined by the "
-             "points in a, b\n"
-             "([lon, lat] if lonlat=True, otherwise [theta, phi]) if inclusive is False, or "
-             "which overlap\n"
+// A single query of a batch.  This must fill pixset with the ranges covered by
+// query number index, and must not touch the python API.  ws is a scratch
+// workspace owned by the calling thread.
+typedef void (*hpgeom_query_func)(const void *params, npy_intp index, i64rangeset *pixset,
+                                  query_workspace *ws, int *status, char *err);
+
+// State for running the [istart, iend) slice of a batch of queries.  The
+// number of values returned by each query is stored in counts[index], and
+// the values are appended to the values stack owned by the chunk.  If
+// merge is set the ranges of all the queries are instead merged into
+// their union, and counts is not used.
+typedef struct {
+    hpgeom_query_func func;
+    const void *params;
+    int return_pixel_ranges;
+    int merge;
+    npy_intp istart;
+    npy_intp iend;
+    int64_t *counts;
+    i64stack *values;
+    int status;
+    char err[ERR_SIZE];
+} hpgeom_query_chunk;
+
+static void hpgeom_run_query_chunk(void *arg, int thread_id) {
+    hpgeom_query_chunk *chunk = &((hpgeom_query_chunk *)arg)[thread_id];
+    i64rangeset *pixset = NULL;
+    query_workspace *ws = NULL;
+    i64stack *values = NULL;
+    int return_ranges = chunk->return_pixel_ranges || chunk->merge;
+
+    pixset = i64rangeset_new(&chunk->status, chunk->err);
+    if (!chunk->status) goto cleanup;
+    ws = query_workspace_new(&chunk->status, chunk->err);
+    if (!chunk->status) goto cleanup;
+    values = i64stack_new(0, &chunk->status, chunk->err);
+    if (!chunk->status) goto cleanup;
+    chunk->values = values;
+
+    for (npy_intp i = chunk->istart; i < chunk->iend; i++) {
+        // Reset without releasing the storage, which is reused by every query.
+        pixset->stack->size = 0;
+        chunk->func(chunk->params, i, pixset, ws, &chunk->status, chunk->err);
+        if (!chunk->status) break;
+
+        size_t start = values->size;
+        size_t nval;
+        if (return_ranges) {
+            nval = pixset->stack->size;
+        } else {
+            nval = i64rangeset_npix(pixset);
+        }
+        if (start + nval > values->allocated_size) {
+            size_t newsize = 2 * values->allocated_size;
+            if (newsize < start + nval) newsize = start + nval;
+            i64stack_realloc(values, newsize, &chunk->status, chunk->err);
+            if (!chunk->status) break;
+        }
+        values->size = start + nval;
+
+        int64_t *buf = &values->data[start];
+        if (return_ranges) {
+            memcpy(buf, pixset->stack->data, nval * sizeof(int64_t));
+            if (!chunk->merge) chunk->counts[i] = (int64_t)(nval / 2);
+        } else {
+            i64rangeset_fill_buffer(pixset, nval, buf);
+            chunk->counts[i] = (int64_t)nval;
+        }
+    }
+
+    if (chunk->status && chunk->merge) {
+        values->size = i64ranges_sort_merge(values->data, values->size);
+    }
+
+cleanup:
+    i64rangeset_delete(pixset);
+    query_workspace_delete(ws);
+}
+
+/*
+ * Merge the ranges gathered by each chunk into their union, and return it
+ * as an (M, 2) array of pixel ranges or as a sorted array of pixels.
+ */
+static PyObject *hpgeom_query_union_arr(hpgeom_query_chunk *chunks, int n_threads,
+                                        int return_pixel_ranges, int typenum) {
+    i64stack *ranges = chunks[0].values;
+    size_t total = 0;
+    int status = 1;
+    char err[ERR_SIZE];
+    int i;
+    NPY_BEGIN_THREADS_DEF;
+
+    for (i = 0; i < n_threads; i++) total += chunks[i].values->size;
+
+    NPY_BEGIN_THREADS;
+    if (n_threads > 1) {
+        size_t start = ranges->size;
+        if (total > ranges->allocated_size) {
+            i64stack_realloc(ranges, total, &status, err);
+        }
+        if (status) {
+            ranges->size = total;
+            for (i = 1; i < n_threads; i++) {
+                memcpy(&ranges->data[start], chunks[i].values->data,
+                       chunks[i].values->size * sizeof(int64_t));
+                start += chunks[i].values->size;
+            }
+            ranges->size = i64ranges_sort_merge(ranges->data, ranges->size);
+        }
+    }
+    NPY_END_THREADS;
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    i64rangeset pixset;
+    pixset.stack = ranges;
+
+    return create_query_return_arr(&pixset, return_pixel_ranges, typenum);
+}
+
+/*
+ * Run nquery queries over n_threads threads (0 for the module default),
+ * and gather the results into a tuple of (offsets, values) in compressed
+ * sparse row layout, such that the results of query i are
+ * values[offsets[i]: offsets[i + 1]].  The values are pixels, or an
+ * (M, 2) array of pixel ranges if return_pixel_ranges is set.  If
+ * return_union is set, the union of all the queries is returned instead,
+ * as pixels or pixel ranges.  The pixels or ranges are returned as typenum,
+ * NPY_INT64 or NPY_INT32; the offsets are always NPY_INT64.
+ *
+ * This must be called with the GIL held, and the GIL is released while
+ * the queries run.  Returns NULL with an exception set on failure;
+ * errors from the queries raise a RuntimeError with the message of the
+ * lowest-numbered failing query.
+ */
+static PyObject *hpgeom_run_query_batch(npy_intp nquery, int n_threads, hpgeom_query_func func,
+                                        const void *params, int return_pixel_ranges,
+                                        int return_union, int typenum) {
+    hpgeom_query_chunk *chunks = NULL;
+    PyObject *offsets_arr = NULL;
+    PyObject *values_arr = NULL;
+    PyObject *retval = NULL;
+    int64_t *offsets = NULL;
+    int64_t total = 0;
+    int i;
+    NPY_BEGIN_THREADS_DEF;
+
+    npy_intp dims[2];
+    if (!return_union) {
+        dims[0] = nquery + 1;
+        offsets_arr = PyArray_ZEROS(1, dims, NPY_INT64, 0);
+        if (offsets_arr == NULL) goto cleanup;
+        offsets = (int64_t *)PyArray_DATA((PyArrayObject *)offsets_arr);
+    }
+
+    n_threads = hpgeom_resolve_threads(n_threads, (int64_t)nquery, HPGEOM_MIN_QUERY_CHUNK);
+
+    chunks = (hpgeom_query_chunk *)PyMem_Calloc(n_threads, sizeof(hpgeom_query_chunk));
+    if (chunks == NULL) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    for (i = 0; i < n_threads; i++) {
+        chunks[i].func = func;
+        chunks[i].params = params;
+        chunks[i].return_pixel_ranges = return_pixel_ranges;
+        chunks[i].merge = return_union;
+        chunks[i].istart = (nquery * i) / n_threads;
+        chunks[i].iend = (nquery * (i + 1)) / n_threads;
+        // Counts are stored one past the query index, ready for the cumulative sum.
+        chunks[i].counts = return_union ? NULL : &offsets[1];
+        chunks[i].status = 1;
+    }
+
+    NPY_BEGIN_THREADS;
+    if (n_threads == 1) {
+        hpgeom_run_query_chunk(chunks, 0);
+    } else {
+        hpgeom_parallel_for(n_threads, hpgeom_run_query_chunk, chunks);
+    }
+    NPY_END_THREADS;
+
+    for (i = 0; i < n_threads; i++) {
+        if (!chunks[i].status) {
+            PyErr_SetString(PyExc_RuntimeError, chunks[i].err);
+            goto cleanup;
+        }
+    }
+
+    if (return_union) {
+        retval = hpgeom_query_union_arr(chunks, n_threads, return_pixel_ranges, typenum);
+        goto cleanup;
+    }
+
+    for (npy_intp j = 0; j < nquery; j++) {
+        total += offsets[j + 1];
+        offsets[j + 1] = total;
+    }
+
+    if (return_pixel_ranges) {
+        dims[0] = (npy_intp)total;
+        dims[1] = 2;
+        values_arr = PyArray_SimpleNew(2, dims, typenum);
+    } else {
+        dims[0] = (npy_intp)total;
+        values_arr = PyArray_SimpleNew(1, dims, typenum);
+    }
+    if (values_arr == NULL) goto cleanup;
+
+    if (typenum == NPY_INT32) {
+        // The nside was checked, so all values fit.
+        int32_t *values_data = (int32_t *)PyArray_DATA((PyArrayObject *)values_arr);
+        for (i = 0; i < n_threads; i++) {
+            for (size_t j = 0; j < chunks[i].values->size; j++) {
+                *values_data++ = (int32_t)chunks[i].values->data[j];
+            }
+        }
+    } else {
+        char *values_data = (char *)PyArray_DATA((PyArrayObject *)values_arr);
+        for (i = 0; i < n_threads; i++) {
+            size_t nbytes = chunks[i].values->size * sizeof(int64_t);
+            if (nbytes > 0) memcpy(values_data, chunks[i].values->data, nbytes);
+            values_data += nbytes;
+        }
+    }
+
+    retval = PyTuple_New(2);
+    if (retval == NULL) goto cleanup;
+    PyTuple_SET_ITEM(retval, 0, offsets_arr);
+    PyTuple_SET_ITEM(retval, 1, values_arr);
+    offsets_arr = NULL;
+    values_arr = NULL;
+
+cleanup:
+    if (chunks != NULL) {
+        for (i = 0; i < n_threads; i++) i64stack_delete(chunks[i].values);
+        PyMem_Free(chunks);
+    }
+    Py_XDECREF(offsets_arr);
+    Py_XDECREF(values_arr);
+
+    return retval;
+}
+
+typedef struct {
+    healpix_info *hpx;
+    const double *theta;
+    const double *phi;
+    const double *radius;
+    int fact;
+} query_circle_params;
+
+static void query_circle_func(const void *params, npy_intp index, i64rangeset *pixset,
+                              query_workspace *ws, int *status, char *err) {
+    const query_circle_params *p = (const query_circle_params *)params;
+
+    query_disc_ws(p->hpx, p->theta[index], p->phi[index], p->radius[index], p->fact, 1,
+                  pixset, ws, status, err);
+}
+
+PyDoc_STRVAR(query_circle_batch_doc,
+             "query_circle_batch(nside, a, b, radius, inclusive=False, fact=4, nest=True, "
+             "lonlat=True, degrees=True, return_pixel_ranges=False, return_union=False, "
+             "n_threads=0, dtype=None)\n"
+             "--\n\n"
+             "Run query_circle for each of a set of circles defined by a, b\n"
+             "([lon, lat] if lonlat=True otherwise [theta, phi]) and radius (in\n"
+             "degrees if lonlat=True and degrees=True, otherwise radians).  The\n"
+             "results are returned in compressed sparse row layout, such that the\n"
+             "pixels for circle i are pixels[offsets[i]: offsets[i + 1]].\n"
+             "\n"
+             "Parameters\n"
+             "----------\n" NSIDE_DOC_PAR AB_DOC_PAR
+             "radius : `float` or `np.ndarray` (N,)\n"
+             "    The radius of each circle. Degrees if degrees=True otherwise radians.\n"
+             "inclusive : `bool`, optional\n"
+             "    If False, return the exact set of pixels whose pixel centers lie\n"
+             "    within each circle. If True, return all pixels that overlap with\n"
+             "    each circle. This is an approximation and may return a few extra\n"
+             "    pixels.\n" FACT_DOC_PAR NEST_DOC_PAR LONLAT_DOC_PAR DEGREES_DOC_PAR
+                 RETURN_PIXEL_RANGES_PAR RETURN_UNION_PAR N_THREADS_DOC_PAR PIX_DTYPE_DOC_PAR
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "offsets : `np.ndarray` (N + 1,)\n"
+             "    Offsets (`np.int64`) of the results of each circle.\n"
+             "pixels : `np.ndarray` (M,)\n"
+             "    Concatenated arrays of pixels (of type dtype) which cover each\n"
+             "    circle (if return_pixel_ranges is False) or\n"
+             "pixel_ranges : `np.ndarray` (M, 2)\n"
+             "    Concatenated arrays of pixel ranges, [lo, high), which cover\n"
+             "    each circle.\n"
+             "    If return_union is True, only the pixels or pixel_ranges covering\n"
+             "    the union of the circles are returned.\n"
+             "\n"
+             "Raises\n"
+             "------\n"
+             "ValueError\n"
+             "    If positions or radii are out of range, or fact is not allowed.\n"
+             "RuntimeError\n"
+             "    If query_circle has an internal error.\n");
+
+static PyObject *query_circle_batch(PyObject *dummy, PyObject *args, PyObject *kwargs) {
+    int64_t nside;
+    PyObject *a_obj = NULL, *b_obj = NULL, *radius_obj = NULL;
+    PyObject *a_arr = NULL, *b_arr = NULL, *radius_arr = NULL;
+    int inclusive = 0;
+    long fact = 4;
+    int nest = 1;
+    int lonlat = 1;
+    int degrees = 1;
+    int return_pixel_ranges = 0;
+    int return_union = 0;
+    int n_threads = 0;
+    PyArray_Descr *dtype = NULL;
+    int typenum;
+    static char *kwlist[] = {"nside",
+                             "a",
+                             "b",
+                             "radius",
+                             "inclusive",
+                             "fact",
+                             "nest",
+                             "lonlat",
+                             "degrees",
+                             "return_pixel_ranges",
+                             "return_union",
+                             "n_threads",
+                             "dtype",
+                             NULL};
+
+    char err[ERR_SIZE];
+    int status = 1;
+    NpyIter *iter = NULL;
+    PyObject *retval = NULL;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "LOOO|plpppppiO&", kwlist, &nside, &a_obj,
+                                     &b_obj, &radius_obj, &inclusive, &fact, &nest, &lonlat,
+                                     &degrees, &return_pixel_ranges, &return_union,
+                                     &n_threads, PyArray_DescrConverter2, &dtype))
+        goto fail;
+    if (!hpgeom_pixel_dtype(dtype, &typenum)) goto fail;
+
+    a_arr = PyArray_FROMANY(a_obj, NPY_DOUBLE, 0, 1, NPY_ARRAY_IN_ARRAY);
+    if (a_arr == NULL) goto fail;
+    b_arr = PyArray_FROMANY(b_obj, NPY_DOUBLE, 0, 1, NPY_ARRAY_IN_ARRAY);
+    if (b_arr == NULL) goto fail;
+    radius_arr = PyArray_FROMANY(radius_obj, NPY_DOUBLE, 0, 1, NPY_ARRAY_IN_ARRAY);
+    if (radius_arr == NULL) goto fail;
+
+    enum Scheme scheme;
+    if (nest) {
+        scheme = NEST;
+    } else {
+        scheme = RING;
+    }
+    if (!hpgeom_check_nside(nside, scheme, err) ||
+        ((typenum == NPY_INT32) && !hpgeom_check_nside_int32(nside, err))) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
+    }
+    healpix_info hpx = healpix_info_from_nside(nside, scheme);
+
+    if (!inclusive) {
+        fact = 0;
+    } else {
+        if (!hpgeom_check_fact(&hpx, fact, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
+    }
+
+    // The input arrays are a_arr, b_arr, radius_arr (double).
+    // The output arrays are theta, phi, radius (double, radians).
+    PyArrayObject *op[6];
+    npy_uint32 op_flags[6];
+    PyArray_Descr *op_dtypes[6];
+
+    op[0] = (PyArrayObject *)a_arr;
+    op_flags[0] = NPY_ITER_READONLY;
+    op_dtypes[0] = NULL;
+    op[1] = (PyArrayObject *)b_arr;
+    op_flags[1] = NPY_ITER_READONLY;
+    op_dtypes[1] = NULL;
+    op[2] = (PyArrayObject *)radius_arr;
+    op_flags[2] = NPY_ITER_READONLY;
+    op_dtypes[2] = NULL;
+    op[3] = NULL;
+    op_flags[3] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
+    op_dtypes[3] = PyArray_DescrFromType(NPY_DOUBLE);
+    op[4] = NULL;
+    op_flags[4] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
+    op_dtypes[4] = PyArray_DescrFromType(NPY_DOUBLE);
+    op[5] = NULL;
+    op_flags[5] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
+    op_dtypes[5] = PyArray_DescrFromType(NPY_DOUBLE);
+
+    // C order, so that the allocated outputs are contiguous in query order.
+    iter = NpyIter_MultiNew(6, op, NPY_ITER_ZEROSIZE_OK, NPY_CORDER, NPY_NO_CASTING, op_flags,
+                            op_dtypes);
+    if (iter == NULL) {
+        PyErr_SetString(PyExc_ValueError,
+                        "a, b, radius arrays could not be broadcast together.");
+        goto fail;
+    }
+
+    npy_intp nquery = NpyIter_GetIterSize(iter);
+    if (nquery > 0) {
+        NpyIter_IterNextFunc *iternext = NpyIter_GetIterNext(iter, NULL);
+        if (iternext == NULL) goto fail;
+        char **dataptr = NpyIter_GetDataPtrArray(iter);
+
+        NPY_BEGIN_THREADS;
+        do {
+            double a = *(double *)dataptr[0];
+            double b = *(double *)dataptr[1];
+            double radius = *(double *)dataptr[2];
+            double *theta = (double *)dataptr[3];
+            double *phi = (double *)dataptr[4];
+
+            if (lonlat) {
+                if (!hpgeom_lonlat_to_thetaphi(a, b, theta, phi, (bool)degrees, err)) {
+                    status = 0;
+                    break;
+                }
+                if (degrees) {
+                    radius *= HPG_D2R;
+                }
+            } else {
+                if (!hpgeom_check_theta_phi(a, b, err)) {
+                    status = 0;
+                    break;
+                }
+                *theta = a;
+                *phi = b;
+            }
+            if (!hpgeom_check_radius(radius, err)) {
+                status = 0;
+                break;
+            }
+            *(double *)dataptr[5] = radius;
+        } while (iternext(iter));
+        NPY_END_THREADS;
+
+        if (!status) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
+    }
+
+    query_circle_params params;
+    params.hpx = &hpx;
+    params.theta = (const double *)PyArray_DATA(NpyIter_GetOperandArray(iter)[3]);
+    params.phi = (const double *)PyArray_DATA(NpyIter_GetOperandArray(iter)[4]);
+    params.radius = (const double *)PyArray_DATA(NpyIter_GetOperandArray(iter)[5]);
+    params.fact = (int)fact;
+
+    retval = hpgeom_run_query_batch(nquery, n_threads, query_circle_func, &params,
+                                    return_pixel_ranges, return_union, typenum);
+    if (retval == NULL) goto fail;
+
+    Py_DECREF(a_arr);
+    Py_DECREF(b_arr);
+    Py_DECREF(radius_arr);
+    Py_XDECREF(dtype);
+    NpyIter_Deallocate(iter);
+
+    return retval;
+
+fail:
+    Py_XDECREF(a_arr);
+    Py_XDECREF(b_arr);
+    Py_XDECREF(radius_arr);
+    Py_XDECREF(dtype);
+    if (iter != NULL) {
+        NpyIter_Deallocate(iter);
+    }
+
+    return NULL;
+}
+
+PyDoc_STRVAR(query_polygon_doc,
+             "query_polygon(nside, a, b, inclusive=False, fact=4, nest=True, lonlat=True, "
+             "degrees=True, return_pixel_ranges=False, dtype=None, return_moc=False)\n"
+             "--\n\n"
+             "Returns pixels whose centers lie within the convex polygon defined by the "
+             "points in a, b\n"
+             "([lon, lat] if lonlat=True, otherwise [theta, phi]) if inclusive is False, or "
+             "which overlap\n"
              "with this polygon (if inclusive is True).\n"
              "\n"
              "Parameters\n"
@@ -563,15 +1654,18 @@ PyDoc_STRVAR(query_polygon_doc,
              "    within the polygon. If True, return all pixels that overlap with\n"
              "    the polygon. This is an approximation and may return a few extra\n"
              "    pixels.\n" FACT_DOC_PAR NEST_DOC_PAR LONLAT_DOC_PAR DEGREES_DOC_PAR
-                 RETURN_PIXEL_RANGES_PAR
+                 RETURN_PIXEL_RANGES_PAR PIX_DTYPE_DOC_PAR RETURN_MOC_PAR
              "\n"
              "Returns\n"
              "-------\n"
              "pixels : `np.ndarray` (N,)\n"
-             "    Array of pixels (`np.int64`) which cover the polygon.\n"
+             "    Array of pixels (`np.int64` or `np.int32`) which cover the polygon.\n"
              "    (if return_pixel_ranges is False) or\n"
              "pixel_ranges : `np.ndarray` (M, 2)\n"
              "    Array of pixel ranges, [lo, high), which cover the polygon.\n"
+             "    (if return_pixel_ranges is True) or\n"
+             "moc : `MOC`\n"
+             "    Multi-order coverage of the pixels (if return_moc is True).\n"
              "\n"
              "Raises\n"
              "------\n"
@@ -588,33 +1682,15 @@ PyDoc_STRVAR(query_polygon_doc,
              "with the polygon. Higher fact values result in fewer false positives at the\n"
              "expense of increased run time.\n");
 
-static PyObject *query_polygon_meth(PyObject *dummy, PyObject *args, PyObject *kwargs) {
-    int64_t nside;
-    PyObject *a_obj = NULL, *b_obj = NULL;
+// Convert the a, b vertex arrays of a polygon to a new pointingarr, dropping
+// the last vertex of a closed polygon.  Returns NULL with an exception set on
+// failure.
+pointingarr *hpgeom_polygon_vertices(PyObject *a_obj, PyObject *b_obj, int lonlat,
+                                     int degrees) {
     PyObject *a_arr = NULL, *b_arr = NULL;
-    int inclusive = 0;
-    long fact = 4;
-    int nest = 1;
-    int lonlat = 1;
-    int degrees = 1;
-    int return_pixel_ranges = 0;
-    static char *kwlist[] = {"nside", "a",      "b",       "inclusive",           "fact",
-                             "nest",  "lonlat", "degrees", "return_pixel_ranges", NULL};
+    pointingarr *vertices = NULL;
     char err[ERR_SIZE];
     int status = 1;
-    i64rangeset *pixset = NULL;
-    pointingarr *vertices = NULL;
-
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "LOO|plpppp", kwlist, &nside, &a_obj,
-                                     &b_obj, &inclusive, &fact, &nest, &lonlat, &degrees,
-                                     &return_pixel_ranges))
-        goto fail;
-
-    if (return_pixel_ranges & ~nest) {
-        PyErr_SetString(PyExc_RuntimeError,
-                        "Can only use return_pixel_ranges with nest ordering.");
-        goto fail;
-    }
 
     a_arr = PyArray_FROM_OTF(a_obj, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
     if (a_arr == NULL) goto fail;
@@ -646,33 +1722,6 @@ static PyObject *query_polygon_meth(PyObject *dummy, PyObject *args, PyObject *k
         goto fail;
     }
 
-    enum Scheme scheme;
-    if (nest) {
-        scheme = NEST;
-    } else {
-        scheme = RING;
-    }
-    if (!hpgeom_check_nside(nside, scheme, err)) {
-        PyErr_SetString(PyExc_ValueError, err);
-        goto fail;
-    }
-    healpix_info hpx = healpix_info_from_nside(nside, scheme);
-
-    pixset = i64rangeset_new(&status, err);
-    if (!status) {
-        PyErr_SetString(PyExc_RuntimeError, err);
-        goto fail;
-    }
-
-    if (!inclusive) {
-        fact = 0;
-    } else {
-        if (!hpgeom_check_fact(&hpx, fact, err)) {
-            PyErr_SetString(PyExc_ValueError, err);
-            goto fail;
-        }
-    }
-
     double *a_data = (double *)PyArray_DATA((PyArrayObject *)a_arr);
     double *b_data = (double *)PyArray_DATA((PyArrayObject *)b_arr);
 
@@ -704,39 +1753,361 @@ static PyObject *query_polygon_meth(PyObject *dummy, PyObject *args, PyObject *k
         vertices->size--;
     }
 
-    query_polygon(&hpx, vertices, fact, pixset, &status, err);
-    if (!status) {
-        PyErr_SetString(PyExc_RuntimeError, err);
-        goto fail;
-    }
-
-    PyObject *return_arr = create_query_return_arr(pixset, return_pixel_ranges, 0, &hpx);
-
     Py_DECREF(a_arr);
     Py_DECREF(b_arr);
-    i64rangeset_delete(pixset);
-    pointingarr_delete(vertices);
 
-    return PyArray_Return((PyArrayObject *)return_arr);
+    return vertices;
 
 fail:
     Py_XDECREF(a_arr);
     Py_XDECREF(b_arr);
-    i64rangeset_delete(pixset);
     pointingarr_delete(vertices);
 
     return NULL;
 }
 
-PyDoc_STRVAR(query_ellipse_doc,
-             "query_ellipse(nside, a, b, semi_major, semi_minor, alpha, inclusive=False, "
-             "fact=4, nest=True, lonlat=True, degrees=True)\n"
-             "--\n\n"
-             "Returns pixels whose centers lie within an ellipse if inclusive is False,\n"
-             "or which overlap with this ellipse if inclusive is True. The ellipse is\n"
-             "defined by a center a, b ([lon, lat] if lonlat=True otherwise [theta, phi]\n"
-             "and semi-major and semi-minor axes (in degrees if lonlat=True and\n"
-             "degrees=True, otherwise radians). The inclination angle alpha is defined\n"
+static PyObject *query_polygon_meth(PyObject *dummy, PyObject *args, PyObject *kwargs) {
+    int64_t nside;
+    PyObject *a_obj = NULL, *b_obj = NULL;
+    int inclusive = 0;
+    long fact = 4;
+    int nest = 1;
+    int lonlat = 1;
+    int degrees = 1;
+    int return_pixel_ranges = 0;
+    PyArray_Descr *dtype = NULL;
+    int typenum;
+    int return_moc = 0;
+    static char *kwlist[] = {"nside", "a",      "b",       "inclusive",           "fact",
+                             "nest",  "lonlat", "degrees", "return_pixel_ranges", "dtype",
+                             "return_moc", NULL};
+    char err[ERR_SIZE];
+    int status = 1;
+    i64rangeset *pixset = NULL;
+    pointingarr *vertices = NULL;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "LOO|plppppO&p", kwlist, &nside, &a_obj,
+                                     &b_obj, &inclusive, &fact, &nest, &lonlat, &degrees,
+                                     &return_pixel_ranges, PyArray_DescrConverter2, &dtype,
+                                     &return_moc))
+        goto fail;
+    if (!hpgeom_pixel_dtype(dtype, &typenum)) goto fail;
+    if (!hpgeom_check_return_moc(return_moc, nest, return_pixel_ranges)) goto fail;
+
+    vertices = hpgeom_polygon_vertices(a_obj, b_obj, lonlat, degrees);
+    if (vertices == NULL) goto fail;
+
+    enum Scheme scheme;
+    if (nest) {
+        scheme = NEST;
+    } else {
+        scheme = RING;
+    }
+    if (!hpgeom_check_nside(nside, scheme, err) ||
+        ((typenum == NPY_INT32) && !hpgeom_check_nside_int32(nside, err))) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
+    }
+    healpix_info hpx = healpix_info_from_nside(nside, scheme);
+
+    pixset = i64rangeset_new(&status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        goto fail;
+    }
+
+    if (!inclusive) {
+        fact = 0;
+    } else {
+        if (!hpgeom_check_fact(&hpx, fact, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
+    }
+
+    NPY_BEGIN_THREADS;
+    query_polygon(&hpx, vertices, fact, pixset, &status, err);
+    NPY_END_THREADS;
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        goto fail;
+    }
+
+    PyObject *retval =
+        create_query_return(&pixset, &hpx, return_pixel_ranges, return_moc, typenum);
+    if (retval == NULL) goto fail;
+
+    i64rangeset_delete(pixset);
+    pointingarr_delete(vertices);
+    Py_XDECREF(dtype);
+
+    return retval;
+
+fail:
+    i64rangeset_delete(pixset);
+    pointingarr_delete(vertices);
+    Py_XDECREF(dtype);
+
+    return NULL;
+}
+
+typedef struct {
+    healpix_info *hpx;
+    pointing *vertices;
+    const int64_t *offsets;
+    int fact;
+} query_polygon_params;
+
+static void query_polygon_func(const void *params, npy_intp index, i64rangeset *pixset,
+                               query_workspace *ws, int *status, char *err) {
+    const query_polygon_params *p = (const query_polygon_params *)params;
+    char msg[ERR_SIZE];
+    pointingarr vertex;
+
+    vertex.size = (size_t)(p->offsets[index + 1] - p->offsets[index]);
+    vertex.data = &p->vertices[p->offsets[index]];
+
+    if (vertex.size < 3) {
+        snprintf(msg, ERR_SIZE, "Polygon must have at least 3 vertices.");
+        *status = 0;
+    } else {
+        // Check for a closed polygon with a small double-precision delta.
+        double delta_theta = fabs(vertex.data[vertex.size - 1].theta - vertex.data[0].theta);
+        double delta_phi = fabs(vertex.data[vertex.size - 1].phi - vertex.data[0].phi);
+        if ((delta_theta < 1e-14) && (delta_phi < 1e-14)) {
+            // Skip last coord
+            vertex.size--;
+        }
+
+        query_polygon_ws(p->hpx, &vertex, p->fact, pixset, ws, status, msg);
+    }
+
+    if (!*status) {
+        snprintf(err, ERR_SIZE, "Polygon %lld: %s", (long long)index, msg);
+    }
+}
+
+PyDoc_STRVAR(query_polygon_batch_doc,
+             "query_polygon_batch(nside, a, b, offsets, inclusive=False, fact=4, nest=True, "
+             "lonlat=True, degrees=True, return_pixel_ranges=False, return_union=False, "
+             "n_threads=0, dtype=None)\n"
+             "--\n\n"
+             "Run query_polygon for each of a set of convex polygons.  The vertices\n"
+             "of all the polygons are concatenated in a, b ([lon, lat] if\n"
+             "lonlat=True, otherwise [theta, phi]), such that the vertices of\n"
+             "polygon i are a[offsets[i]: offsets[i + 1]], b[offsets[i]: offsets[i + 1]].\n"
+             "The results are returned in the same compressed sparse row layout,\n"
+             "such that the pixels for polygon i are\n"
+             "pixels[pixel_offsets[i]: pixel_offsets[i + 1]].\n"
+             "\n"
+             "Parameters\n"
+             "----------\n" NSIDE_DOC_PAR "a, b : `np.ndarray` (N,)\n" AB_DOC_DESCR
+             "offsets : `np.ndarray` (M + 1,)\n"
+             "    Offsets of the vertices of each of the M polygons into a, b.  These\n"
+             "    must be non-decreasing, start at 0, and end at N.\n"
+             "inclusive : `bool`, optional\n"
+             "    If False, return the exact set of pixels whose pixel centers lie\n"
+             "    within each polygon. If True, return all pixels that overlap with\n"
+             "    each polygon. This is an approximation and may return a few extra\n"
+             "    pixels.\n" FACT_DOC_PAR NEST_DOC_PAR LONLAT_DOC_PAR DEGREES_DOC_PAR
+                 RETURN_PIXEL_RANGES_PAR RETURN_UNION_PAR N_THREADS_DOC_PAR PIX_DTYPE_DOC_PAR
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "pixel_offsets : `np.ndarray` (M + 1,)\n"
+             "    Offsets (`np.int64`) of the results of each polygon.\n"
+             "pixels : `np.ndarray` (P,)\n"
+             "    Concatenated arrays of pixels (of type dtype) which cover each\n"
+             "    polygon (if return_pixel_ranges is False) or\n"
+             "pixel_ranges : `np.ndarray` (P, 2)\n"
+             "    Concatenated arrays of pixel ranges, [lo, high), which cover\n"
+             "    each polygon.\n"
+             "    If return_union is True, only the pixels or pixel_ranges covering\n"
+             "    the union of the polygons are returned.\n"
+             "\n"
+             "Raises\n"
+             "------\n"
+             "ValueError\n"
+             "    If vertices are out of range, or offsets are not valid.\n"
+             "RuntimeError\n"
+             "    If a polygon does not have at least 3 vertices, or is not convex,\n"
+             "    or has degenerate corners, or there is an internal error.  The\n"
+             "    message gives the index of the first failing polygon.\n");
+
+static PyObject *query_polygon_batch(PyObject *dummy, PyObject *args, PyObject *kwargs) {
+    int64_t nside;
+    PyObject *a_obj = NULL, *b_obj = NULL, *offsets_obj = NULL;
+    PyObject *a_arr = NULL, *b_arr = NULL, *offsets_arr = NULL;
+    int inclusive = 0;
+    long fact = 4;
+    int nest = 1;
+    int lonlat = 1;
+    int degrees = 1;
+    int return_pixel_ranges = 0;
+    int return_union = 0;
+    int n_threads = 0;
+    PyArray_Descr *dtype = NULL;
+    int typenum;
+    static char *kwlist[] = {"nside",
+                             "a",
+                             "b",
+                             "offsets",
+                             "inclusive",
+                             "fact",
+                             "nest",
+                             "lonlat",
+                             "degrees",
+                             "return_pixel_ranges",
+                             "return_union",
+                             "n_threads",
+                             "dtype",
+                             NULL};
+    char err[ERR_SIZE];
+    int status = 1;
+    pointing *vertices = NULL;
+    PyObject *retval = NULL;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "LOOO|plpppppiO&", kwlist, &nside, &a_obj,
+                                     &b_obj, &offsets_obj, &inclusive, &fact, &nest, &lonlat,
+                                     &degrees, &return_pixel_ranges, &return_union,
+                                     &n_threads, PyArray_DescrConverter2, &dtype))
+        goto fail;
+    if (!hpgeom_pixel_dtype(dtype, &typenum)) goto fail;
+
+    a_arr = PyArray_FROM_OTF(a_obj, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    if (a_arr == NULL) goto fail;
+    b_arr = PyArray_FROM_OTF(b_obj, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    if (b_arr == NULL) goto fail;
+    offsets_arr =
+        PyArray_FROM_OTF(offsets_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    if (offsets_arr == NULL) goto fail;
+
+    if (PyArray_NDIM((PyArrayObject *)a_arr) != 1) {
+        PyErr_SetString(PyExc_ValueError, "a array must be 1D.");
+        goto fail;
+    }
+    if (PyArray_NDIM((PyArrayObject *)b_arr) != 1) {
+        PyErr_SetString(PyExc_ValueError, "b array must be 1D.");
+        goto fail;
+    }
+    if (PyArray_NDIM((PyArrayObject *)offsets_arr) != 1) {
+        PyErr_SetString(PyExc_ValueError, "offsets array must be 1D.");
+        goto fail;
+    }
+
+    npy_intp nvert = PyArray_DIM((PyArrayObject *)a_arr, 0);
+    if (PyArray_DIM((PyArrayObject *)b_arr, 0) != nvert) {
+        PyErr_SetString(PyExc_ValueError, "a and b arrays must be the same length.");
+        goto fail;
+    }
+
+    npy_intp npoly = PyArray_DIM((PyArrayObject *)offsets_arr, 0) - 1;
+    int64_t *offsets_data = (int64_t *)PyArray_DATA((PyArrayObject *)offsets_arr);
+    bool offsets_ok = (npoly >= 0) && (offsets_data[0] == 0) && (offsets_data[npoly] == nvert);
+    for (npy_intp i = 0; offsets_ok && (i < npoly); i++) {
+        if (offsets_data[i + 1] < offsets_data[i]) offsets_ok = false;
+    }
+    if (!offsets_ok) {
+        PyErr_SetString(PyExc_ValueError,
+                        "offsets must be non-decreasing, starting at 0 and ending at the "
+                        "number of vertices.");
+        goto fail;
+    }
+
+    enum Scheme scheme;
+    if (nest) {
+        scheme = NEST;
+    } else {
+        scheme = RING;
+    }
+    if (!hpgeom_check_nside(nside, scheme, err) ||
+        ((typenum == NPY_INT32) && !hpgeom_check_nside_int32(nside, err))) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
+    }
+    healpix_info hpx = healpix_info_from_nside(nside, scheme);
+
+    if (!inclusive) {
+        fact = 0;
+    } else {
+        if (!hpgeom_check_fact(&hpx, fact, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
+    }
+
+    vertices = (pointing *)PyMem_Malloc((nvert > 0 ? nvert : 1) * sizeof(pointing));
+    if (vertices == NULL) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    double *a_data = (double *)PyArray_DATA((PyArrayObject *)a_arr);
+    double *b_data = (double *)PyArray_DATA((PyArrayObject *)b_arr);
+
+    NPY_BEGIN_THREADS;
+    for (npy_intp i = 0; i < nvert; i++) {
+        if (lonlat) {
+            if (!hpgeom_lonlat_to_thetaphi(a_data[i], b_data[i], &vertices[i].theta,
+                                           &vertices[i].phi, (bool)degrees, err)) {
+                status = 0;
+                break;
+            }
+        } else {
+            if (!hpgeom_check_theta_phi(a_data[i], b_data[i], err)) {
+                status = 0;
+                break;
+            }
+            vertices[i].theta = a_data[i];
+            vertices[i].phi = b_data[i];
+        }
+    }
+    NPY_END_THREADS;
+    if (!status) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
+    }
+
+    query_polygon_params params;
+    params.hpx = &hpx;
+    params.vertices = vertices;
+    params.offsets = offsets_data;
+    params.fact = (int)fact;
+
+    retval = hpgeom_run_query_batch(npoly, n_threads, query_polygon_func, &params,
+                                    return_pixel_ranges, return_union, typenum);
+    if (retval == NULL) goto fail;
+
+    Py_DECREF(a_arr);
+    Py_DECREF(b_arr);
+    Py_DECREF(offsets_arr);
+    Py_XDECREF(dtype);
+    PyMem_Free(vertices);
+
+    return retval;
+
+fail:
+    Py_XDECREF(a_arr);
+    Py_XDECREF(b_arr);
+    Py_XDECREF(offsets_arr);
+    Py_XDECREF(dtype);
+    PyMem_Free(vertices);
+
+    return NULL;
+}
+
+PyDoc_STRVAR(query_ellipse_doc,
+             "query_ellipse(nside, a, b, semi_major, semi_minor, alpha, inclusive=False, "
+             "fact=4, nest=True, lonlat=True, degrees=True, return_pixel_ranges=False, "
+             "dtype=None, n_threads=0, return_moc=False)\n"
+             "--\n\n"
+             "Returns pixels whose centers lie within an ellipse if inclusive is False,\n"
+             "or which overlap with this ellipse if inclusive is True. The ellipse is\n"
+             "defined by a center a, b ([lon, lat] if lonlat=True otherwise [theta, phi]\n"
+             "and semi-major and semi-minor axes (in degrees if lonlat=True and\n"
+             "degrees=True, otherwise radians). The inclination angle alpha is defined\n"
              "East of North, and is in degrees if lonlat=True and degrees=True,\n"
              "otherwise radians. The shape of the ellipse is defined by the set\n"
              "of points where the sum of the distances from a point to each of the\n"
@@ -756,15 +2127,19 @@ PyDoc_STRVAR(query_ellipse_doc,
              "    within the ellipse. If True, return all pixels that overlap with\n"
              "    the ellipse. This is an approximation and may return a few extra\n"
              "    pixels.\n" FACT_DOC_PAR NEST_DOC_PAR LONLAT_DOC_PAR DEGREES_DOC_PAR
-                 RETURN_PIXEL_RANGES_PAR
+                 RETURN_PIXEL_RANGES_PAR PIX_DTYPE_DOC_PAR QUERY_N_THREADS_DOC_PAR
+                     RETURN_MOC_PAR
              "\n"
              "Returns\n"
              "-------\n"
              "pixels : `np.ndarray` (N,)\n"
-             "    Array of pixels (`np.int64`) which cover the ellipse.\n"
+             "    Array of pixels (`np.int64` or `np.int32`) which cover the ellipse.\n"
              "    (if return_pixel_ranges is False) or\n"
              "pixel_ranges : `np.ndarray` (M, 2)\n"
              "    Array of pixel ranges, [lo, high), which cover the ellipse.\n"
+             "    (if return_pixel_ranges is True) or\n"
+             "moc : `MOC`\n"
+             "    Multi-order coverage of the pixels (if return_moc is True).\n"
              "\n"
              "Raises\n"
              "------\n"
@@ -776,9 +2151,9 @@ PyDoc_STRVAR(query_ellipse_doc,
              "\n"
              "Notes\n"
              "-----\n"
-             "This method runs natively only with nest ordering. If called with ring\n"
-             "ordering then a ResourceWarning is emitted and the pixel numbers will be\n"
-             "converted to ring and sorted before output.\n"
+             "This method runs natively with nest ordering. If called with ring\n"
+             "ordering then the nest pixel ranges are converted to sorted ring pixel\n"
+             "ranges before output.\n"
              "For inclusive=True, the algorithm may return some pixels which do not overlap\n"
              "with the ellipse. Higher fact values result in fewer false positives at the\n"
              "expense of increased run time.\n");
@@ -792,30 +2167,589 @@ static PyObject *query_ellipse_meth(PyObject *dummy, PyObject *args, PyObject *k
     int lonlat = 1;
     int degrees = 1;
     int return_pixel_ranges = 0;
+    PyArray_Descr *dtype = NULL;
+    int typenum;
+    int n_threads = 0;
+    int return_moc = 0;
     static char *kwlist[] = {
         "nside", "a",    "b",      "semi_major", "semi_minor",          "alpha", "inclusive",
-        "fact",  "nest", "lonlat", "degrees",    "return_pixel_ranges", NULL};
+        "fact",  "nest", "lonlat", "degrees",    "return_pixel_ranges", "dtype", "n_threads",
+        "return_moc", NULL};
+
+    char err[ERR_SIZE];
+    int status = 1;
+    i64rangeset *pixset = NULL;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Lddddd|plppppO&ip", kwlist, &nside, &a,
+                                     &b, &semi_major, &semi_minor, &alpha, &inclusive, &fact,
+                                     &nest, &lonlat, &degrees, &return_pixel_ranges,
+                                     PyArray_DescrConverter2, &dtype, &n_threads, &return_moc))
+        goto fail;
+    if (!hpgeom_pixel_dtype(dtype, &typenum)) goto fail;
+    if (!hpgeom_check_return_moc(return_moc, nest, return_pixel_ranges)) goto fail;
+
+    double theta, phi;
+    if (lonlat) {
+        if (!hpgeom_lonlat_to_thetaphi(a, b, &theta, &phi, (bool)degrees, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
+        if (degrees) {
+            semi_major *= HPG_D2R;
+            semi_minor *= HPG_D2R;
+            alpha *= HPG_D2R;
+        }
+    } else {
+        if (!hpgeom_check_theta_phi(a, b, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
+        theta = a;
+        phi = b;
+    }
+
+    if (!hpgeom_check_semi(semi_major, semi_minor, err)) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
+    }
+
+    if (!hpgeom_check_nside(nside, NEST, err) ||
+        ((typenum == NPY_INT32) && !hpgeom_check_nside_int32(nside, err))) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
+    }
+    healpix_info hpx = healpix_info_from_nside(nside, NEST);
+
+    pixset = i64rangeset_new(&status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        goto fail;
+    }
+
+    if (!inclusive) {
+        fact = 0;
+    } else {
+        if (!hpgeom_check_fact(&hpx, fact, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
+    }
+    NPY_BEGIN_THREADS;
+    query_ellipse(&hpx, theta, phi, semi_major, semi_minor, alpha, fact, n_threads, pixset,
+                  &status, err);
+    if (status && !nest) nest_ranges_to_ring(&hpx, pixset, &status, err);
+    NPY_END_THREADS;
+
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        goto fail;
+    }
+
+    PyObject *retval =
+        create_query_return(&pixset, &hpx, return_pixel_ranges, return_moc, typenum);
+    if (retval == NULL) goto fail;
+
+    i64rangeset_delete(pixset);
+    Py_XDECREF(dtype);
+
+    return retval;
+
+fail:
+    i64rangeset_delete(pixset);
+    Py_XDECREF(dtype);
+
+    return NULL;
+}
+
+PyDoc_STRVAR(
+    query_box_doc,
+    "query_box(nside, a0, a1, b0, b1, inclusive=False, fact=4, nest=True, lonlat=True, "
+    "degrees=True, return_pixel_ranges=False, dtype=None, n_threads=0, return_moc=False)\n"
+    "--\n\n"
+    "Returns pixels whose centers lie within a box if inclusive is False,\n"
+    "or which overlap with this box if inclusive is True. The box is defined\n"
+    "by all the points within [a0, a1] and [b0, b1] ([lon, lat] if lonlat=True\n"
+    "otherwise [theta, phi] (in degrees if lonlat=True and degrees=True, otherwise\n"
+    "radians). The box will have boundaries in constant longitude/latitude, rather\n"
+    "than great circle boundaries as with query_polygon. If a0 > a1 then the box will\n"
+    "wrap around 360 degrees. If a0 == 0.0 and a1 == 360.0 then the box will contain\n"
+    "points at all longitudes. If b0 == 90.0 or -90.0 then the box will be an arc\n"
+    "of a circle with the center at the north/south pole.\n"
+    "\n"
+    "Parameters\n"
+    "----------\n" NSIDE_DOC_PAR "a0, a1, b0, b1 : `float`\n" AB_DOC_DESCR
+    "inclusive : `bool`, optional\n"
+    "    If False, return the exact set of pixels whose pixel centers lie\n"
+    "    within the box. If True, return all pixels that overlap with\n"
+    "    the box. This is an approximation and may return a few extra\n"
+    "    pixels.\n" FACT_DOC_PAR NEST_DOC_PAR LONLAT_DOC_PAR DEGREES_DOC_PAR
+        RETURN_PIXEL_RANGES_PAR PIX_DTYPE_DOC_PAR QUERY_N_THREADS_DOC_PAR RETURN_MOC_PAR
+    "\n"
+    "Returns\n"
+    "-------\n"
+    "pixels : `np.ndarray` (N,)\n"
+    "    Array of pixels (`np.int64` or `np.int32`) which cover the box.\n"
+    "    (if return_pixel_ranges is False) or\n"
+    "pixel_ranges : `np.ndarray` (M, 2)\n"
+    "    Array of pixel ranges, [lo, high), which cover the box.\n"
+    "    (if return_pixel_ranges is True) or\n"
+    "moc : `MOC`\n"
+    "    Multi-order coverage of the pixels (if return_moc is True).\n"
+    "\n"
+    "Raises\n"
+    "------\n"
+    "ValueError\n"
+    "    If positions are out of range, or fact is not allowed.\n"
+    "RuntimeError\n"
+    "    If query_box has an internal error.\n"
+    "\n"
+    "Notes\n"
+    "-----\n"
+    "This method runs natively with nest ordering. If called with ring\n"
+    "ordering then the nest pixel ranges are converted to sorted ring pixel\n"
+    "ranges before output.\n"
+    "For inclusive=True, the algorithm may return some pixels which do not overlap\n"
+    "with the box. Higher fact values result in fewer false positives at the\n"
+    "expense of increased run time.\n");
+
+// Convert the corners of a box to theta/phi, as used by query_box.  Returns 0
+// with an exception set on failure.
+int hpgeom_box_angles(double a0, double a1, double b0, double b1, int lonlat, int degrees,
+                      double *theta0, double *theta1, double *phi0, double *phi1,
+                      bool *full_lon) {
+    char err[ERR_SIZE];
+
+    *full_lon = false;
+    if (lonlat) {
+        if (a0 == 0.0 && a1 == 360.0) *full_lon = true;
+        if (b0 > b1) {
+            PyErr_SetString(PyExc_ValueError, "b1/lat1 must be >= b0/lat0.");
+            return 0;
+        }
+        // Swap theta ordering.
+        if (!hpgeom_lonlat_to_thetaphi(a0, b0, theta1, phi0, (bool)degrees, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            return 0;
+        }
+        if (!hpgeom_lonlat_to_thetaphi(a1, b1, theta0, phi1, (bool)degrees, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            return 0;
+        }
+    } else {
+        if (b0 == 0.0 && b1 == HPG_TWO_PI) *full_lon = true;
+        if (a0 > a1) {
+            PyErr_SetString(PyExc_ValueError, "a1/colatitude1 must be <= a0/colatitude0.");
+            return 0;
+        }
+        if (!hpgeom_check_theta_phi(a0, b0, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            return 0;
+        }
+        *theta0 = a0;
+        *phi0 = b0;
+        if (!hpgeom_check_theta_phi(a1, b1, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            return 0;
+        }
+        *theta1 = a1;
+        *phi1 = b1;
+    }
+
+    return 1;
+}
+
+static PyObject *query_box_meth(PyObject *dummy, PyObject *args, PyObject *kwargs) {
+    int64_t nside;
+    double a0, a1, b0, b1;
+    int inclusive = 0;
+    long fact = 4;
+    int nest = 1;
+    int lonlat = 1;
+    int degrees = 1;
+    int return_pixel_ranges = 0;
+    PyArray_Descr *dtype = NULL;
+    int typenum;
+    int n_threads = 0;
+    int return_moc = 0;
+    static char *kwlist[] = {"nside",
+                             "a0",
+                             "a1",
+                             "b0",
+                             "b1",
+                             "inclusive",
+                             "fact",
+                             "nest",
+                             "lonlat",
+                             "degrees",
+                             "return_pixel_ranges",
+                             "dtype",
+                             "n_threads",
+                             "return_moc",
+                             NULL};
 
     char err[ERR_SIZE];
     int status = 1;
     i64rangeset *pixset = NULL;
+    NPY_BEGIN_THREADS_DEF;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Lddddd|plpppp", kwlist, &nside, &a, &b,
-                                     &semi_major, &semi_minor, &alpha, &inclusive, &fact,
-                                     &nest, &lonlat, &degrees, &return_pixel_ranges))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Ldddd|plppppO&ip", kwlist, &nside, &a0,
+                                     &a1, &b0, &b1, &inclusive, &fact, &nest, &lonlat,
+                                     &degrees, &return_pixel_ranges, PyArray_DescrConverter2,
+                                     &dtype, &n_threads, &return_moc))
         goto fail;
+    if (!hpgeom_pixel_dtype(dtype, &typenum)) goto fail;
+    if (!hpgeom_check_return_moc(return_moc, nest, return_pixel_ranges)) goto fail;
 
-    if (return_pixel_ranges & ~nest) {
-        PyErr_SetString(PyExc_RuntimeError,
-                        "Can only use return_pixel_ranges with nest ordering.");
+    double theta0, theta1, phi0, phi1;
+    bool full_lon;
+    if (!hpgeom_box_angles(a0, a1, b0, b1, lonlat, degrees, &theta0, &theta1, &phi0, &phi1,
+                           &full_lon))
+        goto fail;
+
+    if (!hpgeom_check_nside(nside, NEST, err) ||
+        ((typenum == NPY_INT32) && !hpgeom_check_nside_int32(nside, err))) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
+    }
+    healpix_info hpx = healpix_info_from_nside(nside, NEST);
+
+    pixset = i64rangeset_new(&status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        goto fail;
+    }
+
+    if (!inclusive) {
+        fact = 0;
+    } else {
+        if (!hpgeom_check_fact(&hpx, fact, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
+    }
+    NPY_BEGIN_THREADS;
+    query_box(&hpx, theta0, theta1, phi0, phi1, full_lon, fact, n_threads, pixset, &status,
+              err);
+    if (status && !nest) nest_ranges_to_ring(&hpx, pixset, &status, err);
+    NPY_END_THREADS;
+
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
         goto fail;
     }
 
+    PyObject *retval =
+        create_query_return(&pixset, &hpx, return_pixel_ranges, return_moc, typenum);
+    if (retval == NULL) goto fail;
+
+    i64rangeset_delete(pixset);
+    Py_XDECREF(dtype);
+
+    return retval;
+
+fail:
+    i64rangeset_delete(pixset);
+    Py_XDECREF(dtype);
+
+    return NULL;
+}
+
+#define POINTS_AB_DOC_PAR                                                         \
+    "a, b : `float` or `np.ndarray` (N,)\n"                                       \
+    "    Positions of the points to test.  Longitude/latitude (if lonlat=True)\n" \
+    "    or co-latitude(theta)/longitude(phi) (if lonlat=False).\n"              \
+        FLOAT32_DOC_DESCR
+#define POINTS_RETURNS_DOC                   \
+    "\n"                                     \
+    "Returns\n"                              \
+    "-------\n"                              \
+    "inside : `bool` or `np.ndarray` (N,)\n" \
+    "    True for each point inside the shape.\n"
+
+// Test a contiguous block of points in theta/phi against a shape.
+typedef void (*points_in_shape_func)(const void *shape, const double *theta,
+                                     const double *phi, uint8_t *inside, size_t n);
+
+typedef struct {
+    points_in_shape_func func;
+    const void *shape;
+    int lonlat;
+    int degrees;
+    bool float32;
+} points_in_shape_params;
+
+static void points_in_disc_func(const void *shape, const double *theta, const double *phi,
+                                uint8_t *inside, size_t n) {
+    points_in_disc((const disc_shape *)shape, theta, phi, inside, n);
+}
+
+static void points_in_ellipse_func(const void *shape, const double *theta, const double *phi,
+                                   uint8_t *inside, size_t n) {
+    points_in_ellipse((const ellipse_shape *)shape, theta, phi, inside, n);
+}
+
+static void points_in_box_func(const void *shape, const double *theta, const double *phi,
+                               uint8_t *inside, size_t n) {
+    points_in_box((const box_shape *)shape, theta, phi, inside, n);
+}
+
+static void points_in_polygon_func(const void *shape, const double *theta, const double *phi,
+                                   uint8_t *inside, size_t n) {
+    points_in_polygon((const polygon_shape *)shape, theta, phi, inside, n);
+}
+
+static void points_in_shape_kernel(hpgeom_iter_chunk *chunk) {
+    const points_in_shape_params *params = (const points_in_shape_params *)chunk->params;
+    char **dataptrarray = chunk->dataptrarray;
+    npy_intp *strides = chunk->strides;
+    double theta[HPG_BLOCK_SIZE], phi[HPG_BLOCK_SIZE];
+    uint8_t insidebuf[HPG_BLOCK_SIZE];
+
+    do {
+        char *a_p = dataptrarray[0];
+        char *b_p = dataptrarray[1];
+        char *inside_p = dataptrarray[2];
+        npy_intp count = *chunk->innersizeptr;
+        bool contiguous_out = (strides[2] == sizeof(npy_bool));
+
+        // Points are converted to theta/phi a block at a time, and each
+        // block is tested against the shape in one call.
+        while (count > 0) {
+            npy_intp nblock = (count < HPG_BLOCK_SIZE) ? count : HPG_BLOCK_SIZE;
+            uint8_t *outinside = contiguous_out ? (uint8_t *)inside_p : insidebuf;
+
+            for (npy_intp i = 0; i < nblock; i++) {
+                double a = hpgeom_read_coord(a_p + i * strides[0], params->float32);
+                double b = hpgeom_read_coord(b_p + i * strides[1], params->float32);
+
+                if (params->lonlat) {
+                    if (!hpgeom_lonlat_to_thetaphi(a, b, &theta[i], &phi[i],
+                                                   (bool)params->degrees, chunk->err)) {
+                        chunk->status = 0;
+                        return;
+                    }
+                } else {
+                    if (!hpgeom_check_theta_phi(a, b, chunk->err)) {
+                        chunk->status = 0;
+                        return;
+                    }
+                    theta[i] = a;
+                    phi[i] = b;
+                }
+            }
+            params->func(params->shape, theta, phi, outinside, nblock);
+
+            if (!contiguous_out) {
+                for (npy_intp i = 0; i < nblock; i++) {
+                    *(npy_bool *)(inside_p + i * strides[2]) = (npy_bool)insidebuf[i];
+                }
+            }
+
+            a_p += nblock * strides[0];
+            b_p += nblock * strides[1];
+            inside_p += nblock * strides[2];
+            count -= nblock;
+        }
+    } while (chunk->iternext(chunk->iter));
+}
+
+// Run a point-in-shape test over the broadcast a, b arrays, returning a
+// boolean array (or scalar).
+static PyObject *hpgeom_points_in_shape(PyObject *a_obj, PyObject *b_obj, int lonlat,
+                                        int degrees, int n_threads, points_in_shape_func func,
+                                        const void *shape) {
+    PyObject *a_arr = NULL, *b_arr = NULL;
+    PyObject *inside_arr = NULL;
+    NpyIter *iter = NULL;
+    points_in_shape_params params;
+    char err[ERR_SIZE];
+    int status;
+
+    PyObject *coord_objs[2] = {a_obj, b_obj};
+    int coord_type = hpgeom_coord_type(coord_objs, 2);
+
+    a_arr = PyArray_FROM_OTF(a_obj, coord_type, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    if (a_arr == NULL) goto fail;
+    b_arr = PyArray_FROM_OTF(b_obj, coord_type, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    if (b_arr == NULL) goto fail;
+
+    PyArrayObject *op[3];
+    npy_uint32 op_flags[3];
+    PyArray_Descr *op_dtypes[3];
+
+    op[0] = (PyArrayObject *)a_arr;
+    op_flags[0] = NPY_ITER_READONLY;
+    op_dtypes[0] = NULL;
+    op[1] = (PyArrayObject *)b_arr;
+    op_flags[1] = NPY_ITER_READONLY;
+    op_dtypes[1] = NULL;
+    op[2] = NULL;
+    op_flags[2] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
+    op_dtypes[2] = PyArray_DescrFromType(NPY_BOOL);
+
+    iter = NpyIter_MultiNew(3, op,
+                            NPY_ITER_ZEROSIZE_OK | NPY_ITER_RANGED | NPY_ITER_EXTERNAL_LOOP |
+                                NPY_ITER_BUFFERED | NPY_ITER_GROWINNER,
+                            NPY_KEEPORDER, NPY_NO_CASTING, op_flags, op_dtypes);
+    if (iter == NULL) {
+        PyErr_SetString(PyExc_ValueError, "a, b arrays could not be broadcast together.");
+        goto fail;
+    }
+
+    params.func = func;
+    params.shape = shape;
+    params.lonlat = lonlat;
+    params.degrees = degrees;
+    params.float32 = (coord_type == NPY_FLOAT32);
+
+    status = hpgeom_iter_run(iter, n_threads, points_in_shape_kernel, &params, err);
+    if (status < 0) goto fail;
+    if (status == 0) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
+    }
+
+    inside_arr = (PyObject *)NpyIter_GetOperandArray(iter)[2];
+    Py_INCREF(inside_arr);
+
+    Py_DECREF(a_arr);
+    Py_DECREF(b_arr);
+    if (NpyIter_Deallocate(iter) != NPY_SUCCEED) {
+        iter = NULL;
+        goto fail;
+    }
+
+    return PyArray_Return((PyArrayObject *)inside_arr);
+
+fail:
+    Py_XDECREF(a_arr);
+    Py_XDECREF(b_arr);
+    Py_XDECREF(inside_arr);
+    if (iter != NULL) {
+        NpyIter_Deallocate(iter);
+    }
+
+    return NULL;
+}
+
+PyDoc_STRVAR(points_in_circle_doc,
+             "points_in_circle(a, b, a_center, b_center, radius, lonlat=True, degrees=True, "
+             "n_threads=0)\n"
+             "--\n\n"
+             "Check which points lie within the circle defined by a_center, b_center\n"
+             "([lon, lat] if lonlat=True otherwise [theta, phi]) and radius (in\n"
+             "degrees if lonlat=True and degrees=True, otherwise radians).  This uses\n"
+             "the same criterion as query_circle with inclusive=False, without\n"
+             "computing any pixels.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n" POINTS_AB_DOC_PAR
+             "a_center, b_center : `float`\n" AB_DOC_DESCR
+             "radius : `float`\n"
+             "    The radius of the circle. Degrees if degrees=True otherwise radians.\n"
+                 LONLAT_DOC_PAR DEGREES_DOC_PAR N_THREADS_DOC_PAR POINTS_RETURNS_DOC
+             "\n"
+             "Raises\n"
+             "------\n"
+             "ValueError\n"
+             "    If positions or radius are out of range, or arrays cannot be\n"
+             "    broadcast together.\n");
+
+static PyObject *points_in_circle_meth(PyObject *dummy, PyObject *args, PyObject *kwargs) {
+    PyObject *a_obj = NULL, *b_obj = NULL;
+    double a_center, b_center, radius;
+    int lonlat = 1;
+    int degrees = 1;
+    int n_threads = 0;
+    static char *kwlist[] = {"a",      "b",       "a_center",  "b_center", "radius",
+                             "lonlat", "degrees", "n_threads", NULL};
+    char err[ERR_SIZE];
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOddd|ppi", kwlist, &a_obj, &b_obj,
+                                     &a_center, &b_center, &radius, &lonlat, &degrees,
+                                     &n_threads))
+        return NULL;
+
     double theta, phi;
     if (lonlat) {
-        if (!hpgeom_lonlat_to_thetaphi(a, b, &theta, &phi, (bool)degrees, err)) {
+        if (!hpgeom_lonlat_to_thetaphi(a_center, b_center, &theta, &phi, (bool)degrees, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            return NULL;
+        }
+        if (degrees) {
+            radius *= HPG_D2R;
+        }
+    } else {
+        if (!hpgeom_check_theta_phi(a_center, b_center, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            return NULL;
+        }
+        theta = a_center;
+        phi = b_center;
+    }
+
+    if (!hpgeom_check_radius(radius, err)) {
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    }
+
+    disc_shape disc;
+    disc_shape_init(&disc, theta, phi, radius);
+
+    return hpgeom_points_in_shape(a_obj, b_obj, lonlat, degrees, n_threads,
+                                  points_in_disc_func, &disc);
+}
+
+PyDoc_STRVAR(points_in_ellipse_doc,
+             "points_in_ellipse(a, b, a_center, b_center, semi_major, semi_minor, alpha, "
+             "lonlat=True, degrees=True, n_threads=0)\n"
+             "--\n\n"
+             "Check which points lie within an ellipse.  The ellipse is defined as in\n"
+             "query_ellipse, and a point is inside if the sum of the distances from\n"
+             "the point to each of the foci is less than twice the semi-major axis.\n"
+             "This uses the same criterion as query_ellipse with inclusive=False,\n"
+             "without computing any pixels.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n" POINTS_AB_DOC_PAR
+             "a_center, b_center : `float`\n" AB_DOC_DESCR
+             "semi_major, semi_minor : `float`\n"
+             "    The semi-major and semi-minor axes of the ellipse. Degrees if degrees=True\n"
+             "    and lonlat=True, otherwise radians. The semi-major axis must be >= the\n"
+             "    semi-minor axis.\n"
+             "alpha : `float`\n"
+             "    Inclination angle, counterclockwise with respect to North. Degrees if\n"
+             "    degrees=True and lonlat=True, otherwise radians.\n" LONLAT_DOC_PAR
+                 DEGREES_DOC_PAR N_THREADS_DOC_PAR POINTS_RETURNS_DOC
+             "\n"
+             "Raises\n"
+             "------\n"
+             "ValueError\n"
+             "    If positions or semi-major/minor axes are out of range, or arrays\n"
+             "    cannot be broadcast together.\n");
+
+static PyObject *points_in_ellipse_meth(PyObject *dummy, PyObject *args, PyObject *kwargs) {
+    PyObject *a_obj = NULL, *b_obj = NULL;
+    double a_center, b_center, semi_major, semi_minor, alpha;
+    int lonlat = 1;
+    int degrees = 1;
+    int n_threads = 0;
+    static char *kwlist[] = {"a",          "b",     "a_center", "b_center", "semi_major",
+                             "semi_minor", "alpha", "lonlat",   "degrees",  "n_threads",
+                             NULL};
+    char err[ERR_SIZE];
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOddddd|ppi", kwlist, &a_obj, &b_obj,
+                                     &a_center, &b_center, &semi_major, &semi_minor, &alpha,
+                                     &lonlat, &degrees, &n_threads))
+        return NULL;
+
+    double theta, phi;
+    if (lonlat) {
+        if (!hpgeom_lonlat_to_thetaphi(a_center, b_center, &theta, &phi, (bool)degrees, err)) {
             PyErr_SetString(PyExc_ValueError, err);
-            goto fail;
+            return NULL;
         }
         if (degrees) {
             semi_major *= HPG_D2R;
@@ -823,242 +2757,269 @@ static PyObject *query_ellipse_meth(PyObject *dummy, PyObject *args, PyObject *k
             alpha *= HPG_D2R;
         }
     } else {
-        if (!hpgeom_check_theta_phi(a, b, err)) {
+        if (!hpgeom_check_theta_phi(a_center, b_center, err)) {
             PyErr_SetString(PyExc_ValueError, err);
-            goto fail;
+            return NULL;
         }
-        theta = a;
-        phi = b;
+        theta = a_center;
+        phi = b_center;
     }
 
     if (!hpgeom_check_semi(semi_major, semi_minor, err)) {
         PyErr_SetString(PyExc_ValueError, err);
-        goto fail;
-    }
-
-    if (!nest) {
-        PyErr_WarnEx(PyExc_ResourceWarning,
-                     "query_ellipse natively supports nest ordering.  Result will be "
-                     "converted from nest->ring and sorted",
-                     0);
-    }
-
-    if (!hpgeom_check_nside(nside, NEST, err)) {
-        PyErr_SetString(PyExc_ValueError, err);
-        goto fail;
+        return NULL;
     }
-    healpix_info hpx = healpix_info_from_nside(nside, NEST);
 
-    pixset = i64rangeset_new(&status, err);
-    if (!status) {
-        PyErr_SetString(PyExc_RuntimeError, err);
-        goto fail;
-    }
+    ellipse_shape ellipse;
+    ellipse_shape_init(&ellipse, theta, phi, semi_major, semi_minor, alpha);
 
-    if (!inclusive) {
-        fact = 0;
-    } else {
-        if (!hpgeom_check_fact(&hpx, fact, err)) {
-            PyErr_SetString(PyExc_ValueError, err);
-            goto fail;
-        }
-    }
-    query_ellipse(&hpx, theta, phi, semi_major, semi_minor, alpha, fact, pixset, &status, err);
+    return hpgeom_points_in_shape(a_obj, b_obj, lonlat, degrees, n_threads,
+                                  points_in_ellipse_func, &ellipse);
+}
 
-    if (!status) {
-        PyErr_SetString(PyExc_RuntimeError, err);
-        goto fail;
-    }
+PyDoc_STRVAR(points_in_box_doc,
+             "points_in_box(a, b, a0, a1, b0, b1, lonlat=True, degrees=True, n_threads=0)\n"
+             "--\n\n"
+             "Check which points lie within a box.  The box is defined as in query_box,\n"
+             "by all the points within [a0, a1] and [b0, b1], and is inclusive of the\n"
+             "boundaries.  This uses the same criterion as query_box with\n"
+             "inclusive=False, without computing any pixels.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n" POINTS_AB_DOC_PAR "a0, a1, b0, b1 : `float`\n" AB_DOC_DESCR
+                 LONLAT_DOC_PAR DEGREES_DOC_PAR N_THREADS_DOC_PAR POINTS_RETURNS_DOC
+             "\n"
+             "Raises\n"
+             "------\n"
+             "ValueError\n"
+             "    If positions are out of range, or arrays cannot be broadcast\n"
+             "    together.\n");
 
-    PyObject *return_arr = create_query_return_arr(pixset, return_pixel_ranges, !nest, &hpx);
+static PyObject *points_in_box_meth(PyObject *dummy, PyObject *args, PyObject *kwargs) {
+    PyObject *a_obj = NULL, *b_obj = NULL;
+    double a0, a1, b0, b1;
+    int lonlat = 1;
+    int degrees = 1;
+    int n_threads = 0;
+    static char *kwlist[] = {"a",  "b",      "a0",      "a1",        "b0",
+                             "b1", "lonlat", "degrees", "n_threads", NULL};
 
-    i64rangeset_delete(pixset);
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOdddd|ppi", kwlist, &a_obj, &b_obj, &a0,
+                                     &a1, &b0, &b1, &lonlat, &degrees, &n_threads))
+        return NULL;
 
-    return PyArray_Return((PyArrayObject *)return_arr);
+    double theta0, theta1, phi0, phi1;
+    bool full_lon;
+    if (!hpgeom_box_angles(a0, a1, b0, b1, lonlat, degrees, &theta0, &theta1, &phi0, &phi1,
+                           &full_lon))
+        return NULL;
 
-fail:
-    i64rangeset_delete(pixset);
+    box_shape box;
+    box_shape_init(&box, theta0, theta1, phi0, phi1, full_lon);
 
-    return NULL;
+    return hpgeom_points_in_shape(a_obj, b_obj, lonlat, degrees, n_threads, points_in_box_func,
+                                  &box);
 }
 
-PyDoc_STRVAR(
-    query_box_doc,
-    "query_box(nside, a0, a1, b0, b1, inclusive=False, fact=4, nest=True, lonlat=True, "
-    "degrees=True)\n"
-    "--\n\n"
-    "Returns pixels whose centers lie within a box if inclusive is False,\n"
-    "or which overlap with this box if inclusive is True. The box is defined\n"
-    "by all the points within [a0, a1] and [b0, b1] ([lon, lat] if lonlat=True\n"
-    "otherwise [theta, phi] (in degrees if lonlat=True and degrees=True, otherwise\n"
-    "radians). The box will have boundaries in constant longitude/latitude, rather\n"
-    "than great circle boundaries as with query_polygon. If a0 > a1 then the box will\n"
-    "wrap around 360 degrees. If a0 == 0.0 and a1 == 360.0 then the box will contain\n"
-    "points at all longitudes. If b0 == 90.0 or -90.0 then the box will be an arc\n"
-    "of a circle with the center at the north/south pole.\n"
-    "\n"
-    "Parameters\n"
-    "----------\n" NSIDE_DOC_PAR "a0, a1, b0, b1 : `float`\n" AB_DOC_DESCR
-    "inclusive : `bool`, optional\n"
-    "    If False, return the exact set of pixels whose pixel centers lie\n"
-    "    within the box. If True, return all pixels that overlap with\n"
-    "    the box. This is an approximation and may return a few extra\n"
-    "    pixels.\n" FACT_DOC_PAR NEST_DOC_PAR LONLAT_DOC_PAR DEGREES_DOC_PAR
-        RETURN_PIXEL_RANGES_PAR
-    "\n"
-    "Returns\n"
-    "-------\n"
-    "pixels : `np.ndarray` (N,)\n"
-    "    Array of pixels (`np.int64`) which cover the box.\n"
-    "    (if return_pixel_ranges is False) or\n"
-    "pixel_ranges : `np.ndarray` (M, 2)\n"
-    "    Array of pixel ranges, [lo, high), which cover the box.\n"
-    "\n"
-    "Raises\n"
-    "------\n"
-    "ValueError\n"
-    "    If positions are out of range, or fact is not allowed.\n"
-    "RuntimeError\n"
-    "    If query_box has an internal error.\n"
-    "\n"
-    "Notes\n"
-    "-----\n"
-    "This method runs natively only with nest ordering. If called with ring\n"
-    "ordering then a ResourceWarning is emitted and the pixel numbers will be\n"
-    "converted to ring and sorted before output.\n"
-    "For inclusive=True, the algorithm may return some pixels which do not overlap\n"
-    "with the box. Higher fact values result in fewer false positives at the\n"
-    "expense of increased run time.\n");
+PyDoc_STRVAR(points_in_polygon_doc,
+             "points_in_polygon(a, b, a_vertices, b_vertices, lonlat=True, degrees=True, "
+             "n_threads=0)\n"
+             "--\n\n"
+             "Check which points lie within the convex polygon defined by the vertices\n"
+             "in a_vertices, b_vertices ([lon, lat] if lonlat=True, otherwise\n"
+             "[theta, phi]).  This uses the same criterion as query_polygon with\n"
+             "inclusive=False, without computing any pixels.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n" POINTS_AB_DOC_PAR
+             "a_vertices, b_vertices : `np.ndarray` (M,)\n" AB_DOC_DESCR LONLAT_DOC_PAR
+                 DEGREES_DOC_PAR N_THREADS_DOC_PAR POINTS_RETURNS_DOC
+             "\n"
+             "Raises\n"
+             "------\n"
+             "ValueError\n"
+             "    If positions or vertices are out of range, or arrays cannot be\n"
+             "    broadcast together.\n"
+             "RuntimeError\n"
+             "    If polygon does not have at least 3 vertices, or polygon is not convex,\n"
+             "    or polygon has degenerate corners.\n");
 
-static PyObject *query_box_meth(PyObject *dummy, PyObject *args, PyObject *kwargs) {
-    int64_t nside;
-    double a0, a1, b0, b1;
-    int inclusive = 0;
-    long fact = 4;
-    int nest = 1;
+static PyObject *points_in_polygon_meth(PyObject *dummy, PyObject *args, PyObject *kwargs) {
+    PyObject *a_obj = NULL, *b_obj = NULL;
+    PyObject *a_vert_obj = NULL, *b_vert_obj = NULL;
     int lonlat = 1;
     int degrees = 1;
-    int return_pixel_ranges = 0;
-    static char *kwlist[] = {"nside",
-                             "a0",
-                             "a1",
-                             "b0",
-                             "b1",
-                             "inclusive",
-                             "fact",
-                             "nest",
-                             "lonlat",
-                             "degrees",
-                             "return_pixel_ranges",
-                             NULL};
-
+    int n_threads = 0;
+    static char *kwlist[] = {"a",      "b",       "a_vertices", "b_vertices",
+                             "lonlat", "degrees", "n_threads",  NULL};
     char err[ERR_SIZE];
     int status = 1;
-    i64rangeset *pixset = NULL;
+    pointingarr *vertices = NULL;
+    polygon_shape *polygon = NULL;
+    PyObject *inside_arr = NULL;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Ldddd|plpppp", kwlist, &nside, &a0, &a1,
-                                     &b0, &b1, &inclusive, &fact, &nest, &lonlat, &degrees,
-                                     &return_pixel_ranges))
-        goto fail;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOO|ppi", kwlist, &a_obj, &b_obj,
+                                     &a_vert_obj, &b_vert_obj, &lonlat, &degrees, &n_threads))
+        return NULL;
 
-    if (return_pixel_ranges & ~nest) {
-        PyErr_SetString(PyExc_RuntimeError,
-                        "Can only use return_pixel_ranges with nest ordering.");
-        goto fail;
-    }
+    vertices = hpgeom_polygon_vertices(a_vert_obj, b_vert_obj, lonlat, degrees);
+    if (vertices == NULL) goto cleanup;
 
-    double theta0, theta1, phi0, phi1;
-    bool full_lon = false;
-    if (lonlat) {
-        if (a0 == 0.0 && a1 == 360.0) full_lon = true;
-        if (b0 > b1) {
-            PyErr_SetString(PyExc_ValueError, "b1/lat1 must be >= b0/lat0.");
-            goto fail;
-        }
-        // Swap theta ordering.
-        if (!hpgeom_lonlat_to_thetaphi(a0, b0, &theta1, &phi0, (bool)degrees, err)) {
-            PyErr_SetString(PyExc_ValueError, err);
-            goto fail;
-        }
-        if (!hpgeom_lonlat_to_thetaphi(a1, b1, &theta0, &phi1, (bool)degrees, err)) {
-            PyErr_SetString(PyExc_ValueError, err);
-            goto fail;
-        }
-    } else {
-        if (b0 == 0.0 && b1 == HPG_TWO_PI) full_lon = true;
-        if (a0 > a1) {
-            PyErr_SetString(PyExc_ValueError, "a1/colatitude1 must be <= a0/colatitude0.");
-            goto fail;
-        }
-        if (!hpgeom_check_theta_phi(a0, b0, err)) {
-            PyErr_SetString(PyExc_ValueError, err);
-            goto fail;
-        }
-        theta0 = a0;
-        phi0 = b0;
-        if (!hpgeom_check_theta_phi(a1, b1, err)) {
-            PyErr_SetString(PyExc_ValueError, err);
-            goto fail;
-        }
-        theta1 = a1;
-        phi1 = b1;
+    polygon = polygon_shape_new(vertices, &status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        goto cleanup;
     }
 
-    if (!nest) {
-        PyErr_WarnEx(PyExc_ResourceWarning,
-                     "query_box natively supports nest ordering.  Result will be "
-                     "converted from nest->ring and sorted",
-                     0);
-    }
+    inside_arr = hpgeom_points_in_shape(a_obj, b_obj, lonlat, degrees, n_threads,
+                                        points_in_polygon_func, polygon);
 
-    if (!hpgeom_check_nside(nside, NEST, err)) {
-        PyErr_SetString(PyExc_ValueError, err);
-        goto fail;
-    }
-    healpix_info hpx = healpix_info_from_nside(nside, NEST);
+cleanup:
+    pointingarr_delete(vertices);
+    polygon_shape_delete(polygon);
 
-    pixset = i64rangeset_new(&status, err);
-    if (!status) {
-        PyErr_SetString(PyExc_RuntimeError, err);
-        goto fail;
-    }
+    return inside_arr;
+}
 
-    if (!inclusive) {
-        fact = 0;
+typedef struct {
+    bool to_ring;
+    bool check;
+    // If false the pixels are only checked, and there is no out operand.
+    bool convert;
+} reorder_params;
+
+// Check (if requested) and convert a run of n pixels with a single nside.
+// The conversion is element by element, so out may be the same as in.
+static inline int reorder_run(const reorder_params *params, healpix_info *hpx,
+                              const int64_t *in, int64_t *out, npy_intp n, char *err) {
+    if (n == 0) return 1;
+    if (params->check && !hpgeom_check_pixel_array(hpx, in, n, err)) return 0;
+    if (!params->convert) return 1;
+    if (params->to_ring) {
+        nest2ring_batch(hpx, in, out, n);
     } else {
-        if (!hpgeom_check_fact(&hpx, fact, err)) {
-            PyErr_SetString(PyExc_ValueError, err);
-            goto fail;
-        }
+        ring2nest_batch(hpx, in, out, n);
     }
-    query_box(&hpx, theta0, theta1, phi0, phi1, full_lon, fact, pixset, &status, err);
+    return 1;
+}
 
-    if (!status) {
-        PyErr_SetString(PyExc_RuntimeError, err);
-        goto fail;
-    }
+static void reorder_kernel(hpgeom_iter_chunk *chunk) {
+    const reorder_params *params = (const reorder_params *)chunk->params;
+    char **dataptrarray = chunk->dataptrarray;
+    npy_intp *strides = chunk->strides;
+    int64_t nside;
+    int64_t last_nside = -1;
+    hpx_cache cache;
+    bool started = false;
+    int64_t inbuf[HPG_BLOCK_SIZE], outbuf[HPG_BLOCK_SIZE];
+    healpix_info hpx;
 
-    PyObject *return_arr = create_query_return_arr(pixset, return_pixel_ranges, !nest, &hpx);
+    hpx_cache_init(&cache);
+    do {
+        char *nside_p = dataptrarray[0];
+        char *in_p = dataptrarray[1];
+        char *out_p = params->convert ? dataptrarray[2] : NULL;
+        npy_intp count = *chunk->innersizeptr;
+        // Contiguous pixels are converted directly, in place if out is pix.
+        bool contiguous = (strides[1] == sizeof(int64_t)) &&
+                          (!params->convert || (strides[2] == sizeof(int64_t)));
+
+        // Pixels are converted a block at a time, and each run of constant
+        // nside within the block is checked and converted at once.  Each
+        // block is read before it is written.
+        while (count > 0) {
+            npy_intp nblock = (count < HPG_BLOCK_SIZE) ? count : HPG_BLOCK_SIZE;
+            const int64_t *in = contiguous ? (const int64_t *)in_p : inbuf;
+            int64_t *out = (contiguous && params->convert) ? (int64_t *)out_p : outbuf;
+            npy_intp run_start = 0;
+
+            if (!contiguous) {
+                for (npy_intp i = 0; i < nblock; i++) {
+                    inbuf[i] = *(int64_t *)(in_p + i * strides[1]);
+                }
+            }
 
-    i64rangeset_delete(pixset);
+            for (npy_intp i = 0; i < nblock; i++) {
+                nside = *(int64_t *)(nside_p + i * strides[0]);
+
+                if ((!started) || (nside != last_nside)) {
+                    if (started && !reorder_run(params, &hpx, &in[run_start], &out[run_start],
+                                                i - run_start, chunk->err)) {
+                        chunk->status = 0;
+                        return;
+                    }
+                    run_start = i;
+                    if (!hpgeom_check_nside(nside, NEST, chunk->err)) {
+                        chunk->status = 0;
+                        return;
+                    }
+                    hpx = healpix_info_cached(&cache, nside, NEST);
+                    last_nside = nside;
+                    started = true;
+                }
+                // A constant nside only needs to be looked at once.
+                if (strides[0] == 0) break;
+            }
+            if (!reorder_run(params, &hpx, &in[run_start], &out[run_start], nblock - run_start,
+                             chunk->err)) {
+                chunk->status = 0;
+                return;
+            }
 
-    return PyArray_Return((PyArrayObject *)return_arr);
+            if (params->convert) {
+                if (!contiguous) {
+                    for (npy_intp i = 0; i < nblock; i++) {
+                        *(int64_t *)(out_p + i * strides[2]) = outbuf[i];
+                    }
+                }
+                out_p += nblock * strides[2];
+            }
 
-fail:
-    i64rangeset_delete(pixset);
+            nside_p += nblock * strides[0];
+            in_p += nblock * strides[1];
+            count -= nblock;
+        }
+    } while (chunk->iternext(chunk->iter));
+}
 
-    return NULL;
+/*
+ * Check all pixels of a conversion without writing anything.  This is done
+ * before converting into an out array, which may be pix itself, so that it
+ * is left untouched if any pixel is out of range.  Returns 1 on success, 0
+ * on failure (with err set), or -1 if a python exception has been set.
+ */
+static int reorder_check(PyObject *nside_arr, PyObject *pix_arr, char *err) {
+    reorder_params params = {.to_ring = false, .check = true, .convert = false};
+    PyArrayObject *op[2] = {(PyArrayObject *)nside_arr, (PyArrayObject *)pix_arr};
+    npy_uint32 op_flags[2] = {NPY_ITER_READONLY, NPY_ITER_READONLY};
+    int status;
+
+    NpyIter *iter = NpyIter_MultiNew(2, op,
+                                     NPY_ITER_ZEROSIZE_OK | NPY_ITER_RANGED |
+                                         NPY_ITER_EXTERNAL_LOOP | NPY_ITER_BUFFERED |
+                                         NPY_ITER_GROWINNER,
+                                     NPY_KEEPORDER, NPY_NO_CASTING, op_flags, NULL);
+    if (iter == NULL) return -1;
+
+    status = hpgeom_iter_run(iter, 1, reorder_kernel, &params, err);
+    if (NpyIter_Deallocate(iter) != NPY_SUCCEED) return -1;
+
+    return status;
 }
 
 PyDoc_STRVAR(nest_to_ring_doc,
-             "nest_to_ring(nside, pix)\n"
+             "nest_to_ring(nside, pix, check=True, out=None)\n"
              "--\n\n"
              "Convert pixel number from nest to ring ordering.\n"
              "\n"
              "Parameters\n"
              "----------\n" NSIDE_DOC_PAR
              "pix : `int` or `np.ndarray` (N,)\n"
-             "    The pixel numbers in nest scheme.\n"
+             "    The pixel numbers in nest scheme.\n" CHECK_DOC_PAR OUT_DOC_PAR(
+                 "`np.ndarray` (N,)")
+             "    The conversion may be done in place with out=pix.  With check=True,\n"
+             "    all pixels are checked before out is written, so it is unchanged\n"
+             "    if any are out of range.\n"
              "\n"
              "Returns\n"
              "-------\n"
@@ -1074,16 +3035,22 @@ static PyObject *nest_to_ring(PyObject *dummy, PyObject *args, PyObject *kwargs)
     PyObject *nside_obj = NULL, *nest_pix_obj = NULL;
     PyObject *nside_arr = NULL, *nest_pix_arr = NULL;
     PyObject *ring_pix_arr = NULL;
+    PyObject *out_obj = NULL, *out = NULL;
 
     NpyIter *iter = NULL;
 
-    static char *kwlist[] = {"nside", "pix", NULL};
+    int check = 1;
+    static char *kwlist[] = {"nside", "pix", "check", "out", NULL};
+    static const int out_types[1] = {NPY_INT64};
 
-    healpix_info hpx;
+    reorder_params params;
+    int status;
     char err[ERR_SIZE];
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO", kwlist, &nside_obj, &nest_pix_obj))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|pO", kwlist, &nside_obj, &nest_pix_obj,
+                                     &check, &out_obj))
         goto fail;
+    if (!hpgeom_parse_out(out_obj, 1, out_types, &out)) goto fail;
 
     nside_arr =
         PyArray_FROM_OTF(nside_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
@@ -1097,8 +3064,6 @@ static PyObject *nest_to_ring(PyObject *dummy, PyObject *args, PyObject *kwargs)
     PyArrayObject *op[3];
     npy_uint32 op_flags[3];
     PyArray_Descr *op_dtypes[3];
-    NpyIter_IterNextFunc *iternext;
-    char **dataptrarray;
 
     op[0] = (PyArrayObject *)nside_arr;
     op_flags[0] = NPY_ITER_READONLY;
@@ -1106,47 +3071,43 @@ static PyObject *nest_to_ring(PyObject *dummy, PyObject *args, PyObject *kwargs)
     op[1] = (PyArrayObject *)nest_pix_arr;
     op_flags[1] = NPY_ITER_READONLY;
     op_dtypes[1] = NULL;
-    op[2] = (PyArrayObject *)ring_pix_arr;
-    op_flags[2] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
+    // The kernel reads each block of pixels before writing it, so out may
+    // be the same array as pix.
+    op[2] = (PyArrayObject *)out;
+    op_flags[2] = HPG_OUT_OP_FLAGS(out);
     op_dtypes[2] = PyArray_DescrFromType(NPY_INT64);
 
-    iter = NpyIter_MultiNew(3, op, NPY_ITER_ZEROSIZE_OK, NPY_KEEPORDER, NPY_NO_CASTING,
-                            op_flags, op_dtypes);
+    iter = NpyIter_MultiNew(3, op,
+                            NPY_ITER_ZEROSIZE_OK | NPY_ITER_RANGED | NPY_ITER_EXTERNAL_LOOP |
+                                NPY_ITER_BUFFERED | NPY_ITER_GROWINNER,
+                            NPY_KEEPORDER, NPY_NO_CASTING, op_flags, op_dtypes);
     if (iter == NULL) {
-        PyErr_SetString(PyExc_ValueError,
-                        "nside, pix arrays could not be broadcast together.");
+        if (out == NULL) {
+            PyErr_SetString(PyExc_ValueError,
+                            "nside, pix arrays could not be broadcast together.");
+        }
         goto fail;
     }
 
-    iternext = NpyIter_GetIterNext(iter, NULL);
-    dataptrarray = NpyIter_GetDataPtrArray(iter);
+    params.to_ring = true;
+    params.check = check;
+    params.convert = true;
 
-    // Check for zero-size before entering loop.
-    if (NpyIter_GetIterSize(iter) > 0) {
-        int64_t *nside;
-        int64_t *nest_pix;
-        int64_t *ring_pix;
-        int64_t last_nside = -1;
-        bool started = false;
-        do {
-            nside = (int64_t *)dataptrarray[0];
-            nest_pix = (int64_t *)dataptrarray[1];
-            ring_pix = (int64_t *)dataptrarray[2];
+    if (check && (out != NULL)) {
+        status = reorder_check(nside_arr, nest_pix_arr, err);
+        if (status < 0) goto fail;
+        if (status == 0) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
+        params.check = false;
+    }
 
-            if ((!started) || (*nside != last_nside)) {
-                if (!hpgeom_check_nside(*nside, NEST, err)) {
-                    PyErr_SetString(PyExc_ValueError, err);
-                    goto fail;
-                }
-                hpx = healpix_info_from_nside(*nside, NEST);
-                started = true;
-            }
-            if (!hpgeom_check_pixel(&hpx, *nest_pix, err)) {
-                PyErr_SetString(PyExc_ValueError, err);
-                goto fail;
-            }
-            *ring_pix = nest2ring(&hpx, *nest_pix);
-        } while (iternext(iter));
+    status = hpgeom_iter_run(iter, 1, reorder_kernel, &params, err);
+    if (status < 0) goto fail;
+    if (status == 0) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
     }
 
     ring_pix_arr = (PyObject *)NpyIter_GetOperandArray(iter)[2];
@@ -1159,7 +3120,7 @@ static PyObject *nest_to_ring(PyObject *dummy, PyObject *args, PyObject *kwargs)
         goto fail;
     }
 
-    return PyArray_Return((PyArrayObject *)ring_pix_arr);
+    return hpgeom_return_out(ring_pix_arr, out);
 
 fail:
     Py_XDECREF(nside_arr);
@@ -1173,14 +3134,18 @@ fail:
 }
 
 PyDoc_STRVAR(ring_to_nest_doc,
-             "ring_to_nest(nside, pix)\n"
+             "ring_to_nest(nside, pix, check=True, out=None)\n"
              "--\n\n"
              "Convert pixel number from ring to nest ordering.\n"
              "\n"
              "Parameters\n"
              "----------\n" NSIDE_DOC_PAR
              "pix : `int` or `np.ndarray` (N,)\n"
-             "    The pixel numbers in ring scheme.\n"
+             "    The pixel numbers in ring scheme.\n" CHECK_DOC_PAR OUT_DOC_PAR(
+                 "`np.ndarray` (N,)")
+             "    The conversion may be done in place with out=pix.  With check=True,\n"
+             "    all pixels are checked before out is written, so it is unchanged\n"
+             "    if any are out of range.\n"
              "\n"
              "Returns\n"
              "-------\n"
@@ -1196,16 +3161,22 @@ static PyObject *ring_to_nest(PyObject *dummy, PyObject *args, PyObject *kwargs)
     PyObject *nside_obj = NULL, *ring_pix_obj = NULL;
     PyObject *nside_arr = NULL, *ring_pix_arr = NULL;
     PyObject *nest_pix_arr = NULL;
+    PyObject *out_obj = NULL, *out = NULL;
 
     NpyIter *iter = NULL;
 
-    static char *kwlist[] = {"nside", "pix", NULL};
+    int check = 1;
+    static char *kwlist[] = {"nside", "pix", "check", "out", NULL};
+    static const int out_types[1] = {NPY_INT64};
 
-    healpix_info hpx;
+    reorder_params params;
+    int status;
     char err[ERR_SIZE];
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO", kwlist, &nside_obj, &ring_pix_obj))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|pO", kwlist, &nside_obj, &ring_pix_obj,
+                                     &check, &out_obj))
         goto fail;
+    if (!hpgeom_parse_out(out_obj, 1, out_types, &out)) goto fail;
 
     nside_arr =
         PyArray_FROM_OTF(nside_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
@@ -1219,8 +3190,6 @@ static PyObject *ring_to_nest(PyObject *dummy, PyObject *args, PyObject *kwargs)
     PyArrayObject *op[3];
     npy_uint32 op_flags[3];
     PyArray_Descr *op_dtypes[3];
-    NpyIter_IterNextFunc *iternext;
-    char **dataptrarray;
 
     op[0] = (PyArrayObject *)nside_arr;
     op_flags[0] = NPY_ITER_READONLY;
@@ -1228,47 +3197,43 @@ static PyObject *ring_to_nest(PyObject *dummy, PyObject *args, PyObject *kwargs)
     op[1] = (PyArrayObject *)ring_pix_arr;
     op_flags[1] = NPY_ITER_READONLY;
     op_dtypes[1] = NULL;
-    op[2] = (PyArrayObject *)nest_pix_arr;
-    op_flags[2] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
+    // The kernel reads each block of pixels before writing it, so out may
+    // be the same array as pix.
+    op[2] = (PyArrayObject *)out;
+    op_flags[2] = HPG_OUT_OP_FLAGS(out);
     op_dtypes[2] = PyArray_DescrFromType(NPY_INT64);
 
-    iter = NpyIter_MultiNew(3, op, NPY_ITER_ZEROSIZE_OK, NPY_KEEPORDER, NPY_NO_CASTING,
-                            op_flags, op_dtypes);
+    iter = NpyIter_MultiNew(3, op,
+                            NPY_ITER_ZEROSIZE_OK | NPY_ITER_RANGED | NPY_ITER_EXTERNAL_LOOP |
+                                NPY_ITER_BUFFERED | NPY_ITER_GROWINNER,
+                            NPY_KEEPORDER, NPY_NO_CASTING, op_flags, op_dtypes);
     if (iter == NULL) {
-        PyErr_SetString(PyExc_ValueError,
-                        "nside, pix arrays could not be broadcast together.");
+        if (out == NULL) {
+            PyErr_SetString(PyExc_ValueError,
+                            "nside, pix arrays could not be broadcast together.");
+        }
         goto fail;
     }
 
-    iternext = NpyIter_GetIterNext(iter, NULL);
-    dataptrarray = NpyIter_GetDataPtrArray(iter);
+    params.to_ring = false;
+    params.check = check;
+    params.convert = true;
 
-    // Check for zero-size before entering loop.
-    if (NpyIter_GetIterSize(iter) > 0) {
-        int64_t *nside;
-        int64_t *ring_pix;
-        int64_t *nest_pix;
-        int64_t last_nside = -1;
-        bool started = false;
-        do {
-            nside = (int64_t *)dataptrarray[0];
-            ring_pix = (int64_t *)dataptrarray[1];
-            nest_pix = (int64_t *)dataptrarray[2];
+    if (check && (out != NULL)) {
+        status = reorder_check(nside_arr, ring_pix_arr, err);
+        if (status < 0) goto fail;
+        if (status == 0) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
+        params.check = false;
+    }
 
-            if ((!started) || (*nside != last_nside)) {
-                if (!hpgeom_check_nside(*nside, NEST, err)) {
-                    PyErr_SetString(PyExc_ValueError, err);
-                    goto fail;
-                }
-                hpx = healpix_info_from_nside(*nside, NEST);
-                started = true;
-            }
-            if (!hpgeom_check_pixel(&hpx, *ring_pix, err)) {
-                PyErr_SetString(PyExc_ValueError, err);
-                goto fail;
-            }
-            *nest_pix = ring2nest(&hpx, *ring_pix);
-        } while (iternext(iter));
+    status = hpgeom_iter_run(iter, 1, reorder_kernel, &params, err);
+    if (status < 0) goto fail;
+    if (status == 0) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
     }
 
     nest_pix_arr = (PyObject *)NpyIter_GetOperandArray(iter)[2];
@@ -1281,7 +3246,7 @@ static PyObject *ring_to_nest(PyObject *dummy, PyObject *args, PyObject *kwargs)
         goto fail;
     }
 
-    return PyArray_Return((PyArrayObject *)nest_pix_arr);
+    return hpgeom_return_out(nest_pix_arr, out);
 
 fail:
     Py_XDECREF(nside_arr);
@@ -1295,7 +3260,7 @@ fail:
 }
 
 PyDoc_STRVAR(boundaries_doc,
-             "boundaries(nside, pix, step=1, nest=True, lonlat=True, degrees=True)\n"
+             "boundaries(nside, pix, step=1, nest=True, lonlat=True, degrees=True, out=None)\n"
              "--\n\n"
              "Returns an array containing lon/lat or colatitude/longitude to the\n"
              "boundary of the given pixel(s).\n"
@@ -1307,7 +3272,8 @@ PyDoc_STRVAR(boundaries_doc,
              "----------\n" NSIDE_DOC_PAR PIX_DOC_PAR
              "step : `int`, optional\n"
              "    Number of steps for each side of the pixel.\n" NEST_DOC_PAR LONLAT_DOC_PAR
-                 DEGREES_DOC_PAR
+                 DEGREES_DOC_PAR OUT_DOC_PAR("`tuple` [`np.ndarray`] (2,)")
+             "    The arrays must also be C-contiguous.\n"
              "\n"
              "Returns\n"
              "-------\n"
@@ -1330,17 +3296,22 @@ static PyObject *boundaries_meth(PyObject *dummy, PyObject *args, PyObject *kwar
     int nest = 1;
     int degrees = 1;
     long step = 1;
-    static char *kwlist[] = {"nside", "pix", "step", "lonlat", "nest", "degrees", NULL};
+    PyObject *out_obj = NULL, *out[2];
+    static char *kwlist[] = {"nside", "pix", "step", "lonlat", "nest", "degrees", "out", NULL};
+    static const int out_types[2] = {NPY_FLOAT64, NPY_FLOAT64};
 
     double *as = NULL, *bs = NULL;
     pointingarr *ptg_arr = NULL;
     healpix_info hpx;
     int status;
+    bool fatal = false;
     char err[ERR_SIZE];
+    NPY_BEGIN_THREADS_DEF;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|Lppp", kwlist, &nside_obj, &pix_obj,
-                                     &step, &lonlat, &nest, &degrees))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|LpppO", kwlist, &nside_obj, &pix_obj,
+                                     &step, &lonlat, &nest, &degrees, &out_obj))
         goto fail;
+    if (!hpgeom_parse_out(out_obj, 2, out_types, out)) goto fail;
 
     nside_arr =
         PyArray_FROM_OTF(nside_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
@@ -1384,23 +3355,21 @@ static PyObject *boundaries_meth(PyObject *dummy, PyObject *args, PyObject *kwar
     iternext = NpyIter_GetIterNext(iter, NULL);
     dataptrarray = NpyIter_GetDataPtrArray(iter);
 
+    // The output shape is (4*step,) for scalar input, or (N, 4*step).
     int ndims = NpyIter_GetNDim(iter);
+    npy_intp dims[2];
     if (ndims == 0) {
-        npy_intp dims[1];
+        ndims = 1;
         dims[0] = 4 * step;
-        a_arr = PyArray_SimpleNew(1, dims, NPY_FLOAT64);
-        if (a_arr == NULL) goto fail;
-        b_arr = PyArray_SimpleNew(1, dims, NPY_FLOAT64);
-        if (b_arr == NULL) goto fail;
     } else {
-        npy_intp dims[2];
+        ndims = 2;
         dims[0] = NpyIter_GetIterSize(iter);
         dims[1] = 4 * step;
-        a_arr = PyArray_SimpleNew(2, dims, NPY_FLOAT64);
-        if (a_arr == NULL) goto fail;
-        b_arr = PyArray_SimpleNew(2, dims, NPY_FLOAT64);
-        if (b_arr == NULL) goto fail;
     }
+    a_arr = hpgeom_out_or_new(out[0], ndims, dims, NPY_FLOAT64);
+    if (a_arr == NULL) goto fail;
+    b_arr = hpgeom_out_or_new(out[1], ndims, dims, NPY_FLOAT64);
+    if (b_arr == NULL) goto fail;
     as = (double *)PyArray_DATA((PyArrayObject *)a_arr);
     bs = (double *)PyArray_DATA((PyArrayObject *)b_arr);
 
@@ -1422,29 +3391,33 @@ static PyObject *boundaries_meth(PyObject *dummy, PyObject *args, PyObject *kwar
         int64_t *nside;
         int64_t *pix;
         int64_t last_nside = -1;
+        hpx_cache cache;
         bool started = false;
+        hpx_cache_init(&cache);
+        if (!NpyIter_IterationNeedsAPI(iter)) NPY_BEGIN_THREADS;
         do {
             nside = (int64_t *)dataptrarray[0];
             pix = (int64_t *)dataptrarray[1];
 
             if ((!started) || (*nside != last_nside)) {
                 if (!hpgeom_check_nside(*nside, scheme, err)) {
-                    PyErr_SetString(PyExc_ValueError, err);
-                    goto fail;
+                    status = 0;
+                    break;
                 }
-                hpx = healpix_info_from_nside(*nside, scheme);
+                hpx = healpix_info_cached(&cache, *nside, scheme);
+                last_nside = *nside;
                 started = true;
             }
 
             if (!hpgeom_check_pixel(&hpx, *pix, err)) {
-                PyErr_SetString(PyExc_ValueError, err);
-                goto fail;
+                status = 0;
+                break;
             }
 
             boundaries(&hpx, *pix, step, ptg_arr, &status);
             if (!status) {
-                PyErr_SetString(PyExc_RuntimeError, "Fatal programming error in boundaries.");
-                goto fail;
+                fatal = true;
+                break;
             }
 
             size_t index;
@@ -1463,6 +3436,16 @@ static PyObject *boundaries_meth(PyObject *dummy, PyObject *args, PyObject *kwar
             }
 
         } while (iternext(iter));
+        NPY_END_THREADS;
+
+        if (fatal) {
+            PyErr_SetString(PyExc_RuntimeError, "Fatal programming error in boundaries.");
+            goto fail;
+        }
+        if (!status) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
     }
 
     Py_DECREF(nside_arr);
@@ -1492,8 +3475,85 @@ fail:
     return NULL;
 }
 
+typedef struct {
+    enum Scheme scheme;
+    bool float32;
+    bool int32;
+    bool check;
+} vector_params;
+
+static void vector_to_pixel_kernel(hpgeom_iter_chunk *chunk) {
+    const vector_params *params = (const vector_params *)chunk->params;
+    char **dataptrarray = chunk->dataptrarray;
+    npy_intp *strides = chunk->strides;
+    int64_t nside;
+    int64_t last_nside = -1;
+    hpx_cache cache;
+    bool started = false;
+    double xbuf[HPG_BLOCK_SIZE], ybuf[HPG_BLOCK_SIZE], zbuf[HPG_BLOCK_SIZE];
+    healpix_info hpx;
+    vec3 vec;
+
+    hpx_cache_init(&cache);
+    do {
+        char *nside_p = dataptrarray[0];
+        char *x_p = dataptrarray[1];
+        char *y_p = dataptrarray[2];
+        char *z_p = dataptrarray[3];
+        char *pix_p = dataptrarray[4];
+        npy_intp count = *chunk->innersizeptr;
+
+        // Vectors are read and checked a block at a time, so that zero or
+        // non-finite vectors never reach vec2pix.
+        while (count > 0) {
+            npy_intp nblock = (count < HPG_BLOCK_SIZE) ? count : HPG_BLOCK_SIZE;
+
+            for (npy_intp i = 0; i < nblock; i++) {
+                xbuf[i] = hpgeom_read_coord(x_p + i * strides[1], params->float32);
+                ybuf[i] = hpgeom_read_coord(y_p + i * strides[2], params->float32);
+                zbuf[i] = hpgeom_read_coord(z_p + i * strides[3], params->float32);
+            }
+            if (params->check &&
+                !hpgeom_check_vector_array(xbuf, ybuf, zbuf, nblock, chunk->err)) {
+                chunk->status = 0;
+                return;
+            }
+
+            for (npy_intp i = 0; i < nblock; i++) {
+                nside = *(int64_t *)(nside_p + i * strides[0]);
+
+                if ((!started) || (nside != last_nside)) {
+                    if (!hpgeom_check_nside(nside, params->scheme, chunk->err) ||
+                        (params->int32 && !hpgeom_check_nside_int32(nside, chunk->err))) {
+                        chunk->status = 0;
+                        return;
+                    }
+                    hpx = healpix_info_cached(&cache, nside, params->scheme);
+                    last_nside = nside;
+                    started = true;
+                }
+                vec.x = xbuf[i];
+                vec.y = ybuf[i];
+                vec.z = zbuf[i];
+                if (params->int32) {
+                    *(int32_t *)(pix_p + i * strides[4]) = (int32_t)vec2pix(&hpx, &vec);
+                } else {
+                    *(int64_t *)(pix_p + i * strides[4]) = vec2pix(&hpx, &vec);
+                }
+            }
+
+            nside_p += nblock * strides[0];
+            x_p += nblock * strides[1];
+            y_p += nblock * strides[2];
+            z_p += nblock * strides[3];
+            pix_p += nblock * strides[4];
+            count -= nblock;
+        }
+    } while (chunk->iternext(chunk->iter));
+}
+
 PyDoc_STRVAR(vector_to_pixel_doc,
-             "vector_to_pixel(nside, x, y, z, nest=True)\n"
+             "vector_to_pixel(nside, x, y, z, nest=True, dtype=None, check=True, out=None)\n"
              "--\n\n"
              "Convert vectors to pixels.\n"
              "\n"
@@ -1504,10 +3564,17 @@ PyDoc_STRVAR(vector_to_pixel_doc,
              "y : `float` or `np.ndarray` (N,)\n"
              "    y coordinates for vectors.\n"
              "z : `float` or `np.ndarray` (N,)\n"
-             "    z coordinates for vectors.\n" NEST_DOC_PAR
+             "    z coordinates for vectors.\n" FLOAT32_DOC_DESCR NEST_DOC_PAR
+                 PIX_DTYPE_DOC_PAR CHECK_DOC_PAR OUT_DOC_PAR("`np.ndarray` (N,)")
              "\n"
              "Returns\n"
-             "-------\n" PIX_DOC_PAR);
+             "-------\n" PIX_DOC_PAR
+             "\n"
+             "Raises\n"
+             "------\n"
+             "ValueError\n"
+             "    If vectors are zero or not finite, or nside, x, y, z arrays are not\n"
+             "    compatible.\n");
 
 static PyObject *vector_to_pixel(PyObject *dummy, PyObject *args, PyObject *kwargs) {
     PyObject *nside_obj = NULL, *x_obj = NULL, *y_obj = NULL, *z_obj = NULL;
@@ -1517,33 +3584,42 @@ static PyObject *vector_to_pixel(PyObject *dummy, PyObject *args, PyObject *kwar
     NpyIter *iter = NULL;
 
     int nest = 1;
-    static char *kwlist[] = {"nside", "x", "y", "z", "nest", NULL};
+    int check = 1;
+    PyObject *out_obj = NULL, *out = NULL;
+    PyArray_Descr *dtype = NULL;
+    static char *kwlist[] = {"nside", "x", "y", "z", "nest", "dtype", "check", "out", NULL};
+    int out_types[1];
 
-    healpix_info hpx;
+    vector_params params;
+    int status;
     char err[ERR_SIZE];
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOO|p", kwlist, &nside_obj, &x_obj,
-                                     &y_obj, &z_obj, &nest))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOO|pO&pO", kwlist, &nside_obj, &x_obj,
+                                     &y_obj, &z_obj, &nest, PyArray_DescrConverter2, &dtype,
+                                     &check, &out_obj))
         goto fail;
+    if (!hpgeom_pixel_dtype(dtype, &out_types[0])) goto fail;
+    if (!hpgeom_parse_out(out_obj, 1, out_types, &out)) goto fail;
+
+    PyObject *coord_objs[3] = {x_obj, y_obj, z_obj};
+    int coord_type = hpgeom_coord_type(coord_objs, 3);
 
     nside_arr =
         PyArray_FROM_OTF(nside_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
     if (nside_arr == NULL) goto fail;
-    x_arr = PyArray_FROM_OTF(x_obj, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    x_arr = PyArray_FROM_OTF(x_obj, coord_type, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
     if (x_arr == NULL) goto fail;
-    y_arr = PyArray_FROM_OTF(y_obj, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    y_arr = PyArray_FROM_OTF(y_obj, coord_type, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
     if (y_arr == NULL) goto fail;
-    z_arr = PyArray_FROM_OTF(z_obj, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    z_arr = PyArray_FROM_OTF(z_obj, coord_type, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
     if (z_arr == NULL) goto fail;
 
-    // The input arrays are nside_arr (int64_t), x_arr (double), y_arr (double),
-    // z_arr (double).
-    // The output array is pix_arr (int64_t).
+    // The input arrays are nside_arr (int64_t), x_arr, y_arr, z_arr (double
+    // or float).
+    // The output array is pix_arr (int64_t or int32_t).
     PyArrayObject *op[5];
     npy_uint32 op_flags[5];
     PyArray_Descr *op_dtypes[5];
-    NpyIter_IterNextFunc *iternext;
-    char **dataptrarray;
 
     op[0] = (PyArrayObject *)nside_arr;
     op_flags[0] = NPY_ITER_READONLY;
@@ -1557,56 +3633,32 @@ static PyObject *vector_to_pixel(PyObject *dummy, PyObject *args, PyObject *kwar
     op[3] = (PyArrayObject *)z_arr;
     op_flags[3] = NPY_ITER_READONLY;
     op_dtypes[3] = NULL;
-    op[4] = (PyArrayObject *)pix_arr;
-    op_flags[4] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
-    op_dtypes[4] = PyArray_DescrFromType(NPY_INT64);
-
-    iter = NpyIter_MultiNew(5, op, NPY_ITER_ZEROSIZE_OK, NPY_KEEPORDER, NPY_NO_CASTING,
-                            op_flags, op_dtypes);
+    op[4] = (PyArrayObject *)out;
+    op_flags[4] = HPG_OUT_OP_FLAGS(out);
+    op_dtypes[4] = PyArray_DescrFromType(out_types[0]);
+
+    iter = NpyIter_MultiNew(5, op,
+                            NPY_ITER_ZEROSIZE_OK | NPY_ITER_RANGED | NPY_ITER_EXTERNAL_LOOP |
+                                NPY_ITER_BUFFERED | NPY_ITER_GROWINNER,
+                            NPY_KEEPORDER, NPY_NO_CASTING, op_flags, op_dtypes);
     if (iter == NULL) {
-        PyErr_SetString(PyExc_ValueError,
-                        "nside, x, y, z arrays could not be broadcast together.");
+        if (out == NULL) {
+            PyErr_SetString(PyExc_ValueError,
+                            "nside, x, y, z arrays could not be broadcast together.");
+        }
         goto fail;
     }
 
-    iternext = NpyIter_GetIterNext(iter, NULL);
-    dataptrarray = NpyIter_GetDataPtrArray(iter);
-
-    enum Scheme scheme;
-    if (nest) {
-        scheme = NEST;
-    } else {
-        scheme = RING;
-    }
-
-    // Check for zero-size before entering loop.
-    if (NpyIter_GetIterSize(iter) > 0) {
-        int64_t *nside;
-        double *x, *y, *z;
-        int64_t *outpix;
-        int64_t last_nside = -1;
-        bool started = false;
-        vec3 vec;
-        do {
-            nside = (int64_t *)dataptrarray[0];
-            x = (double *)dataptrarray[1];
-            y = (double *)dataptrarray[2];
-            z = (double *)dataptrarray[3];
-            outpix = (int64_t *)dataptrarray[4];
+    params.scheme = nest ? NEST : RING;
+    params.float32 = (coord_type == NPY_FLOAT32);
+    params.int32 = (out_types[0] == NPY_INT32);
+    params.check = check;
 
-            if ((!started) || (*nside != last_nside)) {
-                if (!hpgeom_check_nside(*nside, scheme, err)) {
-                    PyErr_SetString(PyExc_ValueError, err);
-                    goto fail;
-                }
-                hpx = healpix_info_from_nside(*nside, scheme);
-                started = true;
-            }
-            vec.x = *x;
-            vec.y = *y;
-            vec.z = *z;
-            *outpix = vec2pix(&hpx, &vec);
-        } while (iternext(iter));
+    status = hpgeom_iter_run(iter, 1, vector_to_pixel_kernel, &params, err);
+    if (status < 0) goto fail;
+    if (status == 0) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
     }
 
     pix_arr = (PyObject *)NpyIter_GetOperandArray(iter)[4];
@@ -1616,12 +3668,13 @@ static PyObject *vector_to_pixel(PyObject *dummy, PyObject *args, PyObject *kwar
     Py_DECREF(x_arr);
     Py_DECREF(y_arr);
     Py_DECREF(z_arr);
+    Py_XDECREF(dtype);
     if (NpyIter_Deallocate(iter) != NPY_SUCCEED) {
         iter = NULL;
         goto fail;
     }
 
-    return PyArray_Return((PyArrayObject *)pix_arr);
+    return hpgeom_return_out(pix_arr, out);
 
 fail:
     Py_XDECREF(nside_arr);
@@ -1629,6 +3682,7 @@ fail:
     Py_XDECREF(y_arr);
     Py_XDECREF(z_arr);
     Py_XDECREF(pix_arr);
+    Py_XDECREF(dtype);
     if (iter != NULL) {
         NpyIter_Deallocate(iter);
     }
@@ -1637,12 +3691,13 @@ fail:
 }
 
 PyDoc_STRVAR(pixel_to_vector_doc,
-             "pixel_to_vector(nside, pix, nest=True)\n"
+             "pixel_to_vector(nside, pix, nest=True, dtype=None, check=True, out=None)\n"
              "--\n\n"
              "Convert pixels to vectors.\n"
              "\n"
              "Parameters\n"
-             "----------\n" NSIDE_DOC_PAR PIX_DOC_PAR NEST_DOC_PAR
+             "----------\n" NSIDE_DOC_PAR PIX_DOC_PAR NEST_DOC_PAR COORD_DTYPE_DOC_PAR
+                 CHECK_DOC_PAR OUT_DOC_PAR("`tuple` [`np.ndarray`] (3,)")
              "\n"
              "Returns\n"
              "-------\n"
@@ -1667,14 +3722,24 @@ static PyObject *pixel_to_vector(PyObject *dummy, PyObject *args, PyObject *kwar
     NpyIter *iter = NULL;
 
     int nest = 1;
-    static char *kwlist[] = {"nside", "pix", "nest", NULL};
+    PyObject *out_obj = NULL, *out[3];
+    int check = 1;
+    PyArray_Descr *dtype = NULL;
+    static char *kwlist[] = {"nside", "pix", "nest", "dtype", "check", "out", NULL};
+    int out_types[3];
 
     healpix_info hpx;
+    int status = 1;
     char err[ERR_SIZE];
+    NPY_BEGIN_THREADS_DEF;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|p", kwlist, &nside_obj, &pix_obj,
-                                     &nest))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|pO&pO", kwlist, &nside_obj, &pix_obj,
+                                     &nest, PyArray_DescrConverter2, &dtype, &check, &out_obj))
         goto fail;
+    if (!hpgeom_float_dtype(dtype, &out_types[0])) goto fail;
+    out_types[1] = out_types[2] = out_types[0];
+    bool float32 = (out_types[0] == NPY_FLOAT32);
+    if (!hpgeom_parse_out(out_obj, 3, out_types, out)) goto fail;
 
     nside_arr =
         PyArray_FROM_OTF(nside_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
@@ -1683,7 +3748,7 @@ static PyObject *pixel_to_vector(PyObject *dummy, PyObject *args, PyObject *kwar
     if (pix_arr == NULL) goto fail;
 
     // The input arrays are nside_arr (int64_t), pix_arr (int64_t).
-    // The output arrays are x_arr (double), y_arr (double), z_arr (double).
+    // The output arrays are x_arr, y_arr, z_arr (double or float).
     PyArrayObject *op[5];
     npy_uint32 op_flags[5];
     PyArray_Descr *op_dtypes[5];
@@ -1696,21 +3761,23 @@ static PyObject *pixel_to_vector(PyObject *dummy, PyObject *args, PyObject *kwar
     op[1] = (PyArrayObject *)pix_arr;
     op_flags[1] = NPY_ITER_READONLY;
     op_dtypes[1] = NULL;
-    op[2] = (PyArrayObject *)x_arr;
-    op_flags[2] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
-    op_dtypes[2] = PyArray_DescrFromType(NPY_DOUBLE);
-    op[3] = (PyArrayObject *)y_arr;
-    op_flags[3] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
-    op_dtypes[3] = PyArray_DescrFromType(NPY_DOUBLE);
-    op[4] = (PyArrayObject *)z_arr;
-    op_flags[4] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
-    op_dtypes[4] = PyArray_DescrFromType(NPY_DOUBLE);
+    op[2] = (PyArrayObject *)out[0];
+    op_flags[2] = HPG_OUT_OP_FLAGS(out[0]);
+    op_dtypes[2] = PyArray_DescrFromType(out_types[0]);
+    op[3] = (PyArrayObject *)out[1];
+    op_flags[3] = HPG_OUT_OP_FLAGS(out[1]);
+    op_dtypes[3] = PyArray_DescrFromType(out_types[1]);
+    op[4] = (PyArrayObject *)out[2];
+    op_flags[4] = HPG_OUT_OP_FLAGS(out[2]);
+    op_dtypes[4] = PyArray_DescrFromType(out_types[2]);
 
     iter = NpyIter_MultiNew(5, op, NPY_ITER_ZEROSIZE_OK, NPY_KEEPORDER, NPY_NO_CASTING,
                             op_flags, op_dtypes);
     if (iter == NULL) {
-        PyErr_SetString(PyExc_ValueError,
-                        "nside, x, y, z arrays could not be broadcast together.");
+        if (out[0] == NULL) {
+            PyErr_SetString(PyExc_ValueError,
+                            "nside, x, y, z arrays could not be broadcast together.");
+        }
         goto fail;
     }
 
@@ -1728,34 +3795,40 @@ static PyObject *pixel_to_vector(PyObject *dummy, PyObject *args, PyObject *kwar
     if (NpyIter_GetIterSize(iter) > 0) {
         int64_t *nside;
         int64_t *pix;
-        double *x, *y, *z;
         int64_t last_nside = -1;
+        hpx_cache cache;
         bool started = false;
         vec3 vec;
+        hpx_cache_init(&cache);
+        if (!NpyIter_IterationNeedsAPI(iter)) NPY_BEGIN_THREADS;
         do {
             nside = (int64_t *)dataptrarray[0];
             pix = (int64_t *)dataptrarray[1];
-            x = (double *)dataptrarray[2];
-            y = (double *)dataptrarray[3];
-            z = (double *)dataptrarray[4];
 
             if ((!started) || (*nside != last_nside)) {
                 if (!hpgeom_check_nside(*nside, scheme, err)) {
-                    PyErr_SetString(PyExc_ValueError, err);
-                    goto fail;
+                    status = 0;
+                    break;
                 }
-                hpx = healpix_info_from_nside(*nside, scheme);
+                hpx = healpix_info_cached(&cache, *nside, scheme);
+                last_nside = *nside;
                 started = true;
             }
-            if (!hpgeom_check_pixel(&hpx, *pix, err)) {
-                PyErr_SetString(PyExc_ValueError, err);
-                goto fail;
+            if (check && !hpgeom_check_pixel(&hpx, *pix, err)) {
+                status = 0;
+                break;
             }
             vec = pix2vec(&hpx, *pix);
-            *x = vec.x;
-            *y = vec.y;
-            *z = vec.z;
+            hpgeom_write_coord(dataptrarray[2], vec.x, float32);
+            hpgeom_write_coord(dataptrarray[3], vec.y, float32);
+            hpgeom_write_coord(dataptrarray[4], vec.z, float32);
         } while (iternext(iter));
+        NPY_END_THREADS;
+
+        if (!status) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
     }
 
     x_arr = (PyObject *)NpyIter_GetOperandArray(iter)[2];
@@ -1767,15 +3840,16 @@ static PyObject *pixel_to_vector(PyObject *dummy, PyObject *args, PyObject *kwar
 
     Py_DECREF(nside_arr);
     Py_DECREF(pix_arr);
+    Py_XDECREF(dtype);
     if (NpyIter_Deallocate(iter) != NPY_SUCCEED) {
         iter = NULL;
         goto fail;
     }
 
     PyObject *retval = PyTuple_New(3);
-    PyTuple_SET_ITEM(retval, 0, PyArray_Return((PyArrayObject *)x_arr));
-    PyTuple_SET_ITEM(retval, 1, PyArray_Return((PyArrayObject *)y_arr));
-    PyTuple_SET_ITEM(retval, 2, PyArray_Return((PyArrayObject *)z_arr));
+    PyTuple_SET_ITEM(retval, 0, hpgeom_return_out(x_arr, out[0]));
+    PyTuple_SET_ITEM(retval, 1, hpgeom_return_out(y_arr, out[1]));
+    PyTuple_SET_ITEM(retval, 2, hpgeom_return_out(z_arr, out[2]));
 
     return retval;
 
@@ -1785,6 +3859,7 @@ fail:
     Py_XDECREF(y_arr);
     Py_XDECREF(z_arr);
     Py_XDECREF(pix_arr);
+    Py_XDECREF(dtype);
     if (iter != NULL) {
         NpyIter_Deallocate(iter);
     }
@@ -1793,12 +3868,14 @@ fail:
 }
 
 PyDoc_STRVAR(neighbors_doc,
-             "neighbors(nside, pix, nest=True)\n"
+             "neighbors(nside, pix, nest=True, out=None)\n"
              "--\n\n"
              "Return 8 nearest neighbors for given pixels.\n"
              "\n"
              "Parameters\n"
-             "----------\n" NSIDE_DOC_PAR PIX_DOC_PAR NEST_DOC_PAR
+             "----------\n" NSIDE_DOC_PAR PIX_DOC_PAR NEST_DOC_PAR OUT_DOC_PAR(
+                 "`np.ndarray` (8,) or (N, 8)")
+             "    The array must also be C-contiguous.\n"
              "\n"
              "Returns\n"
              "-------\n"
@@ -1820,17 +3897,22 @@ static PyObject *neighbors_meth(PyObject *dummy, PyObject *args, PyObject *kwarg
     NpyIter *iter = NULL;
 
     int nest = 1;
-    static char *kwlist[] = {"nside", "pix", "nest", NULL};
+    PyObject *out_obj = NULL, *out = NULL;
+    static char *kwlist[] = {"nside", "pix", "nest", "out", NULL};
+    static const int out_types[1] = {NPY_INT64};
 
     i64stack *neigh = NULL;
     int64_t *neighbor_pixels;
     healpix_info hpx;
     int status;
+    bool fatal = false;
     char err[ERR_SIZE];
+    NPY_BEGIN_THREADS_DEF;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|p", kwlist, &nside_obj, &pix_obj,
-                                     &nest))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|pO", kwlist, &nside_obj, &pix_obj,
+                                     &nest, &out_obj))
         goto fail;
+    if (!hpgeom_parse_out(out_obj, 1, out_types, &out)) goto fail;
 
     nside_arr =
         PyArray_FROM_OTF(nside_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
@@ -1873,17 +3955,18 @@ static PyObject *neighbors_meth(PyObject *dummy, PyObject *args, PyObject *kwarg
     iternext = NpyIter_GetIterNext(iter, NULL);
     dataptrarray = NpyIter_GetDataPtrArray(iter);
 
+    // The output shape is (8,) for scalar input, or (N, 8).
     int ndims = NpyIter_GetNDim(iter);
+    npy_intp dims[2];
     if (ndims == 0) {
-        npy_intp dims[1];
+        ndims = 1;
         dims[0] = 8;
-        neighbor_arr = PyArray_SimpleNew(1, dims, NPY_INT64);
     } else {
-        npy_intp dims[2];
+        ndims = 2;
         dims[0] = NpyIter_GetIterSize(iter);
         dims[1] = 8;
-        neighbor_arr = PyArray_SimpleNew(2, dims, NPY_INT64);
     }
+    neighbor_arr = hpgeom_out_or_new(out, ndims, dims, NPY_INT64);
     if (neighbor_arr == NULL) goto fail;
     neighbor_pixels = (int64_t *)PyArray_DATA((PyArrayObject *)neighbor_arr);
 
@@ -1910,32 +3993,50 @@ static PyObject *neighbors_meth(PyObject *dummy, PyObject *args, PyObject *kwarg
         int64_t *nside;
         int64_t *pix;
         int64_t last_nside = -1;
+        hpx_cache cache;
         bool started = false;
         size_t index;
+        hpx_cache_init(&cache);
+        if (!NpyIter_IterationNeedsAPI(iter)) NPY_BEGIN_THREADS;
         do {
             nside = (int64_t *)dataptrarray[0];
             pix = (int64_t *)dataptrarray[1];
 
             if ((!started) || (*nside != last_nside)) {
                 if (!hpgeom_check_nside(*nside, scheme, err)) {
-                    PyErr_SetString(PyExc_ValueError, err);
-                    goto fail;
+                    status = 0;
+                    break;
                 }
-                hpx = healpix_info_from_nside(*nside, scheme);
+                hpx = healpix_info_cached(&cache, *nside, scheme);
+                last_nside = *nside;
                 started = true;
             }
 
             if (!hpgeom_check_pixel(&hpx, *pix, err)) {
-                PyErr_SetString(PyExc_ValueError, err);
-                goto fail;
+                status = 0;
+                break;
             }
             neighbors(&hpx, *pix, neigh, &status, err);
+            if (!status) {
+                fatal = true;
+                break;
+            }
 
             for (size_t i = 0; i < neigh->size; i++) {
                 index = neigh->size * NpyIter_GetIterIndex(iter) + i;
                 neighbor_pixels[index] = neigh->data[i];
             }
         } while (iternext(iter));
+        NPY_END_THREADS;
+
+        if (fatal) {
+            PyErr_SetString(PyExc_RuntimeError, err);
+            goto fail;
+        }
+        if (!status) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
     }
 
     Py_DECREF(nside_arr);
@@ -1988,7 +4089,9 @@ static PyObject *max_pixel_radius(PyObject *dummy, PyObject *args, PyObject *kwa
     static char *kwlist[] = {"nside", "degrees", NULL};
 
     healpix_info hpx;
+    int status = 1;
     char err[ERR_SIZE];
+    NPY_BEGIN_THREADS_DEF;
 
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|p", kwlist, &nside_obj, &degrees))
         goto fail;
@@ -2028,23 +4131,33 @@ static PyObject *max_pixel_radius(PyObject *dummy, PyObject *args, PyObject *kwa
         int64_t *nside;
         double *pixrad;
         int64_t last_nside = -1;
+        hpx_cache cache;
         bool started = false;
+        hpx_cache_init(&cache);
+        if (!NpyIter_IterationNeedsAPI(iter)) NPY_BEGIN_THREADS;
         do {
             nside = (int64_t *)dataptrarray[0];
             pixrad = (double *)dataptrarray[1];
 
             if ((!started) || (*nside != last_nside)) {
                 if (!hpgeom_check_nside(*nside, RING, err)) {
-                    PyErr_SetString(PyExc_ValueError, err);
-                    goto fail;
+                    status = 0;
+                    break;
                 }
-                hpx = healpix_info_from_nside(*nside, RING);
+                hpx = healpix_info_cached(&cache, *nside, RING);
+                last_nside = *nside;
                 started = true;
             }
             *pixrad = max_pixrad(&hpx);
             if (degrees) *pixrad *= HPG_R2D;
 
         } while (iternext(iter));
+        NPY_END_THREADS;
+
+        if (!status) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
     }
 
     pixrad_arr = (PyObject *)NpyIter_GetOperandArray(iter)[1];
@@ -2070,13 +4183,16 @@ fail:
 
 PyDoc_STRVAR(
     get_interpolation_weights_doc,
-    "get_interpolation_weights(nside, a, b, nest=True, lonlat=True, degrees=True)\n"
+    "get_interpolation_weights(nside, a, b, nest=True, lonlat=True, degrees=True,\n"
+    "                          out=None)\n"
     "--\n\n"
     "Return the 4 closest pixels and weights to perform bilinear interpolation along\n"
     "latitude and longitude.\n"
     "\n"
     "Parameters\n"
     "----------\n" NSIDE_DOC_PAR AB_DOC_PAR NEST_DOC_PAR LONLAT_DOC_PAR DEGREES_DOC_PAR
+        OUT_DOC_PAR("`tuple` [`np.ndarray`] (2,)")
+    "    The arrays must also be C-contiguous.\n"
     "\n"
     "Returns\n"
     "-------\n"
@@ -2097,16 +4213,21 @@ static PyObject *get_interpolation_weights(PyObject *dummy, PyObject *args, PyOb
     int lonlat = 1;
     int nest = 1;
     int degrees = 1;
-    static char *kwlist[] = {"nside", "a", "b", "lonlat", "nest", "degrees", NULL};
+    PyObject *out_obj = NULL, *out[2];
+    static char *kwlist[] = {"nside", "a", "b", "lonlat", "nest", "degrees", "out", NULL};
+    static const int out_types[2] = {NPY_INT64, NPY_FLOAT64};
 
     int64_t *pixels = NULL;
     double *weights = NULL;
     healpix_info hpx;
+    int status = 1;
     char err[ERR_SIZE];
+    NPY_BEGIN_THREADS_DEF;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|ppp", kwlist, &nside_obj, &a_obj,
-                                     &b_obj, &lonlat, &nest, &degrees))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|pppO", kwlist, &nside_obj, &a_obj,
+                                     &b_obj, &lonlat, &nest, &degrees, &out_obj))
         goto fail;
+    if (!hpgeom_parse_out(out_obj, 2, out_types, out)) goto fail;
 
     nside_arr =
         PyArray_FROM_OTF(nside_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
@@ -2155,23 +4276,21 @@ static PyObject *get_interpolation_weights(PyObject *dummy, PyObject *args, PyOb
     iternext = NpyIter_GetIterNext(iter, NULL);
     dataptrarray = NpyIter_GetDataPtrArray(iter);
 
+    // The output shape is (4,) for scalar input, or (N, 4).
     int ndims = NpyIter_GetNDim(iter);
+    npy_intp dims[2];
     if (ndims == 0) {
-        npy_intp dims[1];
+        ndims = 1;
         dims[0] = 4;
-        pix_arr = PyArray_SimpleNew(1, dims, NPY_INT64);
-        if (pix_arr == NULL) goto fail;
-        wgt_arr = PyArray_SimpleNew(1, dims, NPY_FLOAT64);
-        if (wgt_arr == NULL) goto fail;
     } else {
-        npy_intp dims[2];
+        ndims = 2;
         dims[0] = NpyIter_GetIterSize(iter);
         dims[1] = 4;
-        pix_arr = PyArray_SimpleNew(2, dims, NPY_INT64);
-        if (pix_arr == NULL) goto fail;
-        wgt_arr = PyArray_SimpleNew(2, dims, NPY_FLOAT64);
-        if (wgt_arr == NULL) goto fail;
     }
+    pix_arr = hpgeom_out_or_new(out[0], ndims, dims, NPY_INT64);
+    if (pix_arr == NULL) goto fail;
+    wgt_arr = hpgeom_out_or_new(out[1], ndims, dims, NPY_FLOAT64);
+    if (wgt_arr == NULL) goto fail;
     pixels = (int64_t *)PyArray_DATA((PyArrayObject *)pix_arr);
     weights = (double *)PyArray_DATA((PyArrayObject *)wgt_arr);
 
@@ -2188,7 +4307,10 @@ static PyObject *get_interpolation_weights(PyObject *dummy, PyObject *args, PyOb
         double *a, *b;
         double theta, phi;
         int64_t last_nside = -1;
+        hpx_cache cache;
         bool started = false;
+        hpx_cache_init(&cache);
+        if (!NpyIter_IterationNeedsAPI(iter)) NPY_BEGIN_THREADS;
         do {
             nside = (int64_t *)dataptrarray[0];
             a = (double *)dataptrarray[1];
@@ -2196,21 +4318,22 @@ static PyObject *get_interpolation_weights(PyObject *dummy, PyObject *args, PyOb
 
             if ((!started) || (*nside != last_nside)) {
                 if (!hpgeom_check_nside(*nside, scheme, err)) {
-                    PyErr_SetString(PyExc_ValueError, err);
-                    goto fail;
+                    status = 0;
+                    break;
                 }
-                hpx = healpix_info_from_nside(*nside, scheme);
+                hpx = healpix_info_cached(&cache, *nside, scheme);
+                last_nside = *nside;
                 started = true;
             }
             if (lonlat) {
                 if (!hpgeom_lonlat_to_thetaphi(*a, *b, &theta, &phi, (bool)degrees, err)) {
-                    PyErr_SetString(PyExc_ValueError, err);
-                    goto fail;
+                    status = 0;
+                    break;
                 }
             } else {
                 if (!hpgeom_check_theta_phi(*a, *b, err)) {
-                    PyErr_SetString(PyExc_ValueError, err);
-                    goto fail;
+                    status = 0;
+                    break;
                 }
                 theta = *a;
                 phi = *b;
@@ -2218,6 +4341,12 @@ static PyObject *get_interpolation_weights(PyObject *dummy, PyObject *args, PyOb
             size_t index = 4 * NpyIter_GetIterIndex(iter);
             get_interpol(&hpx, theta, phi, &pixels[index], &weights[index]);
         } while (iternext(iter));
+        NPY_END_THREADS;
+
+        if (!status) {
+            PyErr_SetString(PyExc_ValueError, err);
+            goto fail;
+        }
     }
 
     Py_DECREF(nside_arr);
@@ -2248,7 +4377,7 @@ fail:
 }
 
 PyDoc_STRVAR(pixel_ranges_to_pixels_doc,
-             "pixel_ranges_to_pixels(pixel_ranges, inclusive=False)\n"
+             "pixel_ranges_to_pixels(pixel_ranges, inclusive=False, dtype=None)\n"
              "--\n\n"
              "Convert (M, 2) array of pixel ranges to an array of pixels.\n"
              "\n"
@@ -2257,25 +4386,40 @@ PyDoc_STRVAR(pixel_ranges_to_pixels_doc,
              "pixel_ranges : `np.ndarray` (M, 2)\n"
              "    Array of pixel ranges, [lo, high) (if inclusive=False) or\n"
              "    [lo, high] (if inclusive=True).\n"
+             "inclusive : `bool`, optional\n"
+             "    If True, the upper end of each range is included.\n"
+             "dtype : `np.dtype`, optional\n"
+             "    Output dtype for the pixels, int64 (default) or int32.\n"
              "\n"
              "Returns\n"
              "-------\n"
              "pixels : `np.ndarray` (N,)\n"
-             "    Array of pixels.\n");
+             "    Array of pixels.\n"
+             "\n"
+             "Raises\n"
+             "------\n"
+             "ValueError\n"
+             "    If a range is reversed, or if dtype is int32 and a pixel does not\n"
+             "    fit in int32.\n");
 
 static PyObject *pixel_ranges_to_pixels(PyObject *dummy, PyObject *args, PyObject *kwargs) {
     PyObject *pixel_ranges_obj = NULL;
     PyObject *pixel_ranges_arr = NULL;
     PyObject *pix_arr = NULL;
     int inclusive = 0;
-    static char *kwlist[] = {"pixel_ranges", "inclusive", NULL};
+    PyArray_Descr *dtype = NULL;
+    int typenum;
+    static char *kwlist[] = {"pixel_ranges", "inclusive", "dtype", NULL};
     NpyIter *iter = NULL;
     NpyIter_IterNextFunc *iternext;
     char **dataptr;
+    int status = 1;
+    NPY_BEGIN_THREADS_DEF;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|p", kwlist, &pixel_ranges_obj,
-                                     &inclusive))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|pO&", kwlist, &pixel_ranges_obj,
+                                     &inclusive, PyArray_DescrConverter2, &dtype))
         goto fail;
+    if (!hpgeom_pixel_dtype(dtype, &typenum)) goto fail;
 
     pixel_ranges_arr = PyArray_FROM_OTF(pixel_ranges_obj, NPY_INT64,
                                         NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
@@ -2291,7 +4435,7 @@ static PyObject *pixel_ranges_to_pixels(PyObject *dummy, PyObject *args, PyObjec
         npy_intp dims[1];
         dims[0] = 0;
 
-        pix_arr = PyArray_SimpleNew(1, dims, NPY_INT64);
+        pix_arr = PyArray_SimpleNew(1, dims, typenum);
         if (pix_arr == NULL) goto fail;
 
         goto succeed;
@@ -2316,24 +4460,41 @@ static PyObject *pixel_ranges_to_pixels(PyObject *dummy, PyObject *args, PyObjec
 
     // Check for zero-size before entering loop.
     if (NpyIter_GetIterSize(iter) > 0) {
+        if (!NpyIter_IterationNeedsAPI(iter)) NPY_BEGIN_THREADS;
         do {
             int64_t *data = (int64_t *)*dataptr;
 
             if (*(data + 1) < *data) {
-                PyErr_SetString(PyExc_ValueError,
-                                "pixel_ranges[:, 0] must all be <= pixel_ranges[:, 1]");
-                goto fail;
+                status = 0;
+                break;
+            }
+            if ((typenum == NPY_INT32) &&
+                ((*data < INT32_MIN) || (*(data + 1) + inclusive - 1 > INT32_MAX))) {
+                status = -1;
+                break;
             }
 
             dims[0] += (*(data + 1) - *data) + inclusive;
         } while (iternext(iter));
+        NPY_END_THREADS;
+
+        if (status == 0) {
+            PyErr_SetString(PyExc_ValueError,
+                            "pixel_ranges[:, 0] must all be <= pixel_ranges[:, 1]");
+            goto fail;
+        }
+        if (status < 0) {
+            PyErr_SetString(PyExc_ValueError, "pixel_ranges do not fit in int32 pixels.");
+            goto fail;
+        }
     }
 
     // Create the output array
-    pix_arr = PyArray_SimpleNew(1, dims, NPY_INT64);
+    pix_arr = PyArray_SimpleNew(1, dims, typenum);
     if (pix_arr == NULL) goto fail;
 
     int64_t *pix_data = (int64_t *)PyArray_DATA((PyArrayObject *)pix_arr);
+    int32_t *pix_data32 = (int32_t *)PyArray_DATA((PyArrayObject *)pix_arr);
 
     // Reset the iterator and loop to expand pixels.
     if (NpyIter_Reset(iter, NULL) == NPY_FAIL) goto fail;
@@ -2342,19 +4503,28 @@ static PyObject *pixel_ranges_to_pixels(PyObject *dummy, PyObject *args, PyObjec
 
     // Check for zero-size before entering loop.
     if (NpyIter_GetIterSize(iter) > 0) {
+        if (!NpyIter_IterationNeedsAPI(iter)) NPY_BEGIN_THREADS;
         do {
             int64_t *data = (int64_t *)*dataptr;
 
-            for (int64_t pix = *data; pix < (*(data + 1) + inclusive); pix++) {
-                pix_data[counter++] = pix;
+            if (typenum == NPY_INT32) {
+                for (int64_t pix = *data; pix < (*(data + 1) + inclusive); pix++) {
+                    pix_data32[counter++] = (int32_t)pix;
+                }
+            } else {
+                for (int64_t pix = *data; pix < (*(data + 1) + inclusive); pix++) {
+                    pix_data[counter++] = pix;
+                }
             }
         } while (iternext(iter));
+        NPY_END_THREADS;
     }
 
 succeed:
 
     Py_DECREF(pixel_ranges_arr);
     if (iter != NULL) NpyIter_Deallocate(iter);
+    Py_XDECREF(dtype);
 
     return PyArray_Return((PyArrayObject *)pix_arr);
 
@@ -2362,10 +4532,220 @@ fail:
     Py_XDECREF(pixel_ranges_arr);
     if (iter != NULL) NpyIter_Deallocate(iter);
     Py_XDECREF(pix_arr);
+    Py_XDECREF(dtype);
+
+    return NULL;
+}
+
+PyDoc_STRVAR(pixels_in_ranges_doc,
+             "pixels_in_ranges(pixel_ranges, pixels, n_threads=0)\n"
+             "--\n\n"
+             "Check which pixels are contained in a set of pixel ranges, without\n"
+             "expanding the ranges.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "pixel_ranges : `np.ndarray` (M, 2) or `RangeSet`\n"
+             "    Array of pixel ranges, [lo, high), sorted and non-overlapping,\n"
+             "    such as returned with return_pixel_ranges=True.\n" PIX_DOC_PAR
+             N_THREADS_DOC_PAR
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "contained : `bool` or `np.ndarray` (N,)\n"
+             "    True for each pixel which is in one of the ranges.\n"
+             "\n"
+             "Raises\n"
+             "------\n"
+             "ValueError\n"
+             "    If pixel_ranges are not sorted and non-overlapping.\n"
+             "\n"
+             "Notes\n"
+             "-----\n"
+             "This is fastest if the pixels are sorted.\n");
+
+typedef struct {
+    i64rangeset *rangeset;
+} pixels_in_ranges_params;
+
+static void pixels_in_ranges_kernel(hpgeom_iter_chunk *chunk) {
+    const pixels_in_ranges_params *params = (const pixels_in_ranges_params *)chunk->params;
+    char **dataptrarray = chunk->dataptrarray;
+    npy_intp *strides = chunk->strides;
+    int64_t pixbuf[HPG_BLOCK_SIZE];
+    uint8_t containedbuf[HPG_BLOCK_SIZE];
+
+    do {
+        char *pix_p = dataptrarray[0];
+        char *contained_p = dataptrarray[1];
+        npy_intp count = *chunk->innersizeptr;
+
+        if ((strides[0] == sizeof(int64_t)) && (strides[1] == sizeof(npy_bool))) {
+            i64rangeset_contains_batch(params->rangeset, (int64_t *)pix_p,
+                                       (uint8_t *)contained_p, count);
+            continue;
+        }
+
+        while (count > 0) {
+            npy_intp nblock = (count < HPG_BLOCK_SIZE) ? count : HPG_BLOCK_SIZE;
+
+            for (npy_intp i = 0; i < nblock; i++) {
+                pixbuf[i] = *(int64_t *)(pix_p + i * strides[0]);
+            }
+            i64rangeset_contains_batch(params->rangeset, pixbuf, containedbuf, nblock);
+            for (npy_intp i = 0; i < nblock; i++) {
+                *(npy_bool *)(contained_p + i * strides[1]) = (npy_bool)containedbuf[i];
+            }
+
+            pix_p += nblock * strides[0];
+            contained_p += nblock * strides[1];
+            count -= nblock;
+        }
+    } while (chunk->iternext(chunk->iter));
+}
+
+static PyObject *pixels_in_ranges(PyObject *dummy, PyObject *args, PyObject *kwargs) {
+    PyObject *pixel_ranges_obj = NULL, *pix_obj = NULL;
+    PyObject *pixel_ranges_arr = NULL, *pix_arr = NULL;
+    PyObject *contained_arr = NULL;
+    int n_threads = 0;
+    static char *kwlist[] = {"pixel_ranges", "pixels", "n_threads", NULL};
+    NpyIter *iter = NULL;
+    char err[ERR_SIZE];
+    int status;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|i", kwlist, &pixel_ranges_obj,
+                                     &pix_obj, &n_threads))
+        goto fail;
+
+    pixel_ranges_arr = PyArray_FROM_OTF(pixel_ranges_obj, NPY_INT64,
+                                        NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    if (pixel_ranges_arr == NULL) goto fail;
+    pix_arr = PyArray_FROM_OTF(pix_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    if (pix_arr == NULL) goto fail;
+
+    if ((PyArray_SIZE((PyArrayObject *)pixel_ranges_arr) > 0) &&
+        ((PyArray_NDIM((PyArrayObject *)pixel_ranges_arr) != 2) ||
+         (PyArray_DIM((PyArrayObject *)pixel_ranges_arr, 1) != 2))) {
+        PyErr_SetString(PyExc_ValueError, "pixel_ranges must be 2D, with shape (M, 2).");
+        goto fail;
+    }
+
+    // The ranges are used in place as the boundaries of a rangeset.
+    i64stack range_stack;
+    i64rangeset rangeset;
+    memset(&range_stack, 0, sizeof(range_stack));
+    range_stack.size = (size_t)PyArray_SIZE((PyArrayObject *)pixel_ranges_arr);
+    range_stack.data = (int64_t *)PyArray_DATA((PyArrayObject *)pixel_ranges_arr);
+    rangeset.stack = &range_stack;
+
+    // The boundary search only needs the boundaries to be non-decreasing,
+    // so empty and touching ranges are allowed.
+    for (size_t i = 1; i < range_stack.size; i++) {
+        if (range_stack.data[i] < range_stack.data[i - 1]) {
+            PyErr_SetString(PyExc_ValueError,
+                            "pixel_ranges must be sorted and non-overlapping.");
+            goto fail;
+        }
+    }
+
+    PyArrayObject *op[2];
+    npy_uint32 op_flags[2];
+    PyArray_Descr *op_dtypes[2];
+
+    op[0] = (PyArrayObject *)pix_arr;
+    op_flags[0] = NPY_ITER_READONLY;
+    op_dtypes[0] = NULL;
+    op[1] = NULL;
+    op_flags[1] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
+    op_dtypes[1] = PyArray_DescrFromType(NPY_BOOL);
+
+    iter = NpyIter_MultiNew(2, op,
+                            NPY_ITER_ZEROSIZE_OK | NPY_ITER_EXTERNAL_LOOP | NPY_ITER_BUFFERED |
+                                NPY_ITER_GROWINNER | NPY_ITER_RANGED,
+                            NPY_KEEPORDER, NPY_NO_CASTING, op_flags, op_dtypes);
+    if (iter == NULL) goto fail;
+
+    pixels_in_ranges_params params;
+    params.rangeset = &rangeset;
+
+    status = hpgeom_iter_run(iter, n_threads, pixels_in_ranges_kernel, &params, err);
+    if (status < 0) goto fail;
+    if (status == 0) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        goto fail;
+    }
+
+    contained_arr = (PyObject *)NpyIter_GetOperandArray(iter)[1];
+    Py_INCREF(contained_arr);
+
+    if (NpyIter_Deallocate(iter) != NPY_SUCCEED) {
+        iter = NULL;
+        goto fail;
+    }
+    Py_DECREF(pixel_ranges_arr);
+    Py_DECREF(pix_arr);
+
+    return PyArray_Return((PyArrayObject *)contained_arr);
+
+fail:
+    Py_XDECREF(pixel_ranges_arr);
+    Py_XDECREF(pix_arr);
+    Py_XDECREF(contained_arr);
+    if (iter != NULL) {
+        NpyIter_Deallocate(iter);
+    }
 
     return NULL;
 }
 
+PyDoc_STRVAR(set_num_threads_doc,
+             "set_num_threads(n_threads)\n"
+             "--\n\n"
+             "Set the default number of threads used by threaded functions.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "n_threads : `int`\n"
+             "    Default number of threads.  If 0, use the number of available\n"
+             "    cpus.\n"
+             "\n"
+             "Raises\n"
+             "------\n"
+             "ValueError\n"
+             "    If n_threads is negative.\n");
+
+static PyObject *set_num_threads(PyObject *dummy, PyObject *args, PyObject *kwargs) {
+    int n_threads;
+    static char *kwlist[] = {"n_threads", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i", kwlist, &n_threads)) return NULL;
+
+    if (n_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "n_threads must be >= 0.");
+        return NULL;
+    }
+    if (n_threads == 0) n_threads = hpgeom_get_num_cpus();
+
+    hpgeom_set_default_threads(n_threads);
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(get_num_threads_doc,
+             "get_num_threads()\n"
+             "--\n\n"
+             "Get the default number of threads used by threaded functions.\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "n_threads : `int`\n"
+             "    Default number of threads.\n");
+
+static PyObject *get_num_threads(PyObject *dummy, PyObject *args) {
+    return PyLong_FromLong(hpgeom_get_default_threads());
+}
+
 static PyMethodDef hpgeom_methods[] = {
     {"angle_to_pixel", (PyCFunction)(void (*)(void))angle_to_pixel,
      METH_VARARGS | METH_KEYWORDS, angle_to_pixel_doc},
@@ -2373,12 +4753,24 @@ static PyMethodDef hpgeom_methods[] = {
      METH_VARARGS | METH_KEYWORDS, pixel_to_angle_doc},
     {"query_circle", (PyCFunction)(void (*)(void))query_circle, METH_VARARGS | METH_KEYWORDS,
      query_circle_doc},
+    {"query_circle_batch", (PyCFunction)(void (*)(void))query_circle_batch,
+     METH_VARARGS | METH_KEYWORDS, query_circle_batch_doc},
     {"query_polygon", (PyCFunction)(void (*)(void))query_polygon_meth,
      METH_VARARGS | METH_KEYWORDS, query_polygon_doc},
+    {"query_polygon_batch", (PyCFunction)(void (*)(void))query_polygon_batch,
+     METH_VARARGS | METH_KEYWORDS, query_polygon_batch_doc},
     {"query_ellipse", (PyCFunction)(void (*)(void))query_ellipse_meth,
      METH_VARARGS | METH_KEYWORDS, query_ellipse_doc},
     {"query_box", (PyCFunction)(void (*)(void))query_box_meth, METH_VARARGS | METH_KEYWORDS,
      query_box_doc},
+    {"points_in_circle", (PyCFunction)(void (*)(void))points_in_circle_meth,
+     METH_VARARGS | METH_KEYWORDS, points_in_circle_doc},
+    {"points_in_ellipse", (PyCFunction)(void (*)(void))points_in_ellipse_meth,
+     METH_VARARGS | METH_KEYWORDS, points_in_ellipse_doc},
+    {"points_in_box", (PyCFunction)(void (*)(void))points_in_box_meth,
+     METH_VARARGS | METH_KEYWORDS, points_in_box_doc},
+    {"points_in_polygon", (PyCFunction)(void (*)(void))points_in_polygon_meth,
+     METH_VARARGS | METH_KEYWORDS, points_in_polygon_doc},
     {"nest_to_ring", (PyCFunction)(void (*)(void))nest_to_ring, METH_VARARGS | METH_KEYWORDS,
      nest_to_ring_doc},
     {"ring_to_nest", (PyCFunction)(void (*)(void))ring_to_nest, METH_VARARGS | METH_KEYWORDS,
@@ -2397,12 +4789,67 @@ static PyMethodDef hpgeom_methods[] = {
      METH_VARARGS | METH_KEYWORDS, get_interpolation_weights_doc},
     {"pixel_ranges_to_pixels", (PyCFunction)(void (*)(void))pixel_ranges_to_pixels,
      METH_VARARGS | METH_KEYWORDS, pixel_ranges_to_pixels_doc},
+    {"pixels_in_ranges", (PyCFunction)(void (*)(void))pixels_in_ranges,
+     METH_VARARGS | METH_KEYWORDS, pixels_in_ranges_doc},
+    {"set_num_threads", (PyCFunction)(void (*)(void))set_num_threads,
+     METH_VARARGS | METH_KEYWORDS, set_num_threads_doc},
+    {"get_num_threads", (PyCFunction)get_num_threads, METH_NOARGS, get_num_threads_doc},
     {NULL, NULL, 0, NULL}};
 
 static struct PyModuleDef hpgeom_module = {PyModuleDef_HEAD_INIT, "_hpgeom", NULL, -1,
                                            hpgeom_methods};
 
 PyMODINIT_FUNC PyInit__hpgeom(void) {
+    PyObject *m;
+
     import_array();
-    return PyModule_Create(&hpgeom_module);
+    healpix_geom_init_dispatch();
+
+    if (PyType_Ready(&RangeSetType) < 0) return NULL;
+    if (PyType_Ready(&QueryContextType) < 0) return NULL;
+    if (PyType_Ready(&MOCType) < 0) return NULL;
+    if (PyType_Ready(&PixelSetType) < 0) return NULL;
+
+    m = PyModule_Create(&hpgeom_module);
+    if (m == NULL) return NULL;
+
+    Py_INCREF(&RangeSetType);
+    if (PyModule_AddObject(m, "RangeSet", (PyObject *)&RangeSetType) < 0) {
+        Py_DECREF(&RangeSetType);
+        Py_DECREF(m);
+        return NULL;
+    }
+
+    Py_INCREF(&QueryContextType);
+    if (PyModule_AddObject(m, "QueryContext", (PyObject *)&QueryContextType) < 0) {
+        Py_DECREF(&QueryContextType);
+        Py_DECREF(m);
+        return NULL;
+    }
+
+    Py_INCREF(&MOCType);
+    if (PyModule_AddObject(m, "MOC", (PyObject *)&MOCType) < 0) {
+        Py_DECREF(&MOCType);
+        Py_DECREF(m);
+        return NULL;
+    }
+
+    Py_INCREF(&PixelSetType);
+    if (PyModule_AddObject(m, "PixelSet", (PyObject *)&PixelSetType) < 0) {
+        Py_DECREF(&PixelSetType);
+        Py_DECREF(m);
+        return NULL;
+    }
+
+    if (hpgeom_add_ufuncs(m) < 0) {
+        Py_DECREF(m);
+        return NULL;
+    }
+
+    if (hpgeom_add_capi(m) < 0) {
+        Py_DECREF(m);
+        return NULL;
+    }
+
+    return m;
 }
@@ -0,0 +1,211 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+// Header-only C++17 front end to the pixelization routines of
+// healpix_geom.c, for a scheme and nside known at compile time.
+//
+//     using Hpx = hpgeom::Healpix<hpgeom::Scheme::NEST, hpgeom::order_from_nside(2048)>;
+//     int64_t pix = Hpx::ang2pix(theta, phi);
+//     Hpx::ang2pix_batch(thetas, phis, pixels);  // Any contiguous ranges.
+//
+// Everything is inline, and the nside/order arithmetic is folded into
+// constants.  The arithmetic is that of healpix_geom_core.h, shared with
+// healpix_geom.c, so the results are identical to those of the python and C
+// interfaces.  As with the batch kernels of healpix_geom.h, the inputs are
+// not range checked.
+
+#ifndef _HPGEOM_HPP
+#define _HPGEOM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+
+namespace hpgeom {
+
+enum class Scheme { RING = 0, NEST = 1 };
+
+constexpr int max_order = 29;
+
+// Matches healpix_info in healpix_geom.h, without the scheme; the
+// HPG_CORE_INFO of healpix_geom_core.h.
+struct HealpixInfo {
+    int order;
+    int64_t nside;
+    int64_t npface;
+    int64_t ncap;
+    int64_t npix;
+    double fact2;
+    double fact1;
+};
+
+constexpr bool is_power_of_two(int64_t nside) { return nside > 0 && !(nside & (nside - 1)); }
+
+// Order of a power-of-two nside, or -1 otherwise.
+constexpr int order_from_nside(int64_t nside) {
+    if (!is_power_of_two(nside)) return -1;
+    int order = 0;
+    while ((int64_t(1) << order) < nside) order++;
+    return order;
+}
+
+constexpr HealpixInfo healpix_info_from_nside(int64_t nside) {
+    HealpixInfo hpx{};
+    hpx.order = order_from_nside(nside);
+    hpx.nside = nside;
+    hpx.npface = nside * nside;
+    hpx.ncap = (hpx.npface - nside) << 1;
+    hpx.npix = 12 * hpx.npface;
+    hpx.fact2 = 4. / hpx.npix;
+    hpx.fact1 = (nside << 1) * hpx.fact2;
+    return hpx;
+}
+
+constexpr HealpixInfo healpix_info_from_order(int order) {
+    return healpix_info_from_nside(int64_t(1) << order);
+}
+
+}  // namespace hpgeom
+
+#define HPG_CORE_INFO hpgeom::HealpixInfo
+#include "healpix_geom_core.h"
+
+namespace hpgeom {
+
+template <Scheme S, int Order>
+class Healpix {
+    static_assert(Order >= 0 && Order <= max_order,
+                  "nside must be a power of 2 no greater than 2**29.");
+
+    static constexpr bool nest = (S == Scheme::NEST);
+
+   public:
+    static constexpr Scheme scheme = S;
+    static constexpr HealpixInfo info = healpix_info_from_order(Order);
+    static constexpr int order = Order;
+    static constexpr int64_t nside = info.nside;
+    static constexpr int64_t npix = info.npix;
+
+    static int64_t loc2pix(double z, double phi, double sth, bool have_sth) {
+        return hpg_core_loc2pix(&info, nest, z, phi, sth, have_sth);
+    }
+
+    static void pix2loc(int64_t pix, double &z, double &phi, double &sth, bool &have_sth) {
+        hpg_core_pix2loc(&info, nest, pix, &z, &phi, &sth, &have_sth);
+    }
+
+    // theta in [0, pi], phi in [0, 2*pi].
+    static int64_t ang2pix(double theta, double phi) {
+        return hpg_core_ang2pix(&info, nest, theta, phi);
+    }
+
+    static void pix2ang(int64_t pix, double &theta, double &phi) {
+        hpg_core_pix2ang(&info, nest, pix, &theta, &phi);
+    }
+
+    // The vector need not be normalized.
+    static int64_t vec2pix(double x, double y, double z) {
+        return hpg_core_vec2pix(&info, nest, x, y, z);
+    }
+
+    static void pix2vec(int64_t pix, double &x, double &y, double &z) {
+        hpg_core_pix2vec(&info, nest, pix, &x, &y, &z);
+    }
+
+    // The remaining routines convert between the schemes, and do not depend
+    // on S.
+    static constexpr int64_t xyf2nest(int ix, int iy, int face_num) {
+        return hpg_core_xyf2nest(&info, ix, iy, face_num);
+    }
+
+    static constexpr void nest2xyf(int64_t pix, int &ix, int &iy, int &face_num) {
+        hpg_core_nest2xyf(&info, pix, &ix, &iy, &face_num);
+    }
+
+    static int64_t xyf2ring(int ix, int iy, int face_num) {
+        return hpg_core_xyf2ring(&info, ix, iy, face_num);
+    }
+
+    static void ring2xyf(int64_t pix, int &ix, int &iy, int &face_num) {
+        hpg_core_ring2xyf(&info, pix, &ix, &iy, &face_num);
+    }
+
+    static int64_t nest2ring(int64_t pix) {
+        int ix, iy, face_num;
+        nest2xyf(pix, ix, iy, face_num);
+        return xyf2ring(ix, iy, face_num);
+    }
+
+    static int64_t ring2nest(int64_t pix) {
+        int ix, iy, face_num;
+        ring2xyf(pix, ix, iy, face_num);
+        return xyf2nest(ix, iy, face_num);
+    }
+
+    // Batch versions over contiguous ranges (arrays, std::vector, spans,
+    // ...) of the same size, as in the hpg_*_batch functions of
+    // libhpgeom.h.
+    template <class Theta, class Phi, class Pix>
+    static void ang2pix_batch(const Theta &theta, const Phi &phi, Pix &&pix) {
+        const double *t = std::data(theta);
+        const double *p = std::data(phi);
+        int64_t *out = std::data(pix);
+        const size_t n = std::size(theta);
+        for (size_t i = 0; i < n; i++) out[i] = ang2pix(t[i], p[i]);
+    }
+
+    template <class Pix, class Theta, class Phi>
+    static void pix2ang_batch(const Pix &pix, Theta &&theta, Phi &&phi) {
+        const int64_t *in = std::data(pix);
+        double *t = std::data(theta);
+        double *p = std::data(phi);
+        const size_t n = std::size(pix);
+        for (size_t i = 0; i < n; i++) pix2ang(in[i], t[i], p[i]);
+    }
+
+    // The output may be the same range as the input.
+    template <class In, class Out>
+    static void nest2ring_batch(const In &nest, Out &&ring) {
+        const int64_t *in = std::data(nest);
+        int64_t *out = std::data(ring);
+        const size_t n = std::size(nest);
+        for (size_t i = 0; i < n; i++) out[i] = nest2ring(in[i]);
+    }
+
+    template <class In, class Out>
+    static void ring2nest_batch(const In &ring, Out &&nest) {
+        const int64_t *in = std::data(ring);
+        int64_t *out = std::data(nest);
+        const size_t n = std::size(ring);
+        for (size_t i = 0; i < n; i++) out[i] = ring2nest(in[i]);
+    }
+};
+
+template <int64_t Nside>
+using HealpixNest = Healpix<Scheme::NEST, order_from_nside(Nside)>;
+
+template <int64_t Nside>
+using HealpixRing = Healpix<Scheme::RING, order_from_nside(Nside)>;
+
+}  // namespace hpgeom
+
+#endif
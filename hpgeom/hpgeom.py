@@ -4,9 +4,15 @@ from ._hpgeom import (
     angle_to_pixel,
     pixel_to_angle,
     query_circle,
+    query_circle_batch,
     query_polygon,
+    query_polygon_batch,
     query_ellipse,
     query_box,
+    points_in_circle,
+    points_in_ellipse,
+    points_in_box,
+    points_in_polygon,
     nest_to_ring,
     ring_to_nest,
     vector_to_pixel,
@@ -16,6 +22,13 @@ from ._hpgeom import (
     max_pixel_radius,
     get_interpolation_weights,
     pixel_ranges_to_pixels,
+    pixels_in_ranges,
+    set_num_threads,
+    get_num_threads,
+    RangeSet,
+    QueryContext,
+    MOC,
+    PixelSet,
 )
 
 __all__ = [
@@ -24,11 +37,17 @@ __all__ = [
     'angle_to_pixel',
     'pixel_to_angle',
     'query_circle',
+    'query_circle_batch',
     'query_circle_vec',
     'query_polygon',
+    'query_polygon_batch',
     'query_polygon_vec',
     'query_ellipse',
     'query_box',
+    'points_in_circle',
+    'points_in_ellipse',
+    'points_in_box',
+    'points_in_polygon',
     'lonlat_to_thetaphi',
     'nest_to_ring',
     'ring_to_nest',
@@ -47,9 +66,16 @@ __all__ = [
     'max_pixel_radius',
     'get_interpolation_weights',
     'pixel_ranges_to_pixels',
+    'pixels_in_ranges',
     'reorder',
     'upgrade_pixels',
     'upgrade_pixel_ranges',
+    'set_num_threads',
+    'get_num_threads',
+    'RangeSet',
+    'QueryContext',
+    'MOC',
+    'PixelSet',
     'UNSEEN',
 ]
 
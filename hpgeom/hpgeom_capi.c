@@ -0,0 +1,268 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+
+#include <Python.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "healpix_geom.h"
+#include "hpgeom_capi.h"
+#include "hpgeom_capsule.h"
+#include "hpgeom_stack.h"
+#include "hpgeom_utils.h"
+
+/*
+ * Implementations of the hpgeom_capi function table.  These are called from
+ * compiled code with no python involved, so errors are only reported through
+ * the return values and the messages written to err are discarded.
+ */
+
+// Check nside and set up hpx for it.
+static inline bool capi_hpx(int64_t nside, enum Scheme scheme, healpix_info *hpx, char *err) {
+    hpx_cache cache;
+
+    if (!hpgeom_check_nside(nside, scheme, err)) return false;
+    hpx_cache_init(&cache);
+    *hpx = healpix_info_cached(&cache, nside, scheme);
+    return true;
+}
+
+static inline enum Scheme capi_scheme(int nest) { return nest ? NEST : RING; }
+
+static int64_t capi_ang2pix(int64_t nside, int nest, double theta, double phi) {
+    healpix_info hpx;
+    char err[ERR_SIZE];
+
+    if (!capi_hpx(nside, capi_scheme(nest), &hpx, err)) return -1;
+    if (!hpgeom_check_theta_phi(theta, phi, err)) return -1;
+
+    return ang2pix(&hpx, theta, phi);
+}
+
+static int capi_pix2ang(int64_t nside, int nest, int64_t pix, double *theta, double *phi) {
+    healpix_info hpx;
+    char err[ERR_SIZE];
+
+    if (!capi_hpx(nside, capi_scheme(nest), &hpx, err)) return 0;
+    if (!hpgeom_check_pixel(&hpx, pix, err)) return 0;
+
+    pix2ang(&hpx, pix, theta, phi);
+    return 1;
+}
+
+static int64_t capi_lonlat2pix(int64_t nside, int nest, double lon, double lat, int degrees) {
+    healpix_info hpx;
+    double theta, phi;
+    char err[ERR_SIZE];
+
+    if (!capi_hpx(nside, capi_scheme(nest), &hpx, err)) return -1;
+    if (!hpgeom_lonlat_to_thetaphi(lon, lat, &theta, &phi, (bool)degrees, err)) return -1;
+
+    return ang2pix(&hpx, theta, phi);
+}
+
+static int capi_pix2lonlat(int64_t nside, int nest, int64_t pix, double *lon, double *lat,
+                           int degrees) {
+    healpix_info hpx;
+    double theta, phi;
+    char err[ERR_SIZE];
+
+    if (!capi_hpx(nside, capi_scheme(nest), &hpx, err)) return 0;
+    if (!hpgeom_check_pixel(&hpx, pix, err)) return 0;
+
+    pix2ang(&hpx, pix, &theta, &phi);
+    return hpgeom_thetaphi_to_lonlat(theta, phi, lon, lat, (bool)degrees, false, err);
+}
+
+static int64_t capi_vec2pix(int64_t nside, int nest, double x, double y, double z) {
+    healpix_info hpx;
+    vec3 vec = {x, y, z};
+    char err[ERR_SIZE];
+
+    if (!capi_hpx(nside, capi_scheme(nest), &hpx, err)) return -1;
+    if (!hpgeom_check_vector(x, y, z, err)) return -1;
+
+    return vec2pix(&hpx, &vec);
+}
+
+static int capi_pix2vec(int64_t nside, int nest, int64_t pix, double *x, double *y,
+                        double *z) {
+    healpix_info hpx;
+    vec3 vec;
+    char err[ERR_SIZE];
+
+    if (!capi_hpx(nside, capi_scheme(nest), &hpx, err)) return 0;
+    if (!hpgeom_check_pixel(&hpx, pix, err)) return 0;
+
+    vec = pix2vec(&hpx, pix);
+    *x = vec.x;
+    *y = vec.y;
+    *z = vec.z;
+    return 1;
+}
+
+static int64_t capi_nest2ring(int64_t nside, int64_t pix) {
+    healpix_info hpx;
+    char err[ERR_SIZE];
+
+    if (!capi_hpx(nside, NEST, &hpx, err)) return -1;
+    if (!hpgeom_check_pixel(&hpx, pix, err)) return -1;
+
+    return nest2ring(&hpx, pix);
+}
+
+static int64_t capi_ring2nest(int64_t nside, int64_t pix) {
+    healpix_info hpx;
+    char err[ERR_SIZE];
+
+    if (!capi_hpx(nside, NEST, &hpx, err)) return -1;
+    if (!hpgeom_check_pixel(&hpx, pix, err)) return -1;
+
+    return ring2nest(&hpx, pix);
+}
+
+static int capi_neighbors(int64_t nside, int nest, int64_t pix, int64_t *neighbor_pixels) {
+    healpix_info hpx;
+    // The neighbors are written directly into the caller's buffer.
+    i64stack result = {.size = 8, .allocated_size = 8, .data = neighbor_pixels};
+    int status;
+    char err[ERR_SIZE];
+
+    if (!capi_hpx(nside, capi_scheme(nest), &hpx, err)) return 0;
+    if (!hpgeom_check_pixel(&hpx, pix, err)) return 0;
+
+    neighbors(&hpx, pix, &result, &status, err);
+    return status;
+}
+
+static int capi_ang2pix_batch(int64_t nside, int nest, const double *theta, const double *phi,
+                              int64_t *pix, int64_t n) {
+    healpix_info hpx;
+    char err[ERR_SIZE];
+
+    if (n < 0) return 0;
+    if (!capi_hpx(nside, capi_scheme(nest), &hpx, err)) return 0;
+    if (!hpgeom_check_theta_phi_array(theta, phi, (size_t)n, err)) return 0;
+
+    ang2pix_batch(&hpx, theta, phi, pix, (size_t)n);
+    return 1;
+}
+
+static int capi_pix2ang_batch(int64_t nside, int nest, const int64_t *pix, double *theta,
+                              double *phi, int64_t n) {
+    healpix_info hpx;
+    char err[ERR_SIZE];
+
+    if (n < 0) return 0;
+    if (!capi_hpx(nside, capi_scheme(nest), &hpx, err)) return 0;
+    if (!hpgeom_check_pixel_array(&hpx, pix, (size_t)n, err)) return 0;
+
+    pix2ang_batch(&hpx, pix, theta, phi, (size_t)n);
+    return 1;
+}
+
+static int capi_nest2ring_batch(int64_t nside, const int64_t *nest, int64_t *ring, int64_t n) {
+    healpix_info hpx;
+    char err[ERR_SIZE];
+
+    if (n < 0) return 0;
+    if (!capi_hpx(nside, NEST, &hpx, err)) return 0;
+    if (!hpgeom_check_pixel_array(&hpx, nest, (size_t)n, err)) return 0;
+
+    nest2ring_batch(&hpx, nest, ring, (size_t)n);
+    return 1;
+}
+
+static int capi_ring2nest_batch(int64_t nside, const int64_t *ring, int64_t *nest, int64_t n) {
+    healpix_info hpx;
+    char err[ERR_SIZE];
+
+    if (n < 0) return 0;
+    if (!capi_hpx(nside, NEST, &hpx, err)) return 0;
+    if (!hpgeom_check_pixel_array(&hpx, ring, (size_t)n, err)) return 0;
+
+    ring2nest_batch(&hpx, ring, nest, (size_t)n);
+    return 1;
+}
+
+static int64_t capi_query_disc(int64_t nside, int nest, double theta, double phi,
+                               double radius, int fact, int64_t *pix, int64_t maxpix) {
+    healpix_info hpx;
+    i64rangeset *pixset;
+    int64_t npix = 0;
+    int status = 1;
+    char err[ERR_SIZE];
+
+    if (!capi_hpx(nside, capi_scheme(nest), &hpx, err)) return -1;
+    if (!hpgeom_check_theta_phi(theta, phi, err)) return -1;
+    if (!hpgeom_check_radius(radius, err)) return -1;
+    if (fact != 0 && !hpgeom_check_fact(&hpx, fact, err)) return -1;
+
+    pixset = i64rangeset_new(&status, err);
+    if (!status) return -1;
+
+    query_disc(&hpx, theta, phi, radius, fact, 1, pixset, &status, err);
+    if (status) {
+        // Fill as much of the buffer as fits, and count the rest.
+        for (size_t j = 0; j < pixset->stack->size; j += 2) {
+            int64_t start = pixset->stack->data[j], end = pixset->stack->data[j + 1];
+            int64_t nfill = (npix < maxpix) ? maxpix - npix : 0;
+            if (nfill > end - start) nfill = end - start;
+            for (int64_t k = 0; k < nfill; k++) pix[npix + k] = start + k;
+            npix += end - start;
+        }
+    }
+    i64rangeset_delete(pixset);
+
+    return status ? npix : -1;
+}
+
+static const hpgeom_capi capi_table = {
+    .version = HPGEOM_CAPI_VERSION,
+    .ang2pix = capi_ang2pix,
+    .pix2ang = capi_pix2ang,
+    .lonlat2pix = capi_lonlat2pix,
+    .pix2lonlat = capi_pix2lonlat,
+    .vec2pix = capi_vec2pix,
+    .pix2vec = capi_pix2vec,
+    .nest2ring = capi_nest2ring,
+    .ring2nest = capi_ring2nest,
+    .neighbors = capi_neighbors,
+    .ang2pix_batch = capi_ang2pix_batch,
+    .pix2ang_batch = capi_pix2ang_batch,
+    .nest2ring_batch = capi_nest2ring_batch,
+    .ring2nest_batch = capi_ring2nest_batch,
+    .query_disc = capi_query_disc,
+};
+
+int hpgeom_add_capi(PyObject *module) {
+    PyObject *capsule;
+
+    capsule = PyCapsule_New((void *)&capi_table, HPGEOM_CAPI_CAPSULE_NAME, NULL);
+    if (capsule == NULL) return -1;
+    if (PyModule_AddObject(module, "_C_API", capsule) < 0) {
+        Py_DECREF(capsule);
+        return -1;
+    }
+    return 0;
+}
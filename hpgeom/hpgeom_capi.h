@@ -0,0 +1,112 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+
+// Versioned C interface to the hpgeom kernels, for calling from C, Cython,
+// or Numba code without going through python.  The function table is
+// exported by the extension module as a PyCapsule named
+// HPGEOM_CAPI_CAPSULE_NAME; from C it is obtained with hpgeom_capi_import()
+// after Python.h has been included, and from Cython with the declarations in
+// hpgeom_capi.pxd.  hpgeom.capi.get_include() gives the directory holding
+// both files.
+//
+// None of the functions use python or need the GIL, and all may be called
+// from multiple threads at once.  All inputs are range checked.  Pixel-valued
+// functions return -1 for invalid input, and the others return 1 on success
+// and 0 on invalid input.  nest is 1 for NEST and 0 for RING pixels.  Angles
+// are in radians unless a degrees argument is given; theta is the colatitude
+// in [0, pi] and phi the longitude in [0, 2*pi].
+//
+// Functions are only ever appended to the table, with HPGEOM_CAPI_VERSION
+// incremented each time, so code compiled against an older header keeps
+// working with newer versions of hpgeom.
+
+#ifndef _HPGEOM_CAPI_H
+#define _HPGEOM_CAPI_H
+
+#include <stdint.h>
+
+#define HPGEOM_CAPI_VERSION 1
+#define HPGEOM_CAPI_CAPSULE_NAME "hpgeom._hpgeom._C_API"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct hpgeom_capi {
+    // HPGEOM_CAPI_VERSION of the module providing the table.
+    int version;
+
+    int64_t (*ang2pix)(int64_t nside, int nest, double theta, double phi);
+    int (*pix2ang)(int64_t nside, int nest, int64_t pix, double *theta, double *phi);
+    int64_t (*lonlat2pix)(int64_t nside, int nest, double lon, double lat, int degrees);
+    int (*pix2lonlat)(int64_t nside, int nest, int64_t pix, double *lon, double *lat,
+                      int degrees);
+    // Vectors need not be normalized, but must be finite and non-zero.
+    int64_t (*vec2pix)(int64_t nside, int nest, double x, double y, double z);
+    int (*pix2vec)(int64_t nside, int nest, int64_t pix, double *x, double *y, double *z);
+    int64_t (*nest2ring)(int64_t nside, int64_t pix);
+    int64_t (*ring2nest)(int64_t nside, int64_t pix);
+    // The 8 neighbors in the order SW, W, NW, N, NE, E, SE, S, with -1 where
+    // there is no neighbor.
+    int (*neighbors)(int64_t nside, int nest, int64_t pix, int64_t *neighbors);
+
+    // Batch conversions of n elements.  The output of nest2ring_batch and
+    // ring2nest_batch may be the same array as the input.
+    int (*ang2pix_batch)(int64_t nside, int nest, const double *theta, const double *phi,
+                         int64_t *pix, int64_t n);
+    int (*pix2ang_batch)(int64_t nside, int nest, const int64_t *pix, double *theta,
+                         double *phi, int64_t n);
+    int (*nest2ring_batch)(int64_t nside, const int64_t *nest, int64_t *ring, int64_t n);
+    int (*ring2nest_batch)(int64_t nside, const int64_t *ring, int64_t *nest, int64_t n);
+
+    // Sorted pixels within radius of (theta, phi), or overlapping it when
+    // fact > 0 (see hpgeom.query_circle).  Returns the number of pixels found,
+    // of which the first maxpix are written to pix, or -1 for invalid input
+    // or a failed allocation.  If the return value is greater than maxpix the
+    // query may be repeated with a larger buffer.
+    int64_t (*query_disc)(int64_t nside, int nest, double theta, double phi, double radius,
+                          int fact, int64_t *pix, int64_t maxpix);
+} hpgeom_capi;
+
+#ifdef Py_PYTHON_H
+// Import the hpgeom function table.  Returns NULL with an exception set if
+// hpgeom cannot be imported or is too old for this header.
+static inline const hpgeom_capi *hpgeom_capi_import(void) {
+    const hpgeom_capi *api;
+
+    api = (const hpgeom_capi *)PyCapsule_Import(HPGEOM_CAPI_CAPSULE_NAME, 0);
+    if (api == NULL) return NULL;
+    if (api->version < HPGEOM_CAPI_VERSION) {
+        PyErr_Format(PyExc_ImportError, "hpgeom C API version %d is older than %d.",
+                     api->version, HPGEOM_CAPI_VERSION);
+        return NULL;
+    }
+    return api;
+}
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
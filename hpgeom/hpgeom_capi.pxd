@@ -0,0 +1,36 @@
+# Cython declarations for the hpgeom C API in hpgeom_capi.h.  Compile with
+# include_dirs=[hpgeom.capi.get_include()], and call hpgeom_capi_import()
+# once (with the GIL held) to get the function table.
+
+from libc.stdint cimport int64_t
+
+cdef extern from "hpgeom_capi.h" nogil:
+    enum:
+        HPGEOM_CAPI_VERSION
+
+    ctypedef struct hpgeom_capi:
+        int version
+
+        int64_t (*ang2pix)(int64_t nside, int nest, double theta, double phi)
+        int (*pix2ang)(int64_t nside, int nest, int64_t pix, double *theta, double *phi)
+        int64_t (*lonlat2pix)(int64_t nside, int nest, double lon, double lat, int degrees)
+        int (*pix2lonlat)(int64_t nside, int nest, int64_t pix, double *lon, double *lat,
+                          int degrees)
+        int64_t (*vec2pix)(int64_t nside, int nest, double x, double y, double z)
+        int (*pix2vec)(int64_t nside, int nest, int64_t pix, double *x, double *y, double *z)
+        int64_t (*nest2ring)(int64_t nside, int64_t pix)
+        int64_t (*ring2nest)(int64_t nside, int64_t pix)
+        int (*neighbors)(int64_t nside, int nest, int64_t pix, int64_t *neighbors)
+
+        int (*ang2pix_batch)(int64_t nside, int nest, const double *theta, const double *phi,
+                             int64_t *pix, int64_t n)
+        int (*pix2ang_batch)(int64_t nside, int nest, const int64_t *pix, double *theta,
+                             double *phi, int64_t n)
+        int (*nest2ring_batch)(int64_t nside, const int64_t *nest, int64_t *ring, int64_t n)
+        int (*ring2nest_batch)(int64_t nside, const int64_t *ring, int64_t *nest, int64_t n)
+
+        int64_t (*query_disc)(int64_t nside, int nest, double theta, double phi, double radius,
+                              int fact, int64_t *pix, int64_t maxpix)
+
+cdef extern from "hpgeom_capi.h":
+    const hpgeom_capi *hpgeom_capi_import() except NULL
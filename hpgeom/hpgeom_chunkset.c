@@ -0,0 +1,781 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hpgeom_chunkset.h"
+#include "hpgeom_stack.h"
+#include "hpgeom_utils.h"
+
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+#define CHUNK_BITMAP_BYTES (CHUNK_NWORD * sizeof(uint64_t))
+
+#if defined(__GNUC__) || defined(__clang__)
+static inline int popcount64(uint64_t x) { return __builtin_popcountll(x); }
+static inline int ctz64(uint64_t x) { return __builtin_ctzll(x); }
+#else
+static inline int popcount64(uint64_t x) {
+    x = x - ((x >> 1) & UINT64_C(0x5555555555555555));
+    x = (x & UINT64_C(0x3333333333333333)) + ((x >> 2) & UINT64_C(0x3333333333333333));
+    x = (x + (x >> 4)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+    return (int)((x * UINT64_C(0x0101010101010101)) >> 56);
+}
+static inline int ctz64(uint64_t x) {
+    int n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+}
+#endif
+
+// Scratch space for building one chunk at a time.
+typedef struct chunk_scratch {
+    uint16_t values[CHUNK_SIZE];
+    uint16_t runs[CHUNK_SIZE];
+    uint64_t words_a[CHUNK_NWORD];
+    uint64_t words_b[CHUNK_NWORD];
+} chunk_scratch;
+
+static chunk_scratch *chunk_scratch_new(int *status, char *err) {
+    *status = 1;
+    chunk_scratch *scratch = malloc(sizeof(chunk_scratch));
+    if (scratch == NULL) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "Could not allocate chunk scratch space");
+    }
+    return scratch;
+}
+
+/*
+ * Bitmap words.
+ */
+
+static void words_set_range(uint64_t *words, uint32_t first, uint32_t last) {
+    uint32_t wfirst = first >> 6;
+    uint32_t wlast = last >> 6;
+    uint64_t mask_first = ~UINT64_C(0) << (first & 63);
+    uint64_t mask_last = ~UINT64_C(0) >> (63 - (last & 63));
+
+    if (wfirst == wlast) {
+        words[wfirst] |= mask_first & mask_last;
+        return;
+    }
+    words[wfirst] |= mask_first;
+    for (uint32_t w = wfirst + 1; w < wlast; w++) words[w] = ~UINT64_C(0);
+    words[wlast] |= mask_last;
+}
+
+static uint32_t words_npix(const uint64_t *words) {
+    uint32_t npix = 0;
+    for (uint32_t w = 0; w < CHUNK_NWORD; w++) npix += popcount64(words[w]);
+    return npix;
+}
+
+static uint32_t words_nrun(const uint64_t *words) {
+    // Each run starts at a set bit whose lower neighbour is clear.
+    uint32_t nrun = 0;
+    uint64_t carry = 0;
+    for (uint32_t w = 0; w < CHUNK_NWORD; w++) {
+        nrun += popcount64(words[w] & ~((words[w] << 1) | carry));
+        carry = words[w] >> 63;
+    }
+    return nrun;
+}
+
+static uint32_t words_to_runs(const uint64_t *words, uint16_t *runs) {
+    uint32_t nrun = 0;
+    bool in_run = false;
+
+    for (uint32_t w = 0; w < CHUNK_NWORD; w++) {
+        uint32_t base = w << 6;
+        int bit = 0;
+        while (bit < 64) {
+            // Find the next transition into or out of a run.
+            uint64_t rest = (in_run ? ~words[w] : words[w]) >> bit;
+            if (rest == 0) break;
+            bit += ctz64(rest);
+            if (in_run) {
+                runs[2 * nrun + 1] = (uint16_t)(base + bit - 1);
+                nrun++;
+            } else {
+                runs[2 * nrun] = (uint16_t)(base + bit);
+            }
+            in_run = !in_run;
+        }
+    }
+    if (in_run) {
+        runs[2 * nrun + 1] = CHUNK_MASK;
+        nrun++;
+    }
+
+    return nrun;
+}
+
+/*
+ * Chunks.
+ */
+
+static size_t chunk_nbytes(const chunk *c) {
+    switch (c->type) {
+        case CHUNK_ARRAY:
+            return c->n * sizeof(uint16_t);
+        case CHUNK_RUN:
+            return 2 * c->n * sizeof(uint16_t);
+        default:
+            return CHUNK_BITMAP_BYTES;
+    }
+}
+
+// Set up c with the smallest container for npix pixels in nrun runs.
+static void chunk_alloc(chunk *c, int64_t key, uint32_t npix, uint32_t nrun, int *status,
+                        char *err) {
+    size_t best = CHUNK_BITMAP_BYTES;
+
+    *status = 1;
+    c->key = key;
+    c->npix = npix;
+    c->type = CHUNK_BITMAP;
+    c->n = CHUNK_NWORD;
+    if (2 * nrun * sizeof(uint16_t) < best) {
+        best = 2 * nrun * sizeof(uint16_t);
+        c->type = CHUNK_RUN;
+        c->n = nrun;
+    }
+    if ((npix <= CHUNK_MAX_ARRAY) && (npix * sizeof(uint16_t) <= best)) {
+        c->type = CHUNK_ARRAY;
+        c->n = npix;
+    }
+
+    c->data.values = malloc(chunk_nbytes(c));
+    if (c->data.values == NULL) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "Could not allocate chunk container");
+    }
+}
+
+// Build c from n sorted, unique values.
+static void chunk_from_values(chunk *c, int64_t key, const uint16_t *values, uint32_t n,
+                              int *status, char *err) {
+    uint32_t nrun = (n > 0) ? 1 : 0;
+
+    *status = 1;
+    c->npix = 0;
+    if (n == 0) return;
+
+    for (uint32_t i = 1; i < n; i++) {
+        if (values[i] != values[i - 1] + 1) nrun++;
+    }
+    chunk_alloc(c, key, n, nrun, status, err);
+    if (!*status) return;
+
+    switch (c->type) {
+        case CHUNK_ARRAY:
+            memcpy(c->data.values, values, n * sizeof(uint16_t));
+            break;
+        case CHUNK_RUN: {
+            uint32_t k = 0;
+            c->data.runs[0] = values[0];
+            for (uint32_t i = 1; i < n; i++) {
+                if (values[i] != values[i - 1] + 1) {
+                    c->data.runs[2 * k + 1] = values[i - 1];
+                    k++;
+                    c->data.runs[2 * k] = values[i];
+                }
+            }
+            c->data.runs[2 * k + 1] = values[n - 1];
+            break;
+        }
+        default:
+            memset(c->data.words, 0, CHUNK_BITMAP_BYTES);
+            for (uint32_t i = 0; i < n; i++) {
+                c->data.words[values[i] >> 6] |= UINT64_C(1) << (values[i] & 63);
+            }
+    }
+}
+
+// Build c from nrun [first, last] runs sorted by first, which are merged in
+// place if they overlap or touch.
+static void chunk_from_runs(chunk *c, int64_t key, uint16_t *runs, uint32_t nrun, int *status,
+                            char *err) {
+    uint32_t k = 0;
+    uint32_t npix = 0;
+
+    *status = 1;
+    c->npix = 0;
+    if (nrun == 0) return;
+
+    for (uint32_t i = 1; i < nrun; i++) {
+        if ((uint32_t)runs[2 * i] <= (uint32_t)runs[2 * k + 1] + 1) {
+            if (runs[2 * i + 1] > runs[2 * k + 1]) runs[2 * k + 1] = runs[2 * i + 1];
+        } else {
+            k++;
+            runs[2 * k] = runs[2 * i];
+            runs[2 * k + 1] = runs[2 * i + 1];
+        }
+    }
+    nrun = k + 1;
+    for (uint32_t i = 0; i < nrun; i++) npix += (uint32_t)(runs[2 * i + 1] - runs[2 * i]) + 1;
+
+    chunk_alloc(c, key, npix, nrun, status, err);
+    if (!*status) return;
+
+    switch (c->type) {
+        case CHUNK_ARRAY: {
+            uint32_t n = 0;
+            for (uint32_t i = 0; i < nrun; i++) {
+                for (uint32_t v = runs[2 * i]; v <= runs[2 * i + 1]; v++) {
+                    c->data.values[n++] = (uint16_t)v;
+                }
+            }
+            break;
+        }
+        case CHUNK_RUN:
+            memcpy(c->data.runs, runs, 2 * nrun * sizeof(uint16_t));
+            break;
+        default:
+            memset(c->data.words, 0, CHUNK_BITMAP_BYTES);
+            for (uint32_t i = 0; i < nrun; i++) {
+                words_set_range(c->data.words, runs[2 * i], runs[2 * i + 1]);
+            }
+    }
+}
+
+// Build c from bitmap words.
+static void chunk_from_words(chunk *c, int64_t key, const uint64_t *words, int *status,
+                             char *err) {
+    uint32_t npix = words_npix(words);
+
+    *status = 1;
+    c->npix = 0;
+    if (npix == 0) return;
+
+    chunk_alloc(c, key, npix, words_nrun(words), status, err);
+    if (!*status) return;
+
+    switch (c->type) {
+        case CHUNK_ARRAY: {
+            uint32_t n = 0;
+            for (uint32_t w = 0; w < CHUNK_NWORD; w++) {
+                uint64_t x = words[w];
+                while (x) {
+                    c->data.values[n++] = (uint16_t)((w << 6) + ctz64(x));
+                    x &= x - 1;
+                }
+            }
+            break;
+        }
+        case CHUNK_RUN:
+            words_to_runs(words, c->data.runs);
+            break;
+        default:
+            memcpy(c->data.words, words, CHUNK_BITMAP_BYTES);
+    }
+}
+
+static void chunk_copy(chunk *c, const chunk *src, int *status, char *err) {
+    *status = 1;
+    *c = *src;
+    c->data.values = malloc(chunk_nbytes(src));
+    if (c->data.values == NULL) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "Could not allocate chunk container");
+        return;
+    }
+    memcpy(c->data.values, src->data.values, chunk_nbytes(src));
+}
+
+// The pixels of c as [first, last] runs.  Returns the number of runs.
+static uint32_t chunk_runs(const chunk *c, uint16_t *runs) {
+    uint32_t nrun = 0;
+
+    switch (c->type) {
+        case CHUNK_ARRAY:
+            runs[0] = c->data.values[0];
+            for (uint32_t i = 1; i < c->n; i++) {
+                if (c->data.values[i] != c->data.values[i - 1] + 1) {
+                    runs[2 * nrun + 1] = c->data.values[i - 1];
+                    nrun++;
+                    runs[2 * nrun] = c->data.values[i];
+                }
+            }
+            runs[2 * nrun + 1] = c->data.values[c->n - 1];
+            return nrun + 1;
+        case CHUNK_RUN:
+            memcpy(runs, c->data.runs, 2 * c->n * sizeof(uint16_t));
+            return c->n;
+        default:
+            return words_to_runs(c->data.words, runs);
+    }
+}
+
+static void chunk_to_words(const chunk *c, uint64_t *words) {
+    switch (c->type) {
+        case CHUNK_ARRAY:
+            memset(words, 0, CHUNK_BITMAP_BYTES);
+            for (uint32_t i = 0; i < c->n; i++) {
+                words[c->data.values[i] >> 6] |= UINT64_C(1) << (c->data.values[i] & 63);
+            }
+            break;
+        case CHUNK_RUN:
+            memset(words, 0, CHUNK_BITMAP_BYTES);
+            for (uint32_t i = 0; i < c->n; i++) {
+                words_set_range(words, c->data.runs[2 * i], c->data.runs[2 * i + 1]);
+            }
+            break;
+        default:
+            memcpy(words, c->data.words, CHUNK_BITMAP_BYTES);
+    }
+}
+
+static bool chunk_contains(const chunk *c, uint16_t v) {
+    size_t low = 0, high = c->n;
+
+    switch (c->type) {
+        case CHUNK_ARRAY:
+            while (low < high) {
+                size_t mid = (low + high) / 2;
+                if (c->data.values[mid] < v) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+            return (low < c->n) && (c->data.values[low] == v);
+        case CHUNK_RUN:
+            // Find the last run starting at or before v.
+            while (low < high) {
+                size_t mid = (low + high) / 2;
+                if (c->data.runs[2 * mid] <= v) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+            return (low > 0) && (v <= c->data.runs[2 * (low - 1) + 1]);
+        default:
+            return (c->data.words[v >> 6] >> (v & 63)) & 1;
+    }
+}
+
+static void chunk_union(const chunk *a, const chunk *b, chunk *c, chunk_scratch *scratch,
+                        int *status, char *err) {
+    if (a->npix == CHUNK_SIZE) {
+        chunk_copy(c, a, status, err);
+    } else if (b->npix == CHUNK_SIZE) {
+        chunk_copy(c, b, status, err);
+    } else if ((a->type == CHUNK_ARRAY) && (b->type == CHUNK_ARRAY)) {
+        uint16_t *values = scratch->values;
+        uint32_t ia = 0, ib = 0, n = 0;
+        while ((ia < a->n) || (ib < b->n)) {
+            if ((ib >= b->n) || ((ia < a->n) && (a->data.values[ia] < b->data.values[ib]))) {
+                values[n++] = a->data.values[ia++];
+            } else if ((ia >= a->n) || (b->data.values[ib] < a->data.values[ia])) {
+                values[n++] = b->data.values[ib++];
+            } else {
+                values[n++] = a->data.values[ia++];
+                ib++;
+            }
+        }
+        chunk_from_values(c, a->key, values, n, status, err);
+    } else if ((a->type == CHUNK_RUN) && (b->type == CHUNK_RUN)) {
+        uint16_t *runs = scratch->runs;
+        uint32_t ia = 0, ib = 0, n = 0;
+        while ((ia < a->n) || (ib < b->n)) {
+            const uint16_t *run;
+            if ((ib >= b->n) ||
+                ((ia < a->n) && (a->data.runs[2 * ia] <= b->data.runs[2 * ib]))) {
+                run = &a->data.runs[2 * ia++];
+            } else {
+                run = &b->data.runs[2 * ib++];
+            }
+            runs[2 * n] = run[0];
+            runs[2 * n + 1] = run[1];
+            n++;
+        }
+        chunk_from_runs(c, a->key, runs, n, status, err);
+    } else {
+        chunk_to_words(a, scratch->words_a);
+        chunk_to_words(b, scratch->words_b);
+        for (uint32_t w = 0; w < CHUNK_NWORD; w++) scratch->words_a[w] |= scratch->words_b[w];
+        chunk_from_words(c, a->key, scratch->words_a, status, err);
+    }
+}
+
+// The intersection of a and b, which is left with npix = 0 if it is empty.
+static void chunk_intersection(const chunk *a, const chunk *b, chunk *c,
+                               chunk_scratch *scratch, int *status, char *err) {
+    if ((a->type == CHUNK_ARRAY) && (b->type == CHUNK_ARRAY)) {
+        uint16_t *values = scratch->values;
+        uint32_t ia = 0, ib = 0, n = 0;
+        while ((ia < a->n) && (ib < b->n)) {
+            if (a->data.values[ia] < b->data.values[ib]) {
+                ia++;
+            } else if (b->data.values[ib] < a->data.values[ia]) {
+                ib++;
+            } else {
+                values[n++] = a->data.values[ia++];
+                ib++;
+            }
+        }
+        chunk_from_values(c, a->key, values, n, status, err);
+    } else if ((a->type == CHUNK_ARRAY) || (b->type == CHUNK_ARRAY)) {
+        const chunk *array = (a->type == CHUNK_ARRAY) ? a : b;
+        const chunk *other = (a->type == CHUNK_ARRAY) ? b : a;
+        uint16_t *values = scratch->values;
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < array->n; i++) {
+            if (chunk_contains(other, array->data.values[i])) {
+                values[n++] = array->data.values[i];
+            }
+        }
+        chunk_from_values(c, a->key, values, n, status, err);
+    } else if ((a->type == CHUNK_RUN) && (b->type == CHUNK_RUN)) {
+        uint16_t *runs = scratch->runs;
+        uint32_t ia = 0, ib = 0, n = 0;
+        while ((ia < a->n) && (ib < b->n)) {
+            uint16_t first = a->data.runs[2 * ia];
+            uint16_t last = a->data.runs[2 * ia + 1];
+            if (b->data.runs[2 * ib] > first) first = b->data.runs[2 * ib];
+            if (b->data.runs[2 * ib + 1] < last) last = b->data.runs[2 * ib + 1];
+            if (first <= last) {
+                runs[2 * n] = first;
+                runs[2 * n + 1] = last;
+                n++;
+            }
+            if (a->data.runs[2 * ia + 1] < b->data.runs[2 * ib + 1]) {
+                ia++;
+            } else {
+                ib++;
+            }
+        }
+        chunk_from_runs(c, a->key, runs, n, status, err);
+    } else {
+        chunk_to_words(a, scratch->words_a);
+        chunk_to_words(b, scratch->words_b);
+        for (uint32_t w = 0; w < CHUNK_NWORD; w++) scratch->words_a[w] &= scratch->words_b[w];
+        chunk_from_words(c, a->key, scratch->words_a, status, err);
+    }
+}
+
+/*
+ * Chunk sets.
+ */
+
+chunkset *chunkset_new(int *status, char *err) {
+    *status = 1;
+    chunkset *set = calloc(1, sizeof(chunkset));
+    if (set == NULL) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "Could not allocate chunkset");
+    }
+    return set;
+}
+
+void chunkset_clear(chunkset *set) {
+    for (size_t i = 0; i < set->size; i++) free(set->chunks[i].data.values);
+    set->size = 0;
+}
+
+chunkset *chunkset_delete(chunkset *set) {
+    if (set != NULL) {
+        chunkset_clear(set);
+        free(set->chunks);
+        free(set);
+    }
+    return NULL;
+}
+
+// Append an empty chunk to the set.
+static chunk *chunkset_push(chunkset *set, int *status, char *err) {
+    *status = 1;
+    if (set->size == set->allocated_size) {
+        size_t new_size = (set->allocated_size == 0) ? 16 : 2 * set->allocated_size;
+        chunk *chunks = realloc(set->chunks, new_size * sizeof(chunk));
+        if (chunks == NULL) {
+            *status = 0;
+            snprintf(err, ERR_SIZE, "Could not reallocate chunkset");
+            return NULL;
+        }
+        set->chunks = chunks;
+        set->allocated_size = new_size;
+    }
+    chunk *c = &set->chunks[set->size++];
+    memset(c, 0, sizeof(chunk));
+
+    return c;
+}
+
+// Drop the last chunk of the set if it is empty.
+static void chunkset_pop_empty(chunkset *set) {
+    if ((set->size > 0) && (set->chunks[set->size - 1].npix == 0)) {
+        free(set->chunks[set->size - 1].data.values);
+        set->size--;
+    }
+}
+
+void chunkset_from_rangeset(chunkset *set, i64rangeset *rangeset, int *status, char *err) {
+    const int64_t *data = rangeset->stack->data;
+    size_t size = rangeset->stack->size;
+    int64_t key = -1;
+    uint32_t nrun = 0;
+    chunk *c;
+
+    chunkset_clear(set);
+    uint16_t *runs = malloc(CHUNK_SIZE * sizeof(uint16_t));
+    if (runs == NULL) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "Could not allocate chunk runs");
+        return;
+    }
+
+    *status = 1;
+    for (size_t j = 0; j < size; j += 2) {
+        int64_t lo = data[j];
+        while (lo < data[j + 1]) {
+            int64_t chunk_key = lo >> CHUNK_BITS;
+            int64_t hi = (chunk_key + 1) << CHUNK_BITS;
+            if (data[j + 1] < hi) hi = data[j + 1];
+            if (chunk_key != key) {
+                if (nrun > 0) {
+                    c = chunkset_push(set, status, err);
+                    if (!*status) goto cleanup;
+                    chunk_from_runs(c, key, runs, nrun, status, err);
+                    if (!*status) goto cleanup;
+                }
+                key = chunk_key;
+                nrun = 0;
+            }
+            runs[2 * nrun] = (uint16_t)(lo & CHUNK_MASK);
+            runs[2 * nrun + 1] = (uint16_t)((hi - 1) & CHUNK_MASK);
+            nrun++;
+            lo = hi;
+        }
+    }
+    if (nrun > 0) {
+        c = chunkset_push(set, status, err);
+        if (!*status) goto cleanup;
+        chunk_from_runs(c, key, runs, nrun, status, err);
+    }
+
+cleanup:
+    free(runs);
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t va = *(const int64_t *)a;
+    int64_t vb = *(const int64_t *)b;
+    return (va > vb) - (va < vb);
+}
+
+void chunkset_from_pixels(chunkset *set, const int64_t *pix, size_t n, int *status,
+                          char *err) {
+    int64_t *sorted = NULL;
+    uint16_t *values = NULL;
+    int64_t key = -1;
+    uint32_t nvalue = 0;
+    chunk *c;
+
+    chunkset_clear(set);
+    *status = 1;
+    if (n == 0) return;
+
+    sorted = malloc(n * sizeof(int64_t));
+    values = malloc(CHUNK_SIZE * sizeof(uint16_t));
+    if ((sorted == NULL) || (values == NULL)) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "Could not allocate chunk values");
+        goto cleanup;
+    }
+    memcpy(sorted, pix, n * sizeof(int64_t));
+    qsort(sorted, n, sizeof(int64_t), compare_int64);
+
+    for (size_t i = 0; i < n; i++) {
+        if ((i > 0) && (sorted[i] == sorted[i - 1])) continue;
+        int64_t chunk_key = sorted[i] >> CHUNK_BITS;
+        if (chunk_key != key) {
+            if (nvalue > 0) {
+                c = chunkset_push(set, status, err);
+                if (!*status) goto cleanup;
+                chunk_from_values(c, key, values, nvalue, status, err);
+                if (!*status) goto cleanup;
+            }
+            key = chunk_key;
+            nvalue = 0;
+        }
+        values[nvalue++] = (uint16_t)(sorted[i] & CHUNK_MASK);
+    }
+    c = chunkset_push(set, status, err);
+    if (!*status) goto cleanup;
+    chunk_from_values(c, key, values, nvalue, status, err);
+
+cleanup:
+    free(sorted);
+    free(values);
+}
+
+void chunkset_to_rangeset(chunkset *set, i64rangeset *rangeset, int *status, char *err) {
+    *status = 1;
+    uint16_t *runs = malloc(CHUNK_SIZE * sizeof(uint16_t));
+    if (runs == NULL) {
+        *status = 0;
+        snprintf(err, ERR_SIZE, "Could not allocate chunk runs");
+        return;
+    }
+
+    for (size_t i = 0; i < set->size; i++) {
+        int64_t base = set->chunks[i].key << CHUNK_BITS;
+        uint32_t nrun = chunk_runs(&set->chunks[i], runs);
+        for (uint32_t k = 0; k < nrun; k++) {
+            i64rangeset_append(rangeset, base + runs[2 * k], base + runs[2 * k + 1] + 1,
+                               status, err);
+            if (!*status) goto cleanup;
+        }
+    }
+
+cleanup:
+    free(runs);
+}
+
+void chunkset_fill_buffer(chunkset *set, int64_t *pix) {
+    size_t n = 0;
+
+    for (size_t i = 0; i < set->size; i++) {
+        const chunk *c = &set->chunks[i];
+        int64_t base = c->key << CHUNK_BITS;
+        switch (c->type) {
+            case CHUNK_ARRAY:
+                for (uint32_t k = 0; k < c->n; k++) pix[n++] = base + c->data.values[k];
+                break;
+            case CHUNK_RUN:
+                for (uint32_t k = 0; k < c->n; k++) {
+                    for (int64_t p = c->data.runs[2 * k]; p <= c->data.runs[2 * k + 1]; p++) {
+                        pix[n++] = base + p;
+                    }
+                }
+                break;
+            default:
+                for (uint32_t w = 0; w < CHUNK_NWORD; w++) {
+                    uint64_t x = c->data.words[w];
+                    while (x) {
+                        pix[n++] = base + (w << 6) + ctz64(x);
+                        x &= x - 1;
+                    }
+                }
+        }
+    }
+}
+
+size_t chunkset_npix(chunkset *set) {
+    size_t npix = 0;
+    for (size_t i = 0; i < set->size; i++) npix += set->chunks[i].npix;
+    return npix;
+}
+
+size_t chunkset_nbytes(chunkset *set) {
+    size_t nbytes = sizeof(chunkset) + set->allocated_size * sizeof(chunk);
+    for (size_t i = 0; i < set->size; i++) nbytes += chunk_nbytes(&set->chunks[i]);
+    return nbytes;
+}
+
+bool chunkset_contains(chunkset *set, int64_t pix) {
+    int64_t key = pix >> CHUNK_BITS;
+    size_t low = 0, high = set->size;
+
+    if (pix < 0) return false;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (set->chunks[mid].key < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if ((low >= set->size) || (set->chunks[low].key != key)) return false;
+
+    return chunk_contains(&set->chunks[low], (uint16_t)(pix & CHUNK_MASK));
+}
+
+bool chunkset_equal(chunkset *a, chunkset *b) {
+    // The containers are chosen by content, so equal sets have equal chunks.
+    if (a->size != b->size) return false;
+    for (size_t i = 0; i < a->size; i++) {
+        const chunk *ca = &a->chunks[i];
+        const chunk *cb = &b->chunks[i];
+        if ((ca->key != cb->key) || (ca->type != cb->type) || (ca->n != cb->n) ||
+            (memcmp(ca->data.values, cb->data.values, chunk_nbytes(ca)) != 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void chunkset_union(chunkset *a, chunkset *b, chunkset *out, int *status, char *err) {
+    size_t ia = 0, ib = 0;
+
+    chunkset_clear(out);
+    chunk_scratch *scratch = chunk_scratch_new(status, err);
+    if (!*status) return;
+
+    while ((ia < a->size) || (ib < b->size)) {
+        chunk *c = chunkset_push(out, status, err);
+        if (!*status) break;
+        if ((ib >= b->size) || ((ia < a->size) && (a->chunks[ia].key < b->chunks[ib].key))) {
+            chunk_copy(c, &a->chunks[ia++], status, err);
+        } else if ((ia >= a->size) || (b->chunks[ib].key < a->chunks[ia].key)) {
+            chunk_copy(c, &b->chunks[ib++], status, err);
+        } else {
+            chunk_union(&a->chunks[ia++], &b->chunks[ib++], c, scratch, status, err);
+        }
+        if (!*status) break;
+    }
+
+    free(scratch);
+}
+
+void chunkset_intersection(chunkset *a, chunkset *b, chunkset *out, int *status, char *err) {
+    size_t ia = 0, ib = 0;
+
+    chunkset_clear(out);
+    chunk_scratch *scratch = chunk_scratch_new(status, err);
+    if (!*status) return;
+
+    while ((ia < a->size) && (ib < b->size)) {
+        if (a->chunks[ia].key < b->chunks[ib].key) {
+            ia++;
+        } else if (b->chunks[ib].key < a->chunks[ia].key) {
+            ib++;
+        } else {
+            chunk *c = chunkset_push(out, status, err);
+            if (!*status) break;
+            chunk_intersection(&a->chunks[ia++], &b->chunks[ib++], c, scratch, status, err);
+            if (!*status) break;
+            chunkset_pop_empty(out);
+        }
+    }
+
+    free(scratch);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+#ifndef _HPGEOM_CHUNKSET_H
+#define _HPGEOM_CHUNKSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hpgeom_stack.h"
+
+// A set of pixels split into chunks of 2**16 pixels, in the manner of a
+// roaring bitmap.  Each chunk holding any pixels is stored in whichever
+// container is smallest: a sorted array of the low 16 bits of each pixel, an
+// array of [first, last] runs, or a bitmap.  The choice depends only on the
+// pixels of the chunk, so equal sets have identical chunks.
+#define CHUNK_BITS 16
+#define CHUNK_SIZE (1 << CHUNK_BITS)
+#define CHUNK_NWORD (CHUNK_SIZE / 64)
+// An array container never holds more values than fit in a bitmap.
+#define CHUNK_MAX_ARRAY 4096
+
+typedef enum chunk_type { CHUNK_ARRAY, CHUNK_RUN, CHUNK_BITMAP } chunk_type;
+
+typedef struct chunk {
+    int64_t key;    // pixel >> CHUNK_BITS
+    chunk_type type;
+    uint32_t npix;  // number of pixels in the chunk, 1 to CHUNK_SIZE
+    uint32_t n;     // number of values (array), runs (run) or words (bitmap)
+    union {
+        uint16_t *values;  // n sorted values
+        uint16_t *runs;    // n pairs of first and last values
+        uint64_t *words;   // CHUNK_NWORD words
+    } data;
+} chunk;
+
+typedef struct chunkset {
+    size_t size;            // number of chunks
+    size_t allocated_size;  // number of allocated chunks
+    chunk *chunks;          // sorted by key
+} chunkset;
+
+chunkset *chunkset_new(int *status, char *err);
+chunkset *chunkset_delete(chunkset *set);
+void chunkset_clear(chunkset *set);
+
+// Build the set from the sorted, merged [lo, high) ranges of a rangeset, or
+// from n pixels in any order, which may be repeated.  Pixels must be >= 0.
+void chunkset_from_rangeset(chunkset *set, i64rangeset *rangeset, int *status, char *err);
+void chunkset_from_pixels(chunkset *set, const int64_t *pix, size_t n, int *status,
+                          char *err);
+// Append the pixels of the set to rangeset as sorted ranges.
+void chunkset_to_rangeset(chunkset *set, i64rangeset *rangeset, int *status, char *err);
+// Fill pix with the chunkset_npix() pixels of the set, in order.
+void chunkset_fill_buffer(chunkset *set, int64_t *pix);
+
+size_t chunkset_npix(chunkset *set);
+// Memory used by the containers and chunk table.
+size_t chunkset_nbytes(chunkset *set);
+bool chunkset_contains(chunkset *set, int64_t pix);
+bool chunkset_equal(chunkset *a, chunkset *b);
+
+// The output must not be a or b.
+void chunkset_union(chunkset *a, chunkset *b, chunkset *out, int *status, char *err);
+void chunkset_intersection(chunkset *a, chunkset *b, chunkset *out, int *status, char *err);
+
+#endif
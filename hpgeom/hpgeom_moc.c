@@ -0,0 +1,546 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+
+#include <Python.h>
+
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#define PY_ARRAY_UNIQUE_SYMBOL HPGEOM_ARRAY_API
+#define NO_IMPORT_ARRAY
+
+#include <numpy/arrayobject.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "healpix_geom.h"
+#include "healpix_moc.h"
+#include "hpgeom_moc.h"
+#include "hpgeom_stack.h"
+#include "hpgeom_utils.h"
+
+static PyObject *MOC_from_moc(moc *m) {
+    MOCObject *self = (MOCObject *)MOCType.tp_alloc(&MOCType, 0);
+    if (self == NULL) {
+        moc_delete(m);
+        return NULL;
+    }
+    self->moc = m;
+
+    return (PyObject *)self;
+}
+
+/*
+ * Wrap rangeset, the sorted and merged ranges of nest pixels at max_order,
+ * in a new MOC object, which takes ownership of it.  On failure the rangeset
+ * is deleted and NULL is returned.
+ */
+PyObject *MOC_from_i64rangeset(i64rangeset *rangeset, int max_order) {
+    char err[ERR_SIZE];
+    int status = 1;
+
+    moc *m = moc_new(max_order, &status, err);
+    if (!status) {
+        i64rangeset_delete(rangeset);
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+    i64rangeset_delete(m->rangeset);
+    m->rangeset = rangeset;
+
+    return MOC_from_moc(m);
+}
+
+// Order of a nest nside, setting a ValueError if it is not valid.
+static int MOC_nside_order(int64_t nside, int *order) {
+    char err[ERR_SIZE];
+
+    if (!hpgeom_check_nside(nside, NEST, err)) {
+        PyErr_SetString(PyExc_ValueError, err);
+        return 0;
+    }
+    *order = ilog2(nside);
+
+    return 1;
+}
+
+static void MOC_dealloc(MOCObject *self) {
+    moc_delete(self->moc);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *MOC_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    int64_t nside;
+    int order;
+    PyObject *ranges_obj = NULL;
+    PyObject *ranges_arr = NULL;
+    MOCObject *self = NULL;
+    static char *kwlist[] = {"nside", "pixel_ranges", NULL};
+    char err[ERR_SIZE];
+    int status = 1;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "L|O", kwlist, &nside, &ranges_obj))
+        goto fail;
+    if (!MOC_nside_order(nside, &order)) goto fail;
+
+    self = (MOCObject *)type->tp_alloc(type, 0);
+    if (self == NULL) goto fail;
+    self->moc = moc_new(order, &status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        goto fail;
+    }
+
+    if ((ranges_obj == NULL) || (ranges_obj == Py_None)) return (PyObject *)self;
+
+    ranges_arr =
+        PyArray_FROM_OTF(ranges_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    if (ranges_arr == NULL) goto fail;
+
+    if (PyArray_SIZE((PyArrayObject *)ranges_arr) == 0) {
+        Py_DECREF(ranges_arr);
+        return (PyObject *)self;
+    }
+
+    if ((PyArray_NDIM((PyArrayObject *)ranges_arr) != 2) ||
+        (PyArray_DIM((PyArrayObject *)ranges_arr, 1) != 2)) {
+        PyErr_SetString(PyExc_ValueError, "pixel_ranges must be 2D, with shape (M, 2).");
+        goto fail;
+    }
+
+    size_t nval = (size_t)PyArray_SIZE((PyArrayObject *)ranges_arr);
+    int64_t *ranges_data = (int64_t *)PyArray_DATA((PyArrayObject *)ranges_arr);
+    i64stack *stack = self->moc->rangeset->stack;
+    int64_t npix = 12 * nside * nside;
+
+    for (size_t i = 0; i < nval; i += 2) {
+        if (ranges_data[i + 1] < ranges_data[i]) {
+            PyErr_SetString(PyExc_ValueError,
+                            "pixel_ranges[:, 0] must all be <= pixel_ranges[:, 1]");
+            goto fail;
+        }
+        if ((ranges_data[i] < 0) || (ranges_data[i + 1] > npix)) {
+            PyErr_SetString(PyExc_ValueError, "pixel_ranges out of range for nside.");
+            goto fail;
+        }
+    }
+
+    i64stack_resize(stack, nval, &status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        goto fail;
+    }
+
+    NPY_BEGIN_THREADS;
+    memcpy(stack->data, ranges_data, nval * sizeof(int64_t));
+    stack->size = i64ranges_sort_merge(stack->data, nval);
+    NPY_END_THREADS;
+
+    Py_DECREF(ranges_arr);
+
+    return (PyObject *)self;
+
+fail:
+    Py_XDECREF(ranges_arr);
+    Py_XDECREF(self);
+
+    return NULL;
+}
+
+PyDoc_STRVAR(MOC_from_nuniq_doc,
+             "from_nuniq(nuniq, nside=None)\n"
+             "--\n\n"
+             "Create a MOC from NUNIQ cells.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "nuniq : `np.ndarray` (N,)\n"
+             "    NUNIQ cells, 4*4**order + pixel, in any order.  These may overlap.\n"
+             "nside : `int`, optional\n"
+             "    Finest resolution of the MOC.  If None, the resolution of the\n"
+             "    finest cell is used.\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "moc : `MOC`\n"
+             "\n"
+             "Raises\n"
+             "------\n"
+             "ValueError\n"
+             "    If any cell is not valid or is finer than nside.\n");
+
+static PyObject *MOC_from_nuniq(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    PyObject *nuniq_obj = NULL;
+    PyObject *nside_obj = Py_None;
+    PyObject *nuniq_arr = NULL;
+    moc *m = NULL;
+    int order = 0;
+    static char *kwlist[] = {"nuniq", "nside", NULL};
+    char err[ERR_SIZE];
+    int status = 1;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", kwlist, &nuniq_obj, &nside_obj))
+        return NULL;
+
+    nuniq_arr =
+        PyArray_FROM_OTF(nuniq_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    if (nuniq_arr == NULL) goto fail;
+
+    size_t n = (size_t)PyArray_SIZE((PyArrayObject *)nuniq_arr);
+    int64_t *nuniq = (int64_t *)PyArray_DATA((PyArrayObject *)nuniq_arr);
+
+    if (nside_obj != Py_None) {
+        long long nside = PyLong_AsLongLong(nside_obj);
+        if ((nside == -1) && PyErr_Occurred()) goto fail;
+        if (!MOC_nside_order((int64_t)nside, &order)) goto fail;
+    } else {
+        // The finest cell; invalid cells are reported by moc_set_nuniq().
+        for (size_t i = 0; i < n; i++) {
+            if ((nuniq[i] >= 4) && (nuniq_order(nuniq[i]) > order)) {
+                order = nuniq_order(nuniq[i]);
+            }
+        }
+        if (order > MAX_ORDER) order = MAX_ORDER;
+    }
+
+    m = moc_new(order, &status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        goto fail;
+    }
+
+    NPY_BEGIN_THREADS;
+    moc_set_nuniq(m, nuniq, n, &status, err);
+    NPY_END_THREADS;
+    if (!status) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
+    }
+
+    Py_DECREF(nuniq_arr);
+
+    return MOC_from_moc(m);
+
+fail:
+    Py_XDECREF(nuniq_arr);
+    moc_delete(m);
+
+    return NULL;
+}
+
+typedef void (*moc_binary_op)(moc *a, moc *b, moc *out, int *status, char *err);
+
+static PyObject *MOC_binary(PyObject *a, PyObject *b, moc_binary_op op) {
+    moc *out = NULL;
+    char err[ERR_SIZE];
+    int status = 1;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyObject_TypeCheck(a, &MOCType) || !PyObject_TypeCheck(b, &MOCType)) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+
+    out = moc_new(0, &status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    NPY_BEGIN_THREADS;
+    op(((MOCObject *)a)->moc, ((MOCObject *)b)->moc, out, &status, err);
+    NPY_END_THREADS;
+    if (!status) {
+        moc_delete(out);
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    return MOC_from_moc(out);
+}
+
+static PyObject *MOC_binary_method(PyObject *self, PyObject *other, moc_binary_op op) {
+    if (!PyObject_TypeCheck(other, &MOCType)) {
+        PyErr_SetString(PyExc_TypeError, "other must be a MOC.");
+        return NULL;
+    }
+    return MOC_binary(self, other, op);
+}
+
+PyDoc_STRVAR(MOC_union_doc,
+             "union(other)\n"
+             "--\n\n"
+             "Return the union of this MOC and other, at the finer resolution of the two.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "other : `MOC`\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "moc : `MOC`\n");
+
+static PyObject *MOC_union(PyObject *self, PyObject *other) {
+    return MOC_binary_method(self, other, moc_union);
+}
+
+PyDoc_STRVAR(MOC_intersection_doc,
+             "intersection(other)\n"
+             "--\n\n"
+             "Return the intersection of this MOC and other, at the finer resolution\n"
+             "of the two.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "other : `MOC`\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "moc : `MOC`\n");
+
+static PyObject *MOC_intersection(PyObject *self, PyObject *other) {
+    return MOC_binary_method(self, other, moc_intersection);
+}
+
+PyDoc_STRVAR(MOC_degrade_doc,
+             "degrade(nside)\n"
+             "--\n\n"
+             "Return this MOC at a coarser resolution.  Each pixel at nside which\n"
+             "is partially covered is fully covered in the result.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "nside : `int`\n"
+             "    New resolution, which must not be finer than the MOC nside.\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "moc : `MOC`\n");
+
+static PyObject *MOC_degrade(MOCObject *self, PyObject *args, PyObject *kwargs) {
+    int64_t nside;
+    int order;
+    static char *kwlist[] = {"nside", NULL};
+    moc *out = NULL;
+    char err[ERR_SIZE];
+    int status = 1;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "L", kwlist, &nside)) return NULL;
+    if (!MOC_nside_order(nside, &order)) return NULL;
+    if (order > self->moc->max_order) {
+        PyErr_SetString(PyExc_ValueError, "nside must not be larger than the MOC nside.");
+        return NULL;
+    }
+
+    out = moc_new(order, &status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    NPY_BEGIN_THREADS;
+    moc_degrade(self->moc, order, out, &status, err);
+    NPY_END_THREADS;
+    if (!status) {
+        moc_delete(out);
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    return MOC_from_moc(out);
+}
+
+PyDoc_STRVAR(MOC_to_nuniq_doc,
+             "to_nuniq()\n"
+             "--\n\n"
+             "Serialize the MOC as the minimal list of NUNIQ cells.\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "nuniq : `np.ndarray` (N,)\n"
+             "    Sorted array (`np.int64`) of cells, 4*4**order + pixel, where each\n"
+             "    cell is a nest pixel of order <= log2(nside).\n");
+
+static PyObject *MOC_to_nuniq(MOCObject *self, PyObject *Py_UNUSED(ignored)) {
+    NPY_BEGIN_THREADS_DEF;
+    npy_intp dims[1];
+
+    NPY_BEGIN_THREADS;
+    dims[0] = (npy_intp)moc_ncell(self->moc, NULL);
+    NPY_END_THREADS;
+
+    PyObject *nuniq_arr = PyArray_SimpleNew(1, dims, NPY_INT64);
+    if (nuniq_arr == NULL) return NULL;
+
+    NPY_BEGIN_THREADS;
+    moc_fill_nuniq(self->moc, (int64_t *)PyArray_DATA((PyArrayObject *)nuniq_arr));
+    NPY_END_THREADS;
+
+    return nuniq_arr;
+}
+
+PyDoc_STRVAR(MOC_to_pixels_doc,
+             "to_pixels()\n"
+             "--\n\n"
+             "Expand the MOC to an array of nest pixels at nside.\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "pixels : `np.ndarray` (N,)\n"
+             "    Sorted array of pixels (`np.int64`).\n");
+
+static PyObject *MOC_to_pixels(MOCObject *self, PyObject *Py_UNUSED(ignored)) {
+    NPY_BEGIN_THREADS_DEF;
+    size_t npix = i64rangeset_npix(self->moc->rangeset);
+    npy_intp dims[1];
+    dims[0] = (npy_intp)npix;
+
+    PyObject *pix_arr = PyArray_SimpleNew(1, dims, NPY_INT64);
+    if (pix_arr == NULL) return NULL;
+
+    NPY_BEGIN_THREADS;
+    i64rangeset_fill_buffer(self->moc->rangeset, npix,
+                            (int64_t *)PyArray_DATA((PyArrayObject *)pix_arr));
+    NPY_END_THREADS;
+
+    return pix_arr;
+}
+
+static PyObject *MOC_get_pixel_ranges(MOCObject *self, void *closure) {
+    i64stack *stack = self->moc->rangeset->stack;
+    npy_intp dims[2];
+    dims[0] = (npy_intp)(stack->size / 2);
+    dims[1] = 2;
+
+    PyObject *ranges_arr = PyArray_SimpleNew(2, dims, NPY_INT64);
+    if (ranges_arr == NULL) return NULL;
+    if (stack->size > 0) {
+        memcpy(PyArray_DATA((PyArrayObject *)ranges_arr), stack->data,
+               stack->size * sizeof(int64_t));
+    }
+
+    return ranges_arr;
+}
+
+static PyObject *MOC_get_nside(MOCObject *self, void *closure) {
+    return PyLong_FromLongLong((long long)1 << self->moc->max_order);
+}
+
+static PyObject *MOC_get_max_order(MOCObject *self, void *closure) {
+    return PyLong_FromLong(self->moc->max_order);
+}
+
+static PyObject *MOC_get_n_cells(MOCObject *self, void *closure) {
+    return PyLong_FromSize_t(moc_ncell(self->moc, NULL));
+}
+
+static PyObject *MOC_get_npix(MOCObject *self, void *closure) {
+    return PyLong_FromSize_t(i64rangeset_npix(self->moc->rangeset));
+}
+
+static PyObject *MOC_richcompare(PyObject *a, PyObject *b, int op) {
+    if (!PyObject_TypeCheck(a, &MOCType) || !PyObject_TypeCheck(b, &MOCType) ||
+        ((op != Py_EQ) && (op != Py_NE))) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+
+    bool equal = moc_equal(((MOCObject *)a)->moc, ((MOCObject *)b)->moc);
+
+    if (equal == (op == Py_EQ)) Py_RETURN_TRUE;
+    Py_RETURN_FALSE;
+}
+
+static PyObject *MOC_repr(MOCObject *self) {
+    return PyUnicode_FromFormat("MOC(nside=%lld, n_cells=%zu)",
+                                (long long)1 << self->moc->max_order,
+                                moc_ncell(self->moc, NULL));
+}
+
+static PyObject *MOC_nb_or(PyObject *a, PyObject *b) { return MOC_binary(a, b, moc_union); }
+
+static PyObject *MOC_nb_and(PyObject *a, PyObject *b) {
+    return MOC_binary(a, b, moc_intersection);
+}
+
+static int MOC_nb_bool(MOCObject *self) { return self->moc->rangeset->stack->size > 0; }
+
+static PyMethodDef MOC_methods[] = {
+    {"from_nuniq", (PyCFunction)(void (*)(void))MOC_from_nuniq,
+     METH_VARARGS | METH_KEYWORDS | METH_CLASS, MOC_from_nuniq_doc},
+    {"union", (PyCFunction)MOC_union, METH_O, MOC_union_doc},
+    {"intersection", (PyCFunction)MOC_intersection, METH_O, MOC_intersection_doc},
+    {"degrade", (PyCFunction)(void (*)(void))MOC_degrade, METH_VARARGS | METH_KEYWORDS,
+     MOC_degrade_doc},
+    {"to_nuniq", (PyCFunction)MOC_to_nuniq, METH_NOARGS, MOC_to_nuniq_doc},
+    {"to_pixels", (PyCFunction)MOC_to_pixels, METH_NOARGS, MOC_to_pixels_doc},
+    {NULL, NULL, 0, NULL}};
+
+static PyGetSetDef MOC_getset[] = {
+    {"pixel_ranges", (getter)MOC_get_pixel_ranges, NULL,
+     "(M, 2) array of the [lo, high) nest pixel ranges at nside.", NULL},
+    {"nside", (getter)MOC_get_nside, NULL, "Finest resolution of the MOC.", NULL},
+    {"max_order", (getter)MOC_get_max_order, NULL, "Order of the finest resolution.", NULL},
+    {"n_cells", (getter)MOC_get_n_cells, NULL, "Number of cells in the MOC.", NULL},
+    {"npix", (getter)MOC_get_npix, NULL, "Number of pixels at nside in the MOC.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}};
+
+static PyNumberMethods MOC_as_number = {
+    .nb_bool = (inquiry)MOC_nb_bool,
+    .nb_and = MOC_nb_and,
+    .nb_or = MOC_nb_or,
+};
+
+PyDoc_STRVAR(MOC_doc,
+             "MOC(nside, pixel_ranges=None)\n"
+             "--\n\n"
+             "An immutable multi-order coverage map (MOC) of nest pixels.\n"
+             "\n"
+             "The coverage is held as sorted pixel ranges at nside, and is serialized\n"
+             "as the minimal set of cells of any order <= log2(nside), each encoded\n"
+             "with the NUNIQ scheme as 4*4**order + pixel.  Large areas at high\n"
+             "resolution need only a few coarse cells.  Union and intersection are\n"
+             "available as methods or with the | and & operators.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "nside : `int`\n"
+             "    Finest resolution of the MOC.  Must be a power of 2.\n"
+             "pixel_ranges : `np.ndarray` (M, 2), optional\n"
+             "    Array of nest pixel ranges at nside, [lo, high), such as returned by\n"
+             "    the query functions with return_pixel_ranges=True.  These may be in\n"
+             "    any order, and may overlap.\n");
+
+PyTypeObject MOCType = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name = "hpgeom._hpgeom.MOC",
+    .tp_basicsize = sizeof(MOCObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor)MOC_dealloc,
+    .tp_repr = (reprfunc)MOC_repr,
+    .tp_as_number = &MOC_as_number,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = MOC_doc,
+    .tp_richcompare = MOC_richcompare,
+    .tp_methods = MOC_methods,
+    .tp_getset = MOC_getset,
+    .tp_new = MOC_new,
+};
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+
+#ifndef _HPGEOM_MOC_H
+#define _HPGEOM_MOC_H
+
+#include <Python.h>
+
+#include "healpix_moc.h"
+#include "hpgeom_stack.h"
+
+// An immutable multi-order coverage map of nest pixels.
+typedef struct {
+    PyObject_HEAD moc *moc;
+} MOCObject;
+
+extern PyTypeObject MOCType;
+
+PyObject *MOC_from_i64rangeset(i64rangeset *rangeset, int max_order);
+
+#endif
@@ -0,0 +1,492 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+
+#include <Python.h>
+
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#define PY_ARRAY_UNIQUE_SYMBOL HPGEOM_ARRAY_API
+#define NO_IMPORT_ARRAY
+
+#include <numpy/arrayobject.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hpgeom_chunkset.h"
+#include "hpgeom_pixelset.h"
+#include "hpgeom_rangeset.h"
+#include "hpgeom_stack.h"
+#include "hpgeom_utils.h"
+
+static PyObject *PixelSet_from_chunkset(PyTypeObject *type, chunkset *set) {
+    PixelSetObject *self = (PixelSetObject *)type->tp_alloc(type, 0);
+    if (self == NULL) {
+        chunkset_delete(set);
+        return NULL;
+    }
+    self->chunkset = set;
+
+    return (PyObject *)self;
+}
+
+static void PixelSet_dealloc(PixelSetObject *self) {
+    chunkset_delete(self->chunkset);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *PixelSet_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    PyObject *pix_obj = NULL;
+    PyObject *pix_arr = NULL;
+    chunkset *set = NULL;
+    static char *kwlist[] = {"pixels", NULL};
+    char err[ERR_SIZE];
+    int status = 1;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &pix_obj)) return NULL;
+
+    set = chunkset_new(&status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    if ((pix_obj == NULL) || (pix_obj == Py_None)) return PixelSet_from_chunkset(type, set);
+
+    pix_arr = PyArray_FROM_OTF(pix_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    if (pix_arr == NULL) goto fail;
+
+    size_t n = (size_t)PyArray_SIZE((PyArrayObject *)pix_arr);
+    int64_t *pix = (int64_t *)PyArray_DATA((PyArrayObject *)pix_arr);
+
+    for (size_t i = 0; i < n; i++) {
+        if (pix[i] < 0) {
+            PyErr_SetString(PyExc_ValueError, "pixels must all be >= 0.");
+            goto fail;
+        }
+    }
+
+    NPY_BEGIN_THREADS;
+    chunkset_from_pixels(set, pix, n, &status, err);
+    NPY_END_THREADS;
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        goto fail;
+    }
+
+    Py_DECREF(pix_arr);
+
+    return PixelSet_from_chunkset(type, set);
+
+fail:
+    Py_XDECREF(pix_arr);
+    chunkset_delete(set);
+
+    return NULL;
+}
+
+PyDoc_STRVAR(PixelSet_from_pixel_ranges_doc,
+             "from_pixel_ranges(pixel_ranges)\n"
+             "--\n\n"
+             "Create a PixelSet from pixel ranges.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "pixel_ranges : `np.ndarray` (M, 2) or `RangeSet`\n"
+             "    Array of [lo, high) pixel ranges, in any order.  These may overlap.\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "pixel_set : `PixelSet`\n");
+
+static PyObject *PixelSet_from_pixel_ranges(PyTypeObject *type, PyObject *ranges_obj) {
+    PyObject *ranges_arr = NULL;
+    i64rangeset *rangeset = NULL;
+    chunkset *set = NULL;
+    char err[ERR_SIZE];
+    int status = 1;
+    NPY_BEGIN_THREADS_DEF;
+
+    ranges_arr =
+        PyArray_FROM_OTF(ranges_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    if (ranges_arr == NULL) goto fail;
+
+    size_t nval = (size_t)PyArray_SIZE((PyArrayObject *)ranges_arr);
+    int64_t *ranges_data = (int64_t *)PyArray_DATA((PyArrayObject *)ranges_arr);
+
+    if ((nval > 0) && ((PyArray_NDIM((PyArrayObject *)ranges_arr) != 2) ||
+                       (PyArray_DIM((PyArrayObject *)ranges_arr, 1) != 2))) {
+        PyErr_SetString(PyExc_ValueError, "pixel_ranges must be 2D, with shape (M, 2).");
+        goto fail;
+    }
+    for (size_t i = 0; i < nval; i += 2) {
+        if (ranges_data[i + 1] < ranges_data[i]) {
+            PyErr_SetString(PyExc_ValueError,
+                            "pixel_ranges[:, 0] must all be <= pixel_ranges[:, 1]");
+            goto fail;
+        }
+        if (ranges_data[i] < 0) {
+            PyErr_SetString(PyExc_ValueError, "pixel_ranges must all be >= 0.");
+            goto fail;
+        }
+    }
+
+    set = chunkset_new(&status, err);
+    if (!status) goto fail_status;
+    rangeset = i64rangeset_new(&status, err);
+    if (!status) goto fail_status;
+    i64stack_resize(rangeset->stack, nval, &status, err);
+    if (!status) goto fail_status;
+
+    NPY_BEGIN_THREADS;
+    if (nval > 0) memcpy(rangeset->stack->data, ranges_data, nval * sizeof(int64_t));
+    rangeset->stack->size = i64ranges_sort_merge(rangeset->stack->data, nval);
+    chunkset_from_rangeset(set, rangeset, &status, err);
+    NPY_END_THREADS;
+    if (!status) goto fail_status;
+
+    Py_DECREF(ranges_arr);
+    i64rangeset_delete(rangeset);
+
+    return PixelSet_from_chunkset(type, set);
+
+fail_status:
+    PyErr_SetString(PyExc_RuntimeError, err);
+fail:
+    Py_XDECREF(ranges_arr);
+    i64rangeset_delete(rangeset);
+    chunkset_delete(set);
+
+    return NULL;
+}
+
+typedef void (*chunkset_binary_op)(chunkset *a, chunkset *b, chunkset *out, int *status,
+                                   char *err);
+
+static PyObject *PixelSet_binary(PyObject *a, PyObject *b, chunkset_binary_op op) {
+    chunkset *out = NULL;
+    char err[ERR_SIZE];
+    int status = 1;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyObject_TypeCheck(a, &PixelSetType) || !PyObject_TypeCheck(b, &PixelSetType)) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+
+    out = chunkset_new(&status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    NPY_BEGIN_THREADS;
+    op(((PixelSetObject *)a)->chunkset, ((PixelSetObject *)b)->chunkset, out, &status, err);
+    NPY_END_THREADS;
+    if (!status) {
+        chunkset_delete(out);
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    return PixelSet_from_chunkset(&PixelSetType, out);
+}
+
+static PyObject *PixelSet_binary_method(PyObject *self, PyObject *other,
+                                        chunkset_binary_op op) {
+    if (!PyObject_TypeCheck(other, &PixelSetType)) {
+        PyErr_SetString(PyExc_TypeError, "other must be a PixelSet.");
+        return NULL;
+    }
+    return PixelSet_binary(self, other, op);
+}
+
+PyDoc_STRVAR(PixelSet_union_doc,
+             "union(other)\n"
+             "--\n\n"
+             "Return the union of this set and other.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "other : `PixelSet`\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "pixel_set : `PixelSet`\n");
+
+static PyObject *PixelSet_union(PyObject *self, PyObject *other) {
+    return PixelSet_binary_method(self, other, chunkset_union);
+}
+
+PyDoc_STRVAR(PixelSet_intersection_doc,
+             "intersection(other)\n"
+             "--\n\n"
+             "Return the intersection of this set and other.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "other : `PixelSet`\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "pixel_set : `PixelSet`\n");
+
+static PyObject *PixelSet_intersection(PyObject *self, PyObject *other) {
+    return PixelSet_binary_method(self, other, chunkset_intersection);
+}
+
+PyDoc_STRVAR(PixelSet_contains_doc,
+             "contains(pixels)\n"
+             "--\n\n"
+             "Check if pixels are in this set.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "pixels : `int` or `np.ndarray` (N,)\n"
+             "    Pixel numbers.\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "contained : `bool` or `np.ndarray` (N,)\n"
+             "    True for each pixel which is in the set.\n");
+
+static PyObject *PixelSet_contains(PixelSetObject *self, PyObject *pix_obj) {
+    PyObject *pix_arr = NULL;
+    PyObject *contained_arr = NULL;
+    NpyIter *iter = NULL;
+    NpyIter_IterNextFunc *iternext;
+    char **dataptr;
+    NPY_BEGIN_THREADS_DEF;
+
+    pix_arr = PyArray_FROM_OTF(pix_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    if (pix_arr == NULL) goto fail;
+
+    PyArrayObject *op[2];
+    npy_uint32 op_flags[2];
+    PyArray_Descr *op_dtypes[2];
+
+    op[0] = (PyArrayObject *)pix_arr;
+    op_flags[0] = NPY_ITER_READONLY;
+    op_dtypes[0] = NULL;
+    op[1] = NULL;
+    op_flags[1] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
+    op_dtypes[1] = PyArray_DescrFromType(NPY_BOOL);
+
+    iter = NpyIter_MultiNew(2, op, NPY_ITER_ZEROSIZE_OK, NPY_KEEPORDER, NPY_NO_CASTING,
+                            op_flags, op_dtypes);
+    if (iter == NULL) goto fail;
+
+    if (NpyIter_GetIterSize(iter) > 0) {
+        iternext = NpyIter_GetIterNext(iter, NULL);
+        if (iternext == NULL) goto fail;
+        dataptr = NpyIter_GetDataPtrArray(iter);
+
+        NPY_BEGIN_THREADS;
+        do {
+            int64_t pix = *(int64_t *)dataptr[0];
+            *(npy_bool *)dataptr[1] = (npy_bool)chunkset_contains(self->chunkset, pix);
+        } while (iternext(iter));
+        NPY_END_THREADS;
+    }
+
+    contained_arr = (PyObject *)NpyIter_GetOperandArray(iter)[1];
+    Py_INCREF(contained_arr);
+
+    if (NpyIter_Deallocate(iter) != NPY_SUCCEED) {
+        iter = NULL;
+        goto fail;
+    }
+    Py_DECREF(pix_arr);
+
+    return PyArray_Return((PyArrayObject *)contained_arr);
+
+fail:
+    Py_XDECREF(pix_arr);
+    Py_XDECREF(contained_arr);
+    if (iter != NULL) {
+        NpyIter_Deallocate(iter);
+    }
+
+    return NULL;
+}
+
+PyDoc_STRVAR(PixelSet_to_pixels_doc,
+             "to_pixels()\n"
+             "--\n\n"
+             "Expand the set to an array of pixels.\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "pixels : `np.ndarray` (N,)\n"
+             "    Sorted array of pixels (`np.int64`).\n");
+
+static PyObject *PixelSet_to_pixels(PixelSetObject *self, PyObject *Py_UNUSED(ignored)) {
+    NPY_BEGIN_THREADS_DEF;
+    npy_intp dims[1];
+    dims[0] = (npy_intp)chunkset_npix(self->chunkset);
+
+    PyObject *pix_arr = PyArray_SimpleNew(1, dims, NPY_INT64);
+    if (pix_arr == NULL) return NULL;
+
+    NPY_BEGIN_THREADS;
+    chunkset_fill_buffer(self->chunkset, (int64_t *)PyArray_DATA((PyArrayObject *)pix_arr));
+    NPY_END_THREADS;
+
+    return pix_arr;
+}
+
+PyDoc_STRVAR(PixelSet_to_rangeset_doc,
+             "to_rangeset()\n"
+             "--\n\n"
+             "Convert the set to sorted pixel ranges.\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "range_set : `RangeSet`\n");
+
+static PyObject *PixelSet_to_rangeset(PixelSetObject *self, PyObject *Py_UNUSED(ignored)) {
+    char err[ERR_SIZE];
+    int status = 1;
+    NPY_BEGIN_THREADS_DEF;
+
+    i64rangeset *rangeset = i64rangeset_new(&status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    NPY_BEGIN_THREADS;
+    chunkset_to_rangeset(self->chunkset, rangeset, &status, err);
+    NPY_END_THREADS;
+    if (!status) {
+        i64rangeset_delete(rangeset);
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    return RangeSet_from_i64rangeset(rangeset);
+}
+
+static PyObject *PixelSet_get_npix(PixelSetObject *self, void *closure) {
+    return PyLong_FromSize_t(chunkset_npix(self->chunkset));
+}
+
+static PyObject *PixelSet_get_n_chunks(PixelSetObject *self, void *closure) {
+    return PyLong_FromSize_t(self->chunkset->size);
+}
+
+static PyObject *PixelSet_get_nbytes(PixelSetObject *self, void *closure) {
+    return PyLong_FromSize_t(chunkset_nbytes(self->chunkset));
+}
+
+static int PixelSet_sq_contains(PixelSetObject *self, PyObject *value) {
+    long long pix = PyLong_AsLongLong(value);
+    if ((pix == -1) && PyErr_Occurred()) return -1;
+
+    return (int)chunkset_contains(self->chunkset, (int64_t)pix);
+}
+
+static PyObject *PixelSet_richcompare(PyObject *a, PyObject *b, int op) {
+    if (!PyObject_TypeCheck(a, &PixelSetType) || !PyObject_TypeCheck(b, &PixelSetType) ||
+        ((op != Py_EQ) && (op != Py_NE))) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+
+    bool equal =
+        chunkset_equal(((PixelSetObject *)a)->chunkset, ((PixelSetObject *)b)->chunkset);
+
+    if (equal == (op == Py_EQ)) Py_RETURN_TRUE;
+    Py_RETURN_FALSE;
+}
+
+static PyObject *PixelSet_repr(PixelSetObject *self) {
+    return PyUnicode_FromFormat("PixelSet(n_chunks=%zu, npix=%zu)", self->chunkset->size,
+                                chunkset_npix(self->chunkset));
+}
+
+static PyObject *PixelSet_nb_or(PyObject *a, PyObject *b) {
+    return PixelSet_binary(a, b, chunkset_union);
+}
+
+static PyObject *PixelSet_nb_and(PyObject *a, PyObject *b) {
+    return PixelSet_binary(a, b, chunkset_intersection);
+}
+
+static int PixelSet_nb_bool(PixelSetObject *self) { return self->chunkset->size > 0; }
+
+static PyMethodDef PixelSet_methods[] = {
+    {"from_pixel_ranges", (PyCFunction)PixelSet_from_pixel_ranges, METH_O | METH_CLASS,
+     PixelSet_from_pixel_ranges_doc},
+    {"union", (PyCFunction)PixelSet_union, METH_O, PixelSet_union_doc},
+    {"intersection", (PyCFunction)PixelSet_intersection, METH_O, PixelSet_intersection_doc},
+    {"contains", (PyCFunction)PixelSet_contains, METH_O, PixelSet_contains_doc},
+    {"to_pixels", (PyCFunction)PixelSet_to_pixels, METH_NOARGS, PixelSet_to_pixels_doc},
+    {"to_rangeset", (PyCFunction)PixelSet_to_rangeset, METH_NOARGS, PixelSet_to_rangeset_doc},
+    {NULL, NULL, 0, NULL}};
+
+static PyGetSetDef PixelSet_getset[] = {
+    {"npix", (getter)PixelSet_get_npix, NULL, "Number of pixels in the set.", NULL},
+    {"n_chunks", (getter)PixelSet_get_n_chunks, NULL,
+     "Number of non-empty chunks of 2**16 pixels.", NULL},
+    {"nbytes", (getter)PixelSet_get_nbytes, NULL, "Memory used by the set, in bytes.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}};
+
+static PyNumberMethods PixelSet_as_number = {
+    .nb_bool = (inquiry)PixelSet_nb_bool,
+    .nb_and = PixelSet_nb_and,
+    .nb_or = PixelSet_nb_or,
+};
+
+static PySequenceMethods PixelSet_as_sequence = {
+    .sq_contains = (objobjproc)PixelSet_sq_contains,
+};
+
+PyDoc_STRVAR(PixelSet_doc,
+             "PixelSet(pixels=None)\n"
+             "--\n\n"
+             "An immutable set of pixels, stored in chunks of 2**16 pixels.\n"
+             "\n"
+             "Each chunk is held in whichever is smallest of a list of runs, a sorted\n"
+             "array of pixels, or a bitmap, so that both contiguous regions and\n"
+             "scattered or speckled masks are stored compactly.  Union and\n"
+             "intersection work chunk by chunk on the containers, and are available\n"
+             "as methods or with the | and & operators.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "pixels : `np.ndarray` (N,), optional\n"
+             "    Pixels in the set, in any order.  These may be repeated.\n");
+
+PyTypeObject PixelSetType = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name = "hpgeom._hpgeom.PixelSet",
+    .tp_basicsize = sizeof(PixelSetObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor)PixelSet_dealloc,
+    .tp_repr = (reprfunc)PixelSet_repr,
+    .tp_as_number = &PixelSet_as_number,
+    .tp_as_sequence = &PixelSet_as_sequence,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = PixelSet_doc,
+    .tp_richcompare = PixelSet_richcompare,
+    .tp_methods = PixelSet_methods,
+    .tp_getset = PixelSet_getset,
+    .tp_new = PixelSet_new,
+};
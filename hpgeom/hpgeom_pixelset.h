@@ -0,0 +1,38 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+
+#ifndef _HPGEOM_PIXELSET_H
+#define _HPGEOM_PIXELSET_H
+
+#include <Python.h>
+
+#include "hpgeom_chunkset.h"
+
+// An immutable set of pixels held in adaptive run, array or bitmap chunks.
+typedef struct {
+    PyObject_HEAD chunkset *chunkset;
+} PixelSetObject;
+
+extern PyTypeObject PixelSetType;
+
+#endif
@@ -0,0 +1,437 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+
+#include <Python.h>
+
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#define PY_ARRAY_UNIQUE_SYMBOL HPGEOM_ARRAY_API
+#define NO_IMPORT_ARRAY
+
+#include <numpy/arrayobject.h>
+#include <stdio.h>
+
+#include "healpix_geom.h"
+#include "hpgeom_query_context.h"
+#include "hpgeom_stack.h"
+#include "hpgeom_utils.h"
+
+static void QueryContext_dealloc(QueryContextObject *self) {
+    if (self->nest_ws != self->ws) query_workspace_delete(self->nest_ws);
+    query_workspace_delete(self->ws);
+    i64rangeset_delete(self->pixset);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *QueryContext_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    int64_t nside;
+    int nest = 1;
+    int inclusive = 0;
+    long fact = 4;
+    static char *kwlist[] = {"nside", "nest", "inclusive", "fact", NULL};
+    QueryContextObject *self = NULL;
+    char err[ERR_SIZE];
+    int status = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "L|ppl", kwlist, &nside, &nest, &inclusive,
+                                     &fact))
+        goto fail;
+
+    enum Scheme scheme = nest ? NEST : RING;
+    if (!hpgeom_check_nside(nside, scheme, err)) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
+    }
+    healpix_info hpx = healpix_info_from_nside(nside, scheme);
+
+    if (!inclusive) {
+        fact = 0;
+    } else if (!hpgeom_check_fact(&hpx, fact, err)) {
+        PyErr_SetString(PyExc_ValueError, err);
+        goto fail;
+    }
+
+    self = (QueryContextObject *)type->tp_alloc(type, 0);
+    if (self == NULL) goto fail;
+    self->hpx = hpx;
+    self->nest = nest;
+    self->inclusive = inclusive;
+    self->fact = fact;
+
+    self->ws = query_workspace_new(&status, err);
+    if (!status) goto fail_runtime;
+    if (nest) {
+        self->nest_ws = self->ws;
+    } else {
+        self->nest_ws = query_workspace_new(&status, err);
+        if (!status) goto fail_runtime;
+    }
+    self->pixset = i64rangeset_new(&status, err);
+    if (!status) goto fail_runtime;
+
+    return (PyObject *)self;
+
+fail_runtime:
+    PyErr_SetString(PyExc_RuntimeError, err);
+fail:
+    Py_XDECREF(self);
+
+    return NULL;
+}
+
+// Claim the context for a query, which must be released with
+// QueryContext_finish.  Returns 0 with an exception set if it is in use.
+static int QueryContext_claim(QueryContextObject *self) {
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "QueryContext is already running a query in another thread.");
+        return 0;
+    }
+    self->busy = 1;
+    return 1;
+}
+
+// Release the context and return the result of the last query.
+static PyObject *QueryContext_finish(QueryContextObject *self, int status, const char *err,
+                                     int return_pixel_ranges) {
+    self->busy = 0;
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    PyObject *return_arr =
+        create_query_return_arr(self->pixset, return_pixel_ranges, NPY_INT64);
+    if (return_arr == NULL) return NULL;
+
+    return PyArray_Return((PyArrayObject *)return_arr);
+}
+
+// The nest healpix_info and inclusive factor for an ellipse or box query.
+// Returns 0 with an exception set if these are not valid for the context.
+static int QueryContext_nest_hpx(QueryContextObject *self, healpix_info *hpx) {
+    char err[ERR_SIZE];
+
+    if (self->nest) {
+        *hpx = self->hpx;
+        return 1;
+    }
+    if (!hpgeom_check_nside(self->hpx.nside, NEST, err)) {
+        PyErr_SetString(PyExc_ValueError, err);
+        return 0;
+    }
+    *hpx = healpix_info_from_nside(self->hpx.nside, NEST);
+    if (self->inclusive && !hpgeom_check_fact(hpx, self->fact, err)) {
+        PyErr_SetString(PyExc_ValueError, err);
+        return 0;
+    }
+    return 1;
+}
+
+PyDoc_STRVAR(QueryContext_query_circle_doc,
+             "query_circle(a, b, radius, lonlat=True, degrees=True, "
+             "return_pixel_ranges=False)\n"
+             "--\n\n"
+             "Returns pixels within (or overlapping, if inclusive) the circle\n"
+             "defined by a, b and radius, as with hpgeom.query_circle.\n");
+
+static PyObject *QueryContext_query_circle(QueryContextObject *self, PyObject *args,
+                                           PyObject *kwargs) {
+    double a, b, radius;
+    int lonlat = 1;
+    int degrees = 1;
+    int return_pixel_ranges = 0;
+    static char *kwlist[] = {"a", "b", "radius", "lonlat", "degrees",
+                             "return_pixel_ranges", NULL};
+    char err[ERR_SIZE];
+    int status = 1;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ddd|ppp", kwlist, &a, &b, &radius, &lonlat,
+                                     &degrees, &return_pixel_ranges))
+        return NULL;
+
+    double theta, phi;
+    if (lonlat) {
+        if (!hpgeom_lonlat_to_thetaphi(a, b, &theta, &phi, (bool)degrees, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            return NULL;
+        }
+        if (degrees) {
+            radius *= HPG_D2R;
+        }
+    } else {
+        if (!hpgeom_check_theta_phi(a, b, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            return NULL;
+        }
+        theta = a;
+        phi = b;
+    }
+    if (!hpgeom_check_radius(radius, err)) {
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    }
+
+    if (!QueryContext_claim(self)) return NULL;
+    NPY_BEGIN_THREADS;
+    query_disc_ws(&self->hpx, theta, phi, radius, (int)self->fact, 1, self->pixset, self->ws,
+                  &status, err);
+    NPY_END_THREADS;
+
+    return QueryContext_finish(self, status, err, return_pixel_ranges);
+}
+
+PyDoc_STRVAR(QueryContext_query_polygon_doc,
+             "query_polygon(a, b, lonlat=True, degrees=True, return_pixel_ranges=False)\n"
+             "--\n\n"
+             "Returns pixels within (or overlapping, if inclusive) the convex polygon\n"
+             "with vertices a, b, as with hpgeom.query_polygon.\n");
+
+static PyObject *QueryContext_query_polygon(QueryContextObject *self, PyObject *args,
+                                            PyObject *kwargs) {
+    PyObject *a_obj = NULL, *b_obj = NULL;
+    int lonlat = 1;
+    int degrees = 1;
+    int return_pixel_ranges = 0;
+    static char *kwlist[] = {"a", "b", "lonlat", "degrees", "return_pixel_ranges", NULL};
+    char err[ERR_SIZE];
+    int status = 1;
+    pointingarr *vertices = NULL;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|ppp", kwlist, &a_obj, &b_obj, &lonlat,
+                                     &degrees, &return_pixel_ranges))
+        return NULL;
+
+    vertices = hpgeom_polygon_vertices(a_obj, b_obj, lonlat, degrees);
+    if (vertices == NULL) return NULL;
+
+    if (!QueryContext_claim(self)) {
+        pointingarr_delete(vertices);
+        return NULL;
+    }
+    NPY_BEGIN_THREADS;
+    query_polygon_ws(&self->hpx, vertices, (int)self->fact, self->pixset, self->ws, &status,
+                     err);
+    NPY_END_THREADS;
+    pointingarr_delete(vertices);
+
+    return QueryContext_finish(self, status, err, return_pixel_ranges);
+}
+
+PyDoc_STRVAR(QueryContext_query_ellipse_doc,
+             "query_ellipse(a, b, semi_major, semi_minor, alpha, lonlat=True, degrees=True, "
+             "return_pixel_ranges=False)\n"
+             "--\n\n"
+             "Returns pixels within (or overlapping, if inclusive) the ellipse\n"
+             "defined by a, b, semi_major, semi_minor and alpha, as with\n"
+             "hpgeom.query_ellipse.  For ring ordering, nside must be a power of 2.\n");
+
+static PyObject *QueryContext_query_ellipse(QueryContextObject *self, PyObject *args,
+                                            PyObject *kwargs) {
+    double a, b, semi_major, semi_minor, alpha;
+    int lonlat = 1;
+    int degrees = 1;
+    int return_pixel_ranges = 0;
+    static char *kwlist[] = {"a",      "b",       "semi_major",          "semi_minor", "alpha",
+                             "lonlat", "degrees", "return_pixel_ranges", NULL};
+    char err[ERR_SIZE];
+    int status = 1;
+    healpix_info hpx;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ddddd|ppp", kwlist, &a, &b, &semi_major,
+                                     &semi_minor, &alpha, &lonlat, &degrees,
+                                     &return_pixel_ranges))
+        return NULL;
+
+    double theta, phi;
+    if (lonlat) {
+        if (!hpgeom_lonlat_to_thetaphi(a, b, &theta, &phi, (bool)degrees, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            return NULL;
+        }
+        if (degrees) {
+            semi_major *= HPG_D2R;
+            semi_minor *= HPG_D2R;
+            alpha *= HPG_D2R;
+        }
+    } else {
+        if (!hpgeom_check_theta_phi(a, b, err)) {
+            PyErr_SetString(PyExc_ValueError, err);
+            return NULL;
+        }
+        theta = a;
+        phi = b;
+    }
+    if (!hpgeom_check_semi(semi_major, semi_minor, err)) {
+        PyErr_SetString(PyExc_ValueError, err);
+        return NULL;
+    }
+    if (!QueryContext_nest_hpx(self, &hpx)) return NULL;
+
+    if (!QueryContext_claim(self)) return NULL;
+    NPY_BEGIN_THREADS;
+    query_ellipse_ws(&hpx, theta, phi, semi_major, semi_minor, alpha, (int)self->fact, 1,
+                     self->pixset, self->nest_ws, &status, err);
+    if (status && !self->nest) nest_ranges_to_ring(&hpx, self->pixset, &status, err);
+    NPY_END_THREADS;
+
+    return QueryContext_finish(self, status, err, return_pixel_ranges);
+}
+
+PyDoc_STRVAR(QueryContext_query_box_doc,
+             "query_box(a0, a1, b0, b1, lonlat=True, degrees=True, "
+             "return_pixel_ranges=False)\n"
+             "--\n\n"
+             "Returns pixels within (or overlapping, if inclusive) the box defined\n"
+             "by [a0, a1] and [b0, b1], as with hpgeom.query_box.  For ring\n"
+             "ordering, nside must be a power of 2.\n");
+
+static PyObject *QueryContext_query_box(QueryContextObject *self, PyObject *args,
+                                        PyObject *kwargs) {
+    double a0, a1, b0, b1;
+    int lonlat = 1;
+    int degrees = 1;
+    int return_pixel_ranges = 0;
+    static char *kwlist[] = {"a0",     "a1",      "b0", "b1", "lonlat", "degrees",
+                             "return_pixel_ranges", NULL};
+    char err[ERR_SIZE];
+    int status = 1;
+    healpix_info hpx;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "dddd|ppp", kwlist, &a0, &a1, &b0, &b1,
+                                     &lonlat, &degrees, &return_pixel_ranges))
+        return NULL;
+
+    double theta0, theta1, phi0, phi1;
+    bool full_lon;
+    if (!hpgeom_box_angles(a0, a1, b0, b1, lonlat, degrees, &theta0, &theta1, &phi0, &phi1,
+                           &full_lon))
+        return NULL;
+    if (!QueryContext_nest_hpx(self, &hpx)) return NULL;
+
+    if (!QueryContext_claim(self)) return NULL;
+    NPY_BEGIN_THREADS;
+    query_box_ws(&hpx, theta0, theta1, phi0, phi1, full_lon, (int)self->fact, 1,
+                 self->pixset, self->nest_ws, &status, err);
+    if (status && !self->nest) nest_ranges_to_ring(&hpx, self->pixset, &status, err);
+    NPY_END_THREADS;
+
+    return QueryContext_finish(self, status, err, return_pixel_ranges);
+}
+
+static PyObject *QueryContext_get_nside(QueryContextObject *self, void *closure) {
+    return PyLong_FromLongLong(self->hpx.nside);
+}
+
+static PyObject *QueryContext_get_nest(QueryContextObject *self, void *closure) {
+    return PyBool_FromLong(self->nest);
+}
+
+static PyObject *QueryContext_get_inclusive(QueryContextObject *self, void *closure) {
+    return PyBool_FromLong(self->inclusive);
+}
+
+static PyObject *QueryContext_get_fact(QueryContextObject *self, void *closure) {
+    return PyLong_FromLong(self->fact);
+}
+
+static PyObject *QueryContext_repr(QueryContextObject *self) {
+    return PyUnicode_FromFormat("QueryContext(nside=%lld, nest=%s, inclusive=%s, fact=%ld)",
+                                (long long)self->hpx.nside, self->nest ? "True" : "False",
+                                self->inclusive ? "True" : "False", self->fact);
+}
+
+static PyMethodDef QueryContext_methods[] = {
+    {"query_circle", (PyCFunction)(void (*)(void))QueryContext_query_circle,
+     METH_VARARGS | METH_KEYWORDS, QueryContext_query_circle_doc},
+    {"query_polygon", (PyCFunction)(void (*)(void))QueryContext_query_polygon,
+     METH_VARARGS | METH_KEYWORDS, QueryContext_query_polygon_doc},
+    {"query_ellipse", (PyCFunction)(void (*)(void))QueryContext_query_ellipse,
+     METH_VARARGS | METH_KEYWORDS, QueryContext_query_ellipse_doc},
+    {"query_box", (PyCFunction)(void (*)(void))QueryContext_query_box,
+     METH_VARARGS | METH_KEYWORDS, QueryContext_query_box_doc},
+    {NULL, NULL, 0, NULL}};
+
+static PyGetSetDef QueryContext_getset[] = {
+    {"nside", (getter)QueryContext_get_nside, NULL, "HEALPix nside of the queries.", NULL},
+    {"nest", (getter)QueryContext_get_nest, NULL, "True if pixels are in nest ordering.",
+     NULL},
+    {"inclusive", (getter)QueryContext_get_inclusive, NULL,
+     "True if the queries return all overlapping pixels.", NULL},
+    {"fact", (getter)QueryContext_get_fact, NULL,
+     "Inclusive oversampling factor, or 0 if not inclusive.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}};
+
+PyDoc_STRVAR(QueryContext_doc,
+             "QueryContext(nside, nest=True, inclusive=False, fact=4)\n"
+             "--\n\n"
+             "A context for running many queries with the same nside, ordering and\n"
+             "inclusive factor.\n"
+             "\n"
+             "The per-resolution tables used by the queries, and the buffers for\n"
+             "their results, are computed and allocated once and reused by every\n"
+             "query, which is faster than calling the module query functions for\n"
+             "many small queries.  The queries return the same pixels as the module\n"
+             "functions, as `np.int64` arrays.\n"
+             "\n"
+             "A context may be shared between threads, but only runs one query at a\n"
+             "time; create one context per thread to query in parallel.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "nside : `int`\n"
+             "    HEALPix nside.  Must be power of 2 for nest ordering.\n"
+             "nest : `bool`, optional\n"
+             "    Use nest ordering scheme?\n"
+             "inclusive : `bool`, optional\n"
+             "    If False, queries return the exact set of pixels whose pixel centers\n"
+             "    lie within the shape. If True, queries return all pixels that\n"
+             "    overlap with the shape.\n"
+             "fact : `int`, optional\n"
+             "    Only used when inclusive=True. The overlap test is performed at\n"
+             "    a resolution fact*nside. For nest ordering, and for ellipse and box\n"
+             "    queries, fact must be a power of 2, and nside*fact must always be\n"
+             "    <= 2**29.\n"
+             "\n"
+             "Raises\n"
+             "------\n"
+             "ValueError\n"
+             "    If nside or fact are not allowed.\n"
+             "RuntimeError\n"
+             "    If a query is started while another is running.\n");
+
+PyTypeObject QueryContextType = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name = "hpgeom._hpgeom.QueryContext",
+    .tp_basicsize = sizeof(QueryContextObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor)QueryContext_dealloc,
+    .tp_repr = (reprfunc)QueryContext_repr,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = QueryContext_doc,
+    .tp_methods = QueryContext_methods,
+    .tp_getset = QueryContext_getset,
+    .tp_new = QueryContext_new,
+};
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+
+#ifndef _HPGEOM_QUERY_CONTEXT_H
+#define _HPGEOM_QUERY_CONTEXT_H
+
+#include <Python.h>
+#include <stdbool.h>
+
+#include "healpix_geom.h"
+#include "hpgeom_stack.h"
+
+// A resolution and inclusive factor fixed for many queries, which keeps the
+// traversal tables and output buffers of the queries between calls.
+// nest_ws is used for ellipse and box queries, which run with nest ordering,
+// and is the same as ws when nest is set.  Only one query may run at a time.
+typedef struct {
+    PyObject_HEAD healpix_info hpx;
+    int nest;
+    int inclusive;
+    long fact;
+    query_workspace *ws;
+    query_workspace *nest_ws;
+    i64rangeset *pixset;
+    int busy;
+} QueryContextObject;
+
+extern PyTypeObject QueryContextType;
+
+// Helpers shared with the module query functions in hpgeom.c.
+PyObject *create_query_return_arr(i64rangeset *pixset, int return_pixel_ranges, int typenum);
+pointingarr *hpgeom_polygon_vertices(PyObject *a_obj, PyObject *b_obj, int lonlat,
+                                     int degrees);
+int hpgeom_box_angles(double a0, double a1, double b0, double b1, int lonlat, int degrees,
+                      double *theta0, double *theta1, double *phi0, double *phi1,
+                      bool *full_lon);
+
+#endif
@@ -0,0 +1,557 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+#include <Python.h>
+
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#define PY_ARRAY_UNIQUE_SYMBOL HPGEOM_ARRAY_API
+#define NO_IMPORT_ARRAY
+
+#include <numpy/arrayobject.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hpgeom_rangeset.h"
+#include "hpgeom_stack.h"
+#include "hpgeom_utils.h"
+
+// Pointer exported for the buffer of an empty set, which must not be NULL.
+static int64_t empty_buffer[2] = {0, 0};
+
+/*
+ * Wrap rangeset in a new RangeSet object, which takes ownership of it.  The
+ * ranges must already be sorted, with no overlapping or touching ranges.
+ * On failure the rangeset is deleted and NULL is returned.
+ */
+PyObject *RangeSet_from_i64rangeset(i64rangeset *rangeset) {
+    RangeSetObject *self = (RangeSetObject *)RangeSetType.tp_alloc(&RangeSetType, 0);
+    if (self == NULL) {
+        i64rangeset_delete(rangeset);
+        return NULL;
+    }
+    self->rangeset = rangeset;
+
+    return (PyObject *)self;
+}
+
+static void RangeSet_dealloc(RangeSetObject *self) {
+    i64rangeset_delete(self->rangeset);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *RangeSet_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    PyObject *ranges_obj = NULL;
+    PyObject *ranges_arr = NULL;
+    RangeSetObject *self = NULL;
+    static char *kwlist[] = {"pixel_ranges", NULL};
+    char err[ERR_SIZE];
+    int status = 1;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &ranges_obj)) goto fail;
+
+    self = (RangeSetObject *)type->tp_alloc(type, 0);
+    if (self == NULL) goto fail;
+    self->rangeset = i64rangeset_new(&status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        goto fail;
+    }
+
+    if ((ranges_obj == NULL) || (ranges_obj == Py_None)) return (PyObject *)self;
+
+    ranges_arr =
+        PyArray_FROM_OTF(ranges_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    if (ranges_arr == NULL) goto fail;
+
+    if (PyArray_SIZE((PyArrayObject *)ranges_arr) == 0) {
+        Py_DECREF(ranges_arr);
+        return (PyObject *)self;
+    }
+
+    if ((PyArray_NDIM((PyArrayObject *)ranges_arr) != 2) ||
+        (PyArray_DIM((PyArrayObject *)ranges_arr, 1) != 2)) {
+        PyErr_SetString(PyExc_ValueError, "pixel_ranges must be 2D, with shape (M, 2).");
+        goto fail;
+    }
+
+    size_t nval = (size_t)PyArray_SIZE((PyArrayObject *)ranges_arr);
+    int64_t *ranges_data = (int64_t *)PyArray_DATA((PyArrayObject *)ranges_arr);
+    i64stack *stack = self->rangeset->stack;
+
+    for (size_t i = 0; i < nval; i += 2) {
+        if (ranges_data[i + 1] < ranges_data[i]) {
+            PyErr_SetString(PyExc_ValueError,
+                            "pixel_ranges[:, 0] must all be <= pixel_ranges[:, 1]");
+            goto fail;
+        }
+    }
+
+    i64stack_resize(stack, nval, &status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        goto fail;
+    }
+
+    NPY_BEGIN_THREADS;
+    memcpy(stack->data, ranges_data, nval * sizeof(int64_t));
+    stack->size = i64ranges_sort_merge(stack->data, nval);
+    NPY_END_THREADS;
+
+    Py_DECREF(ranges_arr);
+
+    return (PyObject *)self;
+
+fail:
+    Py_XDECREF(ranges_arr);
+    Py_XDECREF(self);
+
+    return NULL;
+}
+
+typedef void (*rangeset_binary_op)(i64rangeset *a, i64rangeset *b, i64rangeset *out,
+                                   int *status, char *err);
+
+static PyObject *RangeSet_binary(PyObject *a, PyObject *b, rangeset_binary_op op) {
+    i64rangeset *out = NULL;
+    char err[ERR_SIZE];
+    int status = 1;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyObject_TypeCheck(a, &RangeSetType) || !PyObject_TypeCheck(b, &RangeSetType)) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+
+    out = i64rangeset_new(&status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    NPY_BEGIN_THREADS;
+    op(((RangeSetObject *)a)->rangeset, ((RangeSetObject *)b)->rangeset, out, &status, err);
+    NPY_END_THREADS;
+    if (!status) {
+        i64rangeset_delete(out);
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    return RangeSet_from_i64rangeset(out);
+}
+
+static PyObject *RangeSet_binary_method(PyObject *self, PyObject *other,
+                                        rangeset_binary_op op) {
+    if (!PyObject_TypeCheck(other, &RangeSetType)) {
+        PyErr_SetString(PyExc_TypeError, "other must be a RangeSet.");
+        return NULL;
+    }
+    return RangeSet_binary(self, other, op);
+}
+
+PyDoc_STRVAR(RangeSet_union_doc,
+             "union(other)\n"
+             "--\n\n"
+             "Return the union of this set and other.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "other : `RangeSet`\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "rangeset : `RangeSet`\n");
+
+static PyObject *RangeSet_union(PyObject *self, PyObject *other) {
+    return RangeSet_binary_method(self, other, i64rangeset_union);
+}
+
+PyDoc_STRVAR(RangeSet_intersection_doc,
+             "intersection(other)\n"
+             "--\n\n"
+             "Return the intersection of this set and other.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "other : `RangeSet`\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "rangeset : `RangeSet`\n");
+
+static PyObject *RangeSet_intersection(PyObject *self, PyObject *other) {
+    return RangeSet_binary_method(self, other, i64rangeset_intersection);
+}
+
+PyDoc_STRVAR(RangeSet_difference_doc,
+             "difference(other)\n"
+             "--\n\n"
+             "Return the pixels in this set which are not in other.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "other : `RangeSet`\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "rangeset : `RangeSet`\n");
+
+static PyObject *RangeSet_difference(PyObject *self, PyObject *other) {
+    return RangeSet_binary_method(self, other, i64rangeset_difference);
+}
+
+PyDoc_STRVAR(RangeSet_symmetric_difference_doc,
+             "symmetric_difference(other)\n"
+             "--\n\n"
+             "Return the pixels in either this set or other, but not both.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "other : `RangeSet`\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "rangeset : `RangeSet`\n");
+
+static PyObject *RangeSet_symmetric_difference(PyObject *self, PyObject *other) {
+    return RangeSet_binary_method(self, other, i64rangeset_symmetric_difference);
+}
+
+PyDoc_STRVAR(RangeSet_complement_doc,
+             "complement(npix)\n"
+             "--\n\n"
+             "Return the pixels in [0, npix) which are not in this set.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "npix : `int`\n"
+             "    Total number of pixels, such as from nside_to_npixel(nside).\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "rangeset : `RangeSet`\n");
+
+static PyObject *RangeSet_complement(RangeSetObject *self, PyObject *args, PyObject *kwargs) {
+    int64_t npix;
+    static char *kwlist[] = {"npix", NULL};
+    i64rangeset *out = NULL;
+    char err[ERR_SIZE];
+    int status = 1;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "L", kwlist, &npix)) return NULL;
+
+    if (npix < 0) {
+        PyErr_SetString(PyExc_ValueError, "npix must be >= 0.");
+        return NULL;
+    }
+
+    out = i64rangeset_new(&status, err);
+    if (!status) {
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    NPY_BEGIN_THREADS;
+    i64rangeset_complement(self->rangeset, 0, npix, out, &status, err);
+    NPY_END_THREADS;
+    if (!status) {
+        i64rangeset_delete(out);
+        PyErr_SetString(PyExc_RuntimeError, err);
+        return NULL;
+    }
+
+    return RangeSet_from_i64rangeset(out);
+}
+
+PyDoc_STRVAR(RangeSet_contains_doc,
+             "contains(pixels)\n"
+             "--\n\n"
+             "Check if pixels are in this set.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "pixels : `int` or `np.ndarray` (N,)\n"
+             "    Pixel numbers.\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "contained : `bool` or `np.ndarray` (N,)\n"
+             "    True for each pixel which is in the set.\n");
+
+static PyObject *RangeSet_contains(RangeSetObject *self, PyObject *pix_obj) {
+    PyObject *pix_arr = NULL;
+    PyObject *contained_arr = NULL;
+    NpyIter *iter = NULL;
+    NpyIter_IterNextFunc *iternext;
+    char **dataptr;
+    NPY_BEGIN_THREADS_DEF;
+
+    pix_arr = PyArray_FROM_OTF(pix_obj, NPY_INT64, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSUREARRAY);
+    if (pix_arr == NULL) goto fail;
+
+    PyArrayObject *op[2];
+    npy_uint32 op_flags[2];
+    PyArray_Descr *op_dtypes[2];
+
+    op[0] = (PyArrayObject *)pix_arr;
+    op_flags[0] = NPY_ITER_READONLY;
+    op_dtypes[0] = NULL;
+    op[1] = NULL;
+    op_flags[1] = NPY_ITER_WRITEONLY | NPY_ITER_ALLOCATE;
+    op_dtypes[1] = PyArray_DescrFromType(NPY_BOOL);
+
+    iter = NpyIter_MultiNew(2, op, NPY_ITER_ZEROSIZE_OK, NPY_KEEPORDER, NPY_NO_CASTING,
+                            op_flags, op_dtypes);
+    if (iter == NULL) goto fail;
+
+    if (NpyIter_GetIterSize(iter) > 0) {
+        iternext = NpyIter_GetIterNext(iter, NULL);
+        if (iternext == NULL) goto fail;
+        dataptr = NpyIter_GetDataPtrArray(iter);
+
+        NPY_BEGIN_THREADS;
+        do {
+            int64_t pix = *(int64_t *)dataptr[0];
+            *(npy_bool *)dataptr[1] = (npy_bool)i64rangeset_contains(self->rangeset, pix);
+        } while (iternext(iter));
+        NPY_END_THREADS;
+    }
+
+    contained_arr = (PyObject *)NpyIter_GetOperandArray(iter)[1];
+    Py_INCREF(contained_arr);
+
+    if (NpyIter_Deallocate(iter) != NPY_SUCCEED) {
+        iter = NULL;
+        goto fail;
+    }
+    Py_DECREF(pix_arr);
+
+    return PyArray_Return((PyArrayObject *)contained_arr);
+
+fail:
+    Py_XDECREF(pix_arr);
+    Py_XDECREF(contained_arr);
+    if (iter != NULL) {
+        NpyIter_Deallocate(iter);
+    }
+
+    return NULL;
+}
+
+PyDoc_STRVAR(RangeSet_to_pixels_doc,
+             "to_pixels()\n"
+             "--\n\n"
+             "Expand the set to an array of pixels.\n"
+             "\n"
+             "Returns\n"
+             "-------\n"
+             "pixels : `np.ndarray` (N,)\n"
+             "    Sorted array of pixels (`np.int64`).\n");
+
+static PyObject *RangeSet_to_pixels(RangeSetObject *self, PyObject *Py_UNUSED(ignored)) {
+    NPY_BEGIN_THREADS_DEF;
+    size_t npix = i64rangeset_npix(self->rangeset);
+    npy_intp dims[1];
+    dims[0] = (npy_intp)npix;
+
+    PyObject *pix_arr = PyArray_SimpleNew(1, dims, NPY_INT64);
+    if (pix_arr == NULL) return NULL;
+
+    NPY_BEGIN_THREADS;
+    i64rangeset_fill_buffer(self->rangeset, npix,
+                            (int64_t *)PyArray_DATA((PyArrayObject *)pix_arr));
+    NPY_END_THREADS;
+
+    return pix_arr;
+}
+
+static PyObject *RangeSet_get_ranges(RangeSetObject *self, void *closure) {
+    // A read-only view of the ranges, which keeps this set alive.
+    return PyArray_FromAny((PyObject *)self, NULL, 2, 2, 0, NULL);
+}
+
+static PyObject *RangeSet_get_n_ranges(RangeSetObject *self, void *closure) {
+    return PyLong_FromSize_t(self->rangeset->stack->size / 2);
+}
+
+static PyObject *RangeSet_get_npix(RangeSetObject *self, void *closure) {
+    return PyLong_FromSize_t(i64rangeset_npix(self->rangeset));
+}
+
+static int RangeSet_sq_contains(RangeSetObject *self, PyObject *value) {
+    long long pix = PyLong_AsLongLong(value);
+    if ((pix == -1) && PyErr_Occurred()) return -1;
+
+    return (int)i64rangeset_contains(self->rangeset, (int64_t)pix);
+}
+
+static PyObject *RangeSet_richcompare(PyObject *a, PyObject *b, int op) {
+    if (!PyObject_TypeCheck(a, &RangeSetType) || !PyObject_TypeCheck(b, &RangeSetType) ||
+        ((op != Py_EQ) && (op != Py_NE))) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+
+    // Both sets are normalized, so equal sets have identical ranges.
+    i64stack *sa = ((RangeSetObject *)a)->rangeset->stack;
+    i64stack *sb = ((RangeSetObject *)b)->rangeset->stack;
+    bool equal =
+        (sa->size == sb->size) &&
+        ((sa->size == 0) || (memcmp(sa->data, sb->data, sa->size * sizeof(int64_t)) == 0));
+
+    if (equal == (op == Py_EQ)) Py_RETURN_TRUE;
+    Py_RETURN_FALSE;
+}
+
+static PyObject *RangeSet_repr(RangeSetObject *self) {
+    return PyUnicode_FromFormat("RangeSet(n_ranges=%zu, npix=%zu)",
+                                self->rangeset->stack->size / 2,
+                                i64rangeset_npix(self->rangeset));
+}
+
+static int RangeSet_getbuffer(RangeSetObject *self, Py_buffer *view, int flags) {
+    // The set is immutable, so the buffer is always read-only.
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "RangeSet buffer is read-only.");
+        view->obj = NULL;
+        return -1;
+    }
+
+    i64stack *stack = self->rangeset->stack;
+    Py_ssize_t *shape_strides = (Py_ssize_t *)PyMem_Malloc(4 * sizeof(Py_ssize_t));
+    if (shape_strides == NULL) {
+        PyErr_NoMemory();
+        view->obj = NULL;
+        return -1;
+    }
+    shape_strides[0] = (Py_ssize_t)(stack->size / 2);
+    shape_strides[1] = 2;
+    shape_strides[2] = 2 * sizeof(int64_t);
+    shape_strides[3] = sizeof(int64_t);
+
+    view->buf = (stack->size > 0) ? (void *)stack->data : (void *)empty_buffer;
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->len = (Py_ssize_t)(stack->size * sizeof(int64_t));
+    view->readonly = 1;
+    view->itemsize = sizeof(int64_t);
+    view->format = (flags & PyBUF_FORMAT) ? "q" : NULL;
+    view->ndim = 2;
+    view->shape = (flags & PyBUF_ND) ? &shape_strides[0] : NULL;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? &shape_strides[2] : NULL;
+    view->suboffsets = NULL;
+    view->internal = shape_strides;
+
+    return 0;
+}
+
+static void RangeSet_releasebuffer(RangeSetObject *self, Py_buffer *view) {
+    PyMem_Free(view->internal);
+}
+
+static PyObject *RangeSet_nb_or(PyObject *a, PyObject *b) {
+    return RangeSet_binary(a, b, i64rangeset_union);
+}
+
+static PyObject *RangeSet_nb_and(PyObject *a, PyObject *b) {
+    return RangeSet_binary(a, b, i64rangeset_intersection);
+}
+
+static PyObject *RangeSet_nb_subtract(PyObject *a, PyObject *b) {
+    return RangeSet_binary(a, b, i64rangeset_difference);
+}
+
+static PyObject *RangeSet_nb_xor(PyObject *a, PyObject *b) {
+    return RangeSet_binary(a, b, i64rangeset_symmetric_difference);
+}
+
+static int RangeSet_nb_bool(RangeSetObject *self) { return self->rangeset->stack->size > 0; }
+
+static PyMethodDef RangeSet_methods[] = {
+    {"union", (PyCFunction)RangeSet_union, METH_O, RangeSet_union_doc},
+    {"intersection", (PyCFunction)RangeSet_intersection, METH_O, RangeSet_intersection_doc},
+    {"difference", (PyCFunction)RangeSet_difference, METH_O, RangeSet_difference_doc},
+    {"symmetric_difference", (PyCFunction)RangeSet_symmetric_difference, METH_O,
+     RangeSet_symmetric_difference_doc},
+    {"complement", (PyCFunction)(void (*)(void))RangeSet_complement,
+     METH_VARARGS | METH_KEYWORDS, RangeSet_complement_doc},
+    {"contains", (PyCFunction)RangeSet_contains, METH_O, RangeSet_contains_doc},
+    {"to_pixels", (PyCFunction)RangeSet_to_pixels, METH_NOARGS, RangeSet_to_pixels_doc},
+    {NULL, NULL, 0, NULL}};
+
+static PyGetSetDef RangeSet_getset[] = {
+    {"ranges", (getter)RangeSet_get_ranges, NULL,
+     "Read-only (M, 2) array view of the [lo, high) pixel ranges.", NULL},
+    {"n_ranges", (getter)RangeSet_get_n_ranges, NULL, "Number of pixel ranges.", NULL},
+    {"npix", (getter)RangeSet_get_npix, NULL, "Number of pixels in the set.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}};
+
+static PyNumberMethods RangeSet_as_number = {
+    .nb_bool = (inquiry)RangeSet_nb_bool,
+    .nb_and = RangeSet_nb_and,
+    .nb_or = RangeSet_nb_or,
+    .nb_xor = RangeSet_nb_xor,
+    .nb_subtract = RangeSet_nb_subtract,
+};
+
+static PySequenceMethods RangeSet_as_sequence = {
+    .sq_contains = (objobjproc)RangeSet_sq_contains,
+};
+
+static PyBufferProcs RangeSet_as_buffer = {
+    .bf_getbuffer = (getbufferproc)RangeSet_getbuffer,
+    .bf_releasebuffer = (releasebufferproc)RangeSet_releasebuffer,
+};
+
+PyDoc_STRVAR(RangeSet_doc,
+             "RangeSet(pixel_ranges=None)\n"
+             "--\n\n"
+             "An immutable set of pixels, stored as sorted [lo, high) pixel ranges.\n"
+             "\n"
+             "Set operations are computed directly on the ranges, without expanding\n"
+             "the pixels, and are available as methods or with the |, &, - and ^\n"
+             "operators.  The ranges are exported with the buffer protocol, such that\n"
+             "np.asarray(rangeset) is an (M, 2) view without a copy.\n"
+             "\n"
+             "Parameters\n"
+             "----------\n"
+             "pixel_ranges : `np.ndarray` (M, 2), optional\n"
+             "    Array of pixel ranges, [lo, high), such as returned by the query\n"
+             "    functions with return_pixel_ranges=True.  These may be in any\n"
+             "    order, and may overlap.\n");
+
+PyTypeObject RangeSetType = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name = "hpgeom._hpgeom.RangeSet",
+    .tp_basicsize = sizeof(RangeSetObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor)RangeSet_dealloc,
+    .tp_repr = (reprfunc)RangeSet_repr,
+    .tp_as_number = &RangeSet_as_number,
+    .tp_as_sequence = &RangeSet_as_sequence,
+    .tp_as_buffer = &RangeSet_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = RangeSet_doc,
+    .tp_richcompare = RangeSet_richcompare,
+    .tp_methods = RangeSet_methods,
+    .tp_getset = RangeSet_getset,
+    .tp_new = RangeSet_new,
+};
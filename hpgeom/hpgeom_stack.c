@@ -341,6 +341,176 @@ void i64rangeset_intersect(i64rangeset *rangeset, int64_t a, int64_t b, int *sta
     }
 }
 
+bool i64rangeset_contains(i64rangeset *rangeset, int64_t val) {
+    // val is contained if the last boundary <= val starts a range.
+    return (iiv(rangeset, val) & 1) == 0;
+}
+
+static size_t gallop_upper_bound(const int64_t *data, size_t size, size_t start, int64_t val) {
+    // Return the first index >= start with data[index] > val, where all of
+    // data[:start] are <= val.  The search takes steps of increasing size
+    // from start, so it is fast when the answer is close to start.
+    size_t low = start, high, step = 1;
+
+    if ((low >= size) || (data[low] > val)) return low;
+
+    while (true) {
+        high = low + step;
+        if (high >= size) {
+            high = size;
+            break;
+        }
+        if (data[high] > val) break;
+        low = high;
+        step *= 2;
+    }
+
+    // Now data[low] <= val, and high == size or data[high] > val.
+    low++;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (data[mid] <= val) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+void i64rangeset_contains_batch(i64rangeset *rangeset, const int64_t *vals, uint8_t *contained,
+                                size_t n) {
+    // For sorted vals, the search for each value gallops forward from the
+    // previous position, which is a linear merge in the worst case.
+    // Otherwise each value is a binary search.
+    const int64_t *data = rangeset->stack->data;
+    size_t size = rangeset->stack->size;
+    size_t i;
+
+    for (i = 1; i < n; i++) {
+        if (vals[i] < vals[i - 1]) break;
+    }
+
+    if (i >= n) {
+        size_t pos = 0;
+        for (i = 0; i < n; i++) {
+            pos = gallop_upper_bound(data, size, pos, vals[i]);
+            contained[i] = (uint8_t)(pos & 1);
+        }
+    } else {
+        for (i = 0; i < n; i++) {
+            contained[i] = (uint8_t)i64rangeset_contains(rangeset, vals[i]);
+        }
+    }
+}
+
+// Truth tables for i64rangeset_combine, indexed by (in_a << 1) | in_b.
+#define RANGESET_OP_UNION 0xE
+#define RANGESET_OP_INTERSECTION 0x8
+#define RANGESET_OP_DIFFERENCE 0x4
+#define RANGESET_OP_SYMMETRIC_DIFFERENCE 0x6
+
+static void i64rangeset_combine(i64rangeset *a, i64rangeset *b, int op, i64rangeset *out,
+                                int *status, char *err) {
+    // Linear sweep over the boundaries of a and b, which outputs a boundary
+    // whenever op(in_a, in_b) changes.  out must not be a or b.
+    const int64_t *da = a->stack->data;
+    const int64_t *db = b->stack->data;
+    size_t na = a->stack->size;
+    size_t nb = b->stack->size;
+    size_t ia = 0, ib = 0, nout = 0;
+    int state = 0;
+
+    *status = 1;
+    if (na + nb > out->stack->allocated_size) {
+        i64stack_realloc(out->stack, na + nb, status, err);
+        if (!*status) return;
+    }
+    int64_t *dout = out->stack->data;
+
+    while ((ia < na) || (ib < nb)) {
+        int64_t x;
+        if ((ib >= nb) || ((ia < na) && (da[ia] <= db[ib]))) {
+            x = da[ia];
+        } else {
+            x = db[ib];
+        }
+        if ((ia < na) && (da[ia] == x)) ia++;
+        if ((ib < nb) && (db[ib] == x)) ib++;
+
+        int new_state = (op >> (((ia & 1) << 1) | (ib & 1))) & 1;
+        if (new_state != state) {
+            dout[nout++] = x;
+            state = new_state;
+        }
+    }
+    out->stack->size = nout;
+}
+
+void i64rangeset_union(i64rangeset *a, i64rangeset *b, i64rangeset *out, int *status,
+                       char *err) {
+    i64rangeset_combine(a, b, RANGESET_OP_UNION, out, status, err);
+}
+
+void i64rangeset_intersection(i64rangeset *a, i64rangeset *b, i64rangeset *out, int *status,
+                              char *err) {
+    i64rangeset_combine(a, b, RANGESET_OP_INTERSECTION, out, status, err);
+}
+
+void i64rangeset_difference(i64rangeset *a, i64rangeset *b, i64rangeset *out, int *status,
+                            char *err) {
+    i64rangeset_combine(a, b, RANGESET_OP_DIFFERENCE, out, status, err);
+}
+
+void i64rangeset_symmetric_difference(i64rangeset *a, i64rangeset *b, i64rangeset *out,
+                                      int *status, char *err) {
+    i64rangeset_combine(a, b, RANGESET_OP_SYMMETRIC_DIFFERENCE, out, status, err);
+}
+
+void i64rangeset_complement(i64rangeset *a, int64_t v1, int64_t v2, i64rangeset *out,
+                            int *status, char *err) {
+    // The complement of a within [v1, v2).
+    int64_t bounds[2] = {v1, v2};
+    i64stack universe_stack = {0};
+    i64rangeset universe = {&universe_stack};
+
+    if (v2 > v1) {
+        universe_stack.size = 2;
+        universe_stack.allocated_size = 2;
+        universe_stack.data = bounds;
+    }
+    i64rangeset_combine(&universe, a, RANGESET_OP_DIFFERENCE, out, status, err);
+}
+
+static int compare_range_lo(const void *a, const void *b) {
+    int64_t ia = *(const int64_t *)a;
+    int64_t ib = *(const int64_t *)b;
+
+    return (ia > ib) - (ia < ib);
+}
+
+size_t i64ranges_sort_merge(int64_t *ranges, size_t nval) {
+    // Sort the nval / 2 [lo, high) ranges in place, dropping empty ranges and
+    // merging any that overlap or touch.  Returns the number of values in the
+    // merged ranges.
+    size_t nout = 0;
+
+    qsort(ranges, nval / 2, 2 * sizeof(int64_t), compare_range_lo);
+    for (size_t j = 0; j < nval; j += 2) {
+        if (ranges[j + 1] <= ranges[j]) continue;
+        if ((nout > 0) && (ranges[j] <= ranges[nout - 1])) {
+            if (ranges[j + 1] > ranges[nout - 1]) ranges[nout - 1] = ranges[j + 1];
+        } else {
+            ranges[nout] = ranges[j];
+            ranges[nout + 1] = ranges[j + 1];
+            nout += 2;
+        }
+    }
+
+    return nout;
+}
+
 void i64rangeset_clear(struct i64rangeset *rangeset, int *status, char *err) {
     i64stack_clear(rangeset->stack);
 }
@@ -383,6 +553,17 @@ void i64rangeset_fill_buffer(struct i64rangeset *rangeset, size_t npix, int64_t
     }
 }
 
+void i64rangeset_fill_buffer_int32(struct i64rangeset *rangeset, size_t npix, int32_t *buf) {
+    size_t counter = 0;
+
+    for (size_t j = 0; j < rangeset->stack->size; j += 2) {
+        for (int64_t pix = rangeset->stack->data[j]; pix < rangeset->stack->data[j + 1];
+             pix++) {
+            buf[counter++] = (int32_t)pix;
+        }
+    }
+}
+
 void vec3_crossprod(vec3 *v1, vec3 *v2, vec3 *prod) {
     prod->x = v1->y * v2->z - v1->z * v2->y;
     prod->y = v1->z * v2->x - v1->x * v2->z;
@@ -24,6 +24,8 @@
 #ifndef _HPGEOM_STACK
 #define _HPGEOM_STACK
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define STACK_PUSH_REALLOC_MULT 1
@@ -94,9 +96,24 @@ void i64rangeset_append_i64rangeset(i64rangeset *rangeset, i64rangeset *other, i
 i64rangeset *i64rangeset_delete(i64rangeset *rangeset);
 size_t i64rangeset_npix(i64rangeset *rangeset);
 void i64rangeset_fill_buffer(i64rangeset *rangeset, size_t npix, int64_t *buf);
+void i64rangeset_fill_buffer_int32(i64rangeset *rangeset, size_t npix, int32_t *buf);
 void i64rangeset_remove(i64rangeset *rangeset, int64_t v1, int64_t v2, int *status, char *err);
 void i64rangeset_intersect(i64rangeset *rangeset, int64_t v1, int64_t v2, int *status,
                            char *err);
+bool i64rangeset_contains(i64rangeset *rangeset, int64_t val);
+void i64rangeset_contains_batch(i64rangeset *rangeset, const int64_t *vals, uint8_t *contained,
+                                size_t n);
+void i64rangeset_union(i64rangeset *a, i64rangeset *b, i64rangeset *out, int *status,
+                       char *err);
+void i64rangeset_intersection(i64rangeset *a, i64rangeset *b, i64rangeset *out, int *status,
+                              char *err);
+void i64rangeset_difference(i64rangeset *a, i64rangeset *b, i64rangeset *out, int *status,
+                            char *err);
+void i64rangeset_symmetric_difference(i64rangeset *a, i64rangeset *b, i64rangeset *out,
+                                      int *status, char *err);
+void i64rangeset_complement(i64rangeset *a, int64_t v1, int64_t v2, i64rangeset *out,
+                            int *status, char *err);
+size_t i64ranges_sort_merge(int64_t *ranges, size_t nval);
 
 void vec3_crossprod(vec3 *v1, vec3 *v2, vec3 *prod);
 double vec3_dotprod(vec3 *v1, vec3 *v2);
@@ -0,0 +1,337 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "hpgeom_threads.h"
+
+static int hpgeom_default_threads = 1;
+
+typedef struct {
+    hpgeom_thread_func func;
+    void *arg;
+    int thread_id;
+} hpgeom_thread_task;
+
+#ifdef _WIN32
+typedef SRWLOCK hpgeom_mutex;
+typedef CONDITION_VARIABLE hpgeom_cond;
+typedef HANDLE hpgeom_thread;
+#define HPGEOM_MUTEX_INIT SRWLOCK_INIT
+#define HPGEOM_COND_INIT CONDITION_VARIABLE_INIT
+
+static void mutex_lock(hpgeom_mutex *m) { AcquireSRWLockExclusive(m); }
+static int mutex_trylock(hpgeom_mutex *m) { return TryAcquireSRWLockExclusive(m) != 0; }
+static void mutex_unlock(hpgeom_mutex *m) { ReleaseSRWLockExclusive(m); }
+static void cond_wait(hpgeom_cond *c, hpgeom_mutex *m) {
+    SleepConditionVariableSRW(c, m, INFINITE, 0);
+}
+static void cond_signal(hpgeom_cond *c) { WakeConditionVariable(c); }
+static void cond_broadcast(hpgeom_cond *c) { WakeAllConditionVariable(c); }
+#else
+typedef pthread_mutex_t hpgeom_mutex;
+typedef pthread_cond_t hpgeom_cond;
+typedef pthread_t hpgeom_thread;
+#define HPGEOM_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define HPGEOM_COND_INIT PTHREAD_COND_INITIALIZER
+
+static void mutex_lock(hpgeom_mutex *m) { pthread_mutex_lock(m); }
+static int mutex_trylock(hpgeom_mutex *m) { return pthread_mutex_trylock(m) == 0; }
+static void mutex_unlock(hpgeom_mutex *m) { pthread_mutex_unlock(m); }
+static void cond_wait(hpgeom_cond *c, hpgeom_mutex *m) { pthread_cond_wait(c, m); }
+static void cond_signal(hpgeom_cond *c) { pthread_cond_signal(c); }
+static void cond_broadcast(hpgeom_cond *c) { pthread_cond_broadcast(c); }
+#endif
+
+/*
+ * A persistent pool of worker threads, started on first use.  Each call to
+ * hpgeom_parallel_for() posts a job of n_tasks task ids, which are claimed
+ * one at a time by the waiting workers and by the calling thread.  Only one
+ * job runs on the pool at a time; the submit lock is held for the duration
+ * of a job, and concurrent or nested callers fall back to their own threads.
+ */
+typedef struct {
+    hpgeom_mutex submit;
+    hpgeom_mutex lock;
+    hpgeom_cond work;  // signalled when a job is posted or the pool stops
+    hpgeom_cond done;  // signalled when the last task of a job finishes
+    hpgeom_thread *workers;
+    int n_workers;
+    int stopping;
+    unsigned long generation;  // incremented for each job
+    hpgeom_thread_func func;
+    void *arg;
+    int n_tasks;
+    int next_task;
+    int n_done;
+} hpgeom_pool;
+
+static hpgeom_pool pool = {.submit = HPGEOM_MUTEX_INIT,
+                           .lock = HPGEOM_MUTEX_INIT,
+                           .work = HPGEOM_COND_INIT,
+                           .done = HPGEOM_COND_INIT};
+
+int hpgeom_get_num_cpus(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    return (ncpu < 1) ? 1 : (int)ncpu;
+#endif
+}
+
+int hpgeom_get_default_threads(void) { return hpgeom_default_threads; }
+
+static void hpgeom_pool_stop(void);
+
+void hpgeom_set_default_threads(int n_threads) {
+    hpgeom_default_threads = (n_threads < 1) ? 1 : n_threads;
+
+    // Drop a pool larger than needed; it is restarted at the new size on
+    // next use.
+    mutex_lock(&pool.submit);
+    if (pool.n_workers > hpgeom_default_threads - 1) hpgeom_pool_stop();
+    mutex_unlock(&pool.submit);
+}
+
+int hpgeom_resolve_threads(int n_threads, int64_t n_elements, int64_t min_chunk) {
+    if (n_threads <= 0) n_threads = hpgeom_default_threads;
+
+    int64_t max_threads = n_elements / min_chunk;
+    if (max_threads < 1) max_threads = 1;
+    if (n_threads > max_threads) n_threads = (int)max_threads;
+
+    return n_threads;
+}
+
+// Run tasks of the current job until none are left.  Called with the pool
+// lock held, which is released while each task runs.
+static void hpgeom_pool_run_tasks(void) {
+    while (pool.next_task < pool.n_tasks) {
+        int thread_id = pool.next_task++;
+        hpgeom_thread_func func = pool.func;
+        void *arg = pool.arg;
+
+        mutex_unlock(&pool.lock);
+        func(arg, thread_id);
+        mutex_lock(&pool.lock);
+
+        if (++pool.n_done == pool.n_tasks) cond_signal(&pool.done);
+    }
+}
+
+static void hpgeom_pool_worker(void) {
+    mutex_lock(&pool.lock);
+    unsigned long seen = pool.generation;
+    for (;;) {
+        while ((pool.generation == seen) && !pool.stopping) cond_wait(&pool.work, &pool.lock);
+        if (pool.stopping) break;
+        seen = pool.generation;
+        hpgeom_pool_run_tasks();
+    }
+    mutex_unlock(&pool.lock);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI hpgeom_pool_start(LPVOID arg) {
+    (void)arg;
+    hpgeom_pool_worker();
+    return 0;
+}
+
+static DWORD WINAPI hpgeom_thread_start(LPVOID arg) {
+    hpgeom_thread_task *task = (hpgeom_thread_task *)arg;
+    task->func(task->arg, task->thread_id);
+    return 0;
+}
+#else
+static void *hpgeom_pool_start(void *arg) {
+    (void)arg;
+    hpgeom_pool_worker();
+    return NULL;
+}
+
+static void *hpgeom_thread_start(void *arg) {
+    hpgeom_thread_task *task = (hpgeom_thread_task *)arg;
+    task->func(task->arg, task->thread_id);
+    return NULL;
+}
+
+// Threads do not survive a fork, so the child starts again with no pool.
+static void hpgeom_pool_atfork_child(void) {
+    pthread_mutex_init(&pool.submit, NULL);
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.work, NULL);
+    pthread_cond_init(&pool.done, NULL);
+    pool.n_workers = 0;
+    pool.stopping = 0;
+}
+
+static pthread_once_t hpgeom_pool_once = PTHREAD_ONCE_INIT;
+
+static void hpgeom_pool_register_atfork(void) {
+    pthread_atfork(NULL, NULL, hpgeom_pool_atfork_child);
+}
+#endif
+
+// Start workers until there are n_workers.  Called with the submit lock
+// held.  If a thread cannot be started the pool is left smaller, and the
+// calling thread picks up the remaining tasks.
+static void hpgeom_pool_grow(int n_workers) {
+    if (n_workers <= pool.n_workers) return;
+
+#ifndef _WIN32
+    pthread_once(&hpgeom_pool_once, hpgeom_pool_register_atfork);
+#endif
+
+    hpgeom_thread *workers = realloc(pool.workers, n_workers * sizeof(hpgeom_thread));
+    if (workers == NULL) return;
+    pool.workers = workers;
+
+    while (pool.n_workers < n_workers) {
+        hpgeom_thread *thread = &pool.workers[pool.n_workers];
+#ifdef _WIN32
+        *thread = CreateThread(NULL, 0, hpgeom_pool_start, NULL, 0, NULL);
+        if (*thread == NULL) return;
+#else
+        if (pthread_create(thread, NULL, hpgeom_pool_start, NULL) != 0) return;
+#endif
+        pool.n_workers++;
+    }
+}
+
+// Stop and join all workers.  Called with the submit lock held.
+static void hpgeom_pool_stop(void) {
+    if (pool.n_workers == 0) return;
+
+    mutex_lock(&pool.lock);
+    pool.stopping = 1;
+    cond_broadcast(&pool.work);
+    mutex_unlock(&pool.lock);
+
+    for (int i = 0; i < pool.n_workers; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(pool.workers[i], INFINITE);
+        CloseHandle(pool.workers[i]);
+#else
+        pthread_join(pool.workers[i], NULL);
+#endif
+    }
+
+    pool.n_workers = 0;
+    pool.stopping = 0;
+}
+
+// Run the tasks on newly started threads, for callers which cannot use the
+// pool because another job is running on it.
+static void hpgeom_parallel_for_spawn(int n_threads, hpgeom_thread_func func, void *arg) {
+    hpgeom_thread_task *tasks = malloc(n_threads * sizeof(hpgeom_thread_task));
+    hpgeom_thread *threads = malloc(n_threads * sizeof(hpgeom_thread));
+    int *started = calloc(n_threads, sizeof(int));
+
+    if (tasks == NULL || threads == NULL || started == NULL) {
+        free(tasks);
+        free(threads);
+        free(started);
+        for (int i = 0; i < n_threads; i++) func(arg, i);
+        return;
+    }
+
+    for (int i = 1; i < n_threads; i++) {
+        tasks[i].func = func;
+        tasks[i].arg = arg;
+        tasks[i].thread_id = i;
+#ifdef _WIN32
+        threads[i] = CreateThread(NULL, 0, hpgeom_thread_start, &tasks[i], 0, NULL);
+        started[i] = (threads[i] != NULL);
+#else
+        started[i] = (pthread_create(&threads[i], NULL, hpgeom_thread_start, &tasks[i]) == 0);
+#endif
+    }
+
+    func(arg, 0);
+
+    for (int i = 1; i < n_threads; i++) {
+        if (started[i]) {
+#ifdef _WIN32
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+#else
+            pthread_join(threads[i], NULL);
+#endif
+        } else {
+            func(arg, i);
+        }
+    }
+
+    free(tasks);
+    free(threads);
+    free(started);
+}
+
+/*
+ * Run func(arg, thread_id) for thread_id = 0..n_threads-1 and wait for all
+ * of them to finish.  The tasks are run on the persistent worker pool, which
+ * is grown to n_threads - 1 workers if needed, and on the calling thread,
+ * so this always completes all of the tasks even if no worker could be
+ * started.
+ *
+ * No Python objects may be touched in func; the caller should release the
+ * GIL before calling this.
+ */
+void hpgeom_parallel_for(int n_threads, hpgeom_thread_func func, void *arg) {
+    if (n_threads <= 1) {
+        func(arg, 0);
+        return;
+    }
+
+    if (!mutex_trylock(&pool.submit)) {
+        hpgeom_parallel_for_spawn(n_threads, func, arg);
+        return;
+    }
+
+    hpgeom_pool_grow(n_threads - 1);
+
+    mutex_lock(&pool.lock);
+    pool.func = func;
+    pool.arg = arg;
+    pool.n_tasks = n_threads;
+    pool.next_task = 0;
+    pool.n_done = 0;
+    pool.generation++;
+    cond_broadcast(&pool.work);
+
+    hpgeom_pool_run_tasks();
+    while (pool.n_done < pool.n_tasks) cond_wait(&pool.done, &pool.lock);
+    mutex_unlock(&pool.lock);
+
+    mutex_unlock(&pool.submit);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+#ifndef _HPGEOM_THREADS_H
+#define _HPGEOM_THREADS_H
+
+#include <stdint.h>
+
+// Minimum number of elements (or queries) handed to each worker thread.
+// Below this the cost of handing work to threads outweighs the work being split.
+#define HPGEOM_MIN_THREAD_CHUNK 65536
+#define HPGEOM_MIN_QUERY_CHUNK 16
+// Minimum estimated number of pixels tested by each thread of a single nest
+// query search, and the number of subtrees the search is split into for each
+// thread.
+#define HPGEOM_MIN_TRAVERSAL_CHUNK 16384
+#define HPGEOM_SUBTREES_PER_THREAD 8
+
+typedef void (*hpgeom_thread_func)(void *arg, int thread_id);
+
+int hpgeom_get_num_cpus(void);
+int hpgeom_get_default_threads(void);
+void hpgeom_set_default_threads(int n_threads);
+int hpgeom_resolve_threads(int n_threads, int64_t n_elements, int64_t min_chunk);
+void hpgeom_parallel_for(int n_threads, hpgeom_thread_func func, void *arg);
+
+#endif
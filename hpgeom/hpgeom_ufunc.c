@@ -0,0 +1,640 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+#include <Python.h>
+
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#define PY_ARRAY_UNIQUE_SYMBOL HPGEOM_ARRAY_API
+#define NO_IMPORT_ARRAY
+
+#include <fenv.h>
+#include <math.h>
+#include <numpy/arrayobject.h>
+#include <numpy/ufuncobject.h>
+#include <string.h>
+
+#include "healpix_geom.h"
+#include "hpgeom_stack.h"
+#include "hpgeom_ufunc.h"
+#include "hpgeom_utils.h"
+
+/*
+ * The ufunc inner loops cannot raise exceptions, so invalid inputs (bad
+ * nside, pixel or angle values) give -1 for pixels and NaN for angles and
+ * vectors, and set the floating point invalid flag.  Numpy then reports
+ * "invalid value encountered in <ufunc>" according to np.errstate, and
+ * np.errstate(invalid="raise") turns it into a FloatingPointError.
+ */
+
+// Number of elements converted at a time by the batch kernels.
+#define UFUNC_BLOCK_SIZE 512
+
+typedef struct {
+    hpx_cache cache;
+    healpix_info hpx;
+    int64_t nside;
+    enum Scheme scheme;
+    bool started;
+    bool valid;
+} ufunc_hpx_state;
+
+static void ufunc_hpx_init(ufunc_hpx_state *state) {
+    hpx_cache_init(&state->cache);
+    state->started = false;
+    state->valid = false;
+}
+
+static inline bool ufunc_hpx_stale(const ufunc_hpx_state *state, int64_t nside,
+                                   enum Scheme scheme) {
+    return (!state->started) || (nside != state->nside) || (scheme != state->scheme);
+}
+
+static void ufunc_hpx_set(ufunc_hpx_state *state, int64_t nside, enum Scheme scheme) {
+    char err[ERR_SIZE];
+
+    state->started = true;
+    state->nside = nside;
+    state->scheme = scheme;
+    state->valid = hpgeom_check_nside(nside, scheme, err);
+    if (state->valid) state->hpx = healpix_info_cached(&state->cache, nside, scheme);
+}
+
+// Point the state at this nside and scheme, returning false if the nside is
+// invalid.
+static inline bool ufunc_hpx_get(ufunc_hpx_state *state, int64_t nside, enum Scheme scheme) {
+    if (ufunc_hpx_stale(state, nside, scheme)) ufunc_hpx_set(state, nside, scheme);
+    return state->valid;
+}
+
+static inline bool ufunc_check_pixel(ufunc_hpx_state *state, int64_t pix) {
+    return (pix >= 0) && (pix < state->hpx.npix);
+}
+
+static bool ufunc_thetaphi(double a, double b, bool lonlat, bool degrees, double *theta,
+                           double *phi) {
+    char err[ERR_SIZE];
+
+    // The range checks do not catch a NaN longitude.
+    if (!isfinite(a) || !isfinite(b)) return false;
+    if (lonlat) return hpgeom_lonlat_to_thetaphi(a, b, theta, phi, degrees, err);
+    if (!hpgeom_check_theta_phi(a, b, err)) return false;
+    *theta = a;
+    *phi = b;
+    return true;
+}
+
+static void ufunc_set_output_angles(double theta, double phi, bool lonlat, bool degrees,
+                                    double *a, double *b) {
+    char err[ERR_SIZE];
+
+    if (lonlat) {
+        // We can skip error checking since theta/phi will always be
+        // within range on output.
+        hpgeom_thetaphi_to_lonlat(theta, phi, a, b, degrees, false, err);
+    } else {
+        *a = theta;
+        *b = phi;
+    }
+}
+
+static inline void ufunc_invalid(void) { feraiseexcept(FE_INVALID); }
+
+static inline enum Scheme ufunc_scheme(const char *nest_p) {
+    return *(npy_bool *)nest_p ? NEST : RING;
+}
+
+// angle_to_pixel(nside, a, b, nest, lonlat, degrees) -> pix
+static void angle_to_pixel_loop(char **args, npy_intp const *dimensions, npy_intp const *steps,
+                                void *NPY_UNUSED(data)) {
+    npy_intp n = dimensions[0];
+    char *nside_p = args[0], *a_p = args[1], *b_p = args[2];
+    char *nest_p = args[3], *lonlat_p = args[4], *degrees_p = args[5];
+    char *pix_p = args[6];
+    double theta[UFUNC_BLOCK_SIZE], phi[UFUNC_BLOCK_SIZE];
+    int64_t pixbuf[UFUNC_BLOCK_SIZE];
+    bool bad[UFUNC_BLOCK_SIZE];
+    bool any_bad = false;
+    ufunc_hpx_state state;
+
+    ufunc_hpx_init(&state);
+
+    // Angles are converted a block at a time, and each run of constant
+    // nside and scheme within the block is pixelized with ang2pix_batch.
+    // Invalid entries are pixelized at (0, 0) and overwritten afterwards.
+    for (npy_intp start = 0; start < n; start += UFUNC_BLOCK_SIZE) {
+        npy_intp nblock = (n - start < UFUNC_BLOCK_SIZE) ? (n - start) : UFUNC_BLOCK_SIZE;
+        npy_intp run_start = 0;
+
+        for (npy_intp i = 0; i < nblock; i++) {
+            int64_t nside = *(int64_t *)nside_p;
+            enum Scheme scheme = ufunc_scheme(nest_p);
+
+            if (ufunc_hpx_stale(&state, nside, scheme)) {
+                if (state.valid && (i > run_start)) {
+                    ang2pix_batch(&state.hpx, &theta[run_start], &phi[run_start],
+                                  &pixbuf[run_start], i - run_start);
+                }
+                run_start = i;
+                ufunc_hpx_set(&state, nside, scheme);
+            }
+            bad[i] = !state.valid ||
+                     !ufunc_thetaphi(*(double *)a_p, *(double *)b_p, *(npy_bool *)lonlat_p,
+                                     *(npy_bool *)degrees_p, &theta[i], &phi[i]);
+            if (bad[i]) {
+                theta[i] = 0.0;
+                phi[i] = 0.0;
+            }
+
+            nside_p += steps[0];
+            a_p += steps[1];
+            b_p += steps[2];
+            nest_p += steps[3];
+            lonlat_p += steps[4];
+            degrees_p += steps[5];
+        }
+        if (state.valid && (nblock > run_start)) {
+            ang2pix_batch(&state.hpx, &theta[run_start], &phi[run_start], &pixbuf[run_start],
+                          nblock - run_start);
+        }
+
+        for (npy_intp i = 0; i < nblock; i++) {
+            if (bad[i]) {
+                pixbuf[i] = -1;
+                any_bad = true;
+            }
+            *(int64_t *)pix_p = pixbuf[i];
+            pix_p += steps[6];
+        }
+    }
+
+    if (any_bad) ufunc_invalid();
+}
+
+// pixel_to_angle(nside, pix, nest, lonlat, degrees) -> a, b
+static void pixel_to_angle_loop(char **args, npy_intp const *dimensions, npy_intp const *steps,
+                                void *NPY_UNUSED(data)) {
+    npy_intp n = dimensions[0];
+    char *nside_p = args[0], *pix_p = args[1];
+    char *nest_p = args[2], *lonlat_p = args[3], *degrees_p = args[4];
+    char *a_p = args[5], *b_p = args[6];
+    double theta, phi;
+    bool any_bad = false;
+    ufunc_hpx_state state;
+
+    ufunc_hpx_init(&state);
+
+    for (npy_intp i = 0; i < n; i++) {
+        int64_t pix = *(int64_t *)pix_p;
+
+        if (ufunc_hpx_get(&state, *(int64_t *)nside_p, ufunc_scheme(nest_p)) &&
+            ufunc_check_pixel(&state, pix)) {
+            pix2ang(&state.hpx, pix, &theta, &phi);
+            ufunc_set_output_angles(theta, phi, *(npy_bool *)lonlat_p, *(npy_bool *)degrees_p,
+                                    (double *)a_p, (double *)b_p);
+        } else {
+            *(double *)a_p = NAN;
+            *(double *)b_p = NAN;
+            any_bad = true;
+        }
+
+        nside_p += steps[0];
+        pix_p += steps[1];
+        nest_p += steps[2];
+        lonlat_p += steps[3];
+        degrees_p += steps[4];
+        a_p += steps[5];
+        b_p += steps[6];
+    }
+
+    if (any_bad) ufunc_invalid();
+}
+
+// nest_to_ring(nside, pix) -> pix and ring_to_nest(nside, pix) -> pix.
+// The data pointer selects the direction.
+static void reorder_loop(char **args, npy_intp const *dimensions, npy_intp const *steps,
+                         void *data) {
+    bool to_ring = (data != NULL);
+    npy_intp n = dimensions[0];
+    char *nside_p = args[0], *in_p = args[1], *out_p = args[2];
+    int64_t inbuf[UFUNC_BLOCK_SIZE], outbuf[UFUNC_BLOCK_SIZE];
+    bool bad[UFUNC_BLOCK_SIZE];
+    bool any_bad = false;
+    ufunc_hpx_state state;
+
+    ufunc_hpx_init(&state);
+
+    for (npy_intp start = 0; start < n; start += UFUNC_BLOCK_SIZE) {
+        npy_intp nblock = (n - start < UFUNC_BLOCK_SIZE) ? (n - start) : UFUNC_BLOCK_SIZE;
+        npy_intp run_start = 0;
+
+        for (npy_intp i = 0; i < nblock; i++) {
+            int64_t nside = *(int64_t *)nside_p;
+
+            if (ufunc_hpx_stale(&state, nside, NEST)) {
+                if (state.valid && (i > run_start)) {
+                    if (to_ring) {
+                        nest2ring_batch(&state.hpx, &inbuf[run_start], &outbuf[run_start],
+                                        i - run_start);
+                    } else {
+                        ring2nest_batch(&state.hpx, &inbuf[run_start], &outbuf[run_start],
+                                        i - run_start);
+                    }
+                }
+                run_start = i;
+                ufunc_hpx_set(&state, nside, NEST);
+            }
+            inbuf[i] = *(int64_t *)in_p;
+            bad[i] = !state.valid || !ufunc_check_pixel(&state, inbuf[i]);
+            if (bad[i]) inbuf[i] = 0;
+
+            nside_p += steps[0];
+            in_p += steps[1];
+        }
+        if (state.valid && (nblock > run_start)) {
+            if (to_ring) {
+                nest2ring_batch(&state.hpx, &inbuf[run_start], &outbuf[run_start],
+                                nblock - run_start);
+            } else {
+                ring2nest_batch(&state.hpx, &inbuf[run_start], &outbuf[run_start],
+                                nblock - run_start);
+            }
+        }
+
+        for (npy_intp i = 0; i < nblock; i++) {
+            if (bad[i]) {
+                outbuf[i] = -1;
+                any_bad = true;
+            }
+            *(int64_t *)out_p = outbuf[i];
+            out_p += steps[2];
+        }
+    }
+
+    if (any_bad) ufunc_invalid();
+}
+
+// vector_to_pixel(nside, x, y, z, nest) -> pix
+static void vector_to_pixel_loop(char **args, npy_intp const *dimensions,
+                                 npy_intp const *steps, void *NPY_UNUSED(data)) {
+    npy_intp n = dimensions[0];
+    char *nside_p = args[0], *x_p = args[1], *y_p = args[2], *z_p = args[3];
+    char *nest_p = args[4], *pix_p = args[5];
+    vec3 vec;
+    bool any_bad = false;
+    ufunc_hpx_state state;
+    char err[ERR_SIZE];
+
+    ufunc_hpx_init(&state);
+
+    for (npy_intp i = 0; i < n; i++) {
+        vec.x = *(double *)x_p;
+        vec.y = *(double *)y_p;
+        vec.z = *(double *)z_p;
+
+        if (ufunc_hpx_get(&state, *(int64_t *)nside_p, ufunc_scheme(nest_p)) &&
+            hpgeom_check_vector(vec.x, vec.y, vec.z, err)) {
+            *(int64_t *)pix_p = vec2pix(&state.hpx, &vec);
+        } else {
+            *(int64_t *)pix_p = -1;
+            any_bad = true;
+        }
+
+        nside_p += steps[0];
+        x_p += steps[1];
+        y_p += steps[2];
+        z_p += steps[3];
+        nest_p += steps[4];
+        pix_p += steps[5];
+    }
+
+    if (any_bad) ufunc_invalid();
+}
+
+// pixel_to_vector(nside, pix, nest) -> x, y, z
+static void pixel_to_vector_loop(char **args, npy_intp const *dimensions,
+                                 npy_intp const *steps, void *NPY_UNUSED(data)) {
+    npy_intp n = dimensions[0];
+    char *nside_p = args[0], *pix_p = args[1], *nest_p = args[2];
+    char *x_p = args[3], *y_p = args[4], *z_p = args[5];
+    vec3 vec;
+    bool any_bad = false;
+    ufunc_hpx_state state;
+
+    ufunc_hpx_init(&state);
+
+    for (npy_intp i = 0; i < n; i++) {
+        int64_t pix = *(int64_t *)pix_p;
+
+        if (ufunc_hpx_get(&state, *(int64_t *)nside_p, ufunc_scheme(nest_p)) &&
+            ufunc_check_pixel(&state, pix)) {
+            vec = pix2vec(&state.hpx, pix);
+        } else {
+            vec.x = vec.y = vec.z = NAN;
+            any_bad = true;
+        }
+        *(double *)x_p = vec.x;
+        *(double *)y_p = vec.y;
+        *(double *)z_p = vec.z;
+
+        nside_p += steps[0];
+        pix_p += steps[1];
+        nest_p += steps[2];
+        x_p += steps[3];
+        y_p += steps[4];
+        z_p += steps[5];
+    }
+
+    if (any_bad) ufunc_invalid();
+}
+
+// neighbors(nside, pix, nest) -> neighbor_pixels, with signature (),(),()->(8)
+static void neighbors_loop(char **args, npy_intp const *dimensions, npy_intp const *steps,
+                           void *NPY_UNUSED(data)) {
+    npy_intp n = dimensions[0];
+    char *nside_p = args[0], *pix_p = args[1], *nest_p = args[2], *out_p = args[3];
+    npy_intp out_core_step = steps[4];
+    int64_t neighbor_buf[8];
+    i64stack neigh;
+    int status;
+    char err[ERR_SIZE];
+    bool any_bad = false;
+    ufunc_hpx_state state;
+
+    // neighbors() only fills an 8-element stack, so it can use a local buffer.
+    memset(&neigh, 0, sizeof(neigh));
+    neigh.size = 8;
+    neigh.allocated_size = 8;
+    neigh.data = neighbor_buf;
+
+    ufunc_hpx_init(&state);
+
+    for (npy_intp i = 0; i < n; i++) {
+        int64_t pix = *(int64_t *)pix_p;
+
+        status = 0;
+        if (ufunc_hpx_get(&state, *(int64_t *)nside_p, ufunc_scheme(nest_p)) &&
+            ufunc_check_pixel(&state, pix)) {
+            neighbors(&state.hpx, pix, &neigh, &status, err);
+        }
+        if (!status) {
+            for (int j = 0; j < 8; j++) neighbor_buf[j] = -1;
+            any_bad = true;
+        }
+        for (int j = 0; j < 8; j++) {
+            *(int64_t *)(out_p + j * out_core_step) = neighbor_buf[j];
+        }
+
+        nside_p += steps[0];
+        pix_p += steps[1];
+        nest_p += steps[2];
+        out_p += steps[3];
+    }
+
+    if (any_bad) ufunc_invalid();
+}
+
+// boundaries(nside, pix, nest, lonlat, degrees) -> a, b, with signature
+// (),(),(),(),()->(4),(4) for the pixel corners.
+static void boundaries_loop(char **args, npy_intp const *dimensions, npy_intp const *steps,
+                            void *NPY_UNUSED(data)) {
+    npy_intp n = dimensions[0];
+    char *nside_p = args[0], *pix_p = args[1];
+    char *nest_p = args[2], *lonlat_p = args[3], *degrees_p = args[4];
+    char *a_p = args[5], *b_p = args[6];
+    npy_intp a_core_step = steps[7], b_core_step = steps[8];
+    pointing corner_buf[4];
+    pointingarr corners;
+    int status;
+    bool any_bad = false;
+    ufunc_hpx_state state;
+
+    corners.size = 4;
+    corners.data = corner_buf;
+
+    ufunc_hpx_init(&state);
+
+    for (npy_intp i = 0; i < n; i++) {
+        int64_t pix = *(int64_t *)pix_p;
+
+        status = 0;
+        if (ufunc_hpx_get(&state, *(int64_t *)nside_p, ufunc_scheme(nest_p)) &&
+            ufunc_check_pixel(&state, pix)) {
+            boundaries(&state.hpx, pix, 1, &corners, &status);
+        }
+        for (int j = 0; j < 4; j++) {
+            double *a = (double *)(a_p + j * a_core_step);
+            double *b = (double *)(b_p + j * b_core_step);
+            if (status) {
+                ufunc_set_output_angles(corner_buf[j].theta, corner_buf[j].phi,
+                                        *(npy_bool *)lonlat_p, *(npy_bool *)degrees_p, a, b);
+            } else {
+                *a = NAN;
+                *b = NAN;
+            }
+        }
+        if (!status) any_bad = true;
+
+        nside_p += steps[0];
+        pix_p += steps[1];
+        nest_p += steps[2];
+        lonlat_p += steps[3];
+        degrees_p += steps[4];
+        a_p += steps[5];
+        b_p += steps[6];
+    }
+
+    if (any_bad) ufunc_invalid();
+}
+
+// get_interpolation_weights(nside, a, b, nest, lonlat, degrees) -> pixels,
+// weights, with signature (),(),(),(),(),()->(4),(4)
+static void interpolation_weights_loop(char **args, npy_intp const *dimensions,
+                                       npy_intp const *steps, void *NPY_UNUSED(data)) {
+    npy_intp n = dimensions[0];
+    char *nside_p = args[0], *a_p = args[1], *b_p = args[2];
+    char *nest_p = args[3], *lonlat_p = args[4], *degrees_p = args[5];
+    char *pix_p = args[6], *wgt_p = args[7];
+    npy_intp pix_core_step = steps[8], wgt_core_step = steps[9];
+    int64_t pixels[4];
+    double weights[4];
+    double theta, phi;
+    bool any_bad = false;
+    ufunc_hpx_state state;
+
+    ufunc_hpx_init(&state);
+
+    for (npy_intp i = 0; i < n; i++) {
+        if (ufunc_hpx_get(&state, *(int64_t *)nside_p, ufunc_scheme(nest_p)) &&
+            ufunc_thetaphi(*(double *)a_p, *(double *)b_p, *(npy_bool *)lonlat_p,
+                           *(npy_bool *)degrees_p, &theta, &phi)) {
+            get_interpol(&state.hpx, theta, phi, pixels, weights);
+        } else {
+            for (int j = 0; j < 4; j++) {
+                pixels[j] = -1;
+                weights[j] = NAN;
+            }
+            any_bad = true;
+        }
+        for (int j = 0; j < 4; j++) {
+            *(int64_t *)(pix_p + j * pix_core_step) = pixels[j];
+            *(double *)(wgt_p + j * wgt_core_step) = weights[j];
+        }
+
+        nside_p += steps[0];
+        a_p += steps[1];
+        b_p += steps[2];
+        nest_p += steps[3];
+        lonlat_p += steps[4];
+        degrees_p += steps[5];
+        pix_p += steps[6];
+        wgt_p += steps[7];
+    }
+
+    if (any_bad) ufunc_invalid();
+}
+
+// Each ufunc has a single loop; the tables must outlive the ufunc objects.
+static PyUFuncGenericFunction angle_to_pixel_funcs[1] = {&angle_to_pixel_loop};
+static char angle_to_pixel_types[7] = {NPY_INT64, NPY_DOUBLE, NPY_DOUBLE, NPY_BOOL,
+                                       NPY_BOOL,  NPY_BOOL,   NPY_INT64};
+static PyUFuncGenericFunction pixel_to_angle_funcs[1] = {&pixel_to_angle_loop};
+static char pixel_to_angle_types[7] = {NPY_INT64, NPY_INT64,  NPY_BOOL,  NPY_BOOL,
+                                       NPY_BOOL,  NPY_DOUBLE, NPY_DOUBLE};
+static PyUFuncGenericFunction reorder_funcs[1] = {&reorder_loop};
+static char reorder_types[3] = {NPY_INT64, NPY_INT64, NPY_INT64};
+static void *nest_to_ring_data[1] = {(void *)1};
+static void *ring_to_nest_data[1] = {NULL};
+static PyUFuncGenericFunction vector_to_pixel_funcs[1] = {&vector_to_pixel_loop};
+static char vector_to_pixel_types[6] = {NPY_INT64,  NPY_DOUBLE, NPY_DOUBLE,
+                                        NPY_DOUBLE, NPY_BOOL,   NPY_INT64};
+static PyUFuncGenericFunction pixel_to_vector_funcs[1] = {&pixel_to_vector_loop};
+static char pixel_to_vector_types[6] = {NPY_INT64,  NPY_INT64,  NPY_BOOL,
+                                        NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE};
+static PyUFuncGenericFunction neighbors_funcs[1] = {&neighbors_loop};
+static char neighbors_types[4] = {NPY_INT64, NPY_INT64, NPY_BOOL, NPY_INT64};
+static PyUFuncGenericFunction boundaries_funcs[1] = {&boundaries_loop};
+static char boundaries_types[7] = {NPY_INT64, NPY_INT64,  NPY_BOOL,  NPY_BOOL,
+                                   NPY_BOOL,  NPY_DOUBLE, NPY_DOUBLE};
+static PyUFuncGenericFunction interpolation_weights_funcs[1] = {&interpolation_weights_loop};
+static char interpolation_weights_types[8] = {NPY_INT64, NPY_DOUBLE, NPY_DOUBLE, NPY_BOOL,
+                                              NPY_BOOL,  NPY_BOOL,   NPY_INT64,  NPY_DOUBLE};
+
+PyDoc_STRVAR(angle_to_pixel_ufunc_doc,
+             "angle_to_pixel(nside, a, b, nest, lonlat, degrees)\n"
+             "\n"
+             "Convert angles to pixels.  Invalid inputs give pixel -1.");
+PyDoc_STRVAR(pixel_to_angle_ufunc_doc,
+             "pixel_to_angle(nside, pix, nest, lonlat, degrees)\n"
+             "\n"
+             "Convert pixels to angles.  Invalid inputs give NaN angles.");
+PyDoc_STRVAR(nest_to_ring_ufunc_doc,
+             "nest_to_ring(nside, pix)\n"
+             "\n"
+             "Convert pixel numbers from nest to ring ordering.  Invalid inputs give -1.");
+PyDoc_STRVAR(ring_to_nest_ufunc_doc,
+             "ring_to_nest(nside, pix)\n"
+             "\n"
+             "Convert pixel numbers from ring to nest ordering.  Invalid inputs give -1.");
+PyDoc_STRVAR(vector_to_pixel_ufunc_doc,
+             "vector_to_pixel(nside, x, y, z, nest)\n"
+             "\n"
+             "Convert vectors to pixels.  Invalid inputs give pixel -1.");
+PyDoc_STRVAR(pixel_to_vector_ufunc_doc,
+             "pixel_to_vector(nside, pix, nest)\n"
+             "\n"
+             "Convert pixels to vectors.  Invalid inputs give NaN vectors.");
+PyDoc_STRVAR(neighbors_ufunc_doc,
+             "neighbors(nside, pix, nest)\n"
+             "\n"
+             "Return the SW, W, NW, N, NE, E, SE, and S neighbors of pixels, with\n"
+             "-1 for neighbors that do not exist and for invalid inputs.");
+PyDoc_STRVAR(boundaries_ufunc_doc,
+             "boundaries(nside, pix, nest, lonlat, degrees)\n"
+             "\n"
+             "Return the angles of the 4 corners of pixels.  Invalid inputs give NaN\n"
+             "angles.");
+PyDoc_STRVAR(interpolation_weights_ufunc_doc,
+             "get_interpolation_weights(nside, a, b, nest, lonlat, degrees)\n"
+             "\n"
+             "Return the 4 closest pixels and weights for bilinear interpolation.\n"
+             "Invalid inputs give pixels -1 and NaN weights.");
+
+typedef struct {
+    const char *attr;
+    const char *name;
+    PyUFuncGenericFunction *funcs;
+    void **data;
+    char *types;
+    int nin;
+    int nout;
+    const char *signature;
+    const char *doc;
+} hpgeom_ufunc_def;
+
+int hpgeom_add_ufuncs(PyObject *module) {
+    static const hpgeom_ufunc_def defs[] = {
+        {"angle_to_pixel_ufunc", "angle_to_pixel", angle_to_pixel_funcs, NULL,
+         angle_to_pixel_types, 6, 1, NULL, angle_to_pixel_ufunc_doc},
+        {"pixel_to_angle_ufunc", "pixel_to_angle", pixel_to_angle_funcs, NULL,
+         pixel_to_angle_types, 5, 2, NULL, pixel_to_angle_ufunc_doc},
+        {"nest_to_ring_ufunc", "nest_to_ring", reorder_funcs, nest_to_ring_data, reorder_types,
+         2, 1, NULL, nest_to_ring_ufunc_doc},
+        {"ring_to_nest_ufunc", "ring_to_nest", reorder_funcs, ring_to_nest_data, reorder_types,
+         2, 1, NULL, ring_to_nest_ufunc_doc},
+        {"vector_to_pixel_ufunc", "vector_to_pixel", vector_to_pixel_funcs, NULL,
+         vector_to_pixel_types, 5, 1, NULL, vector_to_pixel_ufunc_doc},
+        {"pixel_to_vector_ufunc", "pixel_to_vector", pixel_to_vector_funcs, NULL,
+         pixel_to_vector_types, 3, 3, NULL, pixel_to_vector_ufunc_doc},
+        {"neighbors_ufunc", "neighbors", neighbors_funcs, NULL, neighbors_types, 3, 1,
+         "(),(),()->(8)", neighbors_ufunc_doc},
+        {"boundaries_ufunc", "boundaries", boundaries_funcs, NULL, boundaries_types, 5, 2,
+         "(),(),(),(),()->(4),(4)", boundaries_ufunc_doc},
+        {"get_interpolation_weights_ufunc", "get_interpolation_weights",
+         interpolation_weights_funcs, NULL, interpolation_weights_types, 6, 2,
+         "(),(),(),(),(),()->(4),(4)", interpolation_weights_ufunc_doc},
+    };
+    static void *null_data[1] = {NULL};
+    PyObject *ufunc;
+
+    if (_import_umath() < 0) return -1;
+
+    for (size_t i = 0; i < sizeof(defs) / sizeof(defs[0]); i++) {
+        void **data = (defs[i].data != NULL) ? defs[i].data : null_data;
+
+        if (defs[i].signature == NULL) {
+            ufunc = PyUFunc_FromFuncAndData(defs[i].funcs, data, defs[i].types, 1, defs[i].nin,
+                                            defs[i].nout, PyUFunc_None, defs[i].name,
+                                            defs[i].doc, 0);
+        } else {
+            ufunc = PyUFunc_FromFuncAndDataAndSignature(
+                defs[i].funcs, data, defs[i].types, 1, defs[i].nin, defs[i].nout, PyUFunc_None,
+                defs[i].name, defs[i].doc, 0, defs[i].signature);
+        }
+        if (ufunc == NULL) return -1;
+        if (PyModule_AddObject(module, defs[i].attr, ufunc) < 0) {
+            Py_DECREF(ufunc);
+            return -1;
+        }
+    }
+
+    return 0;
+}
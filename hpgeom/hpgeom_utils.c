@@ -45,14 +45,23 @@ int hpgeom_check_nside(int64_t nside, Scheme scheme, char *err) {
     return 1;
 }
 
+int hpgeom_check_nside_int32(int64_t nside, char *err) {
+    if (12 * nside * nside - 1 > INT32_MAX) {
+        snprintf(err, ERR_SIZE, "nside %" PRId64 " is too large for int32 pixels.", nside);
+        return 0;
+    }
+    return 1;
+}
+
 int hpgeom_check_theta_phi(double theta, double phi, char *err) {
     err[0] = '\0';
 
-    if (theta < 0.0 || theta > HPG_PI) {
+    // Written so that NaN values are out of range.
+    if (!(theta >= 0.0 && theta <= HPG_PI)) {
         snprintf(err, ERR_SIZE, "colatitude (theta) = %g out of range [0, pi]", theta);
         return 0;
     }
-    if (phi < 0 || phi > HPG_TWO_PI) {
+    if (!(phi >= 0.0 && phi <= HPG_TWO_PI)) {
         snprintf(err, ERR_SIZE, "longitude (phi) = %g out of range [0, 2*pi]", phi);
         return 0;
     }
@@ -70,6 +79,66 @@ int hpgeom_check_pixel(healpix_info *hpx, int64_t pix, char *err) {
     return 1;
 }
 
+int hpgeom_check_theta_phi_array(const double *theta, const double *phi, size_t n,
+                                 char *err) {
+    bool bad = false;
+
+    // Branch-free scan, with the message for the first bad value only
+    // produced on failure.
+    for (size_t i = 0; i < n; i++) {
+        bad |= !(theta[i] >= 0.0) | !(theta[i] <= HPG_PI) | !(phi[i] >= 0.0) |
+               !(phi[i] <= HPG_TWO_PI);
+    }
+    if (!bad) return 1;
+
+    for (size_t i = 0; i < n; i++) {
+        if (!hpgeom_check_theta_phi(theta[i], phi[i], err)) return 0;
+    }
+    return 1;
+}
+
+int hpgeom_check_vector(double x, double y, double z, char *err) {
+    double norm2 = x * x + y * y + z * z;
+
+    err[0] = '\0';
+
+    // Written so that NaN and infinite components are out of range.
+    if (!(norm2 > 0.0) || !isfinite(norm2)) {
+        snprintf(err, ERR_SIZE, "vector (%g, %g, %g) must be finite and non-zero", x, y, z);
+        return 0;
+    }
+    return 1;
+}
+
+int hpgeom_check_vector_array(const double *x, const double *y, const double *z, size_t n,
+                              char *err) {
+    bool bad = false;
+
+    for (size_t i = 0; i < n; i++) {
+        double norm2 = x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+        bad |= !(norm2 > 0.0) | !isfinite(norm2);
+    }
+    if (!bad) return 1;
+
+    for (size_t i = 0; i < n; i++) {
+        if (!hpgeom_check_vector(x[i], y[i], z[i], err)) return 0;
+    }
+    return 1;
+}
+
+int hpgeom_check_pixel_array(healpix_info *hpx, const int64_t *pix, size_t n, char *err) {
+    const int64_t npix = hpx->npix;
+    bool bad = false;
+
+    for (size_t i = 0; i < n; i++) bad |= (pix[i] < 0) | (pix[i] >= npix);
+    if (!bad) return 1;
+
+    for (size_t i = 0; i < n; i++) {
+        if (!hpgeom_check_pixel(hpx, pix[i], err)) return 0;
+    }
+    return 1;
+}
+
 int hpgeom_check_fact(healpix_info *hpx, long fact, char *err) {
     err[0] = '\0';
 
@@ -120,6 +189,11 @@ int hpgeom_lonlat_to_thetaphi(double lon, double lat, double *theta, double *phi
                               char *err) {
     err[0] = '\0';
 
+    if (!isfinite(lon)) {
+        snprintf(err, ERR_SIZE, "lon = %g is not finite", lon);
+        return 0;
+    }
+
     if (degrees) {
         lon = fmodulo(lon * HPG_D2R, HPG_TWO_PI);
         lat = lat * HPG_D2R;
@@ -127,7 +201,7 @@ int hpgeom_lonlat_to_thetaphi(double lon, double lat, double *theta, double *phi
         lon = fmodulo(lon, HPG_TWO_PI);
     }
 
-    if (lat < -HPG_HALFPI || lat > HPG_HALFPI) {
+    if (!(lat >= -HPG_HALFPI && lat <= HPG_HALFPI)) {
         if (degrees) {
             snprintf(err, ERR_SIZE, "lat = %g out of range [-90, 90]", lat * HPG_R2D);
         } else {
@@ -142,6 +216,46 @@ int hpgeom_lonlat_to_thetaphi(double lon, double lat, double *theta, double *phi
     return 1;
 }
 
+int hpgeom_check_lonlat_array(const double *lon, const double *lat, size_t n, bool degrees,
+                               char *err) {
+    bool bad = false;
+    double theta, phi;
+
+    // The latitude is converted as in hpgeom_lonlat_to_thetaphi, so that
+    // values at the edges of the range are treated identically.
+    if (degrees) {
+        for (size_t i = 0; i < n; i++) {
+            double lat_rad = lat[i] * HPG_D2R;
+            bad |= !isfinite(lon[i]) | !(lat_rad >= -HPG_HALFPI) | !(lat_rad <= HPG_HALFPI);
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            bad |= !isfinite(lon[i]) | !(lat[i] >= -HPG_HALFPI) | !(lat[i] <= HPG_HALFPI);
+        }
+    }
+    if (!bad) return 1;
+
+    for (size_t i = 0; i < n; i++) {
+        if (!hpgeom_lonlat_to_thetaphi(lon[i], lat[i], &theta, &phi, degrees, err)) return 0;
+    }
+    return 1;
+}
+
+void hpgeom_lonlat_to_thetaphi_array(const double *lon, const double *lat, double *theta,
+                                     double *phi, size_t n, bool degrees) {
+    if (degrees) {
+        for (size_t i = 0; i < n; i++) {
+            phi[i] = fmodulo(lon[i] * HPG_D2R, HPG_TWO_PI);
+            theta[i] = -(lat[i] * HPG_D2R) + HPG_HALFPI;
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            phi[i] = fmodulo(lon[i], HPG_TWO_PI);
+            theta[i] = -lat[i] + HPG_HALFPI;
+        }
+    }
+}
+
 int hpgeom_thetaphi_to_lonlat(double theta, double phi, double *lon, double *lat, bool degrees,
                               bool check_range, char *err) {
     int status = 1;
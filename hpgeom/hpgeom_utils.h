@@ -29,10 +29,22 @@
 #define ERR_SIZE 256
 
 int hpgeom_check_nside(int64_t nside, Scheme scheme, char *err);
+int hpgeom_check_nside_int32(int64_t nside, char *err);
 int hpgeom_check_theta_phi(double theta, double phi, char *err);
 int hpgeom_check_pixel(healpix_info *hpx, int64_t pix, char *err);
+int hpgeom_check_theta_phi_array(const double *theta, const double *phi, size_t n,
+                                 char *err);
+int hpgeom_check_pixel_array(healpix_info *hpx, const int64_t *pix, size_t n, char *err);
+// Vectors must be finite and non-zero; they need not be normalized.
+int hpgeom_check_vector(double x, double y, double z, char *err);
+int hpgeom_check_vector_array(const double *x, const double *y, const double *z, size_t n,
+                              char *err);
 int hpgeom_lonlat_to_thetaphi(double lon, double lat, double *theta, double *phi, bool degrees,
                               char *err);
+int hpgeom_check_lonlat_array(const double *lon, const double *lat, size_t n, bool degrees,
+                               char *err);
+void hpgeom_lonlat_to_thetaphi_array(const double *lon, const double *lat, double *theta,
+                                     double *phi, size_t n, bool degrees);
 int hpgeom_thetaphi_to_lonlat(double theta, double phi, double *lon, double *lat, bool degrees,
                               bool check_status, char *err);
 int hpgeom_check_fact(healpix_info *hpx, long fact, char *err);
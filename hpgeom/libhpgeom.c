@@ -0,0 +1,363 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "healpix_geom.h"
+#include "healpix_moc.h"
+#include "hpgeom_stack.h"
+#include "hpgeom_utils.h"
+#include "libhpgeom.h"
+
+// Block size for conversions that need scratch theta/phi buffers.
+#define HPG_LIB_BLOCK_SIZE 512
+
+struct hpg_context {
+    hpx_cache cache;
+    query_workspace *ws;
+    i64rangeset *pixset;
+    // Order of the last query result if it is nest, otherwise -1.
+    int result_order;
+    char err[ERR_SIZE];
+};
+
+// The SIMD dispatch is process-wide and is set up exactly once.
+#ifdef _WIN32
+static INIT_ONCE hpg_dispatch_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK hpg_init_dispatch(PINIT_ONCE once, PVOID param, PVOID *context) {
+    healpix_geom_init_dispatch();
+    return TRUE;
+}
+#else
+static pthread_once_t hpg_dispatch_once = PTHREAD_ONCE_INIT;
+
+static void hpg_init_dispatch(void) { healpix_geom_init_dispatch(); }
+#endif
+
+hpg_context *hpg_context_new(void) {
+    hpg_context *ctx;
+    int status = 1;
+
+#ifdef _WIN32
+    InitOnceExecuteOnce(&hpg_dispatch_once, hpg_init_dispatch, NULL, NULL);
+#else
+    pthread_once(&hpg_dispatch_once, hpg_init_dispatch);
+#endif
+
+    if ((ctx = calloc(1, sizeof(hpg_context))) == NULL) return NULL;
+    hpx_cache_init(&ctx->cache);
+    ctx->result_order = -1;
+
+    ctx->ws = query_workspace_new(&status, ctx->err);
+    if (!status) goto fail;
+    ctx->pixset = i64rangeset_new(&status, ctx->err);
+    if (!status) goto fail;
+
+    return ctx;
+
+fail:
+    hpg_context_delete(ctx);
+    return NULL;
+}
+
+void hpg_context_delete(hpg_context *ctx) {
+    if (ctx == NULL) return;
+    query_workspace_delete(ctx->ws);
+    i64rangeset_delete(ctx->pixset);
+    free(ctx);
+}
+
+const char *hpg_context_error(const hpg_context *ctx) { return ctx->err; }
+
+// Check nside and set up hpx for it.
+static int hpg_context_hpx(hpg_context *ctx, int64_t nside, hpg_scheme scheme,
+                           healpix_info *hpx) {
+    if (!hpgeom_check_nside(nside, (enum Scheme)scheme, ctx->err)) return 0;
+    *hpx = healpix_info_cached(&ctx->cache, nside, (enum Scheme)scheme);
+    return 1;
+}
+
+int hpg_ang2pix_batch(hpg_context *ctx, int64_t nside, hpg_scheme scheme, const double *theta,
+                      const double *phi, int64_t *pix, size_t n) {
+    healpix_info hpx;
+
+    if (!hpg_context_hpx(ctx, nside, scheme, &hpx)) return 0;
+    if (!hpgeom_check_theta_phi_array(theta, phi, n, ctx->err)) return 0;
+
+    ang2pix_batch(&hpx, theta, phi, pix, n);
+    return 1;
+}
+
+int hpg_lonlat2pix_batch(hpg_context *ctx, int64_t nside, hpg_scheme scheme, const double *lon,
+                         const double *lat, int degrees, int64_t *pix, size_t n) {
+    healpix_info hpx;
+    double theta[HPG_LIB_BLOCK_SIZE], phi[HPG_LIB_BLOCK_SIZE];
+
+    if (!hpg_context_hpx(ctx, nside, scheme, &hpx)) return 0;
+    if (!hpgeom_check_lonlat_array(lon, lat, n, (bool)degrees, ctx->err)) return 0;
+
+    for (size_t start = 0; start < n; start += HPG_LIB_BLOCK_SIZE) {
+        size_t nblock = (n - start < HPG_LIB_BLOCK_SIZE) ? n - start : HPG_LIB_BLOCK_SIZE;
+        hpgeom_lonlat_to_thetaphi_array(&lon[start], &lat[start], theta, phi, nblock,
+                                        (bool)degrees);
+        ang2pix_batch(&hpx, theta, phi, &pix[start], nblock);
+    }
+    return 1;
+}
+
+int hpg_pix2ang_batch(hpg_context *ctx, int64_t nside, hpg_scheme scheme, const int64_t *pix,
+                      double *theta, double *phi, size_t n) {
+    healpix_info hpx;
+
+    if (!hpg_context_hpx(ctx, nside, scheme, &hpx)) return 0;
+    if (!hpgeom_check_pixel_array(&hpx, pix, n, ctx->err)) return 0;
+
+    pix2ang_batch(&hpx, pix, theta, phi, n);
+    return 1;
+}
+
+int hpg_pix2lonlat_batch(hpg_context *ctx, int64_t nside, hpg_scheme scheme,
+                         const int64_t *pix, double *lon, double *lat, int degrees, size_t n) {
+    healpix_info hpx;
+
+    if (!hpg_context_hpx(ctx, nside, scheme, &hpx)) return 0;
+    if (!hpgeom_check_pixel_array(&hpx, pix, n, ctx->err)) return 0;
+
+    // theta/phi are computed into lat/lon and converted in place, as in
+    // hpgeom_thetaphi_to_lonlat.
+    pix2ang_batch(&hpx, pix, lat, lon, n);
+    for (size_t i = 0; i < n; i++) {
+        lat[i] = -(lat[i] - HPG_HALFPI);
+        if (degrees) {
+            lon[i] *= HPG_R2D;
+            lat[i] *= HPG_R2D;
+        }
+    }
+    return 1;
+}
+
+int hpg_vec2pix_batch(hpg_context *ctx, int64_t nside, hpg_scheme scheme, const double *x,
+                      const double *y, const double *z, int64_t *pix, size_t n) {
+    healpix_info hpx;
+    vec3 vec;
+
+    if (!hpg_context_hpx(ctx, nside, scheme, &hpx)) return 0;
+    if (!hpgeom_check_vector_array(x, y, z, n, ctx->err)) return 0;
+
+    for (size_t i = 0; i < n; i++) {
+        vec.x = x[i];
+        vec.y = y[i];
+        vec.z = z[i];
+        pix[i] = vec2pix(&hpx, &vec);
+    }
+    return 1;
+}
+
+int hpg_pix2vec_batch(hpg_context *ctx, int64_t nside, hpg_scheme scheme, const int64_t *pix,
+                      double *x, double *y, double *z, size_t n) {
+    healpix_info hpx;
+    vec3 vec;
+
+    if (!hpg_context_hpx(ctx, nside, scheme, &hpx)) return 0;
+    if (!hpgeom_check_pixel_array(&hpx, pix, n, ctx->err)) return 0;
+
+    for (size_t i = 0; i < n; i++) {
+        vec = pix2vec(&hpx, pix[i]);
+        x[i] = vec.x;
+        y[i] = vec.y;
+        z[i] = vec.z;
+    }
+    return 1;
+}
+
+int hpg_nest2ring_batch(hpg_context *ctx, int64_t nside, const int64_t *nest, int64_t *ring,
+                        size_t n) {
+    healpix_info hpx;
+
+    if (!hpg_context_hpx(ctx, nside, HPG_NEST, &hpx)) return 0;
+    if (!hpgeom_check_pixel_array(&hpx, nest, n, ctx->err)) return 0;
+
+    nest2ring_batch(&hpx, nest, ring, n);
+    return 1;
+}
+
+int hpg_ring2nest_batch(hpg_context *ctx, int64_t nside, const int64_t *ring, int64_t *nest,
+                        size_t n) {
+    healpix_info hpx;
+
+    if (!hpg_context_hpx(ctx, nside, HPG_NEST, &hpx)) return 0;
+    if (!hpgeom_check_pixel_array(&hpx, ring, n, ctx->err)) return 0;
+
+    ring2nest_batch(&hpx, ring, nest, n);
+    return 1;
+}
+
+// Set up hpx for a query, and check fact if the query is inclusive.
+static int hpg_query_setup(hpg_context *ctx, int64_t nside, hpg_scheme scheme, int fact,
+                           healpix_info *hpx) {
+    int status = 1;
+
+    if (!hpg_context_hpx(ctx, nside, scheme, hpx)) return 0;
+    if (fact != 0 && !hpgeom_check_fact(hpx, fact, ctx->err)) return 0;
+
+    ctx->result_order = -1;
+    i64rangeset_clear(ctx->pixset, &status, ctx->err);
+    return status;
+}
+
+// Record the order of a successful nest query result.
+static int hpg_query_done(hpg_context *ctx, const healpix_info *hpx, hpg_scheme scheme,
+                          int status) {
+    if (status && scheme == HPG_NEST) ctx->result_order = hpx->order;
+    return status;
+}
+
+int hpg_query_disc(hpg_context *ctx, int64_t nside, hpg_scheme scheme, double theta,
+                   double phi, double radius, int fact) {
+    healpix_info hpx;
+    int status = 1;
+
+    if (!hpgeom_check_theta_phi(theta, phi, ctx->err)) return 0;
+    if (!hpgeom_check_radius(radius, ctx->err)) return 0;
+    if (!hpg_query_setup(ctx, nside, scheme, fact, &hpx)) return 0;
+
+    query_disc_ws(&hpx, theta, phi, radius, fact, 1, ctx->pixset, ctx->ws, &status, ctx->err);
+    return hpg_query_done(ctx, &hpx, scheme, status);
+}
+
+int hpg_query_polygon(hpg_context *ctx, int64_t nside, hpg_scheme scheme, const double *theta,
+                      const double *phi, size_t nvert, int fact) {
+    healpix_info hpx;
+    pointingarr *vertices = NULL;
+    int status = 1;
+
+    if (nvert < 3) {
+        snprintf(ctx->err, ERR_SIZE, "Polygon must have at least 3 vertices.");
+        return 0;
+    }
+    if (!hpgeom_check_theta_phi_array(theta, phi, nvert, ctx->err)) return 0;
+    if (!hpg_query_setup(ctx, nside, scheme, fact, &hpx)) return 0;
+
+    vertices = pointingarr_new(nvert, &status, ctx->err);
+    if (!status) return 0;
+    for (size_t i = 0; i < nvert; i++) {
+        vertices->data[i].theta = theta[i];
+        vertices->data[i].phi = phi[i];
+    }
+    // Check for a closed polygon with a small double-precision delta.
+    double delta_theta = fabs(theta[nvert - 1] - theta[0]);
+    double delta_phi = fabs(phi[nvert - 1] - phi[0]);
+    if ((delta_theta < 1e-14) && (delta_phi < 1e-14)) {
+        vertices->size--;
+    }
+
+    query_polygon_ws(&hpx, vertices, fact, ctx->pixset, ctx->ws, &status, ctx->err);
+    pointingarr_delete(vertices);
+    return hpg_query_done(ctx, &hpx, scheme, status);
+}
+
+int hpg_query_ellipse(hpg_context *ctx, int64_t nside, hpg_scheme scheme, double theta,
+                      double phi, double semi_major, double semi_minor, double alpha,
+                      int fact) {
+    healpix_info hpx;
+    int status = 1;
+
+    if (!hpgeom_check_theta_phi(theta, phi, ctx->err)) return 0;
+    if (!hpgeom_check_semi(semi_major, semi_minor, ctx->err)) return 0;
+    if (!hpg_query_setup(ctx, nside, HPG_NEST, fact, &hpx)) return 0;
+
+    query_ellipse_ws(&hpx, theta, phi, semi_major, semi_minor, alpha, fact, 1, ctx->pixset,
+                     ctx->ws, &status, ctx->err);
+    if (status && scheme == HPG_RING) {
+        nest_ranges_to_ring(&hpx, ctx->pixset, &status, ctx->err);
+    }
+    return hpg_query_done(ctx, &hpx, scheme, status);
+}
+
+int hpg_query_box(hpg_context *ctx, int64_t nside, hpg_scheme scheme, double theta0,
+                  double theta1, double phi0, double phi1, int fact) {
+    healpix_info hpx;
+    int status = 1;
+    bool full_lon = (phi0 == 0.0 && phi1 == HPG_TWO_PI);
+
+    if (theta0 > theta1) {
+        snprintf(ctx->err, ERR_SIZE, "theta1 must be >= theta0.");
+        return 0;
+    }
+    if (!hpgeom_check_theta_phi(theta0, phi0, ctx->err)) return 0;
+    if (!hpgeom_check_theta_phi(theta1, phi1, ctx->err)) return 0;
+    if (!hpg_query_setup(ctx, nside, HPG_NEST, fact, &hpx)) return 0;
+
+    query_box_ws(&hpx, theta0, theta1, phi0, phi1, full_lon, fact, 1, ctx->pixset, ctx->ws,
+                 &status, ctx->err);
+    if (status && scheme == HPG_RING) {
+        nest_ranges_to_ring(&hpx, ctx->pixset, &status, ctx->err);
+    }
+    return hpg_query_done(ctx, &hpx, scheme, status);
+}
+
+size_t hpg_result_npixel(const hpg_context *ctx) { return i64rangeset_npix(ctx->pixset); }
+
+const int64_t *hpg_result_ranges(const hpg_context *ctx, size_t *nrange) {
+    *nrange = ctx->pixset->stack->size / 2;
+    return ctx->pixset->stack->data;
+}
+
+void hpg_result_pixels(const hpg_context *ctx, int64_t *pix) {
+    i64rangeset_fill_buffer(ctx->pixset, i64rangeset_npix(ctx->pixset), pix);
+}
+
+// The last result as a MOC, which shares its ranges.
+static int hpg_result_moc(hpg_context *ctx, moc *m) {
+    if (ctx->result_order < 0) {
+        snprintf(ctx->err, ERR_SIZE, "Multi-order cells require a nest query result.");
+        return 0;
+    }
+    m->max_order = ctx->result_order;
+    m->rangeset = ctx->pixset;
+    return 1;
+}
+
+int hpg_result_ncell(hpg_context *ctx, size_t *ncell) {
+    moc m;
+
+    if (!hpg_result_moc(ctx, &m)) return 0;
+    *ncell = moc_ncell(&m, NULL);
+    return 1;
+}
+
+int hpg_result_nuniq(hpg_context *ctx, int64_t *nuniq) {
+    moc m;
+
+    if (!hpg_result_moc(ctx, &m)) return 0;
+    moc_fill_nuniq(&m, nuniq);
+    return 1;
+}
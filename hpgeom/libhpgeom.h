@@ -0,0 +1,131 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+// Public C interface to the hpgeom geometry library (libhpgeom), for use
+// without python.  The header-only C++ interface in hpgeom.hpp is installed
+// alongside it.
+//
+// All state lives in an hpg_context.  A context may only be used by one
+// thread at a time, and threads working in parallel should each create
+// their own.  Functions returning int return 1 on success and 0 on failure,
+// in which case hpg_context_error() describes the problem.
+//
+// Angles are in radians unless a degrees argument is given; theta is the
+// colatitude in [0, pi] and phi the longitude in [0, 2*pi].  All inputs
+// are range checked before anything is computed.
+
+#ifndef _LIBHPGEOM_H
+#define _LIBHPGEOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if !defined(HPG_SHARED)
+#define HPG_API
+#elif defined(HPG_BUILDING)
+#define HPG_API __declspec(dllexport)
+#else
+#define HPG_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__) || defined(__clang__)
+#define HPG_API __attribute__((visibility("default")))
+#else
+#define HPG_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum hpg_scheme { HPG_RING = 0, HPG_NEST = 1 } hpg_scheme;
+
+typedef struct hpg_context hpg_context;
+
+// Returns NULL if the context could not be allocated.
+HPG_API hpg_context *hpg_context_new(void);
+HPG_API void hpg_context_delete(hpg_context *ctx);
+// Message for the most recent failure in this context.
+HPG_API const char *hpg_context_error(const hpg_context *ctx);
+
+// Batch conversions of n elements with a single nside and scheme.
+HPG_API int hpg_ang2pix_batch(hpg_context *ctx, int64_t nside, hpg_scheme scheme,
+                              const double *theta, const double *phi, int64_t *pix, size_t n);
+HPG_API int hpg_lonlat2pix_batch(hpg_context *ctx, int64_t nside, hpg_scheme scheme,
+                                 const double *lon, const double *lat, int degrees,
+                                 int64_t *pix, size_t n);
+HPG_API int hpg_pix2ang_batch(hpg_context *ctx, int64_t nside, hpg_scheme scheme,
+                              const int64_t *pix, double *theta, double *phi, size_t n);
+HPG_API int hpg_pix2lonlat_batch(hpg_context *ctx, int64_t nside, hpg_scheme scheme,
+                                 const int64_t *pix, double *lon, double *lat, int degrees,
+                                 size_t n);
+// Vectors need not be normalized, but must be finite and non-zero.
+HPG_API int hpg_vec2pix_batch(hpg_context *ctx, int64_t nside, hpg_scheme scheme,
+                              const double *x, const double *y, const double *z, int64_t *pix,
+                              size_t n);
+HPG_API int hpg_pix2vec_batch(hpg_context *ctx, int64_t nside, hpg_scheme scheme,
+                              const int64_t *pix, double *x, double *y, double *z, size_t n);
+// The output may be the same array as the input.
+HPG_API int hpg_nest2ring_batch(hpg_context *ctx, int64_t nside, const int64_t *nest,
+                                int64_t *ring, size_t n);
+HPG_API int hpg_ring2nest_batch(hpg_context *ctx, int64_t nside, const int64_t *ring,
+                                int64_t *nest, size_t n);
+
+// Queries.  With fact = 0 the pixels whose centers lie within the shape are
+// found; otherwise all pixels overlapping the shape are found, using the
+// inclusive oversampling factor fact (which must be a power of 2 for nest).
+// The result is kept in the context until the next query.
+HPG_API int hpg_query_disc(hpg_context *ctx, int64_t nside, hpg_scheme scheme, double theta,
+                           double phi, double radius, int fact);
+// The polygon must be convex, with at least 3 vertices.  The closing vertex
+// may be repeated.
+HPG_API int hpg_query_polygon(hpg_context *ctx, int64_t nside, hpg_scheme scheme,
+                              const double *theta, const double *phi, size_t nvert, int fact);
+// alpha is the inclination angle of the major axis, counterclockwise with
+// respect to north.
+HPG_API int hpg_query_ellipse(hpg_context *ctx, int64_t nside, hpg_scheme scheme, double theta,
+                              double phi, double semi_major, double semi_minor, double alpha,
+                              int fact);
+// The box spans colatitude [theta0, theta1] and longitude [phi0, phi1],
+// wrapping through 0 if phi0 > phi1, and covering all longitudes if phi0 == 0
+// and phi1 == 2*pi.
+HPG_API int hpg_query_box(hpg_context *ctx, int64_t nside, hpg_scheme scheme, double theta0,
+                          double theta1, double phi0, double phi1, int fact);
+
+// The result of the last query, as a sorted list of nrange half-open
+// [start, end) pixel ranges (2*nrange values), or as the expanded list of
+// hpg_result_npixel() pixels.
+HPG_API size_t hpg_result_npixel(const hpg_context *ctx);
+HPG_API const int64_t *hpg_result_ranges(const hpg_context *ctx, size_t *nrange);
+HPG_API void hpg_result_pixels(const hpg_context *ctx, int64_t *pix);
+// The result of the last nest query as the minimal list of multi-order
+// cells covering the same pixels, encoded as uniq = 4*4**order + pixel and
+// sorted in increasing order.  This is usually far shorter than the list of
+// pixels at high resolution.  These fail if the last query was not nest.
+HPG_API int hpg_result_ncell(hpg_context *ctx, size_t *ncell);
+HPG_API int hpg_result_nuniq(hpg_context *ctx, int64_t *nuniq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
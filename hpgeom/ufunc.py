@@ -0,0 +1,35 @@
+"""NumPy ufunc versions of the pixel conversion functions.
+
+These take the same inputs as the corresponding hpgeom functions, but all
+options are required positional inputs (nest, lonlat, degrees), and they
+support the full ufunc machinery: broadcasting, casting, out=, where=, and
+dispatch from array containers such as dask and xarray.
+
+Invalid inputs do not raise a ValueError.  Instead, they give -1 for pixels
+and NaN for angles, vectors, and weights, and are reported as
+"invalid value encountered" according to `np.errstate`.  Use
+``np.errstate(invalid="raise")`` to raise a FloatingPointError instead.
+"""
+from ._hpgeom import (
+    angle_to_pixel_ufunc as angle_to_pixel,
+    pixel_to_angle_ufunc as pixel_to_angle,
+    nest_to_ring_ufunc as nest_to_ring,
+    ring_to_nest_ufunc as ring_to_nest,
+    vector_to_pixel_ufunc as vector_to_pixel,
+    pixel_to_vector_ufunc as pixel_to_vector,
+    neighbors_ufunc as neighbors,
+    boundaries_ufunc as boundaries,
+    get_interpolation_weights_ufunc as get_interpolation_weights,
+)
+
+__all__ = [
+    'angle_to_pixel',
+    'pixel_to_angle',
+    'nest_to_ring',
+    'ring_to_nest',
+    'vector_to_pixel',
+    'pixel_to_vector',
+    'neighbors',
+    'boundaries',
+    'get_interpolation_weights',
+]
@@ -7,7 +7,17 @@ ext = Extension(
     [
         "hpgeom/hpgeom_stack.c",
         "hpgeom/hpgeom_utils.c",
+        "hpgeom/hpgeom_threads.c",
+        "hpgeom/hpgeom_rangeset.c",
+        "hpgeom/hpgeom_query_context.c",
+        "hpgeom/hpgeom_moc.c",
+        "hpgeom/hpgeom_pixelset.c",
         "hpgeom/healpix_geom.c",
+        "hpgeom/healpix_geom_simd.c",
+        "hpgeom/healpix_moc.c",
+        "hpgeom/hpgeom_chunkset.c",
+        "hpgeom/hpgeom_ufunc.c",
+        "hpgeom/hpgeom_capi.c",
         "hpgeom/hpgeom.c",
     ],
 )
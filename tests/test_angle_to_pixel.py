@@ -105,6 +105,76 @@ def test_angle_to_pixel_scalar(nside):
     assert pix_scalar2 == pix_arr[0]
 
 
+@pytest.mark.parametrize("nside", [2**0, 2**5, 2**10, 2**20, 2**29, 2**10 - 100])
+@pytest.mark.parametrize("nest", [True, False])
+def test_angle_to_pixel_batch_vs_scalar(nside, nest):
+    """Test the batched (vectorized) array path matches the scalar path."""
+    if nest and (nside & (nside - 1)) != 0:
+        pytest.skip("Nest ordering requires power of 2 nside.")
+
+    np.random.seed(12345)
+
+    ntest = 5000
+    # Random points, plus points near the poles, the equatorial/polar
+    # boundary, and face boundaries in longitude.
+    z = np.concatenate((
+        np.random.uniform(low=-1.0, high=1.0, size=ntest),
+        np.random.uniform(low=0.98, high=1.0, size=ntest)*np.random.choice([-1, 1], size=ntest),
+        2./3. + np.random.uniform(low=-1e-9, high=1e-9, size=ntest),
+        -2./3. + np.random.uniform(low=-1e-9, high=1e-9, size=ntest),
+        np.random.uniform(low=-1.0, high=1.0, size=ntest),
+        [1.0, -1.0, 0.0],
+    ))
+    phi = np.concatenate((
+        np.random.uniform(low=0.0, high=2*np.pi, size=4*ntest),
+        np.random.randint(low=0, high=8, size=ntest)*np.pi/4.,
+        [0.0, 0.0, 2*np.pi],
+    ))
+    theta = np.arccos(z)
+
+    pix = hpgeom.angle_to_pixel(nside, theta, phi, nest=nest, lonlat=False)
+    pix_scalar = np.array(
+        [hpgeom.angle_to_pixel(nside, t, p, nest=nest, lonlat=False) for t, p in zip(theta, phi)]
+    )
+
+    np.testing.assert_array_equal(pix, pix_scalar)
+
+    # And with a strided output order.
+    pix2 = hpgeom.angle_to_pixel(nside, theta[::2], phi[::2], nest=nest, lonlat=False)
+    np.testing.assert_array_equal(pix2, pix_scalar[::2])
+
+
+@pytest.mark.parametrize("nest", [True, False])
+def test_angle_to_pixel_mixed_nside(nest):
+    """Test angle_to_pixel with a per-element nside array."""
+    np.random.seed(12345)
+
+    if nest:
+        nsides = 2**np.arange(30)
+    else:
+        nsides = np.concatenate((2**np.arange(30), [3, 5, 100, 1000, 2**20 - 1, 12345]))
+
+    lon = np.random.uniform(low=0.0, high=360.0, size=100_000)
+    lat = np.random.uniform(low=-90.0, high=90.0, size=100_000)
+    nside = np.random.choice(nsides, size=lon.size)
+
+    pix = hpgeom.angle_to_pixel(nside, lon, lat, nest=nest)
+
+    for nside_test in nsides:
+        use, = np.where(nside == nside_test)
+        pix_test = hpgeom.angle_to_pixel(nside_test, lon[use], lat[use], nest=nest)
+        np.testing.assert_array_equal(pix[use], pix_test)
+
+    # Make sure a bad nside is caught after a run of good ones.
+    nside[-1] = 2040
+    if nest:
+        with pytest.raises(ValueError, match=r"nside .* must be power of 2"):
+            hpgeom.angle_to_pixel(nside, lon, lat, nest=nest)
+    nside[-1] = -1
+    with pytest.raises(ValueError, match=r"nside .* must be positive"):
+        hpgeom.angle_to_pixel(nside, lon, lat, nest=nest)
+
+
 def test_angle_to_pixel_zerolength():
     """Test angle_to_pixel for a zero-length lon/lat array."""
     pix = hpgeom.angle_to_pixel(1024, [], [])
@@ -112,6 +182,39 @@ def test_angle_to_pixel_zerolength():
     assert len(pix) == 0
 
 
+@pytest.mark.parametrize("nest", [True, False])
+def test_angle_to_pixel_conventions(nest):
+    """Test that all angle conventions and input dtypes are consistent."""
+    np.random.seed(12345)
+
+    # Stay away from the range edges so the float32 values are in range.
+    lon = np.random.uniform(low=0.0, high=6.28, size=10_000).astype(np.float32)
+    lat = np.random.uniform(low=-1.57, high=1.57, size=10_000).astype(np.float32)
+    lon64 = lon.astype(np.float64)
+    lat64 = lat.astype(np.float64)
+
+    pix = hpgeom.angle_to_pixel(1024, -lat64 + np.pi/2., lon64, nest=nest, lonlat=False)
+
+    for a, b in [(lon64, lat64), (lon, lat)]:
+        pix2 = hpgeom.angle_to_pixel(1024, a, b, nest=nest, degrees=False)
+        np.testing.assert_array_equal(pix2, pix)
+
+    theta = (-lat64 + np.pi/2.).astype(np.float32)
+    pix2 = hpgeom.angle_to_pixel(1024, theta, lon, nest=nest, lonlat=False)
+    pix3 = hpgeom.angle_to_pixel(1024, theta.astype(np.float64), lon64, nest=nest, lonlat=False)
+    np.testing.assert_array_equal(pix2, pix3)
+
+    lon_deg = np.rad2deg(lon64)
+    lat_deg = np.rad2deg(lat64)
+    pix_deg = hpgeom.angle_to_pixel(1024, lon_deg, lat_deg, nest=nest)
+    pix_deg2 = hpgeom.angle_to_pixel(1024, lon_deg.astype(np.float32).astype(np.float64),
+                                     lat_deg.astype(np.float32).astype(np.float64), nest=nest)
+    pix_deg3 = hpgeom.angle_to_pixel(1024, lon_deg.astype(np.float32),
+                                     lat_deg.astype(np.float32), nest=nest)
+    np.testing.assert_array_equal(pix_deg3, pix_deg2)
+    assert np.sum(pix_deg != pix) < 10
+
+
 def test_angle_to_pixel_mismatched_dims():
     """Test angle_to_pixel errors when dimensions are mismatched."""
     np.random.seed(12345)
@@ -183,3 +286,129 @@ def test_angle_to_pixel_bad_coords():
     with pytest.raises(ValueError, match=r"longitude \(phi\) .* out of range"):
         # phi out of range
         hpgeom.angle_to_pixel(2048, 0.0, 2*np.pi + 0.1, lonlat=False)
+
+    with pytest.raises(ValueError, match=r"lon .* is not finite"):
+        hpgeom.angle_to_pixel(2048, np.nan, 0.0)
+
+    with pytest.raises(ValueError, match=r"lat .* out of range"):
+        hpgeom.angle_to_pixel(2048, 0.0, np.nan)
+
+    with pytest.raises(ValueError, match=r"colatitude \(theta\) .* out of range"):
+        hpgeom.angle_to_pixel(2048, np.nan, 0.0, lonlat=False)
+
+    with pytest.raises(ValueError, match=r"longitude \(phi\) .* out of range"):
+        hpgeom.angle_to_pixel(2048, 0.0, np.nan, lonlat=False)
+
+    # A single bad value deep in a large array.
+    lon = np.zeros(10_000)
+    lat = np.zeros(10_000)
+    lat[7_777] = 95.0
+    with pytest.raises(ValueError, match=r"lat = 95 out of range"):
+        hpgeom.angle_to_pixel(2048, lon, lat)
+
+
+@pytest.mark.parametrize("nest", [True, False])
+@pytest.mark.parametrize("lonlat", [True, False])
+def test_angle_to_pixel_check_false(nest, lonlat):
+    """Test angle_to_pixel with check=False on valid inputs."""
+    np.random.seed(12345)
+
+    if lonlat:
+        a = np.random.uniform(low=-180.0, high=360.0, size=10_000)
+        b = np.random.uniform(low=-90.0, high=90.0, size=10_000)
+    else:
+        a = np.random.uniform(low=0.0, high=np.pi, size=10_000)
+        b = np.random.uniform(low=0.0, high=2*np.pi, size=10_000)
+
+    pix = hpgeom.angle_to_pixel(2048, a, b, nest=nest, lonlat=lonlat)
+    pix2 = hpgeom.angle_to_pixel(2048, a, b, nest=nest, lonlat=lonlat, check=False)
+    np.testing.assert_array_equal(pix2, pix)
+
+    # nside is always checked.
+    with pytest.raises(ValueError, match=r"nside .* must be positive"):
+        hpgeom.angle_to_pixel(-1, a, b, nest=nest, lonlat=lonlat, check=False)
+
+
+def test_angle_to_pixel_out():
+    """Test angle_to_pixel with an out array."""
+    np.random.seed(12345)
+
+    lon = np.random.uniform(low=0.0, high=360.0, size=1000)
+    lat = np.random.uniform(low=-90.0, high=90.0, size=1000)
+
+    pix = hpgeom.angle_to_pixel(1024, lon, lat)
+
+    out = np.zeros(lon.size, dtype=np.int64)
+    pix2 = hpgeom.angle_to_pixel(1024, lon, lat, out=out)
+    assert pix2 is out
+    np.testing.assert_array_equal(out, pix)
+
+    # Strided out arrays are filled through the view.
+    out = np.zeros(2*lon.size, dtype=np.int64)
+    hpgeom.angle_to_pixel(1024, lon, lat, out=out[::2])
+    np.testing.assert_array_equal(out[::2], pix)
+    np.testing.assert_array_equal(out[1::2], 0)
+
+
+def test_angle_to_pixel_bad_out():
+    """Test angle_to_pixel with bad out arrays."""
+    with pytest.raises(TypeError, match=r"out array must have dtype"):
+        hpgeom.angle_to_pixel(1024, [0.0, 1.0], [0.0, 1.0], out=np.zeros(2, dtype=np.int32))
+
+    with pytest.raises(TypeError, match=r"out must be a numpy array"):
+        hpgeom.angle_to_pixel(1024, [0.0, 1.0], [0.0, 1.0], out=[0, 0])
+
+    with pytest.raises(ValueError):
+        hpgeom.angle_to_pixel(1024, [0.0, 1.0], [0.0, 1.0], out=np.zeros(3, dtype=np.int64))
+
+    out = np.zeros(2, dtype=np.int64)
+    out.flags.writeable = False
+    with pytest.raises(ValueError, match=r"out array must be aligned, writeable"):
+        hpgeom.angle_to_pixel(1024, [0.0, 1.0], [0.0, 1.0], out=out)
+
+
+@pytest.mark.parametrize("nest", [True, False])
+def test_angle_to_pixel_float32(nest):
+    """Test angle_to_pixel with float32 inputs."""
+    np.random.seed(12345)
+
+    lon = np.random.uniform(low=0.0, high=360.0, size=1000).astype(np.float32)
+    lat = np.random.uniform(low=-90.0, high=90.0, size=1000).astype(np.float32)
+
+    pix = hpgeom.angle_to_pixel(1024, lon, lat, nest=nest)
+    pix64 = hpgeom.angle_to_pixel(1024, lon.astype(np.float64), lat.astype(np.float64), nest=nest)
+    np.testing.assert_array_equal(pix, pix64)
+
+    # Strided float32 inputs, and mixed float32/float64 inputs.
+    pix = hpgeom.angle_to_pixel(1024, lon[::2], lat[::2], nest=nest)
+    np.testing.assert_array_equal(pix, pix64[::2])
+    pix = hpgeom.angle_to_pixel(1024, lon, lat.astype(np.float64), nest=nest)
+    np.testing.assert_array_equal(pix, pix64)
+
+    with pytest.raises(ValueError, match=r"lat .* out of range"):
+        hpgeom.angle_to_pixel(1024, np.zeros(2, dtype=np.float32), np.full(2, 91.0, dtype=np.float32))
+
+
+@pytest.mark.parametrize("nest", [True, False])
+def test_angle_to_pixel_int32(nest):
+    """Test angle_to_pixel with int32 outputs."""
+    np.random.seed(12345)
+
+    lon = np.random.uniform(low=0.0, high=360.0, size=1000)
+    lat = np.random.uniform(low=-90.0, high=90.0, size=1000)
+
+    pix = hpgeom.angle_to_pixel(8192, lon, lat, nest=nest)
+
+    pix32 = hpgeom.angle_to_pixel(8192, lon, lat, nest=nest, dtype=np.int32)
+    assert pix32.dtype == np.int32
+    np.testing.assert_array_equal(pix32, pix)
+
+    out = np.zeros(2*lon.size, dtype=np.int32)
+    hpgeom.angle_to_pixel(8192, lon, lat, nest=nest, dtype=np.int32, out=out[::2])
+    np.testing.assert_array_equal(out[::2], pix)
+
+    with pytest.raises(ValueError, match=r"too large for int32"):
+        hpgeom.angle_to_pixel(16384, lon, lat, nest=nest, dtype=np.int32)
+
+    with pytest.raises(ValueError, match=r"dtype must be int32 or int64"):
+        hpgeom.angle_to_pixel(8192, lon, lat, nest=nest, dtype=np.float64)
@@ -142,3 +142,18 @@ def test_boundaries_bad_inputs():
 
     with pytest.raises(ValueError, match=r"nside .* must be power of 2"):
         hpgeom.boundaries(2**10 - 2, -1, nest=True)
+
+
+def test_boundaries_out():
+    """Test boundaries with out arrays."""
+    lon, lat = hpgeom.boundaries(1024, [100, 200], step=2)
+
+    out = (np.zeros((2, 8)), np.zeros((2, 8)))
+    lon2, lat2 = hpgeom.boundaries(1024, [100, 200], step=2, out=out)
+    assert lon2 is out[0]
+    assert lat2 is out[1]
+    np.testing.assert_array_equal(lon2, lon)
+    np.testing.assert_array_equal(lat2, lat)
+
+    with pytest.raises(ValueError, match=r"out array must be C-contiguous with shape \(2, 4\)"):
+        hpgeom.boundaries(1024, [100, 200], out=out)
@@ -0,0 +1,147 @@
+import os
+
+import numpy as np
+import pytest
+
+import hpgeom
+import hpgeom.capi
+
+
+@pytest.mark.parametrize("nest", [True, False])
+def test_capi_conversions(nest):
+    """Test the C API conversion functions match the python functions."""
+    np.random.seed(12345)
+
+    nside = 2048
+    pix = np.random.randint(0, 12*nside*nside, size=100)
+    theta, phi = hpgeom.pixel_to_angle(nside, pix, nest=nest, lonlat=False)
+    lon, lat = hpgeom.pixel_to_angle(nside, pix, nest=nest)
+    x, y, z = hpgeom.pixel_to_vector(nside, pix, nest=nest)
+    neighbors = hpgeom.neighbors(nside, pix, nest=nest)
+
+    a = np.zeros(1)
+    b = np.zeros(1)
+    c = np.zeros(1)
+    neigh = np.zeros(8, dtype=np.int64)
+    for i in range(pix.size):
+        assert hpgeom.capi.ang2pix(nside, nest, theta[i], phi[i]) == pix[i]
+        assert hpgeom.capi.lonlat2pix(nside, nest, lon[i], lat[i], 1) == pix[i]
+        assert hpgeom.capi.vec2pix(nside, nest, x[i], y[i], z[i]) == pix[i]
+
+        assert hpgeom.capi.pix2ang(nside, nest, pix[i], a.ctypes, b.ctypes) == 1
+        assert a[0] == theta[i]
+        assert b[0] == phi[i]
+        assert hpgeom.capi.pix2lonlat(nside, nest, pix[i], a.ctypes, b.ctypes, 1) == 1
+        assert a[0] == lon[i]
+        assert b[0] == lat[i]
+        assert hpgeom.capi.pix2vec(nside, nest, pix[i], a.ctypes, b.ctypes, c.ctypes) == 1
+        assert a[0] == x[i]
+        assert b[0] == y[i]
+        assert c[0] == z[i]
+
+        assert hpgeom.capi.neighbors(nside, nest, pix[i], neigh.ctypes) == 1
+        np.testing.assert_array_equal(neigh, neighbors[i, :])
+
+        if nest:
+            ring = hpgeom.nest_to_ring(nside, pix[i])
+            assert hpgeom.capi.nest2ring(nside, pix[i]) == ring
+            assert hpgeom.capi.ring2nest(nside, ring) == pix[i]
+
+    pix2 = np.zeros_like(pix)
+    assert hpgeom.capi.ang2pix_batch(nside, nest, theta.ctypes, phi.ctypes, pix2.ctypes, pix.size) == 1
+    np.testing.assert_array_equal(pix2, pix)
+
+    theta2 = np.zeros_like(theta)
+    phi2 = np.zeros_like(phi)
+    assert hpgeom.capi.pix2ang_batch(nside, nest, pix.ctypes, theta2.ctypes, phi2.ctypes, pix.size) == 1
+    np.testing.assert_array_equal(theta2, theta)
+    np.testing.assert_array_equal(phi2, phi)
+
+    if nest:
+        ring = np.zeros_like(pix)
+        assert hpgeom.capi.nest2ring_batch(nside, pix.ctypes, ring.ctypes, pix.size) == 1
+        np.testing.assert_array_equal(ring, hpgeom.nest_to_ring(nside, pix))
+        assert hpgeom.capi.ring2nest_batch(nside, ring.ctypes, ring.ctypes, pix.size) == 1
+        np.testing.assert_array_equal(ring, pix)
+
+
+@pytest.mark.parametrize("nest", [True, False])
+@pytest.mark.parametrize("inclusive", [True, False])
+def test_capi_query_disc(nest, inclusive):
+    """Test the C API query_disc matches query_circle."""
+    nside = 1024
+    fact = 4 if inclusive else 0
+
+    pixels = hpgeom.query_circle(nside, 1.0, 2.0, 0.01, inclusive=inclusive, nest=nest, lonlat=False)
+
+    buf = np.zeros(pixels.size + 10, dtype=np.int64)
+    npix = hpgeom.capi.query_disc(nside, nest, 1.0, 2.0, 0.01, fact, buf.ctypes, buf.size)
+    assert npix == pixels.size
+    np.testing.assert_array_equal(buf[:npix], pixels)
+
+    # A short buffer gets the start of the list, and the full count.
+    buf = np.zeros(10, dtype=np.int64)
+    npix = hpgeom.capi.query_disc(nside, nest, 1.0, 2.0, 0.01, fact, buf.ctypes, buf.size)
+    assert npix == pixels.size
+    np.testing.assert_array_equal(buf, pixels[: 10])
+
+    assert hpgeom.capi.query_disc(nside, nest, 1.0, 2.0, 0.01, fact, None, 0) == pixels.size
+
+
+def test_capi_bad_inputs():
+    """Test the C API returns error values for bad inputs."""
+    a = np.zeros(8)
+    neigh = np.zeros(8, dtype=np.int64)
+
+    assert hpgeom.capi.ang2pix(-1, 1, 1.0, 1.0) == -1
+    assert hpgeom.capi.ang2pix(1000, 1, 1.0, 1.0) == -1
+    assert hpgeom.capi.ang2pix(1000, 0, 1.0, 1.0) >= 0
+    assert hpgeom.capi.ang2pix(1024, 1, -1.0, 1.0) == -1
+    assert hpgeom.capi.ang2pix(1024, 1, np.nan, 1.0) == -1
+    assert hpgeom.capi.lonlat2pix(1024, 1, 0.0, 91.0, 1) == -1
+    assert hpgeom.capi.vec2pix(1024, 1, np.nan, 0.0, 1.0) == -1
+    assert hpgeom.capi.vec2pix(1024, 0, 1.0, np.inf, 0.0) == -1
+    assert hpgeom.capi.vec2pix(1024, 1, 0.0, 0.0, 0.0) == -1
+    assert hpgeom.capi.pix2ang(1, 1, 12, a.ctypes, a.ctypes) == 0
+    assert hpgeom.capi.pix2vec(1, 1, -1, a.ctypes, a.ctypes, a.ctypes) == 0
+    assert hpgeom.capi.nest2ring(1, 12) == -1
+    assert hpgeom.capi.ring2nest(1000, 0) == -1
+    assert hpgeom.capi.neighbors(1, 1, 12, neigh.ctypes) == 0
+    assert hpgeom.capi.query_disc(1024, 1, 1.0, 1.0, -0.1, 0, None, 0) == -1
+    assert hpgeom.capi.query_disc(1024, 1, 1.0, 1.0, 0.1, 3, None, 0) == -1
+
+
+def test_capi_version():
+    """Test the C API version and include directory."""
+    assert hpgeom.capi.CAPI_VERSION >= 1
+    assert os.path.isfile(os.path.join(hpgeom.capi.get_include(), "hpgeom_capi.h"))
+    assert os.path.isfile(os.path.join(hpgeom.capi.get_include(), "hpgeom_capi.pxd"))
+
+
+def test_capi_numba():
+    """Test calling the C API from numba."""
+    numba = pytest.importorskip("numba")
+
+    ang2pix = hpgeom.capi.ang2pix
+    ang2pix_batch = hpgeom.capi.ang2pix_batch
+
+    @numba.njit
+    def loop_ang2pix(nside, theta, phi):
+        pix = np.zeros(theta.size, dtype=np.int64)
+        for i in range(theta.size):
+            pix[i] = ang2pix(nside, 1, theta[i], phi[i])
+        return pix
+
+    @numba.njit
+    def batch_ang2pix(nside, theta, phi):
+        pix = np.zeros(theta.size, dtype=np.int64)
+        ang2pix_batch(nside, 1, theta.ctypes, phi.ctypes, pix.ctypes, theta.size)
+        return pix
+
+    np.random.seed(12345)
+    theta = np.arccos(np.random.uniform(-1.0, 1.0, size=1000))
+    phi = np.random.uniform(0.0, 2*np.pi, size=1000)
+
+    pix = hpgeom.angle_to_pixel(1024, theta, phi, lonlat=False)
+    np.testing.assert_array_equal(loop_ang2pix(1024, theta, phi), pix)
+    np.testing.assert_array_equal(batch_ang2pix(1024, theta, phi), pix)
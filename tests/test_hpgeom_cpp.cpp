@@ -0,0 +1,133 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+// Tests of the header-only C++ interface in hpgeom.hpp, which must give
+// results identical to libhpgeom.
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "hpgeom.hpp"
+#include "libhpgeom.h"
+
+static int n_failed = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            n_failed++;                                                              \
+        }                                                                            \
+    } while (0)
+
+// The healpix_info is built at compile time.
+static_assert(hpgeom::order_from_nside(2048) == 11);
+static_assert(hpgeom::order_from_nside(1000) == -1);
+static_assert(hpgeom::HealpixNest<2048>::npix == 12 * 2048 * 2048);
+static_assert(hpgeom::HealpixRing<1>::info.ncap == 0);
+static_assert(hpgeom::HealpixNest<8>::xyf2nest(7, 7, 11) == 12 * 64 - 1);
+
+constexpr size_t ntest = 20000;
+
+template <hpgeom::Scheme S, int Order>
+static void test_healpix(hpg_context *ctx, std::mt19937_64 &rng) {
+    using Hpx = hpgeom::Healpix<S, Order>;
+    const hpg_scheme scheme = (S == hpgeom::Scheme::NEST) ? HPG_NEST : HPG_RING;
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::uniform_int_distribution<int64_t> pixdist(0, Hpx::npix - 1);
+    std::vector<double> theta(ntest), phi(ntest), theta2(ntest), phi2(ntest);
+    std::vector<int64_t> pix(ntest), pix2(ntest);
+
+    for (size_t i = 0; i < ntest; i++) {
+        theta[i] = std::acos(2.0 * uniform(rng) - 1.0);
+        phi[i] = 2.0 * M_PI * uniform(rng);
+    }
+    // Include the poles.
+    theta[0] = 0.0;
+    theta[1] = M_PI;
+
+    Hpx::ang2pix_batch(theta, phi, pix);
+    CHECK(hpg_ang2pix_batch(ctx, Hpx::nside, scheme, theta.data(), phi.data(), pix2.data(),
+                            ntest));
+    CHECK(pix == pix2);
+
+    for (size_t i = 0; i < ntest; i++) pix[i] = pixdist(rng);
+    pix[0] = 0;
+    pix[1] = Hpx::npix - 1;
+
+    Hpx::pix2ang_batch(pix, theta, phi);
+    CHECK(hpg_pix2ang_batch(ctx, Hpx::nside, scheme, pix.data(), theta2.data(), phi2.data(),
+                            ntest));
+    CHECK(theta == theta2);
+    CHECK(phi == phi2);
+
+    double x, y, z, x2, y2, z2;
+    for (size_t i = 0; i < ntest; i++) {
+        Hpx::pix2vec(pix[i], x, y, z);
+        CHECK(hpg_pix2vec_batch(ctx, Hpx::nside, scheme, &pix[i], &x2, &y2, &z2, 1));
+        CHECK(x == x2 && y == y2 && z == z2);
+        CHECK(Hpx::vec2pix(x, y, z) == pix[i]);
+    }
+
+    if constexpr (S == hpgeom::Scheme::NEST) {
+        Hpx::nest2ring_batch(pix, pix2);
+        std::vector<int64_t> ring(ntest);
+        CHECK(hpg_nest2ring_batch(ctx, Hpx::nside, pix.data(), ring.data(), ntest));
+        CHECK(pix2 == ring);
+        // In place.
+        Hpx::ring2nest_batch(pix2, pix2);
+        CHECK(pix2 == pix);
+    }
+}
+
+template <int Order>
+static void test_order(hpg_context *ctx, std::mt19937_64 &rng) {
+    test_healpix<hpgeom::Scheme::NEST, Order>(ctx, rng);
+    test_healpix<hpgeom::Scheme::RING, Order>(ctx, rng);
+}
+
+int main() {
+    hpg_context *ctx = hpg_context_new();
+    std::mt19937_64 rng(12345);
+
+    if (ctx == nullptr) {
+        fprintf(stderr, "Failed to create context.\n");
+        return 1;
+    }
+
+    test_order<0>(ctx, rng);
+    test_order<1>(ctx, rng);
+    test_order<5>(ctx, rng);
+    test_order<11>(ctx, rng);
+    test_order<20>(ctx, rng);
+    test_order<29>(ctx, rng);
+
+    hpg_context_delete(ctx);
+
+    if (n_failed) {
+        fprintf(stderr, "%d checks failed.\n", n_failed);
+        return 1;
+    }
+    return 0;
+}
@@ -214,3 +214,18 @@ def test_interpolation_bad_coords():
     with pytest.raises(ValueError, match=r"longitude \(phi\) .* out of range"):
         # phi out of range
         hpgeom.get_interpolation_weights(2048, 0.0, 2*np.pi + 0.1, lonlat=False)
+
+
+def test_interpolation_out():
+    """Test get_interpolation_weights with out arrays."""
+    interp_pix, interp_wgt = hpgeom.get_interpolation_weights(1024, [1.0, 2.0], [1.0, 2.0])
+
+    out = (np.zeros((2, 4), dtype=np.int64), np.zeros((2, 4)))
+    interp_pix2, interp_wgt2 = hpgeom.get_interpolation_weights(1024, [1.0, 2.0], [1.0, 2.0], out=out)
+    assert interp_pix2 is out[0]
+    assert interp_wgt2 is out[1]
+    np.testing.assert_array_equal(interp_pix2, interp_pix)
+    np.testing.assert_array_equal(interp_wgt2, interp_wgt)
+
+    with pytest.raises(TypeError, match=r"out array must have dtype"):
+        hpgeom.get_interpolation_weights(1024, [1.0, 2.0], [1.0, 2.0], out=(out[1], out[0]))
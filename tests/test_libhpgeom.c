@@ -0,0 +1,283 @@
+/*
+ * Copyright 2022 LSST DESC
+ * Author: Eli Rykoff
+ *
+ * This product includes software developed by the
+ * LSST DESC (https://www.lsstdesc.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+// Tests of the standalone libhpgeom C interface, run with ctest.  The
+// geometry itself is tested in depth through python.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libhpgeom.h"
+
+#define PI 3.141592653589793238462643383279502884197
+#define NTEST 10000
+
+static int n_failed = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            n_failed++;                                                              \
+        }                                                                            \
+    } while (0)
+
+static double uniform(double low, double high) {
+    return low + (high - low) * ((double)rand() / ((double)RAND_MAX + 1.0));
+}
+
+static void test_roundtrip(hpg_context *ctx, hpg_scheme scheme) {
+    int64_t nside = 1024;
+    int64_t npix = 12 * nside * nside;
+    int64_t *pix = malloc(NTEST * sizeof(int64_t));
+    int64_t *pix2 = malloc(NTEST * sizeof(int64_t));
+    double *theta = malloc(NTEST * sizeof(double));
+    double *phi = malloc(NTEST * sizeof(double));
+    double *z = malloc(NTEST * sizeof(double));
+
+    for (int i = 0; i < NTEST; i++) pix[i] = (int64_t)uniform(0.0, (double)npix);
+
+    // Pixel centers map back to the same pixels.
+    CHECK(hpg_pix2ang_batch(ctx, nside, scheme, pix, theta, phi, NTEST));
+    CHECK(hpg_ang2pix_batch(ctx, nside, scheme, theta, phi, pix2, NTEST));
+    CHECK(memcmp(pix, pix2, NTEST * sizeof(int64_t)) == 0);
+
+    CHECK(hpg_pix2lonlat_batch(ctx, nside, scheme, pix, phi, theta, 1, NTEST));
+    CHECK(hpg_lonlat2pix_batch(ctx, nside, scheme, phi, theta, 1, pix2, NTEST));
+    CHECK(memcmp(pix, pix2, NTEST * sizeof(int64_t)) == 0);
+
+    CHECK(hpg_pix2vec_batch(ctx, nside, scheme, pix, theta, phi, z, NTEST));
+    CHECK(hpg_vec2pix_batch(ctx, nside, scheme, theta, phi, z, pix2, NTEST));
+    CHECK(memcmp(pix, pix2, NTEST * sizeof(int64_t)) == 0);
+
+    free(pix);
+    free(pix2);
+    free(theta);
+    free(phi);
+    free(z);
+}
+
+static void test_reorder(hpg_context *ctx) {
+    int64_t nside = 2048;
+    int64_t *nest = malloc(NTEST * sizeof(int64_t));
+    int64_t *ring = malloc(NTEST * sizeof(int64_t));
+    double *theta = malloc(NTEST * sizeof(double));
+    double *phi = malloc(NTEST * sizeof(double));
+    int64_t *pix = malloc(NTEST * sizeof(int64_t));
+
+    for (int i = 0; i < NTEST; i++) {
+        theta[i] = acos(uniform(-1.0, 1.0));
+        phi[i] = uniform(0.0, 2 * PI);
+    }
+    CHECK(hpg_ang2pix_batch(ctx, nside, HPG_NEST, theta, phi, nest, NTEST));
+    CHECK(hpg_ang2pix_batch(ctx, nside, HPG_RING, theta, phi, ring, NTEST));
+
+    CHECK(hpg_nest2ring_batch(ctx, nside, nest, pix, NTEST));
+    CHECK(memcmp(pix, ring, NTEST * sizeof(int64_t)) == 0);
+    // In place.
+    CHECK(hpg_ring2nest_batch(ctx, nside, pix, pix, NTEST));
+    CHECK(memcmp(pix, nest, NTEST * sizeof(int64_t)) == 0);
+
+    free(nest);
+    free(ring);
+    free(theta);
+    free(phi);
+    free(pix);
+}
+
+// Non-inclusive queries return exactly the pixels with centers inside the
+// shape, so these are compared against a brute force search.
+static void test_query_disc(hpg_context *ctx, hpg_scheme scheme) {
+    int64_t nside = 64;
+    int64_t npix = 12 * nside * nside;
+    double theta0 = 1.0, phi0 = 2.0, radius = 0.1;
+    double x, y, z;
+    double x0 = sin(theta0) * cos(phi0), y0 = sin(theta0) * sin(phi0), z0 = cos(theta0);
+    size_t npixel, nrange, n_inside = 0;
+    int64_t *pixels;
+    const int64_t *ranges;
+
+    CHECK(hpg_query_disc(ctx, nside, scheme, theta0, phi0, radius, 0));
+    npixel = hpg_result_npixel(ctx);
+    pixels = malloc(npixel * sizeof(int64_t));
+    hpg_result_pixels(ctx, pixels);
+    ranges = hpg_result_ranges(ctx, &nrange);
+    CHECK(nrange > 0);
+    CHECK(ranges[0] == pixels[0]);
+    CHECK(ranges[2 * nrange - 1] == pixels[npixel - 1] + 1);
+
+    size_t j = 0;
+    for (int64_t p = 0; p < npix; p++) {
+        CHECK(hpg_pix2vec_batch(ctx, nside, scheme, &p, &x, &y, &z, 1));
+        if (x * x0 + y * y0 + z * z0 > cos(radius)) {
+            n_inside++;
+            CHECK(j < npixel && pixels[j] == p);
+            j++;
+        }
+    }
+    CHECK(n_inside == npixel);
+
+    // The inclusive query contains the exact one.
+    CHECK(hpg_query_disc(ctx, nside, scheme, theta0, phi0, radius, 4));
+    CHECK(hpg_result_npixel(ctx) > npixel);
+
+    free(pixels);
+}
+
+static void test_query_shapes(hpg_context *ctx) {
+    double theta[4] = {1.0, 1.2, 1.2, 1.0};
+    double phi[4] = {0.5, 0.5, 0.7, 0.7};
+    size_t npix_nest, npix_ring;
+
+    CHECK(hpg_query_polygon(ctx, 256, HPG_NEST, theta, phi, 4, 0));
+    npix_nest = hpg_result_npixel(ctx);
+    CHECK(npix_nest > 0);
+    CHECK(hpg_query_polygon(ctx, 256, HPG_RING, theta, phi, 4, 0));
+    CHECK(hpg_result_npixel(ctx) == npix_nest);
+
+    CHECK(hpg_query_ellipse(ctx, 256, HPG_NEST, 1.0, 1.0, 0.1, 0.05, 0.3, 0));
+    npix_nest = hpg_result_npixel(ctx);
+    CHECK(npix_nest > 0);
+    CHECK(hpg_query_ellipse(ctx, 256, HPG_RING, 1.0, 1.0, 0.1, 0.05, 0.3, 0));
+    npix_ring = hpg_result_npixel(ctx);
+    CHECK(npix_ring == npix_nest);
+
+    CHECK(hpg_query_box(ctx, 256, HPG_NEST, 1.0, 1.2, 6.0, 0.2, 0));
+    npix_nest = hpg_result_npixel(ctx);
+    CHECK(npix_nest > 0);
+    CHECK(hpg_query_box(ctx, 256, HPG_RING, 1.0, 1.2, 6.0, 0.2, 0));
+    npix_ring = hpg_result_npixel(ctx);
+    CHECK(npix_ring == npix_nest);
+
+    // Ring results are sorted.
+    int64_t *pixels = malloc(npix_ring * sizeof(int64_t));
+    hpg_result_pixels(ctx, pixels);
+    for (size_t i = 1; i < npix_ring; i++) CHECK(pixels[i] > pixels[i - 1]);
+    free(pixels);
+}
+
+// The multi-order cells of a nest query are sorted, lie within the query
+// ranges, and cover the same number of pixels.
+static void test_query_nuniq(hpg_context *ctx) {
+    int64_t nside = 65536;
+    int order = 16;
+    size_t ncell, nrange;
+    int64_t npix = 0;
+
+    CHECK(hpg_query_disc(ctx, nside, HPG_NEST, 1.0, 1.0, 0.05, 0));
+    const int64_t *ranges = hpg_result_ranges(ctx, &nrange);
+    CHECK(hpg_result_ncell(ctx, &ncell));
+    CHECK(ncell < hpg_result_npixel(ctx) / 100);
+
+    int64_t *nuniq = malloc(ncell * sizeof(int64_t));
+    CHECK(hpg_result_nuniq(ctx, nuniq));
+    for (size_t i = 0; i < ncell; i++) {
+        if (i > 0) CHECK(nuniq[i] > nuniq[i - 1]);
+
+        int cell_order = 0;
+        while ((INT64_C(4) << (2 * (cell_order + 1))) <= nuniq[i]) cell_order++;
+        CHECK(cell_order <= order);
+        int shift = 2 * (order - cell_order);
+        int64_t lo = (nuniq[i] - (INT64_C(4) << (2 * cell_order))) << shift;
+        int64_t hi = lo + (INT64_C(1) << shift);
+        npix += hi - lo;
+
+        size_t low = 0, high = nrange;
+        while (high - low > 1) {
+            size_t mid = (low + high) / 2;
+            if (ranges[2 * mid] <= lo) {
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        CHECK((ranges[2 * low] <= lo) && (hi <= ranges[2 * low + 1]));
+    }
+    CHECK(npix == (int64_t)hpg_result_npixel(ctx));
+    free(nuniq);
+
+    CHECK(hpg_query_disc(ctx, nside, HPG_RING, 1.0, 1.0, 0.05, 0));
+    CHECK(!hpg_result_ncell(ctx, &ncell));
+    CHECK(strstr(hpg_context_error(ctx), "nest") != NULL);
+}
+
+static void test_errors(hpg_context *ctx) {
+    double theta = 1.0, phi = 1.0, bad = NAN;
+    int64_t pix = 0, bad_pix = 12;
+
+    CHECK(!hpg_ang2pix_batch(ctx, 0, HPG_NEST, &theta, &phi, &pix, 1));
+    CHECK(strstr(hpg_context_error(ctx), "must be positive") != NULL);
+    CHECK(!hpg_ang2pix_batch(ctx, 1000, HPG_NEST, &theta, &phi, &pix, 1));
+    CHECK(strstr(hpg_context_error(ctx), "power of 2") != NULL);
+    CHECK(hpg_ang2pix_batch(ctx, 1000, HPG_RING, &theta, &phi, &pix, 1));
+
+    CHECK(!hpg_ang2pix_batch(ctx, 1024, HPG_NEST, &bad, &phi, &pix, 1));
+    CHECK(strstr(hpg_context_error(ctx), "out of range") != NULL);
+    CHECK(!hpg_pix2ang_batch(ctx, 1, HPG_RING, &bad_pix, &theta, &phi, 1));
+    CHECK(strstr(hpg_context_error(ctx), "out of range") != NULL);
+
+    // Vectors with NaN or infinite components, or zero length, are rejected.
+    double vx[4] = {1.0, NAN, INFINITY, 0.0};
+    double vy[4] = {0.0, 0.0, 0.0, 0.0};
+    double vz[4] = {0.0, 0.0, 0.0, 0.0};
+    int64_t vpix[4];
+    for (int i = 1; i < 4; i++) {
+        CHECK(!hpg_vec2pix_batch(ctx, 1024, HPG_NEST, &vx[i], &vy[i], &vz[i], vpix, 1));
+        CHECK(strstr(hpg_context_error(ctx), "must be finite and non-zero") != NULL);
+        CHECK(!hpg_vec2pix_batch(ctx, 1024, HPG_RING, vx, vy, vz, vpix, (size_t)(i + 1)));
+    }
+    CHECK(hpg_vec2pix_batch(ctx, 1024, HPG_RING, vx, vy, vz, vpix, 1));
+
+    CHECK(!hpg_query_disc(ctx, 1024, HPG_NEST, 1.0, 1.0, -1.0, 0));
+    CHECK(!hpg_query_disc(ctx, 1024, HPG_NEST, 1.0, 1.0, 0.1, 3));
+    CHECK(!hpg_query_polygon(ctx, 1024, HPG_NEST, &theta, &phi, 1, 0));
+    CHECK(!hpg_query_box(ctx, 1024, HPG_NEST, 1.2, 1.0, 0.0, 0.1, 0));
+}
+
+int main(void) {
+    hpg_context *ctx = hpg_context_new();
+
+    if (ctx == NULL) {
+        fprintf(stderr, "Failed to create context.\n");
+        return 1;
+    }
+
+    srand(12345);
+    test_roundtrip(ctx, HPG_NEST);
+    test_roundtrip(ctx, HPG_RING);
+    test_reorder(ctx);
+    test_query_disc(ctx, HPG_NEST);
+    test_query_disc(ctx, HPG_RING);
+    test_query_shapes(ctx);
+    test_query_nuniq(ctx);
+    test_errors(ctx);
+
+    hpg_context_delete(ctx);
+
+    if (n_failed) {
+        fprintf(stderr, "%d checks failed.\n", n_failed);
+        return 1;
+    }
+    return 0;
+}
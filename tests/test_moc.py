@@ -0,0 +1,170 @@
+import numpy as np
+import pytest
+
+import hpgeom
+
+
+def _nuniq_to_pixel_ranges(nuniq, nside):
+    """Expand NUNIQ cells to sorted pixel ranges at nside."""
+    nuniq = np.asarray(nuniq, dtype=np.int64)
+    order = np.zeros(len(nuniq), dtype=np.int64)
+    while np.any((4 << (2*(order + 1))) <= nuniq):
+        order[(4 << (2*(order + 1))) <= nuniq] += 1
+    pix = nuniq - (4 << (2*order))
+    shift = 2*(hpgeom.nside_to_order(nside) - order)
+
+    return hpgeom.RangeSet(np.column_stack((pix << shift, (pix + 1) << shift))).ranges
+
+
+def _random_moc(rng, nside, n_ranges):
+    lo = rng.randint(0, hpgeom.nside_to_npixel(nside) - 100, size=n_ranges)
+    hi = lo + rng.randint(0, 100, size=n_ranges)
+
+    return hpgeom.MOC(nside, np.column_stack((lo, hi)))
+
+
+@pytest.mark.parametrize("inclusive", [False, True])
+def test_moc_from_query(inclusive):
+    """Test the multi-order output of the queries."""
+    nside = 2**14
+
+    queries = [
+        (hpgeom.query_circle, (nside, 10.0, 20.0, 1.0)),
+        (hpgeom.query_ellipse, (nside, 10.0, 20.0, 1.0, 0.5, 30.0)),
+        (hpgeom.query_box, (nside, 10.0, 12.0, 20.0, 21.0)),
+        (hpgeom.query_polygon, (nside, [10.0, 12.0, 11.0], [20.0, 21.0, 20.0])),
+    ]
+
+    for query, args in queries:
+        pixel_ranges = query(*args, inclusive=inclusive, return_pixel_ranges=True)
+        moc = query(*args, inclusive=inclusive, return_moc=True)
+
+        assert isinstance(moc, hpgeom.MOC)
+        assert moc.nside == nside
+        assert moc.max_order == hpgeom.nside_to_order(nside)
+        np.testing.assert_array_equal(moc.pixel_ranges, pixel_ranges)
+        assert moc.npix == np.sum(pixel_ranges[:, 1] - pixel_ranges[:, 0])
+
+        # The cells are sorted, far fewer than the pixels, and cover them exactly.
+        nuniq = moc.to_nuniq()
+        assert len(nuniq) == moc.n_cells
+        assert np.all(np.diff(nuniq) > 0)
+        assert moc.n_cells < moc.npix // 10
+        np.testing.assert_array_equal(_nuniq_to_pixel_ranges(nuniq, nside), pixel_ranges)
+
+
+def test_moc_nuniq():
+    """Test creating a MOC from NUNIQ cells."""
+    # Pixel 1 of order 0, the 4 children of pixel 0 of order 0 (which
+    # merge), and an overlapping pixel of order 2.
+    nuniq = np.array([5, 16, 17, 18, 19, 4*16 + 20])
+
+    moc = hpgeom.MOC.from_nuniq(nuniq[::-1])
+    assert moc.nside == 4
+    np.testing.assert_array_equal(moc.to_nuniq(), [4, 5])
+    np.testing.assert_array_equal(moc.pixel_ranges, [[0, 32]])
+
+    moc = hpgeom.MOC.from_nuniq(nuniq, nside=1024)
+    assert moc.nside == 1024
+    np.testing.assert_array_equal(moc.to_nuniq(), [4, 5])
+
+    np.testing.assert_array_equal(hpgeom.MOC.from_nuniq([4*16 + 20]).to_nuniq(), [4*16 + 20])
+
+    empty = hpgeom.MOC.from_nuniq([])
+    assert empty.nside == 1
+    assert empty.n_cells == 0
+    assert not bool(empty)
+    assert len(empty.to_nuniq()) == 0
+    assert len(empty.to_pixels()) == 0
+    assert empty.pixel_ranges.shape == (0, 2)
+
+    moc = hpgeom.query_circle(2**20, 10.0, 20.0, 0.5, return_moc=True)
+    moc2 = hpgeom.MOC.from_nuniq(np.random.permutation(moc.to_nuniq()), nside=2**20)
+    assert moc2 == moc
+    np.testing.assert_array_equal(moc2.pixel_ranges, moc.pixel_ranges)
+
+
+@pytest.mark.parametrize("seed", [1, 2, 3, 4])
+def test_moc_algebra(seed):
+    """Test MOC union and intersection against expanded pixels."""
+    rng = np.random.RandomState(seed)
+
+    a = _random_moc(rng, 64, 20)
+    b = _random_moc(rng, 64, 30)
+    pix_a = a.to_pixels()
+    pix_b = b.to_pixels()
+
+    np.testing.assert_array_equal((a | b).to_pixels(), np.union1d(pix_a, pix_b))
+    np.testing.assert_array_equal(a.union(b).to_pixels(), np.union1d(pix_a, pix_b))
+    np.testing.assert_array_equal((a & b).to_pixels(), np.intersect1d(pix_a, pix_b))
+    np.testing.assert_array_equal(a.intersection(b).to_pixels(), np.intersect1d(pix_a, pix_b))
+
+    # With different resolutions, the result is at the finer resolution.
+    c = _random_moc(rng, 16, 10)
+    pix_c = hpgeom.upgrade_pixels(16, c.to_pixels(), 64)
+
+    union = a | c
+    assert union.nside == 64
+    np.testing.assert_array_equal(union.to_pixels(), np.union1d(pix_a, pix_c))
+    intersection = c & a
+    assert intersection.nside == 64
+    np.testing.assert_array_equal(intersection.to_pixels(), np.intersect1d(pix_a, pix_c))
+
+    assert (a | b) == (b | a)
+    assert (a & a) == a
+    assert a != b
+
+
+@pytest.mark.parametrize("nside_degrade", [1, 4, 32, 64])
+def test_moc_degrade(nside_degrade):
+    """Test degrading a MOC."""
+    rng = np.random.RandomState(12345)
+    moc = _random_moc(rng, 64, 50)
+
+    degraded = moc.degrade(nside_degrade)
+
+    assert degraded.nside == nside_degrade
+    shift = 2*(hpgeom.nside_to_order(64) - hpgeom.nside_to_order(nside_degrade))
+    np.testing.assert_array_equal(degraded.to_pixels(), np.unique(moc.to_pixels() >> shift))
+
+    # The same coverage at a finer resolution compares equal.
+    assert degraded.degrade(nside_degrade) == degraded
+    assert hpgeom.MOC.from_nuniq(degraded.to_nuniq(), nside=64) == degraded
+
+
+def test_moc_badinputs():
+    """Test MOC with bad inputs."""
+    with pytest.raises(ValueError, match=r"power of 2"):
+        hpgeom.MOC(1000)
+
+    with pytest.raises(ValueError, match=r"must be 2D"):
+        hpgeom.MOC(64, np.arange(10))
+
+    with pytest.raises(ValueError, match=r"must all be <="):
+        hpgeom.MOC(64, [[10, 5]])
+
+    with pytest.raises(ValueError, match=r"out of range"):
+        hpgeom.MOC(1, [[0, 13]])
+
+    with pytest.raises(ValueError, match=r"not valid"):
+        hpgeom.MOC.from_nuniq([3])
+
+    with pytest.raises(ValueError, match=r"finer than max_order"):
+        hpgeom.MOC.from_nuniq([4*16 + 20], nside=2)
+
+    moc = hpgeom.MOC(64, [[0, 10]])
+
+    with pytest.raises(ValueError, match=r"must not be larger"):
+        moc.degrade(128)
+
+    with pytest.raises(TypeError, match=r"must be a MOC"):
+        moc.union([[0, 10]])
+
+    with pytest.raises(TypeError):
+        moc | hpgeom.RangeSet([[0, 10]])
+
+    with pytest.raises(ValueError, match=r"return_moc requires nest=True"):
+        hpgeom.query_circle(64, 10.0, 20.0, 1.0, nest=False, return_moc=True)
+
+    with pytest.raises(ValueError, match=r"return_pixel_ranges=False"):
+        hpgeom.query_box(64, 10.0, 12.0, 20.0, 21.0, return_pixel_ranges=True, return_moc=True)
@@ -67,3 +67,23 @@ def test_neighbors_bad_input():
 
     with pytest.raises(ValueError, match=r"nside .* must be positive"):
         hpgeom.neighbors(-1, 100)
+
+
+def test_neighbors_out():
+    """Test neighbors with an out array."""
+    neighbors = hpgeom.neighbors(1024, [100, 200, 300])
+
+    out = np.zeros((3, 8), dtype=np.int64)
+    neighbors2 = hpgeom.neighbors(1024, [100, 200, 300], out=out)
+    assert neighbors2 is out
+    np.testing.assert_array_equal(out, neighbors)
+
+    out = np.zeros(8, dtype=np.int64)
+    hpgeom.neighbors(1024, 100, out=out)
+    np.testing.assert_array_equal(out, neighbors[0, :])
+
+    with pytest.raises(ValueError, match=r"out array must be C-contiguous with shape \(3, 8\)"):
+        hpgeom.neighbors(1024, [100, 200, 300], out=np.zeros((8, 3), dtype=np.int64))
+
+    with pytest.raises(ValueError, match=r"out array must be C-contiguous"):
+        hpgeom.neighbors(1024, [100, 200, 300], out=np.zeros((8, 3), dtype=np.int64).T)
@@ -36,6 +36,26 @@ def test_nest_to_ring_samplepix(nside):
     np.testing.assert_array_equal(nest_pix_hpgeom, nest_pix_healpy)
 
 
+def test_nest_to_ring_mixed_nside():
+    """Test nest_to_ring with mixed nsides and strided input, round-tripping."""
+    np.random.seed(12345)
+
+    nsides = 2**np.arange(30)
+    nside = np.random.choice(nsides, size=100_000)
+    nest_pix = (np.random.uniform(size=nside.size)*12*nside*nside).astype(np.int64)
+
+    ring_pix = hpgeom.nest_to_ring(nside, nest_pix)
+
+    for nside_test in nsides:
+        use, = np.where(nside == nside_test)
+        ring_pix_test = hpgeom.nest_to_ring(nside_test, nest_pix[use])
+        np.testing.assert_array_equal(ring_pix[use], ring_pix_test)
+
+    np.testing.assert_array_equal(hpgeom.ring_to_nest(nside, ring_pix), nest_pix)
+    np.testing.assert_array_equal(hpgeom.nest_to_ring(nside[::3], nest_pix[::3]), ring_pix[::3])
+    np.testing.assert_array_equal(hpgeom.ring_to_nest(nside[::3], ring_pix[::3]), nest_pix[::3])
+
+
 @pytest.mark.parametrize("nside", [2**0, 2**5, 2**10, 2**15, 2**20, 2**25, 2**29])
 def test_nest_to_ring_scalar(nside):
     """Test nest_to_ring for scalars."""
@@ -80,3 +100,51 @@ def test_nest_to_ring_bad_nside():
 
     with pytest.raises(ValueError, match=r"nside .* must be power of 2"):
         hpgeom.nest_to_ring(1020, 100)
+
+
+def test_nest_to_ring_check_false():
+    """Test nest_to_ring with check=False on valid inputs."""
+    np.random.seed(12345)
+
+    pix = np.random.randint(low=0, high=12*1024*1024, size=10_000, dtype=np.int64)
+    pix2 = hpgeom.nest_to_ring(1024, pix)
+    np.testing.assert_array_equal(hpgeom.nest_to_ring(1024, pix, check=False), pix2)
+
+    out = pix.copy()
+    hpgeom.nest_to_ring(1024, out, check=False, out=out)
+    np.testing.assert_array_equal(out, pix2)
+
+    pix[7_777] = 12*1024*1024
+    with pytest.raises(ValueError, match=r"Pixel value .* out of range"):
+        hpgeom.nest_to_ring(1024, pix)
+
+
+def test_nest_to_ring_out():
+    """Test nest_to_ring with an out array, including in place."""
+    np.random.seed(12345)
+
+    nest_pix = np.random.randint(low=0, high=12*1024*1024, size=10_000, dtype=np.int64)
+    ring_pix = hpgeom.nest_to_ring(1024, nest_pix)
+
+    out = np.zeros_like(nest_pix)
+    ring_pix2 = hpgeom.nest_to_ring(1024, nest_pix, out=out)
+    assert ring_pix2 is out
+    np.testing.assert_array_equal(out, ring_pix)
+
+    pix = nest_pix.copy()
+    ring_pix3 = hpgeom.nest_to_ring(1024, pix, out=pix)
+    assert ring_pix3 is pix
+    np.testing.assert_array_equal(pix, ring_pix)
+
+    with pytest.raises(TypeError, match=r"out array must have dtype"):
+        hpgeom.nest_to_ring(1024, nest_pix, out=np.zeros(nest_pix.size, dtype=np.uint64))
+
+    # With mixed nsides, a bad pixel in a later block leaves an in-place
+    # array unchanged.
+    nside = np.where(np.arange(100_000) < 50_000, 1024, 2048)
+    pix = np.random.randint(low=0, high=12*1024*1024, size=100_000, dtype=np.int64)
+    pix[-10] = 12*2048*2048
+    pix_orig = pix.copy()
+    with pytest.raises(ValueError, match=r"Pixel value .* out of range"):
+        hpgeom.nest_to_ring(nside, pix, out=pix)
+    np.testing.assert_array_equal(pix, pix_orig)
@@ -89,3 +89,101 @@ def test_pixel_ranges_bad():
         test = np.zeros((10, 2), dtype=np.int64)
         test[5, 1] = -1
         hpg.pixel_ranges_to_pixels(test)
+
+
+@pytest.mark.parametrize("inclusive", [False, True])
+def test_pixel_ranges_int32(inclusive):
+    """Test pixel_ranges_to_pixels, int32 output."""
+    range1 = np.array(
+        [
+            [0, 10],
+            [30, 40],
+            [2**31 - 20, 2**31 - 2],
+        ]
+    )
+
+    pixels = hpg.pixel_ranges_to_pixels(range1, inclusive=inclusive, dtype=np.int32)
+    pixels_test = _pixel_ranges_to_pixels_numpy(range1, inclusive=inclusive)
+
+    assert pixels.dtype == np.int32
+    np.testing.assert_array_equal(pixels, pixels_test)
+
+    pixels = hpg.pixel_ranges_to_pixels(np.zeros((0, 2), dtype=np.int64), dtype=np.int32)
+    assert pixels.dtype == np.int32
+    assert len(pixels) == 0
+
+    with pytest.raises(ValueError, match=r"do not fit in int32"):
+        hpg.pixel_ranges_to_pixels(np.array([[2**31 - 10, 2**31 + 1]]), dtype=np.int32)
+
+
+@pytest.mark.parametrize("n_threads", [1, 2])
+def test_pixels_in_ranges(n_threads):
+    """Test pixels_in_ranges."""
+    np.random.seed(12345)
+
+    nside = 2048
+    pixel_ranges = hpg.query_circle(nside, 10.0, 20.0, 2.0, return_pixel_ranges=True)
+    pixels_test = _pixel_ranges_to_pixels_numpy(pixel_ranges)
+
+    pixels = np.random.randint(low=pixel_ranges[0, 0] - 1000, high=pixel_ranges[-1, 1] + 1000, size=200_000)
+
+    # Unsorted input.
+    contained = hpg.pixels_in_ranges(pixel_ranges, pixels, n_threads=n_threads)
+    np.testing.assert_array_equal(contained, np.isin(pixels, pixels_test))
+
+    # Sorted input.
+    pixels_sorted = np.sort(pixels)
+    contained = hpg.pixels_in_ranges(pixel_ranges, pixels_sorted, n_threads=n_threads)
+    np.testing.assert_array_equal(contained, np.isin(pixels_sorted, pixels_test))
+
+    # Strided input.
+    contained = hpg.pixels_in_ranges(pixel_ranges, pixels_sorted[::3], n_threads=n_threads)
+    np.testing.assert_array_equal(contained, np.isin(pixels_sorted[::3], pixels_test))
+
+    # RangeSet input.
+    contained = hpg.pixels_in_ranges(hpg.RangeSet(pixel_ranges), pixels, n_threads=n_threads)
+    np.testing.assert_array_equal(contained, np.isin(pixels, pixels_test))
+
+
+def test_pixels_in_ranges_edges():
+    """Test pixels_in_ranges at the range boundaries."""
+    pixel_ranges = np.array(
+        [
+            [0, 10],
+            [10, 20],
+            [25, 25],
+            [30, 40],
+        ]
+    )
+    pixels_test = _pixel_ranges_to_pixels_numpy(pixel_ranges)
+
+    pixels = np.arange(-5, 45)
+    contained = hpg.pixels_in_ranges(pixel_ranges, pixels)
+    np.testing.assert_array_equal(contained, np.isin(pixels, pixels_test))
+
+    contained = hpg.pixels_in_ranges(pixel_ranges, pixels[::-1])
+    np.testing.assert_array_equal(contained, np.isin(pixels[::-1], pixels_test))
+
+    # Scalar input.
+    assert hpg.pixels_in_ranges(pixel_ranges, 10)
+    assert not hpg.pixels_in_ranges(pixel_ranges, 20)
+
+    # Empty ranges and empty pixels.
+    contained = hpg.pixels_in_ranges(np.zeros((0, 2), dtype=np.int64), pixels)
+    assert contained.dtype == bool
+    assert not np.any(contained)
+
+    contained = hpg.pixels_in_ranges(pixel_ranges, np.zeros(0, dtype=np.int64))
+    assert len(contained) == 0
+
+
+def test_pixels_in_ranges_bad():
+    """Test pixels_in_ranges, bad inputs."""
+    with pytest.raises(ValueError, match=r"pixel_ranges must be 2D"):
+        hpg.pixels_in_ranges(np.zeros((10, 3), dtype=np.int64), [0])
+
+    with pytest.raises(ValueError, match=r"must be sorted"):
+        hpg.pixels_in_ranges(np.array([[10, 20], [0, 5]]), [0])
+
+    with pytest.raises(ValueError, match=r"must be sorted"):
+        hpg.pixels_in_ranges(np.array([[10, 5]]), [0])
@@ -103,6 +103,35 @@ def test_pixel_to_angle_scalar(nside):
     assert not isinstance(lat_scalar2, np.ndarray)
 
 
+@pytest.mark.parametrize("nest", [True, False])
+@pytest.mark.parametrize("lonlat", [True, False])
+def test_pixel_to_angle_batch_vs_scalar(nest, lonlat):
+    """Test the contiguous, strided, and mixed nside paths match the scalar path."""
+    np.random.seed(12345)
+
+    nsides = 2**np.arange(30)
+    nside = np.random.choice(nsides, size=5000)
+    pix = (np.random.uniform(size=nside.size)*12*nside.astype(np.float64)**2).astype(np.int64)
+
+    a, b = hpgeom.pixel_to_angle(nside, pix, nest=nest, lonlat=lonlat)
+    a_scalar, b_scalar = np.array(
+        [hpgeom.pixel_to_angle(n, p, nest=nest, lonlat=lonlat) for n, p in zip(nside, pix)]
+    ).T
+    np.testing.assert_array_equal(a, a_scalar)
+    np.testing.assert_array_equal(b, b_scalar)
+
+    # A single nside, with contiguous and strided pixels.
+    pix = np.arange(12*64*64)
+    a, b = hpgeom.pixel_to_angle(64, pix, nest=nest, lonlat=lonlat)
+    a2, b2 = hpgeom.pixel_to_angle(64, pix[::3], nest=nest, lonlat=lonlat)
+    np.testing.assert_array_equal(a2, a[::3])
+    np.testing.assert_array_equal(b2, b[::3])
+
+    a_scalar, b_scalar = hpgeom.pixel_to_angle(64, pix[1000], nest=nest, lonlat=lonlat)
+    assert a[1000] == a_scalar
+    assert b[1000] == b_scalar
+
+
 def test_pixel_to_angle_zerolength():
     """Test pixel_to_angle for a zero-length pixel array."""
     ra, dec = hpgeom.pixel_to_angle(1024, [])
@@ -139,3 +168,72 @@ def test_pixel_to_angle_bad_nside():
 
     with pytest.raises(ValueError, match=r"nside .* must not be greater"):
         hpgeom.pixel_to_angle(2**30, pix, nest=True)
+
+
+@pytest.mark.parametrize("nest", [True, False])
+def test_pixel_to_angle_check_false(nest):
+    """Test pixel_to_angle with check=False on valid inputs."""
+    np.random.seed(12345)
+
+    pix = np.random.randint(low=0, high=12*2048*2048, size=10_000)
+    lon, lat = hpgeom.pixel_to_angle(2048, pix, nest=nest)
+    lon2, lat2 = hpgeom.pixel_to_angle(2048, pix, nest=nest, check=False)
+    np.testing.assert_array_equal(lon2, lon)
+    np.testing.assert_array_equal(lat2, lat)
+
+    x, y, z = hpgeom.pixel_to_vector(2048, pix, nest=nest)
+    x2, y2, z2 = hpgeom.pixel_to_vector(2048, pix, nest=nest, check=False)
+    np.testing.assert_array_equal(x2, x)
+    np.testing.assert_array_equal(y2, y)
+    np.testing.assert_array_equal(z2, z)
+
+    # A single bad value deep in a large array is still found when checking.
+    pix[7_777] = -1
+    with pytest.raises(ValueError, match=r"Pixel value -1 out of range"):
+        hpgeom.pixel_to_angle(2048, pix, nest=nest)
+
+
+def test_pixel_to_angle_out():
+    """Test pixel_to_angle with out arrays."""
+    pix = np.arange(12*64*64)
+
+    lon, lat = hpgeom.pixel_to_angle(64, pix)
+
+    out = (np.zeros(pix.size), np.zeros(pix.size))
+    lon2, lat2 = hpgeom.pixel_to_angle(64, pix, out=out)
+    assert lon2 is out[0]
+    assert lat2 is out[1]
+    np.testing.assert_array_equal(lon2, lon)
+    np.testing.assert_array_equal(lat2, lat)
+
+    with pytest.raises(TypeError, match=r"out must be a tuple of 2 arrays"):
+        hpgeom.pixel_to_angle(64, pix, out=np.zeros(pix.size))
+
+    with pytest.raises(TypeError, match=r"out array must have dtype"):
+        hpgeom.pixel_to_angle(64, pix, out=(np.zeros(pix.size), np.zeros(pix.size, dtype=np.float32)))
+
+
+@pytest.mark.parametrize("nest", [True, False])
+def test_pixel_to_angle_float32(nest):
+    """Test pixel_to_angle with float32 outputs."""
+    pix = np.arange(12*64*64)
+
+    lon, lat = hpgeom.pixel_to_angle(64, pix, nest=nest)
+
+    lon32, lat32 = hpgeom.pixel_to_angle(64, pix, nest=nest, dtype=np.float32)
+    assert lon32.dtype == np.float32
+    assert lat32.dtype == np.float32
+    np.testing.assert_array_equal(lon32, lon.astype(np.float32))
+    np.testing.assert_array_equal(lat32, lat.astype(np.float32))
+
+    out = (np.zeros(pix.size, dtype=np.float32), np.zeros(pix.size, dtype=np.float32))
+    lon2, lat2 = hpgeom.pixel_to_angle(64, pix, nest=nest, dtype=np.float32, out=out)
+    assert lon2 is out[0]
+    np.testing.assert_array_equal(lon2, lon32)
+    np.testing.assert_array_equal(lat2, lat32)
+
+    lon32, lat32 = hpgeom.pixel_to_angle(64, 0, nest=nest, dtype=np.float32)
+    assert isinstance(lon32, np.float32)
+
+    with pytest.raises(ValueError, match=r"dtype must be float32 or float64"):
+        hpgeom.pixel_to_angle(64, pix, dtype=np.int64)
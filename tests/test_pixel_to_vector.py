@@ -82,3 +82,35 @@ def test_pixel_to_vector_bad_nside():
 
     with pytest.raises(ValueError, match=r"nside .* must not be greater than"):
         hpgeom.pixel_to_vector(2**30, pix, nest=True)
+
+
+def test_pixel_to_vector_out():
+    """Test pixel_to_vector with out arrays."""
+    pix = np.arange(12*64*64)
+
+    x, y, z = hpgeom.pixel_to_vector(64, pix)
+
+    out = (np.zeros(pix.size), np.zeros(pix.size), np.zeros(pix.size))
+    x2, y2, z2 = hpgeom.pixel_to_vector(64, pix, out=out)
+    assert x2 is out[0]
+    assert y2 is out[1]
+    assert z2 is out[2]
+    np.testing.assert_array_equal(x2, x)
+    np.testing.assert_array_equal(y2, y)
+    np.testing.assert_array_equal(z2, z)
+
+
+def test_pixel_to_vector_float32():
+    """Test pixel_to_vector with float32 outputs."""
+    pix = np.arange(12*64*64)
+
+    x, y, z = hpgeom.pixel_to_vector(64, pix)
+
+    x32, y32, z32 = hpgeom.pixel_to_vector(64, pix, dtype=np.float32)
+    assert x32.dtype == np.float32
+    np.testing.assert_array_equal(x32, x.astype(np.float32))
+    np.testing.assert_array_equal(y32, y.astype(np.float32))
+    np.testing.assert_array_equal(z32, z.astype(np.float32))
+
+    with pytest.raises(ValueError, match=r"dtype must be float32 or float64"):
+        hpgeom.pixel_to_vector(64, pix, dtype=np.int32)
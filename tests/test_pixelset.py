@@ -0,0 +1,133 @@
+import numpy as np
+import pytest
+
+import hpgeom
+
+
+def _random_pixels(rng, max_pix=2**20):
+    # A mix of sparse pixels, long runs, and dense speckle, so that every
+    # chunk container is used.
+    sparse = rng.randint(0, max_pix, size=2000)
+    runs = np.concatenate([np.arange(lo, lo + rng.randint(1, 100_000))
+                           for lo in rng.randint(0, max_pix, size=5)])
+    dense_lo = rng.randint(0, max_pix - 2**16)
+    dense = dense_lo + np.where(rng.uniform(size=2**16) < 0.5)[0]
+
+    return np.concatenate((sparse, runs, dense))
+
+
+def test_pixelset_basic():
+    """Test creating a PixelSet and converting it."""
+    # Unsorted and repeated pixels, spanning two chunks.
+    pixels = np.array([70000, 5, 3, 4, 5, 65535, 65536])
+    pixelset = hpgeom.PixelSet(pixels)
+
+    expected = np.array([3, 4, 5, 65535, 65536, 70000])
+    np.testing.assert_array_equal(pixelset.to_pixels(), expected)
+    assert pixelset.npix == 6
+    assert pixelset.n_chunks == 2
+    assert bool(pixelset)
+
+    # Ranges are merged across chunk boundaries.
+    rangeset = pixelset.to_rangeset()
+    assert isinstance(rangeset, hpgeom.RangeSet)
+    np.testing.assert_array_equal(rangeset.ranges, [[3, 6], [65535, 65537], [70000, 70001]])
+
+    empty = hpgeom.PixelSet()
+    assert empty.npix == 0
+    assert empty.n_chunks == 0
+    assert not bool(empty)
+    assert len(empty.to_pixels()) == 0
+    assert empty.to_rangeset().n_ranges == 0
+    assert empty == hpgeom.PixelSet([])
+
+
+def test_pixelset_from_query():
+    """Test a PixelSet from a query with return_pixel_ranges."""
+    nside = 4096
+    pixel_ranges = hpgeom.query_circle(nside, 10.0, 20.0, 5.0, return_pixel_ranges=True)
+    pixels = hpgeom.query_circle(nside, 10.0, 20.0, 5.0)
+
+    pixelset = hpgeom.PixelSet.from_pixel_ranges(pixel_ranges)
+
+    np.testing.assert_array_equal(pixelset.to_pixels(), pixels)
+    np.testing.assert_array_equal(pixelset.to_rangeset().ranges, pixel_ranges)
+    assert pixelset == hpgeom.PixelSet(pixels)
+    assert pixelset == hpgeom.PixelSet.from_pixel_ranges(hpgeom.RangeSet(pixel_ranges))
+
+
+@pytest.mark.parametrize("seed", [1, 2, 3, 4])
+def test_pixelset_algebra(seed):
+    """Test PixelSet set operations against expanded pixels."""
+    rng = np.random.RandomState(seed)
+
+    pix_a = np.unique(_random_pixels(rng))
+    pix_b = np.unique(_random_pixels(rng))
+    a = hpgeom.PixelSet(pix_a)
+    b = hpgeom.PixelSet(pix_b)
+
+    np.testing.assert_array_equal(a.to_pixels(), pix_a)
+    np.testing.assert_array_equal((a | b).to_pixels(), np.union1d(pix_a, pix_b))
+    np.testing.assert_array_equal(a.union(b).to_pixels(), np.union1d(pix_a, pix_b))
+    np.testing.assert_array_equal((a & b).to_pixels(), np.intersect1d(pix_a, pix_b))
+    np.testing.assert_array_equal(a.intersection(b).to_pixels(), np.intersect1d(pix_a, pix_b))
+
+    # Results match the same operations on ranges.
+    ra = a.to_rangeset()
+    rb = b.to_rangeset()
+    assert (a | b) == hpgeom.PixelSet.from_pixel_ranges(ra | rb)
+    assert (a & b) == hpgeom.PixelSet.from_pixel_ranges(ra & rb)
+    assert (a | b).to_rangeset() == (ra | rb)
+
+    assert (a | b) == (b | a)
+    assert (a & a) == a
+    assert a != b
+
+    test_pix = np.concatenate((np.arange(-5, 100), rng.randint(0, 2**20, size=10_000)))
+    np.testing.assert_array_equal(a.contains(test_pix), np.isin(test_pix, pix_a))
+    assert a.contains(int(pix_a[0]))
+    assert (int(pix_a[0]) in a)
+    assert (-1 not in a)
+
+
+def test_pixelset_speckled():
+    """Test that a speckled high-resolution mask is stored compactly."""
+    rng = np.random.RandomState(12345)
+    nside = 32768
+
+    # A large region with 10% of its pixels masked at random.
+    pixel_ranges = hpgeom.query_circle(nside, 10.0, 20.0, 1.0, return_pixel_ranges=True)
+    pixels = hpgeom.pixel_ranges_to_pixels(pixel_ranges)
+    pixels = pixels[rng.uniform(size=len(pixels)) > 0.1]
+
+    pixelset = hpgeom.PixelSet(pixels)
+    rangeset = pixelset.to_rangeset()
+
+    np.testing.assert_array_equal(pixelset.to_pixels(), pixels)
+    # Bitmaps need one bit per pixel in each chunk, far less than either the
+    # pixels or the ranges.
+    assert pixelset.nbytes < pixels.nbytes // 20
+    assert pixelset.nbytes < rangeset.ranges.nbytes // 5
+
+
+def test_pixelset_badinputs():
+    """Test PixelSet with bad inputs."""
+    with pytest.raises(ValueError, match=r"must all be >= 0"):
+        hpgeom.PixelSet([-1, 5])
+
+    with pytest.raises(ValueError, match=r"must be 2D"):
+        hpgeom.PixelSet.from_pixel_ranges(np.arange(10))
+
+    with pytest.raises(ValueError, match=r"must all be <="):
+        hpgeom.PixelSet.from_pixel_ranges([[10, 5]])
+
+    with pytest.raises(ValueError, match=r"must all be >= 0"):
+        hpgeom.PixelSet.from_pixel_ranges([[-10, 5]])
+
+    pixelset = hpgeom.PixelSet([0, 10])
+
+    with pytest.raises(TypeError, match=r"must be a PixelSet"):
+        pixelset.union([0, 10])
+
+    with pytest.raises(TypeError):
+        pixelset | 5
@@ -0,0 +1,144 @@
+import numpy as np
+import pytest
+
+import hpgeom
+
+
+def _pixel_centers(nside, pixels_query, margin=2000):
+    """Get a set of test pixels around a query, and their centers."""
+    lo = max(pixels_query.min() - margin, 0)
+    hi = min(pixels_query.max() + margin, hpgeom.nside_to_npixel(nside))
+    pixels = np.arange(lo, hi)
+    lon, lat = hpgeom.pixel_to_angle(nside, pixels)
+
+    return pixels, lon, lat
+
+
+@pytest.mark.parametrize("lon", [0.0, 90.0, 270.0])
+@pytest.mark.parametrize("lat", [-45.0, 0.0, 89.0])
+def test_points_in_circle(lon, lat):
+    """Test points_in_circle against query_circle."""
+    nside = 1024
+    radius = 1.0
+
+    pixels_query = hpgeom.query_circle(nside, lon, lat, radius)
+    pixels, lon_pix, lat_pix = _pixel_centers(nside, pixels_query)
+
+    inside = hpgeom.points_in_circle(lon_pix, lat_pix, lon, lat, radius)
+    np.testing.assert_array_equal(inside, np.isin(pixels, pixels_query))
+
+    # Theta/phi in radians.
+    theta, phi = hpgeom.lonlat_to_thetaphi(lon_pix, lat_pix)
+    theta_c, phi_c = hpgeom.lonlat_to_thetaphi(lon, lat)
+    inside2 = hpgeom.points_in_circle(theta, phi, theta_c, phi_c, np.deg2rad(radius), lonlat=False)
+    np.testing.assert_array_equal(inside2, inside)
+
+    # Threads.
+    inside3 = hpgeom.points_in_circle(lon_pix, lat_pix, lon, lat, radius, n_threads=2)
+    np.testing.assert_array_equal(inside3, inside)
+
+
+@pytest.mark.parametrize("lon", [0.0, 90.0, 270.0])
+@pytest.mark.parametrize("lat", [-45.0, 0.0, 89.0])
+@pytest.mark.parametrize("alpha", [0.0, 45.0])
+def test_points_in_ellipse(lon, lat, alpha):
+    """Test points_in_ellipse against query_ellipse."""
+    nside = 1024
+    semi_major = 1.5
+    semi_minor = 0.5
+
+    pixels_query = hpgeom.query_ellipse(nside, lon, lat, semi_major, semi_minor, alpha)
+    pixels, lon_pix, lat_pix = _pixel_centers(nside, pixels_query)
+
+    inside = hpgeom.points_in_ellipse(lon_pix, lat_pix, lon, lat, semi_major, semi_minor, alpha)
+    np.testing.assert_array_equal(inside, np.isin(pixels, pixels_query))
+
+
+@pytest.mark.parametrize("box", [(10.0, 20.0, -5.0, 5.0),
+                                 (350.0, 10.0, 40.0, 50.0),
+                                 (0.0, 360.0, 80.0, 90.0)])
+def test_points_in_box(box):
+    """Test points_in_box against query_box."""
+    nside = 512
+
+    pixels_query = hpgeom.query_box(nside, *box)
+    pixels, lon_pix, lat_pix = _pixel_centers(nside, pixels_query)
+
+    inside = hpgeom.points_in_box(lon_pix, lat_pix, *box)
+    np.testing.assert_array_equal(inside, np.isin(pixels, pixels_query))
+
+
+def test_points_in_polygon():
+    """Test points_in_polygon against query_polygon."""
+    nside = 1024
+    lon_vert = np.array([10.0, 12.0, 12.5, 10.5])
+    lat_vert = np.array([20.0, 19.5, 22.0, 21.5])
+
+    pixels_query = hpgeom.query_polygon(nside, lon_vert, lat_vert)
+    pixels, lon_pix, lat_pix = _pixel_centers(nside, pixels_query)
+
+    inside = hpgeom.points_in_polygon(lon_pix, lat_pix, lon_vert, lat_vert)
+    np.testing.assert_array_equal(inside, np.isin(pixels, pixels_query))
+
+    # Closed polygon.
+    inside2 = hpgeom.points_in_polygon(
+        lon_pix,
+        lat_pix,
+        np.append(lon_vert, lon_vert[0]),
+        np.append(lat_vert, lat_vert[0]),
+    )
+    np.testing.assert_array_equal(inside2, inside)
+
+
+def test_points_in_shape_scalar_broadcast():
+    """Test points_in_* with scalars and broadcasting."""
+    assert hpgeom.points_in_circle(10.0, 0.0, 10.0, 0.5, 1.0)
+    assert not hpgeom.points_in_circle(10.0, 5.0, 10.0, 0.5, 1.0)
+
+    lon = np.linspace(0.0, 20.0, 21)
+    inside = hpgeom.points_in_box(lon, 0.0, 5.0, 15.0, -1.0, 1.0)
+    np.testing.assert_array_equal(inside, (lon >= 5.0) & (lon <= 15.0))
+
+    lon = np.arange(100.0).reshape(10, 10)
+    inside = hpgeom.points_in_circle(lon, np.zeros(10), 50.0, 0.0, 10.0)
+    assert inside.shape == (10, 10)
+    assert inside.dtype == bool
+
+    inside = hpgeom.points_in_circle(np.zeros(0), np.zeros(0), 50.0, 0.0, 10.0)
+    assert len(inside) == 0
+
+
+def test_points_in_shape_bad():
+    """Test points_in_* with bad inputs."""
+    with pytest.raises(ValueError, match=r"lat .* out of range"):
+        hpgeom.points_in_circle([0.0, 10.0], [0.0, 100.0], 0.0, 0.0, 1.0)
+
+    with pytest.raises(ValueError, match=r"lat .* out of range"):
+        hpgeom.points_in_circle(0.0, 0.0, 0.0, 100.0, 1.0)
+
+    with pytest.raises(ValueError, match=r"could not be broadcast"):
+        hpgeom.points_in_circle(np.zeros(3), np.zeros(4), 0.0, 0.0, 1.0)
+
+    with pytest.raises(ValueError, match=r"Semi-major axis must be"):
+        hpgeom.points_in_ellipse(0.0, 0.0, 0.0, 0.0, 1.0, 2.0, 0.0)
+
+    with pytest.raises(ValueError, match=r"b1/lat1 must be >= b0/lat0"):
+        hpgeom.points_in_box(0.0, 0.0, 0.0, 10.0, 5.0, -5.0)
+
+    with pytest.raises(RuntimeError, match=r"Polygon is not convex"):
+        hpgeom.points_in_polygon(0.0, 0.0, [0.0, 10.0, 0.0, 10.0], [0.0, 0.0, 10.0, 10.0])
+
+    with pytest.raises(RuntimeError, match=r"at least 3 vertices"):
+        hpgeom.points_in_polygon(0.0, 0.0, [0.0, 10.0], [0.0, 0.0])
+
+
+def test_points_in_circle_float32():
+    """Test points_in_circle with float32 inputs."""
+    pixels_query = hpgeom.query_circle(1024, 90.0, 0.0, 1.0)
+    pixels, lon_pix, lat_pix = _pixel_centers(1024, pixels_query)
+    lon32 = lon_pix.astype(np.float32)
+    lat32 = lat_pix.astype(np.float32)
+
+    inside = hpgeom.points_in_circle(lon32, lat32, 90.0, 0.0, 1.0)
+    inside64 = hpgeom.points_in_circle(lon32.astype(np.float64), lat32.astype(np.float64), 90.0, 0.0, 1.0)
+    np.testing.assert_array_equal(inside, inside64)
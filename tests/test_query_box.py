@@ -1,6 +1,5 @@
 import numpy as np
 import pytest
-import warnings
 
 import hpgeom
 
@@ -388,27 +387,32 @@ def test_query_box_thetaphi():
     np.testing.assert_array_equal(pixels_thetaphi, pixels_deg)
 
 
-def test_query_box_ring():
+@pytest.mark.parametrize("box", [[89.0, 91.0, 44.0, 46.0],
+                                 [355.0, 5.0, -5.0, 5.0],
+                                 [0.0, 360.0, 80.0, 90.0],
+                                 [10.0, 350.0, -90.0, 30.0]])
+@pytest.mark.parametrize("inclusive", [False, True])
+def test_query_box_ring(box, inclusive):
     """Test query_box, ring ordering."""
     nside = 1024
-    lon = 90.0
-    lat = 45.0
-    radius = 1.0
-
-    box = [lon - radius, lon + radius, lat - radius, lat + radius]
 
-    with warnings.catch_warnings():
-        warnings.simplefilter("ignore")
-        pixels_ring = hpgeom.query_box(nside, *box, nest=False)
+    pixels_ring = hpgeom.query_box(nside, *box, inclusive=inclusive, nest=False)
 
-    pixels_nest = hpgeom.query_box(nside, *box)
+    pixels_nest = hpgeom.query_box(nside, *box, inclusive=inclusive)
     pixels_nest_to_ring = hpgeom.nest_to_ring(nside, pixels_nest)
     pixels_nest_to_ring.sort()
 
     np.testing.assert_array_equal(pixels_ring, pixels_nest_to_ring)
 
+    pixel_ranges = hpgeom.query_box(nside, *box, inclusive=inclusive, nest=False, return_pixel_ranges=True)
+    np.testing.assert_array_equal(hpgeom.pixel_ranges_to_pixels(pixel_ranges), pixels_nest_to_ring)
+    # The ranges are sorted and disjoint, with no empty or adjacent ranges.
+    assert np.all(pixel_ranges[1:, 0] > pixel_ranges[:-1, 1])
+    assert np.all(pixel_ranges[:, 1] > pixel_ranges[:, 0])
 
-def test_query_box_return_pixel_ranges():
+
+@pytest.mark.parametrize("nest", [True, False])
+def test_query_box_return_pixel_ranges(nest):
     """Test query_box with return_pixel_ranges."""
     nside = 1024
     lon = 90.0
@@ -417,9 +421,9 @@ def test_query_box_return_pixel_ranges():
 
     box = [lon - radius, lon + radius, lat - radius, lat + radius]
 
-    pixels = hpgeom.query_box(nside, *box)
+    pixels = hpgeom.query_box(nside, *box, nest=nest)
 
-    pixel_ranges = hpgeom.query_box(nside, *box, return_pixel_ranges=True)
+    pixel_ranges = hpgeom.query_box(nside, *box, return_pixel_ranges=True, nest=nest)
     pixels_from_ranges = hpgeom.pixel_ranges_to_pixels(pixel_ranges)
 
     assert pixel_ranges.size < pixels.size
@@ -429,8 +433,8 @@ def test_query_box_return_pixel_ranges():
     # And test a tiny box that has no pixels.
     radius = 0.001
     box = [lon - radius, lon + radius, lat - radius, lat + radius]
-    pixels = hpgeom.query_box(nside, *box)
-    pixel_ranges = hpgeom.query_box(nside, *box, return_pixel_ranges=True)
+    pixels = hpgeom.query_box(nside, *box, nest=nest)
+    pixel_ranges = hpgeom.query_box(nside, *box, return_pixel_ranges=True, nest=nest)
     pixels_from_ranges = hpgeom.pixel_ranges_to_pixels(pixel_ranges)
 
     np.testing.assert_array_equal(pixels, pixels_from_ranges)
@@ -472,13 +476,6 @@ def test_query_box_badinputs():
     with pytest.raises(ValueError, match=r"Inclusive factor .* must be power of 2 for nest"):
         hpgeom.query_box(2048, 0.0, 1.0, 0.0, 1.0, inclusive=True, fact=3)
 
-    with pytest.raises(RuntimeError, match=r"Can only use return_pixel_ranges with nest"):
-        hpgeom.query_box(2048, 0.0, 1.0, 0.0, 1.0, nest=False, return_pixel_ranges=True)
-
     # Different platforms have different strings here, but they all say ``integer``.
     with pytest.raises(TypeError, match=r"integer"):
         hpgeom.query_box(2048, 0.0, 1.0, 0.0, 1.0, inclusive=True, nest=False, fact=3.5)
-
-    # Check resource warning
-    with pytest.warns(ResourceWarning, match=r"natively supports nest ordering"):
-        hpgeom.query_box(1024, 0.0, 1.0, 0.0, 1.0, nest=False)
@@ -153,16 +153,17 @@ def test_query_circle_vec():
     np.testing.assert_array_equal(pixels_qcv, pixels_qc)
 
 
-def test_query_circle_return_pixel_ranges():
+@pytest.mark.parametrize("nest", [True, False])
+def test_query_circle_return_pixel_ranges(nest):
     """Test query_circle with return_pixel_ranges."""
     lon = 10.0
     lat = 20.0
     radius = 0.5
     nside = 4096
 
-    pixels = hpgeom.query_circle(nside, lon, lat, radius)
+    pixels = hpgeom.query_circle(nside, lon, lat, radius, nest=nest)
 
-    pixel_ranges = hpgeom.query_circle(nside, lon, lat, radius, return_pixel_ranges=True)
+    pixel_ranges = hpgeom.query_circle(nside, lon, lat, radius, return_pixel_ranges=True, nest=nest)
     pixels_from_ranges = hpgeom.pixel_ranges_to_pixels(pixel_ranges)
 
     assert pixel_ranges.size < pixels.size
@@ -171,8 +172,8 @@ def test_query_circle_return_pixel_ranges():
 
     # And try a tiny circle that has no pixels.
     radius = 0.001
-    pixels = hpgeom.query_circle(nside, lon, lat, radius)
-    pixel_ranges = hpgeom.query_circle(nside, lon, lat, radius, return_pixel_ranges=True)
+    pixels = hpgeom.query_circle(nside, lon, lat, radius, nest=nest)
+    pixel_ranges = hpgeom.query_circle(nside, lon, lat, radius, return_pixel_ranges=True, nest=nest)
     pixels_from_ranges = hpgeom.pixel_ranges_to_pixels(pixel_ranges)
 
     np.testing.assert_array_equal(pixels, pixels_from_ranges)
@@ -221,10 +222,150 @@ def test_query_circle_badinputs():
         # Illegal fact (must be power of 2 for nest)
         hpgeom.query_circle(2048, 0.0, 0.0, 1.0, inclusive=True, fact=3)
 
-    with pytest.raises(RuntimeError, match=r"Can only use return_pixel_ranges with nest"):
-        hpgeom.query_circle(2048, 0.0, 0.0, 1.0, nest=False, return_pixel_ranges=True)
-
     # Different platforms have different strings here, but they all say ``integer``.
     with pytest.raises(TypeError, match=r"integer"):
         # Illegal fact (must be integer)
         hpgeom.query_circle(2048, 0.0, 0.0, 1.0, inclusive=True, nest=False, fact=3.5)
+
+
+@pytest.mark.parametrize("nest", [True, False])
+@pytest.mark.parametrize("inclusive", [True, False])
+@pytest.mark.parametrize("n_threads", [1, 4])
+def test_query_circle_batch(nest, inclusive, n_threads):
+    """Test query_circle_batch against query_circle."""
+    np.random.seed(12345)
+
+    nside = 1024
+    n_query = 100
+    lon = np.random.uniform(0.0, 360.0, n_query)
+    lat = np.random.uniform(-90.0, 90.0, n_query)
+    radius = np.random.uniform(0.01, 1.0, n_query)
+
+    offsets, pixels = hpgeom.query_circle_batch(
+        nside,
+        lon,
+        lat,
+        radius,
+        inclusive=inclusive,
+        nest=nest,
+        n_threads=n_threads,
+    )
+
+    assert offsets.dtype == np.int64
+    assert pixels.dtype == np.int64
+    assert len(offsets) == n_query + 1
+    assert offsets[0] == 0
+    assert offsets[-1] == len(pixels)
+
+    for i in range(n_query):
+        pixels_single = hpgeom.query_circle(
+            nside,
+            lon[i],
+            lat[i],
+            radius[i],
+            inclusive=inclusive,
+            nest=nest,
+        )
+        np.testing.assert_array_equal(pixels[offsets[i]:offsets[i + 1]], pixels_single)
+
+
+def test_query_circle_batch_return_pixel_ranges():
+    """Test query_circle_batch with return_pixel_ranges."""
+    nside = 4096
+    lon = np.array([10.0, 100.0, 200.0])
+    lat = np.array([20.0, -45.0, 89.0])
+
+    # A scalar radius is broadcast to all the circles; the last circle is too
+    # small to contain any pixel centers.
+    offsets, pixels = hpgeom.query_circle_batch(nside, lon, lat, [0.5, 0.5, 0.001])
+    offsets_ranges, pixel_ranges = hpgeom.query_circle_batch(
+        nside,
+        lon,
+        lat,
+        [0.5, 0.5, 0.001],
+        return_pixel_ranges=True,
+    )
+
+    assert pixel_ranges.shape == (offsets_ranges[-1], 2)
+    assert offsets_ranges[-1] == offsets_ranges[-2]
+
+    for i in range(len(lon)):
+        np.testing.assert_array_equal(
+            hpgeom.pixel_ranges_to_pixels(pixel_ranges[offsets_ranges[i]:offsets_ranges[i + 1]]),
+            pixels[offsets[i]:offsets[i + 1]],
+        )
+
+    offsets2, pixels2 = hpgeom.query_circle_batch(nside, lon, lat, 0.5)
+    np.testing.assert_array_equal(offsets2[:3], offsets[:3])
+    np.testing.assert_array_equal(pixels2[:offsets[2]], pixels[:offsets[2]])
+
+    # And no circles at all.
+    offsets, pixels = hpgeom.query_circle_batch(nside, [], [], [])
+    np.testing.assert_array_equal(offsets, [0])
+    assert len(pixels) == 0
+
+
+def test_query_circle_batch_badinputs():
+    """Test query_circle_batch with bad inputs."""
+    with pytest.raises(ValueError, match=r"lat .* out of range"):
+        hpgeom.query_circle_batch(2048, [0.0, 0.0], [0.0, 100.0], 1.0)
+
+    with pytest.raises(ValueError, match=r"Radius must be positive"):
+        hpgeom.query_circle_batch(2048, [0.0, 0.0], [0.0, 0.0], [1.0, 0.0])
+
+    with pytest.raises(ValueError, match=r"could not be broadcast"):
+        hpgeom.query_circle_batch(2048, [0.0, 0.0], [0.0, 0.0, 0.0], 1.0)
+
+
+@pytest.mark.parametrize("nest", [True, False])
+def test_query_circle_int32(nest):
+    """Test query_circle with int32 outputs."""
+    pixels = hpgeom.query_circle(8192, 10.0, 20.0, 0.5, nest=nest)
+
+    pixels32 = hpgeom.query_circle(8192, 10.0, 20.0, 0.5, nest=nest, dtype=np.int32)
+    assert pixels32.dtype == np.int32
+    np.testing.assert_array_equal(pixels32, pixels)
+
+    if nest:
+        ranges = hpgeom.query_circle(8192, 10.0, 20.0, 0.5, return_pixel_ranges=True)
+        ranges32 = hpgeom.query_circle(8192, 10.0, 20.0, 0.5, return_pixel_ranges=True, dtype=np.int32)
+        assert ranges32.dtype == np.int32
+        np.testing.assert_array_equal(ranges32, ranges)
+
+    with pytest.raises(ValueError, match=r"too large for int32"):
+        hpgeom.query_circle(16384, 10.0, 20.0, 0.5, nest=nest, dtype=np.int32)
+
+
+@pytest.mark.parametrize("n_threads", [1, 4])
+def test_query_circle_batch_int32(n_threads):
+    """Test query_circle_batch with int32 outputs."""
+    np.random.seed(12345)
+    lon = np.random.uniform(0.0, 360.0, size=100)
+    lat = np.random.uniform(-80.0, 80.0, size=100)
+
+    offsets, pixels = hpgeom.query_circle_batch(8192, lon, lat, 0.1, n_threads=n_threads)
+    offsets32, pixels32 = hpgeom.query_circle_batch(8192, lon, lat, 0.1, n_threads=n_threads,
+                                                    dtype=np.int32)
+    assert offsets32.dtype == np.int64
+    assert pixels32.dtype == np.int32
+    np.testing.assert_array_equal(offsets32, offsets)
+    np.testing.assert_array_equal(pixels32, pixels)
+
+    offsets, ranges = hpgeom.query_circle_batch(8192, lon, lat, 0.1, return_pixel_ranges=True,
+                                                n_threads=n_threads)
+    offsets32, ranges32 = hpgeom.query_circle_batch(8192, lon, lat, 0.1, return_pixel_ranges=True,
+                                                    n_threads=n_threads, dtype=np.int32)
+    assert ranges32.dtype == np.int32
+    np.testing.assert_array_equal(ranges32, ranges)
+
+    union = hpgeom.query_circle_batch(8192, lon, lat, 0.1, return_union=True, n_threads=n_threads)
+    union32 = hpgeom.query_circle_batch(8192, lon, lat, 0.1, return_union=True, n_threads=n_threads,
+                                        dtype=np.int32)
+    assert union32.dtype == np.int32
+    np.testing.assert_array_equal(union32, union)
+
+    with pytest.raises(ValueError, match=r"too large for int32"):
+        hpgeom.query_circle_batch(16384, lon, lat, 0.1, dtype=np.int32)
+
+    with pytest.raises(ValueError, match=r"dtype must be int32 or int64"):
+        hpgeom.query_circle_batch(8192, lon, lat, 0.1, dtype=np.float64)
@@ -0,0 +1,135 @@
+import threading
+
+import numpy as np
+import pytest
+
+import hpgeom
+
+
+@pytest.mark.parametrize("nside", [1, 64, 2**15])
+@pytest.mark.parametrize("nest", [True, False])
+@pytest.mark.parametrize("inclusive", [False, True])
+def test_query_context_matches_functions(nside, nest, inclusive):
+    """Test that QueryContext queries match the module query functions."""
+    context = hpgeom.QueryContext(nside, nest=nest, inclusive=inclusive, fact=4)
+    kwargs = {"nest": nest, "inclusive": inclusive, "fact": 4}
+
+    rng = np.random.RandomState(12345)
+    for _ in range(10):
+        lon = rng.uniform(0.0, 350.0)
+        lat = rng.uniform(-85.0, 85.0)
+        radius = rng.uniform(0.01, 5.0)
+
+        np.testing.assert_array_equal(
+            context.query_circle(lon, lat, radius),
+            hpgeom.query_circle(nside, lon, lat, radius, **kwargs),
+        )
+        np.testing.assert_array_equal(
+            context.query_ellipse(lon, lat, radius, radius/2., 30.0),
+            hpgeom.query_ellipse(nside, lon, lat, radius, radius/2., 30.0, **kwargs),
+        )
+        np.testing.assert_array_equal(
+            context.query_box(lon, lon + radius, lat - radius, lat + radius),
+            hpgeom.query_box(nside, lon, lon + radius, lat - radius, lat + radius, **kwargs),
+        )
+        poly_lon = np.array([lon, lon + radius, lon + radius, lon]) % 360.0
+        poly_lat = np.array([lat, lat, lat + radius, lat + radius])
+        np.testing.assert_array_equal(
+            context.query_polygon(poly_lon, poly_lat),
+            hpgeom.query_polygon(nside, poly_lon, poly_lat, **kwargs),
+        )
+
+
+@pytest.mark.parametrize("nest", [True, False])
+def test_query_context_ranges(nest):
+    """Test QueryContext queries returning pixel ranges and radians."""
+    nside = 2048
+    context = hpgeom.QueryContext(nside, nest=nest)
+
+    theta, phi = 1.0, 2.0
+    pixel_ranges = context.query_circle(theta, phi, 0.05, lonlat=False, return_pixel_ranges=True)
+    np.testing.assert_array_equal(
+        pixel_ranges,
+        hpgeom.query_circle(nside, theta, phi, 0.05, nest=nest, lonlat=False, return_pixel_ranges=True),
+    )
+    np.testing.assert_array_equal(
+        hpgeom.pixel_ranges_to_pixels(pixel_ranges),
+        context.query_circle(theta, phi, 0.05, lonlat=False),
+    )
+
+    pixel_ranges = context.query_box(10.0, 20.0, 5.0, 15.0, return_pixel_ranges=True)
+    np.testing.assert_array_equal(
+        pixel_ranges,
+        hpgeom.query_box(nside, 10.0, 20.0, 5.0, 15.0, nest=nest, return_pixel_ranges=True),
+    )
+    # Ring ranges are sorted.
+    assert np.all(pixel_ranges[1:, 0] > pixel_ranges[:-1, 1])
+
+
+def test_query_context_attributes():
+    """Test the QueryContext attributes."""
+    context = hpgeom.QueryContext(1024, nest=False, inclusive=True, fact=3)
+    assert context.nside == 1024
+    assert not context.nest
+    assert context.inclusive
+    assert context.fact == 3
+    assert "nside=1024" in repr(context)
+
+    with pytest.raises(AttributeError):
+        context.nside = 2048
+
+    # The inclusive factor is not used for non-inclusive queries.
+    context = hpgeom.QueryContext(1024, fact=3)
+    assert context.fact == 0
+
+
+def test_query_context_threads():
+    """Test that separate QueryContexts may be used in parallel."""
+    nside = 4096
+    expected = hpgeom.query_circle(nside, 30.0, 40.0, 2.0)
+    results = [None]*4
+
+    def run(i):
+        context = hpgeom.QueryContext(nside)
+        for _ in range(5):
+            results[i] = context.query_circle(30.0, 40.0, 2.0)
+
+    threads = [threading.Thread(target=run, args=(i, )) for i in range(len(results))]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    for result in results:
+        np.testing.assert_array_equal(result, expected)
+
+
+def test_query_context_bad():
+    """Test QueryContext with bad inputs."""
+    with pytest.raises(ValueError, match=r"must be power of 2"):
+        hpgeom.QueryContext(1000)
+    with pytest.raises(ValueError, match=r"must be positive"):
+        hpgeom.QueryContext(0, nest=False)
+    with pytest.raises(ValueError, match=r"must be power of 2 for nest"):
+        hpgeom.QueryContext(1024, inclusive=True, fact=3)
+
+    # Ellipses and boxes run with nest ordering.
+    context = hpgeom.QueryContext(1000, nest=False)
+    context.query_circle(0.0, 0.0, 1.0)
+    with pytest.raises(ValueError, match=r"must be power of 2"):
+        context.query_ellipse(0.0, 0.0, 1.0, 0.5, 0.0)
+    with pytest.raises(ValueError, match=r"must be power of 2"):
+        context.query_box(0.0, 1.0, 0.0, 1.0)
+    context = hpgeom.QueryContext(1024, nest=False, inclusive=True, fact=3)
+    with pytest.raises(ValueError, match=r"must be power of 2 for nest"):
+        context.query_box(0.0, 1.0, 0.0, 1.0)
+
+    context = hpgeom.QueryContext(1024)
+    with pytest.raises(ValueError, match=r"out of range"):
+        context.query_circle(0.0, 100.0, 1.0)
+    with pytest.raises(ValueError, match=r"Radius must be positive"):
+        context.query_circle(0.0, 0.0, -1.0)
+    with pytest.raises(ValueError, match=r"Semi-major"):
+        context.query_ellipse(0.0, 0.0, 0.5, 1.0, 0.0)
+    with pytest.raises(RuntimeError, match=r"at least 3 vertices"):
+        context.query_polygon([0.0, 1.0], [0.0, 1.0])
@@ -1,6 +1,5 @@
 import numpy as np
 import pytest
-import warnings
 
 import hpgeom
 
@@ -41,27 +40,23 @@ def test_query_ellipse_circle_ring(nside_radius, lon, lat):
     radius = nside_radius[1]
 
     # First, non-inclusive
-    with warnings.catch_warnings():
-        warnings.simplefilter("ignore")
-        pixels_ellipse = hpgeom.query_ellipse(nside, lon, lat, radius, radius, 0.0, nest=False)
+    pixels_ellipse = hpgeom.query_ellipse(nside, lon, lat, radius, radius, 0.0, nest=False)
 
     pixels_circle = hpgeom.query_circle(nside, lon, lat, radius, nest=False)
 
     np.testing.assert_array_equal(pixels_ellipse, pixels_circle)
 
     # Second, inclusive.
-    with warnings.catch_warnings():
-        warnings.simplefilter("ignore")
-        pixels_ellipse = hpgeom.query_ellipse(
-            nside,
-            lon,
-            lat,
-            radius,
-            radius,
-            0.0,
-            inclusive=True,
-            nest=False
-        )
+    pixels_ellipse = hpgeom.query_ellipse(
+        nside,
+        lon,
+        lat,
+        radius,
+        radius,
+        0.0,
+        inclusive=True,
+        nest=False
+    )
 
     pixels_circle = hpgeom.query_circle(nside, lon, lat, radius, inclusive=True, nest=False)
 
@@ -251,7 +246,8 @@ def test_query_ellipse_fact(fact):
     assert sub1.size >= int(0.9*pixels_circle_ellipse.size)
 
 
-def test_query_ellipse_return_pixel_ranges():
+@pytest.mark.parametrize("nest", [True, False])
+def test_query_ellipse_return_pixel_ranges(nest):
     """Test query_ellipse with return_pixel_ranges."""
     nside = 1024
     lon = 90.0
@@ -260,9 +256,11 @@ def test_query_ellipse_return_pixel_ranges():
     minor = 1.0
     alpha = 75.0
 
-    pixels = hpgeom.query_ellipse(nside, lon, lat, major, minor, alpha)
+    pixels = hpgeom.query_ellipse(nside, lon, lat, major, minor, alpha, nest=nest)
 
-    pixel_ranges = hpgeom.query_ellipse(nside, lon, lat, major, minor, alpha, return_pixel_ranges=True)
+    pixel_ranges = hpgeom.query_ellipse(
+        nside, lon, lat, major, minor, alpha, return_pixel_ranges=True, nest=nest
+    )
     pixels_from_ranges = hpgeom.pixel_ranges_to_pixels(pixel_ranges)
 
     assert pixel_ranges.size < pixels.size
@@ -272,8 +270,10 @@ def test_query_ellipse_return_pixel_ranges():
     # And try a tiny ellipse that has no pixels.
     major = 0.001
     minor = 0.0005
-    pixels = hpgeom.query_ellipse(nside, lon, lat, major, minor, alpha)
-    pixel_ranges = hpgeom.query_ellipse(nside, lon, lat, major, minor, alpha, return_pixel_ranges=True)
+    pixels = hpgeom.query_ellipse(nside, lon, lat, major, minor, alpha, nest=nest)
+    pixel_ranges = hpgeom.query_ellipse(
+        nside, lon, lat, major, minor, alpha, return_pixel_ranges=True, nest=nest
+    )
     pixels_from_ranges = hpgeom.pixel_ranges_to_pixels(pixel_ranges)
 
     np.testing.assert_array_equal(pixels, pixels_from_ranges)
@@ -330,14 +330,7 @@ def test_query_ellipse_badinputs():
         # Illegal fact (must be power of 2 for nest)
         hpgeom.query_ellipse(2048, 0.0, 0.0, 1.0, 0.5, 0.0, inclusive=True, fact=3)
 
-    with pytest.raises(RuntimeError, match=r"Can only use return_pixel_ranges with nest"):
-        hpgeom.query_ellipse(2048, 0.0, 0.0, 1.0, 0.5, 0.0, nest=False, return_pixel_ranges=True)
-
     # Different platforms have different strings here, but they all say ``integer``.
     with pytest.raises(TypeError, match=r"integer"):
         # Illegal fact (must be integer)
         hpgeom.query_ellipse(2048, 0.0, 0.0, 1.0, 0.5, 0.0, inclusive=True, nest=False, fact=3.5)
-
-    # Check resource warning
-    with pytest.warns(ResourceWarning, match=r"natively supports nest ordering"):
-        hpgeom.query_ellipse(1024, 0.0, 1.0, 0.5, 0.5, 0.0, nest=False)
@@ -204,7 +204,8 @@ def test_query_polygon_vec():
     np.testing.assert_array_equal(pixels_lonlat, pixels_vec)
 
 
-def test_query_polygon_return_pixel_ranges():
+@pytest.mark.parametrize("nest", [True, False])
+def test_query_polygon_return_pixel_ranges(nest):
     """Test query_polygon with return_pixel_ranges."""
     nside = 1024
     delta = 1.0
@@ -213,9 +214,9 @@ def test_query_polygon_return_pixel_ranges():
     lon = np.array([lon_ref, lon_ref + delta, lon_ref + delta, lon_ref])
     lat = np.array([lat_ref, lat_ref, lat_ref + delta, lat_ref + delta])
 
-    pixels = hpgeom.query_polygon(nside, lon, lat)
+    pixels = hpgeom.query_polygon(nside, lon, lat, nest=nest)
 
-    pixel_ranges = hpgeom.query_polygon(nside, lon, lat, return_pixel_ranges=True)
+    pixel_ranges = hpgeom.query_polygon(nside, lon, lat, return_pixel_ranges=True, nest=nest)
     pixels_from_ranges = hpgeom.pixel_ranges_to_pixels(pixel_ranges)
 
     assert pixel_ranges.size < pixels.size
@@ -227,8 +228,8 @@ def test_query_polygon_return_pixel_ranges():
     lon = np.array([lon_ref, lon_ref + delta, lon_ref + delta, lon_ref])
     lat = np.array([lat_ref, lat_ref, lat_ref + delta, lat_ref + delta])
 
-    pixels = hpgeom.query_polygon(nside, lon, lat)
-    pixel_ranges = hpgeom.query_polygon(nside, lon, lat, return_pixel_ranges=True)
+    pixels = hpgeom.query_polygon(nside, lon, lat, nest=nest)
+    pixel_ranges = hpgeom.query_polygon(nside, lon, lat, return_pixel_ranges=True, nest=nest)
     pixels_from_ranges = hpgeom.pixel_ranges_to_pixels(pixel_ranges)
 
     np.testing.assert_array_equal(pixels, pixels_from_ranges)
@@ -278,5 +279,164 @@ def test_query_polygon_badinputs():
         # Illegal fact (must be integer)
         hpgeom.query_polygon(nside, lon, lat, inclusive=True, nest=False, fact=3.5)
 
-    with pytest.raises(RuntimeError, match=r"Can only use return_pixel_ranges with nest"):
-        hpgeom.query_polygon(nside, lon, lat, nest=False, return_pixel_ranges=True)
+
+def _make_ccd_polygons(n_poly, seed=12345):
+    """Make a set of small squares and triangles, with ragged vertex offsets."""
+    rng = np.random.RandomState(seed)
+
+    lon = []
+    lat = []
+    offsets = [0]
+    for i in range(n_poly):
+        lon_ref = rng.uniform(0.0, 360.0)
+        lat_ref = rng.uniform(-60.0, 60.0)
+        delta = rng.uniform(0.1, 0.5)
+        if i % 2 == 0:
+            lon.extend([lon_ref, lon_ref + delta, lon_ref + delta, lon_ref])
+            lat.extend([lat_ref, lat_ref, lat_ref + delta, lat_ref + delta])
+        else:
+            lon.extend([lon_ref, lon_ref + delta, lon_ref + delta])
+            lat.extend([lat_ref, lat_ref + delta, lat_ref - delta])
+        offsets.append(len(lon))
+
+    return np.array(lon), np.array(lat), np.array(offsets)
+
+
+@pytest.mark.parametrize("nest", [True, False])
+@pytest.mark.parametrize("inclusive", [True, False])
+@pytest.mark.parametrize("n_threads", [1, 4])
+def test_query_polygon_batch(nest, inclusive, n_threads):
+    """Test query_polygon_batch against query_polygon."""
+    nside = 1024
+    n_poly = 100
+    lon, lat, offsets = _make_ccd_polygons(n_poly)
+
+    pixel_offsets, pixels = hpgeom.query_polygon_batch(
+        nside,
+        lon,
+        lat,
+        offsets,
+        inclusive=inclusive,
+        nest=nest,
+        n_threads=n_threads,
+    )
+
+    assert len(pixel_offsets) == n_poly + 1
+    assert pixel_offsets[-1] == len(pixels)
+
+    pixels_all = []
+    for i in range(n_poly):
+        pixels_single = hpgeom.query_polygon(
+            nside,
+            lon[offsets[i]:offsets[i + 1]],
+            lat[offsets[i]:offsets[i + 1]],
+            inclusive=inclusive,
+            nest=nest,
+        )
+        np.testing.assert_array_equal(pixels[pixel_offsets[i]:pixel_offsets[i + 1]], pixels_single)
+        pixels_all.append(pixels_single)
+
+    # And the union of all the polygons.
+    pixels_union = hpgeom.query_polygon_batch(
+        nside,
+        lon,
+        lat,
+        offsets,
+        inclusive=inclusive,
+        nest=nest,
+        return_union=True,
+        n_threads=n_threads,
+    )
+    np.testing.assert_array_equal(pixels_union, np.unique(np.concatenate(pixels_all)))
+
+    if nest:
+        pixel_ranges_union = hpgeom.query_polygon_batch(
+            nside,
+            lon,
+            lat,
+            offsets,
+            inclusive=inclusive,
+            return_pixel_ranges=True,
+            return_union=True,
+            n_threads=n_threads,
+        )
+        assert pixel_ranges_union.shape[1] == 2
+        np.testing.assert_array_equal(hpgeom.pixel_ranges_to_pixels(pixel_ranges_union), pixels_union)
+
+
+@pytest.mark.parametrize("n_threads", [1, 4])
+def test_query_polygon_batch_int32(n_threads):
+    """Test query_polygon_batch with int32 outputs."""
+    lon, lat, offsets = _make_ccd_polygons(100)
+
+    pixel_offsets, pixels = hpgeom.query_polygon_batch(8192, lon, lat, offsets, n_threads=n_threads)
+    pixel_offsets32, pixels32 = hpgeom.query_polygon_batch(8192, lon, lat, offsets,
+                                                           n_threads=n_threads, dtype=np.int32)
+    assert pixel_offsets32.dtype == np.int64
+    assert pixels32.dtype == np.int32
+    np.testing.assert_array_equal(pixel_offsets32, pixel_offsets)
+    np.testing.assert_array_equal(pixels32, pixels)
+
+    ranges_union = hpgeom.query_polygon_batch(8192, lon, lat, offsets, return_pixel_ranges=True,
+                                              return_union=True, n_threads=n_threads)
+    ranges_union32 = hpgeom.query_polygon_batch(8192, lon, lat, offsets, return_pixel_ranges=True,
+                                                return_union=True, n_threads=n_threads,
+                                                dtype=np.int32)
+    assert ranges_union32.dtype == np.int32
+    np.testing.assert_array_equal(ranges_union32, ranges_union)
+
+    with pytest.raises(ValueError, match=r"too large for int32"):
+        hpgeom.query_polygon_batch(16384, lon, lat, offsets, dtype=np.int32)
+
+
+def test_query_polygon_batch_closed():
+    """Test query_polygon_batch with closed polygons and no polygons."""
+    nside = 2048
+    lon = np.array([10.0, 11.0, 11.0, 10.0, 10.0, 20.0, 21.0, 21.0])
+    lat = np.array([20.0, 20.0, 21.0, 21.0, 20.0, 20.0, 21.0, 19.0])
+    offsets = np.array([0, 5, 8])
+
+    pixel_offsets, pixels = hpgeom.query_polygon_batch(nside, lon, lat, offsets)
+
+    np.testing.assert_array_equal(
+        pixels[pixel_offsets[0]:pixel_offsets[1]],
+        hpgeom.query_polygon(nside, lon[:4], lat[:4]),
+    )
+    np.testing.assert_array_equal(
+        pixels[pixel_offsets[1]:pixel_offsets[2]],
+        hpgeom.query_polygon(nside, lon[5:], lat[5:]),
+    )
+
+    pixel_offsets, pixels = hpgeom.query_polygon_batch(nside, [], [], [0])
+    np.testing.assert_array_equal(pixel_offsets, [0])
+    assert len(pixels) == 0
+
+
+def test_query_polygon_batch_badinputs():
+    """Test query_polygon_batch with bad inputs."""
+    lon, lat, offsets = _make_ccd_polygons(10)
+
+    with pytest.raises(ValueError, match=r"offsets must be non-decreasing"):
+        hpgeom.query_polygon_batch(2048, lon, lat, offsets[1:])
+
+    with pytest.raises(ValueError, match=r"offsets must be non-decreasing"):
+        hpgeom.query_polygon_batch(2048, lon, lat, offsets[::-1])
+
+    with pytest.raises(ValueError, match=r"a and b arrays must be the same length"):
+        hpgeom.query_polygon_batch(2048, lon, lat[:-1], offsets)
+
+    lat_bad = lat.copy()
+    lat_bad[5] = 100.0
+    with pytest.raises(ValueError, match=r"lat .* out of range"):
+        hpgeom.query_polygon_batch(2048, lon, lat_bad, offsets)
+
+    # Polygon 3 is degenerate.
+    lat_bad = lat.copy()
+    lon_bad = lon.copy()
+    lon_bad[offsets[3] + 1] = lon_bad[offsets[3]]
+    lat_bad[offsets[3] + 1] = lat_bad[offsets[3]]
+    with pytest.raises(RuntimeError, match=r"Polygon 3: Polygon has degenerate corner"):
+        hpgeom.query_polygon_batch(2048, lon_bad, lat_bad, offsets)
+
+    with pytest.raises(RuntimeError, match=r"Polygon 1: Polygon must have at least 3 vertices"):
+        hpgeom.query_polygon_batch(2048, lon, lat, [0, 4, 6, len(lon)])
@@ -0,0 +1,111 @@
+import numpy as np
+import pytest
+
+import hpgeom
+
+
+def _random_ranges(rng, n_ranges, max_pix=1000):
+    lo = rng.randint(0, max_pix, size=n_ranges)
+    hi = lo + rng.randint(0, 50, size=n_ranges)
+
+    return np.column_stack((lo, hi))
+
+
+def test_rangeset_basic():
+    """Test creating a RangeSet and accessing the ranges."""
+    # Unsorted, overlapping, touching and empty ranges.
+    pixel_ranges = np.array([[20, 30], [0, 10], [5, 12], [12, 15], [40, 40]])
+    rangeset = hpgeom.RangeSet(pixel_ranges)
+
+    expected = np.array([[0, 15], [20, 30]])
+    np.testing.assert_array_equal(rangeset.ranges, expected)
+    np.testing.assert_array_equal(np.asarray(rangeset), expected)
+    assert rangeset.n_ranges == 2
+    assert rangeset.npix == 25
+    assert bool(rangeset)
+    np.testing.assert_array_equal(rangeset.to_pixels(), hpgeom.pixel_ranges_to_pixels(expected))
+
+    # The ranges are a read-only view of the set.
+    ranges = rangeset.ranges
+    assert not ranges.flags.writeable
+    with pytest.raises(ValueError):
+        ranges[0, 0] = 1
+
+    empty = hpgeom.RangeSet()
+    assert empty.n_ranges == 0
+    assert empty.npix == 0
+    assert not bool(empty)
+    assert empty.ranges.shape == (0, 2)
+    assert len(empty.to_pixels()) == 0
+
+
+def test_rangeset_from_query():
+    """Test a RangeSet from a query with return_pixel_ranges."""
+    nside = 4096
+    pixel_ranges = hpgeom.query_circle(nside, 10.0, 20.0, 0.5, return_pixel_ranges=True)
+    pixels = hpgeom.query_circle(nside, 10.0, 20.0, 0.5)
+
+    rangeset = hpgeom.RangeSet(pixel_ranges)
+
+    np.testing.assert_array_equal(rangeset.ranges, pixel_ranges)
+    np.testing.assert_array_equal(rangeset.to_pixels(), pixels)
+    assert rangeset.npix == len(pixels)
+
+
+@pytest.mark.parametrize("seed", [1, 2, 3, 4])
+def test_rangeset_algebra(seed):
+    """Test RangeSet set operations against expanded pixels."""
+    rng = np.random.RandomState(seed)
+    npix = 1100
+
+    a = hpgeom.RangeSet(_random_ranges(rng, 20))
+    b = hpgeom.RangeSet(_random_ranges(rng, 30))
+    pix_a = a.to_pixels()
+    pix_b = b.to_pixels()
+
+    np.testing.assert_array_equal((a | b).to_pixels(), np.union1d(pix_a, pix_b))
+    np.testing.assert_array_equal(a.union(b).to_pixels(), np.union1d(pix_a, pix_b))
+    np.testing.assert_array_equal((a & b).to_pixels(), np.intersect1d(pix_a, pix_b))
+    np.testing.assert_array_equal(a.intersection(b).to_pixels(), np.intersect1d(pix_a, pix_b))
+    np.testing.assert_array_equal((a - b).to_pixels(), np.setdiff1d(pix_a, pix_b))
+    np.testing.assert_array_equal(a.difference(b).to_pixels(), np.setdiff1d(pix_a, pix_b))
+    np.testing.assert_array_equal((a ^ b).to_pixels(), np.setxor1d(pix_a, pix_b))
+    np.testing.assert_array_equal(
+        a.symmetric_difference(b).to_pixels(),
+        np.setxor1d(pix_a, pix_b),
+    )
+    np.testing.assert_array_equal(
+        a.complement(npix).to_pixels(),
+        np.setdiff1d(np.arange(npix), pix_a),
+    )
+
+    assert (a | b) == (b | a)
+    assert (a - b) != (b - a) or (a == b)
+    assert (a & a) == a
+    assert not (a - a)
+
+    test_pix = np.arange(-5, npix + 5)
+    np.testing.assert_array_equal(a.contains(test_pix), np.isin(test_pix, pix_a))
+    assert a.contains(int(pix_a[0]))
+    assert (int(pix_a[0]) in a)
+    assert (-1 not in a)
+
+
+def test_rangeset_badinputs():
+    """Test RangeSet with bad inputs."""
+    with pytest.raises(ValueError, match=r"must be 2D"):
+        hpgeom.RangeSet(np.arange(10))
+
+    with pytest.raises(ValueError, match=r"must all be <="):
+        hpgeom.RangeSet([[10, 5]])
+
+    rangeset = hpgeom.RangeSet([[0, 10]])
+
+    with pytest.raises(TypeError, match=r"must be a RangeSet"):
+        rangeset.union([[0, 10]])
+
+    with pytest.raises(TypeError):
+        rangeset | 5
+
+    with pytest.raises(ValueError, match=r"npix must be >= 0"):
+        rangeset.complement(-1)
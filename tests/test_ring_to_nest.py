@@ -80,3 +80,50 @@ def test_ring_to_nest_bad_nside():
 
     with pytest.raises(ValueError, match=r"nside .* must be power of 2"):
         hpgeom.ring_to_nest(1020, 100)
+
+
+def test_ring_to_nest_check_false():
+    """Test ring_to_nest with check=False on valid inputs."""
+    np.random.seed(12345)
+
+    pix = np.random.randint(low=0, high=12*1024*1024, size=10_000, dtype=np.int64)
+    pix2 = hpgeom.ring_to_nest(1024, pix)
+    np.testing.assert_array_equal(hpgeom.ring_to_nest(1024, pix, check=False), pix2)
+
+    out = pix.copy()
+    hpgeom.ring_to_nest(1024, out, check=False, out=out)
+    np.testing.assert_array_equal(out, pix2)
+
+    pix[7_777] = 12*1024*1024
+    with pytest.raises(ValueError, match=r"Pixel value .* out of range"):
+        hpgeom.ring_to_nest(1024, pix)
+
+
+def test_ring_to_nest_out():
+    """Test ring_to_nest with an out array, including in place."""
+    np.random.seed(12345)
+
+    ring_pix = np.random.randint(low=0, high=12*1024*1024, size=10_000, dtype=np.int64)
+    nest_pix = hpgeom.ring_to_nest(1024, ring_pix)
+
+    out = np.zeros_like(ring_pix)
+    nest_pix2 = hpgeom.ring_to_nest(1024, ring_pix, out=out)
+    assert nest_pix2 is out
+    np.testing.assert_array_equal(out, nest_pix)
+
+    pix = ring_pix.copy()
+    hpgeom.ring_to_nest(1024, pix, out=pix)
+    np.testing.assert_array_equal(pix, nest_pix)
+
+    with pytest.raises(ValueError):
+        hpgeom.ring_to_nest(1024, ring_pix, out=np.zeros(10, dtype=np.int64))
+
+    # With mixed nsides, a bad pixel in a later block leaves an in-place
+    # array unchanged.
+    nside = np.where(np.arange(100_000) < 50_000, 1024, 2048)
+    pix = np.random.randint(low=0, high=12*1024*1024, size=100_000, dtype=np.int64)
+    pix[-10] = 12*2048*2048
+    pix_orig = pix.copy()
+    with pytest.raises(ValueError, match=r"Pixel value .* out of range"):
+        hpgeom.ring_to_nest(nside, pix, out=pix)
+    np.testing.assert_array_equal(pix, pix_orig)
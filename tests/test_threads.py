@@ -0,0 +1,171 @@
+import threading
+
+import numpy as np
+import pytest
+
+import hpgeom
+
+
+@pytest.mark.parametrize("nside", [2**5, 2**10 - 100, 2**29])
+@pytest.mark.parametrize("nest", [True, False])
+@pytest.mark.parametrize("n_threads", [2, 3, 8])
+def test_angle_to_pixel_threads(nside, nest, n_threads):
+    """Test threaded angle_to_pixel matches a single thread."""
+    if nest and (nside & (nside - 1)) != 0:
+        pytest.skip("Nest ordering requires power of 2 nside.")
+
+    np.random.seed(12345)
+
+    lon = np.random.uniform(low=0.0, high=360.0, size=1_000_000)
+    lat = np.random.uniform(low=-90.0, high=90.0, size=1_000_000)
+
+    pix_single = hpgeom.angle_to_pixel(nside, lon, lat, nest=nest, n_threads=1)
+    pix_threaded = hpgeom.angle_to_pixel(nside, lon, lat, nest=nest, n_threads=n_threads)
+
+    np.testing.assert_array_equal(pix_threaded, pix_single)
+
+    # Check with a broadcast nside array as well.
+    nsides = np.full(lon.size, nside)
+    pix_threaded = hpgeom.angle_to_pixel(nsides, lon, lat, nest=nest, n_threads=n_threads)
+
+    np.testing.assert_array_equal(pix_threaded, pix_single)
+
+
+@pytest.mark.parametrize("nside", [2**5, 2**10 - 100, 2**29])
+@pytest.mark.parametrize("nest", [True, False])
+@pytest.mark.parametrize("n_threads", [2, 3, 8])
+def test_pixel_to_angle_threads(nside, nest, n_threads):
+    """Test threaded pixel_to_angle matches a single thread."""
+    if nest and (nside & (nside - 1)) != 0:
+        pytest.skip("Nest ordering requires power of 2 nside.")
+
+    np.random.seed(12345)
+
+    pix = np.random.randint(low=0, high=12*nside*nside - 1, size=1_000_000, dtype=np.int64)
+
+    lon_single, lat_single = hpgeom.pixel_to_angle(nside, pix, nest=nest, n_threads=1)
+    lon_threaded, lat_threaded = hpgeom.pixel_to_angle(nside, pix, nest=nest, n_threads=n_threads)
+
+    np.testing.assert_array_equal(lon_threaded, lon_single)
+    np.testing.assert_array_equal(lat_threaded, lat_single)
+
+
+def test_threads_2d():
+    """Test threaded angle_to_pixel with multi-dimensional input."""
+    np.random.seed(12345)
+
+    lon = np.random.uniform(low=0.0, high=360.0, size=(1000, 1000))
+    lat = np.random.uniform(low=-90.0, high=90.0, size=(1000, 1000))
+
+    pix_single = hpgeom.angle_to_pixel(1024, lon, lat, n_threads=1)
+    pix_threaded = hpgeom.angle_to_pixel(1024, lon, lat, n_threads=4)
+
+    np.testing.assert_array_equal(pix_threaded, pix_single)
+    np.testing.assert_array_equal(pix_threaded.shape, lon.shape)
+
+
+@pytest.mark.parametrize("inclusive", [False, True])
+@pytest.mark.parametrize("n_threads", [2, 3, 8])
+def test_query_threads(inclusive, n_threads):
+    """Test threaded nest queries match a single thread."""
+    nside = 2**16
+    kwargs = {"inclusive": inclusive, "return_pixel_ranges": True}
+
+    ranges_single = hpgeom.query_circle(nside, 10.0, 20.0, 2.0, n_threads=1, **kwargs)
+    ranges_threaded = hpgeom.query_circle(nside, 10.0, 20.0, 2.0, n_threads=n_threads, **kwargs)
+
+    np.testing.assert_array_equal(ranges_threaded, ranges_single)
+
+    ranges_single = hpgeom.query_ellipse(nside, 10.0, 20.0, 2.0, 1.0, 30.0, n_threads=1, **kwargs)
+    ranges_threaded = hpgeom.query_ellipse(
+        nside, 10.0, 20.0, 2.0, 1.0, 30.0, n_threads=n_threads, **kwargs,
+    )
+
+    np.testing.assert_array_equal(ranges_threaded, ranges_single)
+
+    ranges_single = hpgeom.query_box(nside, 10.0, 12.0, 20.0, 22.0, n_threads=1, **kwargs)
+    ranges_threaded = hpgeom.query_box(nside, 10.0, 12.0, 20.0, 22.0, n_threads=n_threads, **kwargs)
+
+    np.testing.assert_array_equal(ranges_threaded, ranges_single)
+
+
+def test_threads_bad_values():
+    """Test that errors in any thread are raised."""
+    np.random.seed(12345)
+
+    lon = np.random.uniform(low=0.0, high=360.0, size=1_000_000)
+    lat = np.random.uniform(low=-90.0, high=90.0, size=1_000_000)
+    lat[-10] = 100.0
+
+    with pytest.raises(ValueError, match=r"lat .* out of range"):
+        hpgeom.angle_to_pixel(1024, lon, lat, n_threads=4)
+
+    pix = np.zeros(1_000_000, dtype=np.int64)
+    pix[-10] = -1
+
+    with pytest.raises(ValueError, match=r"Pixel value .* out of range"):
+        hpgeom.pixel_to_angle(1024, pix, n_threads=4)
+
+
+def test_set_num_threads():
+    """Test setting the default number of threads."""
+    n_threads_orig = hpgeom.get_num_threads()
+
+    try:
+        hpgeom.set_num_threads(4)
+        assert hpgeom.get_num_threads() == 4
+
+        np.random.seed(12345)
+
+        lon = np.random.uniform(low=0.0, high=360.0, size=1_000_000)
+        lat = np.random.uniform(low=-90.0, high=90.0, size=1_000_000)
+
+        pix_default = hpgeom.angle_to_pixel(1024, lon, lat)
+        pix_single = hpgeom.angle_to_pixel(1024, lon, lat, n_threads=1)
+
+        np.testing.assert_array_equal(pix_default, pix_single)
+
+        hpgeom.set_num_threads(0)
+        assert hpgeom.get_num_threads() >= 1
+
+        with pytest.raises(ValueError, match=r"n_threads must be"):
+            hpgeom.set_num_threads(-1)
+    finally:
+        hpgeom.set_num_threads(n_threads_orig)
+
+
+def test_thread_pool_reuse():
+    """Test repeated and concurrent calls on the worker pool."""
+    n_threads_orig = hpgeom.get_num_threads()
+
+    np.random.seed(12345)
+
+    lon = np.random.uniform(low=0.0, high=360.0, size=200_000)
+    lat = np.random.uniform(low=-90.0, high=90.0, size=200_000)
+
+    pix_single = hpgeom.angle_to_pixel(1024, lon, lat, n_threads=1)
+
+    try:
+        # The pool is resized as the default changes.
+        for n_threads in [4, 2, 8, 1, 3]:
+            hpgeom.set_num_threads(n_threads)
+            for _ in range(5):
+                np.testing.assert_array_equal(hpgeom.angle_to_pixel(1024, lon, lat), pix_single)
+
+        # Callers in other threads share the pool or start their own threads.
+        hpgeom.set_num_threads(4)
+        results = [None]*4
+
+        def _run(i):
+            results[i] = hpgeom.angle_to_pixel(1024, lon, lat)
+
+        threads = [threading.Thread(target=_run, args=(i, )) for i in range(len(results))]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        for result in results:
+            np.testing.assert_array_equal(result, pix_single)
+    finally:
+        hpgeom.set_num_threads(n_threads_orig)
@@ -0,0 +1,117 @@
+import numpy as np
+import pytest
+
+import hpgeom
+import hpgeom.ufunc
+
+
+@pytest.mark.parametrize("nest", [True, False])
+@pytest.mark.parametrize("lonlat", [True, False])
+def test_angle_pixel_ufuncs(nest, lonlat):
+    """Test angle_to_pixel and pixel_to_angle ufuncs match the functions."""
+    np.random.seed(12345)
+
+    nside = np.random.choice([2**5, 2**10, 2**20], size=10_000)
+    pix = (np.random.uniform(size=nside.size)*12*nside*nside).astype(np.int64)
+
+    a, b = hpgeom.pixel_to_angle(nside, pix, nest=nest, lonlat=lonlat)
+    a2, b2 = hpgeom.ufunc.pixel_to_angle(nside, pix, nest, lonlat, True)
+    np.testing.assert_array_equal(a2, a)
+    np.testing.assert_array_equal(b2, b)
+
+    pix2 = hpgeom.ufunc.angle_to_pixel(nside, a, b, nest, lonlat, True)
+    np.testing.assert_array_equal(pix2, hpgeom.angle_to_pixel(nside, a, b, nest=nest, lonlat=lonlat))
+    np.testing.assert_array_equal(pix2, pix)
+
+    # Casting, where=, and out= come from the ufunc machinery.
+    pix3 = hpgeom.ufunc.angle_to_pixel(nside.astype(np.int32), a.astype(np.float32),
+                                       b.astype(np.float32), nest, lonlat, True)
+    np.testing.assert_array_equal(
+        pix3,
+        hpgeom.angle_to_pixel(nside, a.astype(np.float32), b.astype(np.float32), nest=nest, lonlat=lonlat),
+    )
+
+    out = np.full(pix.size, -2, dtype=np.int64)
+    where = np.zeros(pix.size, dtype=bool)
+    where[::2] = True
+    hpgeom.ufunc.angle_to_pixel(nside, a, b, nest, lonlat, True, out=out, where=where)
+    np.testing.assert_array_equal(out[::2], pix[::2])
+    np.testing.assert_array_equal(out[1::2], -2)
+
+
+def test_reorder_ufuncs():
+    """Test nest_to_ring and ring_to_nest ufuncs, including in place."""
+    np.random.seed(12345)
+
+    nside = np.random.choice(2**np.arange(30), size=10_000)
+    nest_pix = (np.random.uniform(size=nside.size)*12*nside*nside).astype(np.int64)
+
+    ring_pix = hpgeom.ufunc.nest_to_ring(nside, nest_pix)
+    np.testing.assert_array_equal(ring_pix, hpgeom.nest_to_ring(nside, nest_pix))
+    np.testing.assert_array_equal(hpgeom.ufunc.ring_to_nest(nside, ring_pix), nest_pix)
+
+    pix = nest_pix.copy()
+    hpgeom.ufunc.nest_to_ring(nside, pix, out=pix)
+    np.testing.assert_array_equal(pix, ring_pix)
+
+
+def test_vector_ufuncs():
+    """Test vector_to_pixel and pixel_to_vector ufuncs."""
+    pix = np.arange(12*64*64)
+
+    x, y, z = hpgeom.ufunc.pixel_to_vector(64, pix, False)
+    x2, y2, z2 = hpgeom.pixel_to_vector(64, pix, nest=False)
+    np.testing.assert_array_equal(x, x2)
+    np.testing.assert_array_equal(y, y2)
+    np.testing.assert_array_equal(z, z2)
+
+    np.testing.assert_array_equal(hpgeom.ufunc.vector_to_pixel(64, x, y, z, False), pix)
+
+
+def test_gufuncs():
+    """Test neighbors, boundaries, and interpolation weight gufuncs."""
+    pix = np.arange(12*16*16)
+
+    neighbors = hpgeom.ufunc.neighbors(16, pix, True)
+    assert neighbors.shape == (pix.size, 8)
+    np.testing.assert_array_equal(neighbors, hpgeom.neighbors(16, pix))
+
+    lon, lat = hpgeom.ufunc.boundaries(16, pix, True, True, True)
+    lon2, lat2 = hpgeom.boundaries(16, pix)
+    assert lon.shape == (pix.size, 4)
+    np.testing.assert_array_equal(lon, lon2)
+    np.testing.assert_array_equal(lat, lat2)
+
+    lon, lat = hpgeom.pixel_to_angle(16, pix)
+    interp_pix, interp_wgt = hpgeom.ufunc.get_interpolation_weights(16, lon, lat, True, True, True)
+    interp_pix2, interp_wgt2 = hpgeom.get_interpolation_weights(16, lon, lat)
+    np.testing.assert_array_equal(interp_pix, interp_pix2)
+    np.testing.assert_array_equal(interp_wgt, interp_wgt2)
+
+
+def test_ufunc_invalid():
+    """Test that ufuncs flag invalid inputs instead of raising ValueError."""
+    with np.errstate(invalid="ignore"):
+        pix = hpgeom.ufunc.angle_to_pixel(1024, [0.0, 0.0, np.nan], [0.0, 100.0, 0.0], True, True, True)
+        np.testing.assert_array_equal(pix[1:], -1)
+        assert pix[0] == hpgeom.angle_to_pixel(1024, 0.0, 0.0)
+
+        lon, lat = hpgeom.ufunc.pixel_to_angle([1024, 1000], [0, 0], True, True, True)
+        assert np.isfinite(lon[0])
+        assert np.isnan(lon[1])
+        assert np.isnan(lat[1])
+
+        assert hpgeom.ufunc.nest_to_ring(1024, -1) == -1
+        pix = hpgeom.ufunc.vector_to_pixel(1024, [1.0, np.nan, 0.0], [0.0, 0.0, 0.0], [0.0, 0.0, 0.0], True)
+        np.testing.assert_array_equal(pix[1:], -1)
+        assert pix[0] == hpgeom.vector_to_pixel(1024, 1.0, 0.0, 0.0)
+        assert np.all(hpgeom.ufunc.neighbors(1024, -1, True) == -1)
+
+    with np.errstate(invalid="raise"):
+        with pytest.raises(FloatingPointError):
+            hpgeom.ufunc.angle_to_pixel(1024, 0.0, 100.0, True, True, True)
+        with pytest.raises(FloatingPointError):
+            hpgeom.ufunc.ring_to_nest(1000, 0)
+
+    with pytest.warns(RuntimeWarning, match=r"invalid value encountered in pixel_to_angle"):
+        hpgeom.ufunc.pixel_to_angle(1024, -1, True, True, True)
@@ -49,3 +49,55 @@ def test_vector_to_pixel_zerolength():
     pix = hpgeom.vector_to_pixel(1024, [], [], [])
 
     assert len(pix) == 0
+
+
+def test_vector_to_pixel_out():
+    """Test vector_to_pixel with an out array."""
+    x, y, z = hpgeom.pixel_to_vector(64, np.arange(12*64*64))
+
+    pix = hpgeom.vector_to_pixel(64, x, y, z)
+
+    out = np.zeros(x.size, dtype=np.int64)
+    pix2 = hpgeom.vector_to_pixel(64, x, y, z, out=out)
+    assert pix2 is out
+    np.testing.assert_array_equal(out, pix)
+
+
+def test_vector_to_pixel_float32():
+    """Test vector_to_pixel with float32 inputs."""
+    x, y, z = hpgeom.pixel_to_vector(64, np.arange(12*64*64), dtype=np.float32)
+
+    pix = hpgeom.vector_to_pixel(64, x, y, z)
+    pix64 = hpgeom.vector_to_pixel(64, x.astype(np.float64), y.astype(np.float64), z.astype(np.float64))
+    np.testing.assert_array_equal(pix, pix64)
+
+
+def test_vector_to_pixel_int32():
+    """Test vector_to_pixel with int32 outputs."""
+    x, y, z = hpgeom.pixel_to_vector(64, np.arange(12*64*64))
+
+    pix32 = hpgeom.vector_to_pixel(64, x, y, z, dtype=np.int32)
+    assert pix32.dtype == np.int32
+    np.testing.assert_array_equal(pix32, np.arange(12*64*64))
+
+    with pytest.raises(ValueError, match=r"too large for int32"):
+        hpgeom.vector_to_pixel(2**14, x, y, z, dtype=np.int32)
+
+
+def test_vector_to_pixel_bad_vectors():
+    """Test vector_to_pixel with zero and non-finite vectors."""
+    x, y, z = hpgeom.pixel_to_vector(64, np.arange(12*64*64))
+
+    for bad in [(0.0, 0.0, 0.0), (np.nan, 0.0, 1.0), (1.0, np.inf, 0.0)]:
+        with pytest.raises(ValueError, match=r"must be finite and non-zero"):
+            hpgeom.vector_to_pixel(64, *bad)
+
+        # A single bad vector at the end of a large array is caught.
+        x2, y2, z2 = x.copy(), y.copy(), z.copy()
+        x2[-10], y2[-10], z2[-10] = bad
+        out = np.zeros(x.size, dtype=np.int32)
+        with pytest.raises(ValueError, match=r"must be finite and non-zero"):
+            hpgeom.vector_to_pixel(64, x2, y2, z2, dtype=np.int32, out=out)
+
+    # Valid vectors give the same pixels without the checks.
+    np.testing.assert_array_equal(hpgeom.vector_to_pixel(64, x, y, z, check=False), np.arange(12*64*64))